@@ -0,0 +1,1344 @@
+// Microbenchmarks of the platform neutral parts of RadClipboard on synthetic payloads.
+//
+// Builds with the RadClipboardBench project, or on Linux from the repository root with
+//   g++ -std=c++14 -O2 -I. Bench/Bench.cpp PayloadStore.cpp History.cpp Journal.cpp SearchIndex.cpp Query.cpp QueryEngine.cpp Thumbnails.cpp CapturePolicy.cpp ClipboardFormats.cpp TextExtract.cpp Rad/Arena.cpp Rad/AsyncLog.cpp Rad/Dib.cpp Rad/HexDump.cpp Rad/Lz4.cpp Rad/MappedFile.cpp Rad/TextLayout.cpp Rad/TypedFormat.cpp Rad/WorkStealing.cpp -lpthread -o RadClipboardBench
+//
+// RadClipboardBench [--filter TEXT] [--max-size N[k|m|g]] [--min-time MS] [--baseline FILE] [--threshold PERCENT]
+//
+// Prints one CSV line per benchmark, name,param,bytes,iterations,ns,ns_min,mb_per_s, where ns is
+// the median time per operation of 5 batches and bytes are processed per operation.
+// The output can be saved as a baseline: later runs compared to it add the baseline time, the
+// change and its status, and exit with 1 if any benchmark is slower by more than the threshold.
+// Measurements that aren't times, such as the fragmentation of the arena, go to stderr.
+
+#include <algorithm>
+#include <chrono>
+#include <clocale>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cstring>
+#include <cwchar>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "CapturePolicy.h"
+#include "ClipboardFormats.h"
+#include "History.h"
+#include "Journal.h"
+#include "PayloadStore.h"
+#include "Query.h"
+#include "QueryEngine.h"
+#include "SearchIndex.h"
+#include "TextExtract.h"
+#include "Thumbnails.h"
+#include "Rad/Arena.h"
+#include "Rad/AsyncLog.h"
+#include "Rad/Convert.h"
+#include "Rad/Dib.h"
+#include "Rad/Format.h"
+#include "Rad/HexDump.h"
+#include "Rad/Lz4.h"
+#include "Rad/TextLayout.h"
+#include "Rad/TypedFormat.h"
+
+namespace
+{
+    const size_t Batches = 5;
+
+    // Keeps results alive so the work isn't optimised away.
+    volatile uint64_t g_sink;
+    // Time spent in Untimed during the batch.
+    double g_untimed;
+
+    // Runs an operation the given number of times.
+    typedef std::function<void(uint64_t)> BenchBody;
+
+    struct BenchCase
+    {
+        std::string name;
+        uint64_t param;     // the size or count the case is run at
+        uint64_t bytes;     // processed per operation, 0 if not meaningful
+        // Builds the fixture, which is freed once the case has run.
+        std::function<BenchBody()> setup;
+    };
+
+    struct BenchResult
+    {
+        uint64_t iterations;    // per batch
+        double ns;
+        double nsMin;
+    };
+
+    struct Options
+    {
+        std::string filter;
+        uint64_t maxSize = 256 << 20;
+        double minTime = 0.25;  // s per case
+        std::string baseline;
+        double threshold = 10;  // %
+    };
+
+    // Leaves the rest of the scope out of the time of the batch.
+    class Untimed
+    {
+    public:
+        Untimed() : m_begin(std::chrono::steady_clock::now()) { }
+        ~Untimed() { g_untimed += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_begin).count(); }
+
+    private:
+        const std::chrono::steady_clock::time_point m_begin;
+    };
+
+    double Seconds(const BenchBody& body, const uint64_t iterations)
+    {
+        g_untimed = 0;
+        const auto begin = std::chrono::steady_clock::now();
+        body(iterations);
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() - g_untimed;
+    }
+
+    BenchResult Run(const BenchBody& body, const double minTime)
+    {
+        // Grow a batch until it takes its share of the time
+        const double batchTime = minTime / Batches;
+        uint64_t iterations = 1;
+        double t = Seconds(body, iterations);
+        while (t < batchTime && iterations < (uint64_t(1) << 40))
+        {
+            const double scale = t > 0 ? std::min(batchTime * 1.2 / t, 10.0) : 10.0;
+            iterations = std::max(iterations + 1, uint64_t(double(iterations) * scale));
+            t = Seconds(body, iterations);
+        }
+
+        std::vector<double> ns;
+        for (size_t i = 0; i < Batches; ++i)
+            ns.push_back(Seconds(body, iterations) * 1e9 / double(iterations));
+        std::sort(ns.begin(), ns.end());
+        return { iterations, ns[Batches / 2], ns[0] };
+    }
+
+    bool ParseSize(const char* s, uint64_t& size)
+    {
+        char* end = nullptr;
+        size = strtoull(s, &end, 10);
+        if (end == s)
+            return false;
+        switch (*end)
+        {
+        case 'k': case 'K': size <<= 10; ++end; break;
+        case 'm': case 'M': size <<= 20; ++end; break;
+        case 'g': case 'G': size <<= 30; ++end; break;
+        }
+        return *end == '\0';
+    }
+
+    std::string Key(const std::string& name, const uint64_t param)
+    {
+        return name + ',' + std::to_string(param);
+    }
+
+    // name,param,bytes,iterations,ns,... to the median ns by name and param.
+    bool LoadBaseline(const std::string& path, std::map<std::string, double>& baseline)
+    {
+        std::ifstream f(path);
+        if (!f)
+            return false;
+        std::string line;
+        while (std::getline(f, line))
+        {
+            std::vector<std::string> fields;
+            size_t start = 0;
+            for (size_t comma; (comma = line.find(',', start)) != std::string::npos; start = comma + 1)
+                fields.push_back(line.substr(start, comma - start));
+            fields.push_back(line.substr(start));
+            if (fields.size() < 5 || fields[0] == "name")
+                continue;
+            baseline[fields[0] + ',' + fields[1]] = strtod(fields[4].c_str(), nullptr);
+        }
+        return true;
+    }
+
+    std::vector<uint8_t> RandomBytes(const size_t size, const uint32_t seed)
+    {
+        std::vector<uint8_t> data(size);
+        std::mt19937 rng(seed);
+        size_t i = 0;
+        for (; i + 4 <= size; i += 4)
+        {
+            const uint32_t r = rng();
+            memcpy(data.data() + i, &r, 4);
+        }
+        for (; i < size; ++i)
+            data[i] = uint8_t(rng());
+        return data;
+    }
+
+    // Text with some accented letters and CJK, so the conversions leave the ASCII fast paths.
+    std::wstring SampleText(const size_t chars, const bool ascii)
+    {
+        const wchar_t* const sample = ascii ? L"The quick brown fox jumps over the lazy dog.\r\n"
+            : L"The quick brown fox jumps over the lazy dog. \u00C9t\u00E9 \u00E0 la plage, \u6771\u4EAC\u3067.\r\n";
+        const size_t n = wcslen(sample);
+        std::wstring s;
+        s.reserve(chars);
+        while (s.size() < chars)
+            s.append(sample, std::min(n, chars - s.size()));
+        return s;
+    }
+
+    std::vector<uint8_t> Utf16Bytes(const std::wstring& s)
+    {
+        std::vector<uint8_t> data;
+        data.reserve(s.size() * 2);
+        for (const wchar_t c : s)
+        {
+            // Everything in SampleText is in the BMP
+            data.push_back(uint8_t(uint32_t(c) & 0xFF));
+            data.push_back(uint8_t(uint32_t(c) >> 8));
+        }
+        data.push_back(0);
+        data.push_back(0);
+        return data;
+    }
+
+    void Put16(std::vector<uint8_t>& data, const size_t offset, const uint32_t v)
+    {
+        data[offset] = uint8_t(v);
+        data[offset + 1] = uint8_t(v >> 8);
+    }
+
+    void Put32(std::vector<uint8_t>& data, const size_t offset, const uint32_t v)
+    {
+        Put16(data, offset, v & 0xFFFF);
+        Put16(data, offset + 2, v >> 16);
+    }
+
+    const size_t DropFilesSize = 20;
+
+    std::string FilePath(const size_t i)
+    {
+        return "C:\\Users\\Someone\\Documents\\Projects\\Report " + std::to_string(i) + ".docx";
+    }
+
+    // DROPFILES of count wide paths, as Explorer puts on the clipboard.
+    std::vector<uint8_t> DropFiles(const size_t count)
+    {
+        std::vector<uint8_t> data(DropFilesSize);
+        Put32(data, 0, uint32_t(DropFilesSize));
+        Put32(data, 16, 1);
+        for (size_t i = 0; i < count; ++i)
+        {
+            for (const char c : FilePath(i))
+            {
+                data.push_back(uint8_t(c));
+                data.push_back(0);
+            }
+            data.push_back(0);
+            data.push_back(0);
+        }
+        data.push_back(0);
+        data.push_back(0);
+        return data;
+    }
+
+    size_t DropFilesBytes(const size_t count)
+    {
+        size_t size = DropFilesSize + 2;
+        for (size_t i = 0; i < count; ++i)
+            size += (FilePath(i).size() + 1) * 2;
+        return size;
+    }
+
+    // A packed DIB with a header of headerSize bytes, 40 or 124.
+    std::vector<uint8_t> Dib(const int32_t width, const int32_t height, const uint32_t bitCount, const uint32_t headerSize)
+    {
+        const bool bitfields = bitCount == 32 && headerSize > 40;
+        const size_t colors = bitCount <= 8 ? size_t(1) << bitCount : 0;
+        const size_t stride = (size_t(width) * bitCount + 31) / 32 * 4;
+        const size_t offset = headerSize + colors * 4;
+        std::vector<uint8_t> data = RandomBytes(offset + stride * size_t(height), 8);
+        std::fill(data.begin(), data.begin() + headerSize, uint8_t(0));
+        Put32(data, 0, headerSize);
+        Put32(data, 4, uint32_t(width));
+        Put32(data, 8, uint32_t(height));
+        Put16(data, 12, 1);
+        Put16(data, 14, bitCount);
+        Put32(data, 16, bitfields ? 3 : 0);     // BI_BITFIELDS or BI_RGB
+        Put32(data, 20, uint32_t(stride * size_t(height)));
+        if (bitfields)
+        {
+            Put32(data, 40, 0x00FF0000);
+            Put32(data, 44, 0x0000FF00);
+            Put32(data, 48, 0x000000FF);
+            Put32(data, 52, 0xFF000000);
+        }
+        return data;
+    }
+
+    std::vector<size_t> Sizes(const Options& options)
+    {
+        std::vector<size_t> sizes;
+        for (const size_t s : { size_t(16), size_t(1) << 10, size_t(64) << 10, size_t(1) << 20, size_t(16) << 20, size_t(256) << 20 })
+            if (s <= options.maxSize)
+                sizes.push_back(s);
+        return sizes;
+    }
+
+    void AddPayloadCases(std::vector<BenchCase>& cases, const Options& options)
+    {
+        for (const size_t size : Sizes(options))
+        {
+            // Copying off the clipboard thread
+            cases.push_back({ "payload.stage", size, size, [size]()
+            {
+                auto store = std::make_shared<PayloadStore>();
+                auto data = std::make_shared<std::vector<uint8_t>>(RandomBytes(size, 1));
+                return BenchBody([store, data](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                        g_sink += store->Stage(data->data(), data->size())->size();
+                });
+            } });
+            // Hashing and copying content that isn't stored yet
+            cases.push_back({ "payload.add_new", size, size, [size]()
+            {
+                auto store = std::make_shared<PayloadStore>();
+                auto data = std::make_shared<std::vector<uint8_t>>(RandomBytes(size, 2));
+                return BenchBody([store, data](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                        store->Release(store->Add(data->data(), data->size()));
+                });
+            } });
+            // Hashing and comparing content that is stored already
+            cases.push_back({ "payload.add_duplicate", size, size, [size]()
+            {
+                auto store = std::make_shared<PayloadStore>();
+                auto data = std::make_shared<std::vector<uint8_t>>(RandomBytes(size, 3));
+                store->Add(data->data(), data->size());
+                // A separate copy, so the comparison reads both
+                auto copy = std::make_shared<std::vector<uint8_t>>(*data);
+                return BenchBody([store, copy](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                        store->Release(store->Add(copy->data(), copy->size()));
+                });
+            } });
+        }
+    }
+
+    void AddPolicyCases(std::vector<BenchCase>& cases)
+    {
+        // The formats Word puts on the clipboard for a copy of formatted text, with the synthesized ones
+        struct Format { uint32_t id; const char* name; };
+        static const Format Formats[] = {
+            { 0xC00E, "Object Descriptor" }, { 0xC013, "Rich Text Format" }, { 0xC0A1, "HTML Format" },
+            { FmtUnicodeText, "" }, { FmtText, "" }, { FmtEnhMetafile, "" }, { 3, "" }, { 0xC004, "Embed Source" },
+            { 0xC00B, "Link Source" }, { 0xC00C, "Link Source Descriptor" }, { FmtLocale, "" }, { FmtOemText, "" },
+        };
+
+        for (const size_t rules : { size_t(0), size_t(16), size_t(256) })
+        {
+            cases.push_back({ "policy.evaluate", rules, 0, [rules]()
+            {
+                auto policy = std::make_shared<CapturePolicy>();
+                // Rules for other applications, the usual case, so every one is tried
+                for (size_t i = 0; i < rules; ++i)
+                    policy->Add({ "*", "app" + std::to_string(i) + ".exe", CaptureAction::MaxSize, 1 << 20, std::string() });
+                auto names = std::make_shared<std::vector<std::string>>();
+                for (const Format& f : Formats)
+                    names->push_back(f.name);
+                return BenchBody([policy, names](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                    {
+                        CaptureEvaluation evaluation(*policy, "WINWORD.EXE");
+                        for (size_t f = 0; f < names->size(); ++f)
+                        {
+                            uint64_t maxSize;
+                            if (evaluation.Wants(Formats[f].id, (*names)[f], maxSize))
+                            {
+                                evaluation.Copied(Formats[f].id, (*names)[f]);
+                                ++g_sink;
+                            }
+                        }
+                    }
+                });
+            } });
+        }
+    }
+
+    void AddFileListCases(std::vector<BenchCase>& cases, const Options& options)
+    {
+        for (const size_t count : { size_t(1), size_t(100), size_t(10000), size_t(1000000) })
+        {
+            const size_t bytes = DropFilesBytes(count);
+            if (bytes > options.maxSize)
+                break;
+            cases.push_back({ "dropfiles.extract", count, bytes, [count]()
+            {
+                auto data = std::make_shared<std::vector<uint8_t>>(DropFiles(count));
+                auto out = std::make_shared<std::string>();
+                return BenchBody([data, out](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                    {
+                        out->clear();
+                        ExtractText(TextKind::FileList, data->data(), data->size(), *out);
+                        g_sink += out->size();
+                    }
+                });
+            } });
+        }
+    }
+
+    void AddDibCases(std::vector<BenchCase>& cases, const Options& options)
+    {
+        struct Header { const char* name; uint32_t bitCount; uint32_t headerSize; };
+        for (const Header& h : { Header{ "dib.parse_info_8bpp", 8, 40 }, Header{ "dib.parse_v5_32bpp", 32, 124 } })
+        {
+            cases.push_back({ h.name, 0, 0, [h]()
+            {
+                auto data = std::make_shared<std::vector<uint8_t>>(Dib(64, 64, h.bitCount, h.headerSize));
+                return BenchBody([data](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                    {
+                        DibInfo info;
+                        g_sink += ParseDib(data->data(), data->size(), info) ? uint64_t(info.offset) : 0;
+                    }
+                });
+            } });
+        }
+
+        // Decoding every row, as the thumbnails do
+        for (const size_t size : Sizes(options))
+        {
+            const int32_t width = int32_t(std::min<size_t>(size / 4, 1024));
+            const int32_t height = int32_t(size / 4 / size_t(width));
+            cases.push_back({ "dib.decode_rows", size, size, [width, height]()
+            {
+                auto data = std::make_shared<std::vector<uint8_t>>(Dib(width, height, 32, 124));
+                auto row = std::make_shared<std::vector<uint32_t>>(width);
+                return BenchBody([data, row](const uint64_t n)
+                {
+                    DibInfo info;
+                    if (!ParseDib(data->data(), data->size(), info))
+                        return;
+                    for (uint64_t i = 0; i < n; ++i)
+                    {
+                        for (int32_t y = 0; y < info.height; ++y)
+                            DecodeDibRow(info, data->data(), y, row->data());
+                        g_sink += (*row)[0];
+                    }
+                });
+            } });
+        }
+    }
+
+    void AddHexDumpCases(std::vector<BenchCase>& cases, const Options& options)
+    {
+        // A page of the viewer
+        cases.push_back({ "hexdump.page", 64, 64 * HexRowBytes, []()
+        {
+            auto data = std::make_shared<std::vector<uint8_t>>(RandomBytes(64 * HexRowBytes, 4));
+            auto out = std::make_shared<std::vector<char>>();
+            return BenchBody([data, out](const uint64_t n)
+            {
+                for (uint64_t i = 0; i < n; ++i)
+                    g_sink += HexDumpRows(*out, data->data(), data->size(), 0, 64);
+            });
+        } });
+
+        // All of a payload, as when it is saved
+        for (const size_t size : Sizes(options))
+        {
+            cases.push_back({ "hexdump.all", size, size, [size]()
+            {
+                auto data = std::make_shared<std::vector<uint8_t>>(RandomBytes(size, 5));
+                auto out = std::make_shared<std::vector<char>>();
+                return BenchBody([data, out](const uint64_t n)
+                {
+                    const size_t Chunk = 4096;
+                    const size_t rows = HexRowCount(data->size());
+                    for (uint64_t i = 0; i < n; ++i)
+                        for (size_t row = 0; row < rows; row += Chunk)
+                            g_sink += HexDumpRows(*out, data->data(), data->size(), row, Chunk);
+                });
+            } });
+            // The viewer before HexDump, a printf per byte into one string
+            cases.push_back({ "hexdump.per_byte", size, size, [size]()
+            {
+                auto data = std::make_shared<std::vector<uint8_t>>(RandomBytes(size, 5));
+                return BenchBody([data](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                    {
+                        std::string text;
+                        const uint8_t* const p = data->data();
+                        const size_t sz = data->size();
+                        for (size_t j = 0; j < sz; j += 16)
+                        {
+                            text += '\n';
+                            for (size_t k = 0; k < 16 && (j + k) < sz; ++k)
+                            {
+                                char tmp[100];
+                                snprintf(tmp, sizeof(tmp), " %02X", p[j + k]);
+                                text += tmp;
+                            }
+                            text += '\t';
+                            for (size_t k = 0; k < 16 && (j + k) < sz; ++k)
+                                text += isprint(p[j + k]) ? char(p[j + k]) : '.';
+                        }
+                        g_sink += text.size();
+                    }
+                });
+            } });
+        }
+    }
+
+    void AddTextCases(std::vector<BenchCase>& cases, const Options& options, const bool utf8Locale)
+    {
+        for (const size_t size : Sizes(options))
+        {
+            // Sized by the UTF-16 bytes
+            const size_t chars = std::max<size_t>(size / 2, 1);
+            cases.push_back({ "text.utf16_extract", size, chars * 2, [chars]()
+            {
+                auto data = std::make_shared<std::vector<uint8_t>>(Utf16Bytes(SampleText(chars, false)));
+                auto out = std::make_shared<std::string>();
+                return BenchBody([data, out](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                    {
+                        out->clear();
+                        ExtractText(TextKind::Unicode, data->data(), data->size(), *out);
+                        g_sink += out->size();
+                    }
+                });
+            } });
+            // Convert.h goes through the C locale, which is UTF-8 where it could be set
+            cases.push_back({ "text.w2a", size, chars * 2, [chars, utf8Locale]()
+            {
+                auto text = std::make_shared<std::wstring>(SampleText(chars, !utf8Locale));
+                return BenchBody([text](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                        g_sink += w2a(*text).size();
+                });
+            } });
+            cases.push_back({ "text.a2w", size, chars * 2, [chars, utf8Locale]()
+            {
+                auto text = std::make_shared<std::string>(w2a(SampleText(chars, !utf8Locale)));
+                return BenchBody([text](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                        g_sink += a2w(*text).size();
+                });
+            } });
+        }
+    }
+
+    void AddTextLayoutCases(std::vector<BenchCase>& cases, const Options& options)
+    {
+        for (const size_t size : Sizes(options))
+        {
+            const size_t chars = std::max<size_t>(size / 2, 1);
+            // Opening the viewer on a text entry
+            cases.push_back({ "textlayout.set_text", size, chars * 2, [chars]()
+            {
+                auto text = std::make_shared<std::wstring>(SampleText(chars, false));
+                auto layout = std::make_shared<TextLayout>();
+                layout->SetMeasure([](const wchar_t c) { return c < 0x3000 ? 7 : 14; });
+                return BenchBody([text, layout](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                    {
+                        layout->SetText(*text);
+                        layout->SetWidth(800);
+                        g_sink += layout->RowCount();
+                    }
+                });
+            } });
+            // Resizing the viewer, to widths that aren't cached
+            cases.push_back({ "textlayout.rewrap", size, chars * 2, [chars]()
+            {
+                auto layout = std::make_shared<TextLayout>();
+                layout->SetMeasure([](const wchar_t c) { return c < 0x3000 ? 7 : 14; });
+                layout->SetText(SampleText(chars, false));
+                auto width = std::make_shared<int>(0);
+                return BenchBody([layout, width](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                    {
+                        *width = (*width + 1) % 200;
+                        layout->SetWidth(200 + *width);
+                        g_sink += layout->RowCount();
+                    }
+                });
+            } });
+        }
+    }
+
+    void AddThumbnailCases(std::vector<BenchCase>& cases, const Options& options)
+    {
+        for (const size_t size : Sizes(options))
+        {
+            const int32_t width = int32_t(std::min<size_t>(size / 4, 1024));
+            const int32_t height = int32_t(size / 4 / size_t(width));
+            // Decoding, scaling to the preview and scaling that to the menu
+            cases.push_back({ "thumbnail.make", size, size, [width, height]()
+            {
+                auto data = std::make_shared<std::vector<uint8_t>>(Dib(width, height, 32, 124));
+                return BenchBody([data](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                    {
+                        Thumbnail thumbnail;
+                        g_sink += MakeThumbnail(data->data(), data->size(), ThumbnailCache::MaxSize, thumbnail) ? thumbnail.menuImage.pixels.size() : 0;
+                    }
+                });
+            } });
+            cases.push_back({ "dib.box_scale", size, size, [width, height]()
+            {
+                BgraImage image;
+                const std::vector<uint8_t> dib = Dib(width, height, 32, 40);
+                DecodeDib(dib.data(), dib.size(), image);
+                auto source = std::make_shared<BgraImage>(std::move(image));
+                return BenchBody([source](const uint64_t n)
+                {
+                    int32_t w, h;
+                    FitSize(source->width, source->height, ThumbnailCache::MaxSize, ThumbnailCache::MaxSize, w, h);
+                    for (uint64_t i = 0; i < n; ++i)
+                    {
+                        BoxScaler scaler(source->width, source->height, w, h);
+                        for (int32_t y = 0; y < source->height; ++y)
+                            scaler.AddRow(source->pixels.data() + size_t(y) * size_t(source->width));
+                        g_sink += scaler.Result().pixels[0];
+                    }
+                });
+            } });
+        }
+    }
+
+    struct HistoryFixture
+    {
+        PayloadStore payloads;
+        History history{ payloads };
+        std::vector<HistId> ids;
+        std::mt19937 rng{ 6 };
+        uint64_t now = 1;
+
+        explicit HistoryFixture(const size_t count)
+        {
+            HistBudget budget;
+            budget.maxBytes = SIZE_MAX;
+            budget.maxEntries = SIZE_MAX;
+            history.SetBudget(budget, now);
+            ids.reserve(count);
+            for (uint64_t i = 0; i < count; ++i)
+            {
+                const uint64_t text[2] = { i, ~i };
+                std::vector<HistItem> items = { { FmtUnicodeText, payloads.Add(text, sizeof(text)) }, { FmtLocale, payloads.Add("\x09\x04\0\0", 4) } };
+                ids.push_back(history.Add(std::move(items), ++now));
+            }
+        }
+
+        // Erases the entry and adds it back as the most recent one, keeping the same payloads.
+        HistId Cycle(const HistId id)
+        {
+            std::vector<HistItem> items = history.Items(id);
+            for (const HistItem& item : items)
+                payloads.AddRef(item.payload);
+            history.Erase(id);
+            return history.Add(std::move(items), ++now);
+        }
+    };
+
+    void AddHistoryCases(std::vector<BenchCase>& cases)
+    {
+        for (const size_t count : { size_t(10), size_t(1000), size_t(100000), size_t(1000000) })
+        {
+            // An entry evicted for each one added, the steady state once the history is full
+            cases.push_back({ "history.erase_oldest_add", count, 0, [count]()
+            {
+                auto f = std::make_shared<HistoryFixture>(count);
+                return BenchBody([f](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                        g_sink += f->Cycle(f->history.Back());
+                });
+            } });
+            // Deleting an entry from the menu and copying something else
+            cases.push_back({ "history.erase_random_add", count, 0, [count]()
+            {
+                auto f = std::make_shared<HistoryFixture>(count);
+                return BenchBody([f](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                    {
+                        const size_t j = f->rng() % f->ids.size();
+                        f->ids[j] = f->Cycle(f->ids[j]);
+                    }
+                });
+            } });
+        }
+    }
+
+    // Sizes of clipboard payloads, log uniform from 16 bytes to 64 KB
+    size_t PayloadSize(std::mt19937& rng)
+    {
+        return (size_t(16) << (rng() % 13)) + rng() % 16;
+    }
+
+    // Live blocks of random sizes, reporting the overhead of the arena once the case has run.
+    struct ArenaFixture
+    {
+        Arena arena;
+        std::mt19937 rng{ 9 };
+        std::vector<std::pair<void*, size_t>> blocks;
+
+        explicit ArenaFixture(const size_t count)
+        {
+            blocks.reserve(count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                const size_t size = PayloadSize(rng);
+                blocks.push_back({ arena.Alloc(size), size });
+            }
+        }
+
+        ~ArenaFixture()
+        {
+            const Arena::Stats stats = arena.GetStats();
+            fprintf(stderr, "arena.churn,%zu: %zu reserved for %zu requested, %.1f%% overhead, %zu slabs, %zu empty\n", blocks.size(),
+                stats.reserved, stats.requested, stats.requested > 0 ? double(stats.reserved - stats.requested) * 100 / double(stats.requested) : 0.0,
+                stats.slabs, stats.emptySlabs);
+            for (const auto& b : blocks)
+                arena.Free(b.first, b.second);
+        }
+    };
+
+    void AddArenaCases(std::vector<BenchCase>& cases)
+    {
+        for (const size_t size : { size_t(64), size_t(4) << 10, size_t(32) << 10, size_t(1) << 20 })
+        {
+            cases.push_back({ "arena.alloc_free", size, 0, [size]()
+            {
+                auto arena = std::make_shared<Arena>();
+                return BenchBody([arena, size](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                    {
+                        void* const p = arena->Alloc(size);
+                        g_sink += uintptr_t(p);
+                        arena->Free(p, size);
+                    }
+                });
+            } });
+            // The process heap, which held the payloads before the arena
+            cases.push_back({ "heap.alloc_free", size, 0, [size]()
+            {
+                return BenchBody([size](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                    {
+                        void* const p = malloc(size);
+                        g_sink += uintptr_t(p);
+                        free(p);
+                    }
+                });
+            } });
+        }
+
+        // A full history replacing payloads at random
+        for (const size_t count : { size_t(1000), size_t(100000) })
+        {
+            cases.push_back({ "arena.churn", count, 0, [count]()
+            {
+                auto f = std::make_shared<ArenaFixture>(count);
+                return BenchBody([f](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                    {
+                        auto& b = f->blocks[f->rng() % f->blocks.size()];
+                        f->arena.Free(b.first, b.second);
+                        b.second = PayloadSize(f->rng);
+                        b.first = f->arena.Alloc(b.second);
+                    }
+                });
+            } });
+        }
+    }
+
+    void AddLz4Cases(std::vector<BenchCase>& cases, const Options& options)
+    {
+        for (const size_t size : Sizes(options))
+        {
+            const size_t chars = std::max<size_t>(size / 2, 1);
+            cases.push_back({ "lz4.compress_text", size, chars * 2, [chars]()
+            {
+                auto data = std::make_shared<std::vector<uint8_t>>(Utf16Bytes(SampleText(chars, false)));
+                auto packed = std::make_shared<std::vector<uint8_t>>();
+                return BenchBody([data, packed](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                    {
+                        Lz4Compress(data->data(), data->size(), *packed);
+                        g_sink += packed->size();
+                    }
+                });
+            } });
+            // What the cold tier tries before marking a payload incompressible
+            cases.push_back({ "lz4.compress_random", size, size, [size]()
+            {
+                auto data = std::make_shared<std::vector<uint8_t>>(RandomBytes(size, 10));
+                auto packed = std::make_shared<std::vector<uint8_t>>();
+                return BenchBody([data, packed](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                    {
+                        Lz4Compress(data->data(), data->size(), *packed);
+                        g_sink += packed->size();
+                    }
+                });
+            } });
+            cases.push_back({ "lz4.decompress_text", size, chars * 2, [chars]()
+            {
+                const std::vector<uint8_t> data = Utf16Bytes(SampleText(chars, false));
+                auto packed = std::make_shared<std::vector<uint8_t>>();
+                Lz4Compress(data.data(), data.size(), *packed);
+                auto out = std::make_shared<std::vector<uint8_t>>(data.size());
+                return BenchBody([packed, out](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                        g_sink += Lz4Decompress(packed->data(), packed->size(), out->data(), out->size());
+                });
+            } });
+            // Reading a cold payload without bringing it back, as the viewer and queries do
+            cases.push_back({ "payload.read_cold", size, chars * 2, [chars]()
+            {
+                const std::vector<uint8_t> data = Utf16Bytes(SampleText(chars, false));
+                auto store = std::make_shared<PayloadStore>();
+                const PayloadId id = store->Add(data.data(), data.size());
+                std::vector<uint8_t> packed;
+                Lz4Compress(data.data(), data.size(), packed);
+                store->SetCold(id, store->Share(id), std::move(packed));
+                auto ref = std::make_shared<PayloadRef>(store->Ref(id));
+                auto scratch = std::make_shared<std::vector<uint8_t>>();
+                return BenchBody([store, ref, scratch](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                        g_sink += ref->Read(ref->size, *scratch)[0];
+                });
+            } });
+            // Pasting a cold payload, which makes it hot again
+            cases.push_back({ "payload.promote", size, chars * 2, [chars]()
+            {
+                const std::vector<uint8_t> data = Utf16Bytes(SampleText(chars, false));
+                auto store = std::make_shared<PayloadStore>();
+                const PayloadId id = store->Add(data.data(), data.size());
+                auto packed = std::make_shared<std::vector<uint8_t>>();
+                Lz4Compress(data.data(), data.size(), *packed);
+                return BenchBody([store, id, packed](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                    {
+                        {
+                            Untimed untimed;
+                            store->SetCold(id, store->Share(id), *packed);
+                        }
+                        g_sink += store->Data(id)[0];
+                    }
+                });
+            } });
+        }
+    }
+
+    // Writes n as 16 hex digits over the start of UTF-16 text, so entries differ but are still text.
+    void Stamp(std::vector<uint8_t>& utf16, uint64_t n)
+    {
+        for (size_t i = std::min<size_t>(16, utf16.size() / 2); i > 0; --i, n >>= 4)
+            Put16(utf16, (i - 1) * 2, uint32_t("0123456789ABCDEF"[n & 0xF]));
+    }
+
+    PathString TempPath(const char* const name)
+    {
+#ifdef _WIN32
+        wchar_t* dir = nullptr;
+        size_t length = 0;
+        _wdupenv_s(&dir, &length, L"TEMP");
+        const PathString path = PathString(dir != nullptr ? dir : L".") + L"\\" + a2w(name);
+        free(dir);
+        return path;
+#else
+        return PathString("/tmp/") + name;
+#endif
+    }
+
+    void RemoveFile(const PathString& path)
+    {
+#ifdef _WIN32
+        _wremove(path.c_str());
+#else
+        remove(path.c_str());
+#endif
+    }
+
+    // A history saved to a journal in the temporary directory, with text entries of one size.
+    struct JournalFixture
+    {
+        PathString path = TempPath("RadClipboardBench.journal");
+        PayloadStore payloads;
+        History history{ payloads };
+        Journal journal{ payloads };
+        std::vector<uint8_t> text;
+        uint64_t now = 1;
+
+        explicit JournalFixture(const size_t size)
+            : text(Utf16Bytes(SampleText(std::max<size_t>(size / 2, 1), false)))
+        {
+            RemoveFile(path);
+            journal.Open(path);
+            history.AddListener(&journal);
+        }
+
+        ~JournalFixture()
+        {
+            history.RemoveListener(&journal);
+            journal.Close();
+            RemoveFile(path);
+        }
+
+        void Add()
+        {
+            // Different every time so nothing is deduplicated
+            Stamp(text, ++now);
+            std::vector<HistItem> items = { { FmtUnicodeText, payloads.Add(text.data(), text.size()) } };
+            history.Add(std::move(items), now);
+        }
+    };
+
+    void AddJournalCases(std::vector<BenchCase>& cases)
+    {
+        // Including the wait for the journal thread to write and flush them
+        for (const size_t size : { size_t(1) << 10, size_t(64) << 10, size_t(1) << 20 })
+        {
+            cases.push_back({ "journal.append", size, size, [size]()
+            {
+                auto f = std::make_shared<JournalFixture>(size);
+                return BenchBody([f](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                        f->Add();
+                    f->journal.Flush();
+                });
+            } });
+        }
+
+        // Restoring the history at startup
+        for (const size_t count : { size_t(100), size_t(1000) })
+        {
+            cases.push_back({ "journal.load", count, 0, [count]()
+            {
+                auto f = std::make_shared<JournalFixture>(1024);
+                for (size_t i = 0; i < count; ++i)
+                    f->Add();
+                f->journal.Flush();
+                return BenchBody([f](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                    {
+                        PayloadStore payloads;
+                        History history(payloads);
+                        Journal journal(payloads);
+                        journal.Open(f->path);
+                        journal.Load(history, f->now);
+                        g_sink += history.size();
+                        journal.Close();
+                    }
+                });
+            } });
+        }
+    }
+
+    // Indexed text entries, one in a hundred with a word that is nowhere else.
+    struct SearchFixture
+    {
+        PayloadStore payloads;
+        History history{ payloads };
+        SearchIndex search;
+
+        explicit SearchFixture(const size_t count)
+        {
+            HistBudget budget;
+            budget.maxBytes = SIZE_MAX;
+            budget.maxEntries = SIZE_MAX;
+            history.SetBudget(budget, 1);
+            history.AddListener(&search);
+            const std::wstring sample = SampleText(512, true);
+            for (size_t i = 0; i < count; ++i)
+            {
+                const std::vector<uint8_t> data = Utf16Bytes(sample + L" entry " + std::to_wstring(i) + (i % 100 == 0 ? L" zebra" : L""));
+                std::vector<HistItem> items = { { FmtUnicodeText, payloads.Add(data.data(), data.size()) } };
+                history.Add(std::move(items), i + 2);
+            }
+        }
+
+        ~SearchFixture()
+        {
+            history.RemoveListener(&search);
+        }
+    };
+
+    void AddSearchCases(std::vector<BenchCase>& cases)
+    {
+        for (const size_t size : { size_t(1) << 10, size_t(64) << 10, size_t(256) << 10 })
+        {
+            // The part of indexing done on the capture pipeline
+            cases.push_back({ "search.prepare", size, size, [size]()
+            {
+                auto text = std::make_shared<std::string>(w2a(SampleText(size, true)));
+                return BenchBody([text](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                        g_sink += SearchIndex::Prepare(*text).trigrams.size();
+                });
+            } });
+        }
+
+        for (const size_t count : { size_t(1000), size_t(10000) })
+        {
+            // Adding an entry, with an old one erased to keep the size
+            cases.push_back({ "search.add", count, 0, [count]()
+            {
+                auto f = std::make_shared<SearchFixture>(count);
+                auto now = std::make_shared<uint64_t>(count + 2);
+                auto text = std::make_shared<std::vector<uint8_t>>(Utf16Bytes(SampleText(512, true)));
+                return BenchBody([f, now, text](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                    {
+                        Stamp(*text, ++*now);
+                        std::vector<HistItem> items = { { FmtUnicodeText, f->payloads.Add(text->data(), text->size()) } };
+                        f->history.Erase(f->history.Back());
+                        g_sink += f->history.Add(std::move(items), *now);
+                    }
+                });
+            } });
+
+            struct Find { const char* name; const char* text; };
+            for (const Find& q : { Find{ "search.find_rare", "zebra" }, Find{ "search.find_common", "brown fox" } })
+            {
+                cases.push_back({ q.name, count, 0, [count, q]()
+                {
+                    auto f = std::make_shared<SearchFixture>(count);
+                    return BenchBody([f, q](const uint64_t n)
+                    {
+                        for (uint64_t i = 0; i < n; ++i)
+                            g_sink += f->search.Find(f->history, q.text, 100).size();
+                    });
+                } });
+            }
+        }
+    }
+
+    // 64 KB text entries adding up to size bytes, with a snapshot to query.
+    struct QueryFixture
+    {
+        PayloadStore payloads;
+        History history{ payloads };
+        std::vector<QueryEntry> entries;
+        Query query;
+        QueryEngine engine;
+
+        QueryFixture(const size_t size, const char* const text)
+        {
+            const size_t EntrySize = 64 << 10;
+            HistBudget budget;
+            budget.maxBytes = SIZE_MAX;
+            budget.maxEntries = SIZE_MAX;
+            history.SetBudget(budget, 1);
+            std::vector<uint8_t> data = Utf16Bytes(SampleText(EntrySize / 2 - 1, false));
+            for (uint64_t i = 0; i < std::max<size_t>(size / EntrySize, 1); ++i)
+            {
+                Stamp(data, i);
+                std::vector<HistItem> items = { { FmtUnicodeText, payloads.Add(data.data(), data.size()) } };
+                history.Add(std::move(items), i + 2);
+            }
+            entries = QueryEngine::Snapshot(history);
+            query.Parse(text);
+        }
+    };
+
+    void AddQueryCases(std::vector<BenchCase>& cases, const Options& options)
+    {
+        // Nothing matches, so every entry is scanned
+        struct Terms { const char* name; const char* text; };
+        for (const Terms& t : { Terms{ "query.text", "zqxj" }, Terms{ "query.regex", "re:zq[0-9]+x" } })
+        {
+            for (const size_t size : { size_t(1) << 20, size_t(16) << 20, size_t(256) << 20 })
+            {
+                if (size > options.maxSize)
+                    break;
+                cases.push_back({ t.name, size, size, [size, t]()
+                {
+                    auto f = std::make_shared<QueryFixture>(size, t.text);
+                    return BenchBody([f](const uint64_t n)
+                    {
+                        for (uint64_t i = 0; i < n; ++i)
+                            g_sink += f->engine.Run(f->entries, f->query, SIZE_MAX, [](HistId) { ++g_sink; }).entries;
+                    });
+                } });
+            }
+        }
+    }
+
+    class NullLogSink : public LogSink
+    {
+    public:
+        void Write(LogLevel /*level*/, const std::string& line) override { g_sink += line.size(); }
+    };
+
+    void AddLogCases(std::vector<BenchCase>& cases)
+    {
+        // Flushed before the buffer fills, so nothing is dropped
+        const uint64_t Burst = LogBufferCapacity / 2;
+        static bool sinkAdded = false;
+        if (!sinkAdded)
+        {
+            LogAddSink(std::make_shared<NullLogSink>());
+            sinkAdded = true;
+        }
+
+        // The cost to the thread that logs
+        for (const size_t length : { size_t(32), size_t(200) })
+        {
+            cases.push_back({ "log.write", length, length, [length]()
+            {
+                auto messages = std::make_shared<std::vector<std::string>>();
+                // Different messages, so none are coalesced
+                for (size_t i = 0; i < 16; ++i)
+                    messages->push_back(std::string(length - 4, 'a' + char(i)) + " 123");
+                return BenchBody([messages, Burst](const uint64_t n)
+                {
+                    for (uint64_t i = 0; i < n; ++i)
+                    {
+                        LogWrite(LOG_DEBUG, (*messages)[i % messages->size()].c_str(), __FILE__, long(i % 1024), __FUNCTION__);
+                        if (i % Burst == Burst - 1)
+                        {
+                            Untimed untimed;
+                            LogFlush();
+                        }
+                    }
+                });
+            } });
+        }
+        cases.push_back({ "log.write_wide", 200, 400, [Burst]()
+        {
+            auto message = std::make_shared<std::wstring>(SampleText(200, false));
+            return BenchBody([message, Burst](const uint64_t n)
+            {
+                for (uint64_t i = 0; i < n; ++i)
+                {
+                    LogWrite(LOG_DEBUG, message->c_str(), L"Bench.cpp", long(i % 1024), L"main");
+                    if (i % Burst == Burst - 1)
+                    {
+                        Untimed untimed;
+                        LogFlush();
+                    }
+                }
+            });
+        } });
+        // Including formatting the line on the logging thread
+        cases.push_back({ "log.write_flushed", 200, 200, [Burst]()
+        {
+            auto message = std::make_shared<std::string>(std::string(196, 'x') + " 123");
+            return BenchBody([message, Burst](const uint64_t n)
+            {
+                for (uint64_t i = 0; i < n; ++i)
+                {
+                    LogWrite(LOG_DEBUG, message->c_str(), __FILE__, long(i % 1024), __FUNCTION__);
+                    if (i % Burst == Burst - 1 || i == n - 1)
+                        LogFlush();
+                }
+            });
+        } });
+    }
+
+    const size_t MessageLength = 512;   // RadLogMessageLength
+
+    // Typical RadLog messages, formatted by Format into a new string as RadLog(l, Format(...)) did,
+    // and by FormatTo into a stack buffer as RADLOG does. param is the message.
+    void AddFormatCases(std::vector<BenchCase>& cases)
+    {
+        const std::wstring path = L"C:\\Users\\someone\\AppData\\Local\\RadClipboard\\Trace.json";
+
+        cases.push_back({ "format.printf", 1, 0, [path]()
+        {
+            return BenchBody([path](const uint64_t n)
+            {
+                for (uint64_t i = 0; i < n; ++i)
+                    g_sink += Format(L"Unable to save the trace to %ls", path.c_str()).size();
+            });
+        } });
+        cases.push_back({ "format.typed", 1, 0, [path]()
+        {
+            return BenchBody([path](const uint64_t n)
+            {
+                wchar_t msg[MessageLength];
+                for (uint64_t i = 0; i < n; ++i)
+                    g_sink += FormatTo(msg, RAD_FMT(L"Unable to save the trace to %ls"), path.c_str());
+            });
+        } });
+
+        cases.push_back({ "format.printf", 2, 0, [path]()
+        {
+            return BenchBody([path](const uint64_t n)
+            {
+                for (uint64_t i = 0; i < n; ++i)
+                    g_sink += Format(L"Capture policy not loaded, error on line %zu of %ls", size_t(i % 100), path.c_str()).size();
+            });
+        } });
+        cases.push_back({ "format.typed", 2, 0, [path]()
+        {
+            return BenchBody([path](const uint64_t n)
+            {
+                wchar_t msg[MessageLength];
+                for (uint64_t i = 0; i < n; ++i)
+                    g_sink += FormatTo(msg, RAD_FMT(L"Capture policy not loaded, error on line %zu of %ls"), size_t(i % 100), path.c_str());
+            });
+        } });
+
+        // Five 64-bit counters and a process name
+        cases.push_back({ "format.printf", 3, 0, []()
+        {
+            return BenchBody([](const uint64_t n)
+            {
+                for (uint64_t i = 0; i < n; ++i)
+                {
+                    const unsigned long long v = 1000000 + i;
+                    g_sink += Format(L"Clipboard contention: %llu opened, %llu contended, %llu failed, wait p50 %llu us, p99 %llu us, most often held by %ls",
+                        v, v / 7, v / 1000, v % 1000, v % 100000, L"explorer.exe").size();
+                }
+            });
+        } });
+        cases.push_back({ "format.typed", 3, 0, []()
+        {
+            return BenchBody([](const uint64_t n)
+            {
+                wchar_t msg[MessageLength];
+                for (uint64_t i = 0; i < n; ++i)
+                {
+                    const unsigned long long v = 1000000 + i;
+                    g_sink += FormatTo(msg, RAD_FMT(L"Clipboard contention: %llu opened, %llu contended, %llu failed, wait p50 %llu us, p99 %llu us, most often held by %ls"),
+                        v, v / 7, v / 1000, v % 1000, v % 100000, L"explorer.exe");
+                }
+            });
+        } });
+    }
+
+    int Usage()
+    {
+        fprintf(stderr, "RadClipboardBench [--filter TEXT] [--max-size N[k|m|g]] [--min-time MS] [--baseline FILE] [--threshold PERCENT]\n");
+        return 2;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc)
+            return Usage();
+        const char* const value = argv[++i];
+        if (arg == "--filter")
+            options.filter = value;
+        else if (arg == "--max-size")
+        {
+            if (!ParseSize(value, options.maxSize))
+                return Usage();
+        }
+        else if (arg == "--min-time")
+            options.minTime = strtod(value, nullptr) / 1000;
+        else if (arg == "--baseline")
+            options.baseline = value;
+        else if (arg == "--threshold")
+            options.threshold = strtod(value, nullptr);
+        else
+            return Usage();
+    }
+
+    std::map<std::string, double> baseline;
+    if (!options.baseline.empty() && !LoadBaseline(options.baseline, baseline))
+    {
+        fprintf(stderr, "Can't read %s\n", options.baseline.c_str());
+        return 2;
+    }
+
+#ifdef _WIN32
+    const bool utf8Locale = setlocale(LC_ALL, ".UTF8") != nullptr;
+#else
+    const bool utf8Locale = setlocale(LC_ALL, "C.UTF-8") != nullptr;
+#endif
+
+    std::vector<BenchCase> cases;
+    AddPayloadCases(cases, options);
+    AddPolicyCases(cases);
+    AddFileListCases(cases, options);
+    AddDibCases(cases, options);
+    AddHexDumpCases(cases, options);
+    AddTextCases(cases, options, utf8Locale);
+    AddTextLayoutCases(cases, options);
+    AddThumbnailCases(cases, options);
+    AddHistoryCases(cases);
+    AddArenaCases(cases);
+    AddLz4Cases(cases, options);
+    AddJournalCases(cases);
+    AddSearchCases(cases);
+    AddQueryCases(cases, options);
+    AddLogCases(cases);
+    AddFormatCases(cases);
+
+    printf(baseline.empty() ? "name,param,bytes,iterations,ns,ns_min,mb_per_s\n" : "name,param,bytes,iterations,ns,ns_min,mb_per_s,baseline_ns,change_pct,status\n");
+    bool regressed = false;
+    for (const BenchCase& c : cases)
+    {
+        if (!options.filter.empty() && Key(c.name, c.param).find(options.filter) == std::string::npos)
+            continue;
+
+        BenchResult r;
+        {
+            const BenchBody body = c.setup();
+            r = Run(body, options.minTime);
+        }
+        printf("%s,%llu,%llu,%llu,%.1f,%.1f,", c.name.c_str(), (unsigned long long) c.param, (unsigned long long) c.bytes, (unsigned long long) r.iterations, r.ns, r.nsMin);
+        if (c.bytes != 0)
+            printf("%.1f", double(c.bytes) * 1e3 / r.ns);
+        if (!baseline.empty())
+        {
+            const auto it = baseline.find(Key(c.name, c.param));
+            if (it == baseline.end() || it->second <= 0)
+                printf(",,,new");
+            else
+            {
+                const double change = (r.ns - it->second) * 100 / it->second;
+                const char* const status = change > options.threshold ? "regressed" : change < -options.threshold ? "improved" : "same";
+                printf(",%.1f,%+.1f,%s", it->second, change, status);
+                regressed = regressed || change > options.threshold;
+            }
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+    return regressed ? 1 : 0;
+}
@@ -0,0 +1,139 @@
+#include "CapturePipeline.h"
+
+#include "Rad/Hash.h"
+#include "Rad/Trace.h"
+
+CapturePipeline::CapturePipeline(std::function<void()> notify, const size_t threads)
+    : m_notify(std::move(notify))
+    , m_kinds(std::make_shared<TextKinds>())
+    , m_pool(threads)
+    , m_thread(&CapturePipeline::Run, this)
+{
+}
+
+CapturePipeline::~CapturePipeline()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+}
+
+void CapturePipeline::SetTextKinds(const TextKinds& kinds)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_kinds = std::make_shared<TextKinds>(kinds);
+}
+
+uint64_t CapturePipeline::Add(const uint64_t time, std::vector<CaptureItem> items)
+{
+    Capture c = {};
+    c.serial = m_serial++;
+    c.time = time;
+    c.items = std::move(items);
+    c.entry = InvalidHist;
+    const uint64_t serial = c.serial;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending.push_back(std::move(c));
+    }
+    m_cv.notify_one();
+    return serial;
+}
+
+uint64_t CapturePipeline::Prepare(const HistId entry, std::vector<std::pair<uint32_t, PayloadRef>> refs)
+{
+    Capture c = {};
+    c.serial = m_serial++;
+    c.entry = entry;
+    c.refs = std::move(refs);
+    const uint64_t serial = c.serial;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending.push_back(std::move(c));
+    }
+    m_cv.notify_one();
+    return serial;
+}
+
+bool CapturePipeline::Pop(Capture& capture)
+{
+    // Cleared first, so anything published after the drain notifies again
+    m_notified = false;
+    Capture c;
+    while (m_done.Pop(c))
+    {
+        const uint64_t serial = c.serial;
+        m_ready.emplace(serial, std::move(c));
+    }
+
+    const auto it = m_ready.find(m_next);
+    if (it == m_ready.end())
+        return false;
+    capture = std::move(it->second);
+    m_ready.erase(it);
+    ++m_next;
+    return true;
+}
+
+void CapturePipeline::Process(Capture& capture, const TextKinds& kinds) const
+{
+    TraceSpan span("ProcessCapture");
+    span.Arg("formats", capture.items.size());
+    std::vector<std::pair<uint32_t, PayloadRef>>& refs = capture.refs;
+    for (CaptureItem& i : capture.items)
+    {
+        i.hash = HashBytes(i.raw->data(), i.raw->size());
+        refs.push_back({ i.uFormat, { i.hash, i.raw->size(), i.raw, nullptr, nullptr } });
+    }
+    std::vector<std::pair<TextKind, PayloadRef>> text;
+    uint64_t bytes = 0;
+    for (const auto& r : refs)
+    {
+        bytes += r.second.size;
+        const TextKind kind = GetTextKind(kinds, r.first);
+        if (kind != TextKind::None)
+            text.push_back({ kind, r.second });
+    }
+    span.Arg("bytes", bytes);
+    capture.summary = Summarize(refs, kinds);
+    capture.text = SearchIndex::Prepare(EntryText(text, SearchIndex::MaxText));
+    // The payloads can be released once the entry is gone
+    refs.clear();
+}
+
+void CapturePipeline::Publish(Capture capture)
+{
+    m_done.Push(std::move(capture));
+    if (!m_notified.exchange(true) && m_notify)
+        m_notify();
+}
+
+void CapturePipeline::Run()
+{
+    TraceThreadName("Capture pipeline");
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_cv.wait(lock, [this] { return m_stop || !m_pending.empty(); });
+        if (m_stop)
+            break;
+
+        // Everything queued so far is one batch for the pool
+        std::vector<Capture> batch(std::make_move_iterator(m_pending.begin()), std::make_move_iterator(m_pending.end()));
+        m_pending.clear();
+        const std::shared_ptr<const TextKinds> kinds = m_kinds;
+        lock.unlock();
+
+        m_pool.Run(batch.size(), [this, &batch, &kinds](const size_t i)
+        {
+            Process(batch[i], *kinds);
+            Publish(std::move(batch[i]));
+            return true;
+        });
+
+        lock.lock();
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "PayloadStore.h"
+#include "SearchIndex.h"
+#include "Summary.h"
+#include "Rad/MpscQueue.h"
+#include "Rad/WorkStealing.h"
+
+// A clipboard format as it was read, staged in the PayloadStore.
+struct CaptureItem
+{
+    uint32_t uFormat;
+    PayloadBytes raw;
+    uint64_t hash;      // set by the pipeline
+};
+
+// A clipboard change, or an entry already in the history, and what the pipeline made of it.
+struct Capture
+{
+    uint64_t serial;
+    uint64_t time;      // ms, from HistNow
+    std::vector<CaptureItem> items;
+    HistId entry;       // InvalidHist for a clipboard change
+    std::vector<std::pair<uint32_t, PayloadRef>> refs;     // the payloads of entry
+    EntrySummary summary;
+    IndexText text;
+};
+
+// Work on a clipboard change that doesn't need the clipboard open.
+// The UI thread only copies the bytes and calls Add. The payloads are hashed, summarized
+// and prepared for the search index on a WorkStealingPool, and finished captures are
+// passed back through a lock-free queue. Pop returns them in the order they were added,
+// and must be called on the thread that called Add, after notify has been called.
+class CapturePipeline
+{
+public:
+    CapturePipeline(std::function<void()> notify, size_t threads = std::min<size_t>(4, std::thread::hardware_concurrency()));
+    CapturePipeline(const CapturePipeline&) = delete;
+    CapturePipeline& operator=(const CapturePipeline&) = delete;
+    ~CapturePipeline();
+
+    void SetTextKinds(const TextKinds& kinds);
+    // Returns the serial of the capture.
+    uint64_t Add(uint64_t time, std::vector<CaptureItem> items);
+    // Summarizes and prepares the text of an entry that is already in the history, such as one
+    // loaded from the journal. Returns the serial of the capture.
+    uint64_t Prepare(HistId entry, std::vector<std::pair<uint32_t, PayloadRef>> refs);
+    bool Pop(Capture& capture);
+    // Added and not yet popped.
+    size_t Pending() const { return size_t(m_serial - m_next); }
+
+private:
+    void Run();
+    void Process(Capture& capture, const TextKinds& kinds) const;
+    void Publish(Capture capture);
+
+    const std::function<void()> m_notify;
+    uint64_t m_serial = 0;
+    uint64_t m_next = 0;
+    std::map<uint64_t, Capture> m_ready;    // finished out of order
+    MpscQueue<Capture> m_done;
+    std::atomic<bool> m_notified{ false };
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::shared_ptr<const TextKinds> m_kinds;
+    std::deque<Capture> m_pending;
+    bool m_stop = false;
+    WorkStealingPool m_pool;
+    std::thread m_thread;
+};
@@ -0,0 +1,190 @@
+#include "CapturePolicy.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "ClipboardFormats.h"
+#include "Rad/Glob.h"
+
+namespace
+{
+    inline char Lower(char c) { return c >= 'A' && c <= 'Z' ? char(c + 'a' - 'A') : c; }
+
+    bool IsNumber(const std::string& s)
+    {
+        return !s.empty() && s.find_first_not_of("0123456789") == std::string::npos;
+    }
+
+    // Space separated, with quotes for names that have spaces.
+    // Returns false on an unterminated quote.
+    bool Tokenize(const std::string& line, std::vector<std::string>& tokens)
+    {
+        size_t i = 0;
+        while (i < line.size())
+        {
+            while (i < line.size() && (line[i] == ' ' || line[i] == '\t'))
+                ++i;
+            if (i >= line.size() || line[i] == '#')
+                break;
+            std::string t;
+            bool quoted = false;
+            while (i < line.size() && (quoted || (line[i] != ' ' && line[i] != '\t')))
+            {
+                if (line[i] == '"')
+                    quoted = !quoted;
+                else
+                    t += line[i];
+                ++i;
+            }
+            if (quoted)
+                return false;
+            tokens.push_back(t);
+        }
+        return true;
+    }
+
+    bool ParseSize(const std::string& s, uint64_t& size)
+    {
+        if (s.empty() || s[0] < '0' || s[0] > '9')
+            return false;
+        char* end = nullptr;
+        size = strtoull(s.c_str(), &end, 10);
+        switch (Lower(*end))
+        {
+        case 'k': size <<= 10; ++end; break;
+        case 'm': size <<= 20; ++end; break;
+        case 'g': size <<= 30; ++end; break;
+        }
+        if (Lower(*end) == 'b')
+            ++end;
+        return *end == '\0';
+    }
+
+    bool ParseRule(const std::vector<std::string>& tokens, CaptureRule& rule)
+    {
+        if (tokens.size() < 3)
+            return false;
+        rule = {};
+        rule.format = tokens[0];
+        rule.source = tokens[1];
+        std::string action = tokens[2];
+        std::transform(action.begin(), action.end(), action.begin(), Lower);
+        if (action == "always" && tokens.size() == 3)
+            rule.action = CaptureAction::Always;
+        else if (action == "never" && tokens.size() == 3)
+            rule.action = CaptureAction::Never;
+        else if (action == "max" && tokens.size() == 4 && ParseSize(tokens[3], rule.maxSize))
+            rule.action = CaptureAction::MaxSize;
+        else if (action == "first" && tokens.size() == 4)
+        {
+            rule.action = CaptureAction::First;
+            rule.family = tokens[3];
+            std::transform(rule.family.begin(), rule.family.end(), rule.family.begin(), Lower);
+        }
+        else
+            return false;
+        return true;
+    }
+
+    bool Parse(const std::string& text, std::vector<CaptureRule>& rules, size_t& errorLine)
+    {
+        size_t line = 0;
+        size_t start = 0;
+        while (start < text.size())
+        {
+            ++line;
+            size_t end = text.find('\n', start);
+            if (end == std::string::npos)
+                end = text.size();
+            const size_t length = end > start && text[end - 1] == '\r' ? end - start - 1 : end - start;
+            std::vector<std::string> tokens;
+            if (!Tokenize(text.substr(start, length), tokens))
+            {
+                errorLine = line;
+                return false;
+            }
+            if (!tokens.empty())
+            {
+                CaptureRule rule;
+                if (!ParseRule(tokens, rule))
+                {
+                    errorLine = line;
+                    return false;
+                }
+                rules.push_back(rule);
+            }
+            start = end + 1;
+        }
+        return true;
+    }
+}
+
+const char* const CapturePolicy::ExclusionFormats[] = {
+    "ExcludeClipboardContentFromMonitorProcessing",
+    "Clipboard Viewer Ignore",
+};
+const size_t CapturePolicy::ExclusionFormatCount = sizeof(ExclusionFormats) / sizeof(ExclusionFormats[0]);
+
+CapturePolicy::CapturePolicy()
+{
+    // Only the first of the formats synthesized from one another, see
+    // https://learn.microsoft.com/en-us/windows/win32/dataxchg/clipboard-formats#synthesized-clipboard-formats
+    for (const FormatDesc& d : FormatTable)
+    {
+        if (d.family != FormatFamily::None)
+            m_rules.push_back({ d.name, "*", CaptureAction::First, 0, FamilyName(d.family) });
+        else if (d.capture == CaptureStrategy::Never)
+            m_rules.push_back({ d.name, "*", CaptureAction::Never, 0, std::string() });
+    }
+    m_rules.push_back({ "*", "*", CaptureAction::MaxSize, 32 << 20, std::string() });
+    m_builtIn = m_rules.size();
+}
+
+bool CapturePolicy::Load(const std::string& text, size_t& errorLine)
+{
+    std::vector<CaptureRule> rules;
+    if (!Parse(text, rules, errorLine))
+        return false;
+    m_rules.insert(m_rules.end() - m_builtIn, rules.begin(), rules.end());
+    return true;
+}
+
+const CaptureRule* CapturePolicy::Find(const uint32_t format, const std::string& name, const std::string& source) const
+{
+    const char* const n = !name.empty() ? name.c_str() : StandardFormat(format).name;
+    for (const CaptureRule& r : m_rules)
+    {
+        const bool formatMatch = IsNumber(r.format) ? strtoul(r.format.c_str(), nullptr, 10) == format : Glob(n, r.format.c_str());
+        if (formatMatch && Glob(source.c_str(), r.source.c_str()))
+            return &r;
+    }
+    return nullptr;
+}
+
+bool CaptureEvaluation::Wants(const uint32_t format, const std::string& name, uint64_t& maxSize) const
+{
+    maxSize = UINT64_MAX;
+    const CaptureRule* const r = m_policy.Find(format, name, m_source);
+    if (r == nullptr)
+        return true;
+    switch (r->action)
+    {
+    case CaptureAction::Always:
+        return true;
+    case CaptureAction::Never:
+        return false;
+    case CaptureAction::MaxSize:
+        maxSize = r->maxSize;
+        return true;
+    case CaptureAction::First:
+        return std::find(m_families.begin(), m_families.end(), r->family) == m_families.end();
+    }
+    return true;
+}
+
+void CaptureEvaluation::Copied(const uint32_t format, const std::string& name)
+{
+    const CaptureRule* const r = m_policy.Find(format, name, m_source);
+    if (r != nullptr && r->action == CaptureAction::First)
+        m_families.push_back(r->family);
+}
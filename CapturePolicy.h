@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class CaptureAction { Always, Never, MaxSize, First };
+
+struct CaptureRule
+{
+    std::string format;     // format id, or glob on its name, CF_TEXT etc. for the standard formats
+    std::string source;     // glob on the process name of the clipboard owner
+    CaptureAction action;
+    uint64_t maxSize;       // MaxSize
+    std::string family;     // First
+};
+
+// Decides which clipboard formats are copied, from rules on the format and the application that
+// owns the clipboard. The first rule that matches a format decides:
+//   always             copied
+//   never              not requested from the clipboard, so it isn't rendered either
+//   max N[k|m|g]       copied if it is no more than N bytes
+//   first FAMILY       copied unless a format of the family already was
+// A format that no rule matches is copied.
+// Rules that are loaded come before the built-in ones, which skip the synthesized formats and
+// formats other than text and images over 32MB.
+class CapturePolicy
+{
+public:
+    CapturePolicy();
+
+    // One rule per line, "format source action", # starts a comment.
+    // On an error returns false with the line number, and the rules are unchanged.
+    bool Load(const std::string& text, size_t& errorLine);
+    void Add(const CaptureRule& rule) { m_rules.insert(m_rules.end() - m_builtIn, rule); }
+    const std::vector<CaptureRule>& Rules() const { return m_rules; }
+
+    // Formats marking the clipboard as not to be captured at all.
+    static const char* const ExclusionFormats[];
+    static const size_t ExclusionFormatCount;
+
+    // The rule for a format, null if none matches. name may be left empty for the standard formats.
+    const CaptureRule* Find(uint32_t format, const std::string& name, const std::string& source) const;
+
+private:
+    std::vector<CaptureRule> m_rules;
+    size_t m_builtIn = 0;   // at the end
+};
+
+// The policy applied to one clipboard change, with the formats in the order they are enumerated.
+class CaptureEvaluation
+{
+public:
+    CaptureEvaluation(const CapturePolicy& policy, std::string source)
+        : m_policy(policy), m_source(std::move(source))
+    {
+    }
+
+    // Before the format is requested. Returns false if it isn't wanted, otherwise maxSize is the
+    // most that may be copied, as the size is only known once the data has been requested.
+    bool Wants(uint32_t format, const std::string& name, uint64_t& maxSize) const;
+    // The format was copied, so the rest of its family isn't wanted.
+    void Copied(uint32_t format, const std::string& name);
+
+    const std::string& Source() const { return m_source; }
+
+private:
+    const CapturePolicy& m_policy;
+    const std::string m_source;
+    std::vector<std::string> m_families;
+};
@@ -0,0 +1,131 @@
+#include "ClipboardAccess.h"
+#include <algorithm>
+#include <thread>
+
+#include "ClipboardChange.h"
+#include "Rad/MemoryPlus.h"
+#include "Rad/Log.h"
+
+std::string Win32FormatBackend::Name(const uint32_t id)
+{
+    char name[256] = "";
+    const int length = GetClipboardFormatNameA(id, name, ARRAYSIZE(name));
+    return std::string(name, size_t(std::max(length, 0)));
+}
+
+std::wstring WindowProcessName(const HWND hWnd)
+{
+    if (hWnd == NULL)
+        return std::wstring();
+
+    DWORD pid = 0;
+    GetWindowThreadProcessId(hWnd, &pid);
+    const auto hProcess = MakeUniqueHandle(OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid), CloseHandle);
+    WCHAR name[MAX_PATH] = L"";
+    DWORD size = ARRAYSIZE(name);
+    if (hProcess && QueryFullProcessImageNameW(hProcess.get(), 0, name, &size))
+    {
+        const WCHAR* const slash = wcsrchr(name, L'\\');
+        return slash != nullptr ? slash + 1 : name;
+    }
+    // Fall back to the window class
+    size = GetClassNameW(hWnd, name, ARRAYSIZE(name));
+    return std::wstring(name, size);
+}
+
+std::wstring ClipboardHolder()
+{
+    return WindowProcessName(GetOpenClipboardWindow());
+}
+
+bool OpenClipboardWait(const HWND hWnd, const BackoffPolicy& policy, ContentionStats& stats)
+{
+    std::wstring holder;
+    const AcquireResult result = Acquire(policy,
+        [hWnd, &holder]
+        {
+            if (OpenClipboard(hWnd))
+                return true;
+            if (holder.empty())
+                holder = ClipboardHolder();
+            return false;
+        },
+        SteadyMicros,
+        [](uint32_t ms) { Sleep(ms); },
+        [] { std::this_thread::yield(); });
+    stats.Record(result, holder);
+    return result.acquired;
+}
+
+void ClipboardOpener::Open(const HWND hWnd, std::function<void(bool opened)> then)
+{
+    Cancel();
+    m_hWnd = hWnd;
+    m_then = std::move(then);
+    m_start = SteadyMicros();
+    m_backoff = Backoff(m_policy, m_start);
+    m_attempts = 0;
+    m_holder.clear();
+    Attempt();
+}
+
+bool ClipboardOpener::OnTimer(const UINT_PTR id)
+{
+    if (id != m_timerId)
+        return false;
+    CHECK_LE(KillTimer(m_hWnd, m_timerId));
+    if (m_then)
+        Attempt();
+    return true;
+}
+
+void ClipboardOpener::Cancel()
+{
+    if (m_then)
+    {
+        CHECK_LE(KillTimer(m_hWnd, m_timerId));
+        Finish(false, false);
+    }
+}
+
+// Retries in place until the backoff wants to sleep, then waits for the timer
+void ClipboardOpener::Attempt()
+{
+    while (true)
+    {
+        ++m_attempts;
+        if (OpenClipboard(m_hWnd))
+        {
+            Finish(true);
+            return;
+        }
+        if (m_holder.empty())
+            m_holder = ClipboardHolder();
+
+        uint32_t ms = 0;
+        switch (m_backoff.Next(SteadyMicros(), ms))
+        {
+        case Backoff::Step::Retry:
+            break;
+        case Backoff::Step::Yield:
+            std::this_thread::yield();
+            break;
+        case Backoff::Step::Sleep:
+            CHECK_LE(SetTimer(m_hWnd, m_timerId, std::max<UINT>(ms, USER_TIMER_MINIMUM), nullptr));
+            return;
+        case Backoff::Step::GiveUp:
+            Finish(false);
+            return;
+        }
+    }
+}
+
+void ClipboardOpener::Finish(const bool opened, const bool call)
+{
+    m_stats.Record({ opened, m_attempts, SteadyMicros() - m_start }, m_holder);
+    // Taken first, then may start another Open
+    const std::function<void(bool)> then = std::move(m_then);
+    m_then = nullptr;
+    if (call)
+        then(opened);
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <functional>
+#include <string>
+
+#include "Rad/MessageHandler.h"
+#include "Rad/Backoff.h"
+#include "ClipboardFormats.h"
+
+class Win32FormatBackend : public FormatBackend
+{
+public:
+    uint32_t Register(const char* name) override { return RegisterClipboardFormatA(name); }
+    std::string Name(uint32_t id) override;
+};
+
+// Process name of the window, falling back to its class.
+std::wstring WindowProcessName(HWND hWnd);
+// Process name of the window that has the clipboard open, if any.
+std::wstring ClipboardHolder();
+
+// Opens the clipboard, backing off while another window has it open.
+// Blocks the calling thread, for when the clipboard is needed before returning.
+bool OpenClipboardWait(HWND hWnd, const BackoffPolicy& policy, ContentionStats& stats);
+
+// Opens the clipboard without holding up the message loop. The retries are driven by a timer on
+// the window, whose WM_TIMER must be passed to OnTimer.
+class ClipboardOpener
+{
+public:
+    ClipboardOpener(const UINT_PTR timerId, const BackoffPolicy& policy, ContentionStats& stats)
+        : m_timerId(timerId), m_policy(policy), m_stats(stats)
+    {
+    }
+    ClipboardOpener(const ClipboardOpener&) = delete;
+    ClipboardOpener& operator=(const ClipboardOpener&) = delete;
+
+    // Calls then(true) with the clipboard open, then must close it, or then(false) on timing out.
+    // Cancels an Open that is still waiting.
+    void Open(HWND hWnd, std::function<void(bool opened)> then);
+    // Returns false if the timer isn't ours.
+    bool OnTimer(UINT_PTR id);
+    // Drops a waiting Open without calling it.
+    void Cancel();
+
+private:
+    void Attempt();
+    void Finish(bool opened, bool call = true);
+
+    const UINT_PTR m_timerId;
+    const BackoffPolicy m_policy;
+    ContentionStats& m_stats;
+
+    HWND m_hWnd = NULL;
+    std::function<void(bool)> m_then;
+    Backoff m_backoff{ BackoffPolicy(), 0 };
+    uint64_t m_start = 0;
+    uint32_t m_attempts = 0;
+    std::wstring m_holder;
+};
@@ -0,0 +1,20 @@
+#include "ClipboardChange.h"
+
+void ChangeQueue::Push(ClipboardChange change)
+{
+    m_captureLatency.Add(change.captured >= change.notified ? change.captured - change.notified : 0);
+    m_changes.Push(std::move(change));
+    if (!m_notified.exchange(true) && m_notify)
+        m_notify();
+}
+
+bool ChangeQueue::Pop(ClipboardChange& change)
+{
+    // Cleared first, so anything pushed after the last Pop notifies again
+    m_notified = false;
+    if (!m_changes.Pop(change))
+        return false;
+    const uint64_t now = m_clock();
+    m_handoffLatency.Add(now >= change.captured ? now - change.captured : 0);
+    return true;
+}
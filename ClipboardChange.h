@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "CapturePipeline.h"
+#include "Rad/Histogram.h"
+#include "Rad/MpscQueue.h"
+
+// Steady clock in microseconds, for latencies.
+inline uint64_t SteadyMicros()
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// A clipboard change as the listener read it.
+struct ClipboardChange
+{
+    uint64_t notified;      // us, SteadyMicros when the change was signalled
+    uint64_t captured;      // us, once the formats had been copied
+    uint64_t time;          // ms, HistNow
+    bool own;               // made by the owner window, nothing was captured
+    std::vector<CaptureItem> items;
+};
+
+// Hands clipboard changes from the listener thread to the UI thread, and keeps the latencies.
+// Pop must be called on a single thread, after notify has been called.
+class ChangeQueue
+{
+public:
+    explicit ChangeQueue(std::function<void()> notify, std::function<uint64_t()> clock = SteadyMicros)
+        : m_notify(std::move(notify)), m_clock(std::move(clock))
+    {
+    }
+
+    void Push(ClipboardChange change);
+    bool Pop(ClipboardChange& change);
+
+    // Notification to captured, in us.
+    const Histogram& CaptureLatency() const { return m_captureLatency; }
+    // Captured to popped, in us.
+    const Histogram& HandoffLatency() const { return m_handoffLatency; }
+
+private:
+    const std::function<void()> m_notify;
+    const std::function<uint64_t()> m_clock;
+    MpscQueue<ClipboardChange> m_changes;
+    std::atomic<bool> m_notified{ false };
+    Histogram m_captureLatency;
+    Histogram m_handoffLatency;
+};
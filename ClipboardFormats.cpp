@@ -0,0 +1,73 @@
+#include "ClipboardFormats.h"
+
+namespace
+{
+    constexpr bool StandardAtTheirIds(size_t i = 0)
+    {
+        return i >= StandardFormatCount || (FormatTable[i].id == i && StandardAtTheirIds(i + 1));
+    }
+
+    constexpr bool RegisteredWithoutIds(size_t i = StandardFormatCount)
+    {
+        return i >= FormatTableSize || (FormatTable[i].id == 0 && RegisteredWithoutIds(i + 1));
+    }
+
+    static_assert(StandardAtTheirIds(), "standard formats must be at their ids");
+    static_assert(RegisteredWithoutIds(), "registered formats are only known at run time");
+    static_assert(StandardFormat(FmtDib).view == FormatView::Image, "");
+    static_assert(StandardFormat(FmtUnicodeText).encoding == TextEncoding::Utf16, "");
+    static_assert(StandardFormat(0xC000).view == FormatView::Hex, "");
+}
+
+FormatRegistry::FormatRegistry(FormatBackend& backend)
+    : m_backend(backend)
+{
+    for (size_t i = StandardFormatCount; i < FormatTableSize; ++i)
+    {
+        const uint32_t id = m_backend.Register(FormatTable[i].name);
+        if (id != 0)
+            m_registered.emplace(id, &FormatTable[i]);
+    }
+}
+
+const FormatDesc& FormatRegistry::Describe(const uint32_t id) const
+{
+    if (id < StandardFormatCount)
+        return FormatTable[id];
+    const auto it = m_registered.find(id);
+    return it != m_registered.end() ? *it->second : UnknownFormat;
+}
+
+std::string FormatRegistry::Name(const uint32_t id) const
+{
+    const FormatDesc& d = Describe(id);
+    if (d.name[0] != '\0')
+        return d.name;
+    // Only registered formats have names
+    if (id < 0xC000 || id > 0xFFFF)
+        return std::string();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto it = m_names.find(id);
+    if (it != m_names.end())
+        return it->second;
+    return m_names.emplace(id, m_backend.Name(id)).first->second;
+}
+
+std::string FormatRegistry::Label(const uint32_t id) const
+{
+    const FormatDesc& d = Describe(id);
+    if (d.label[0] != '\0')
+        return d.label;
+    const std::string name = Name(id);
+    return !name.empty() ? name : "Format: " + std::to_string(id);
+}
+
+TextKinds FormatRegistry::RegisteredTextKinds() const
+{
+    TextKinds kinds;
+    for (const auto& r : m_registered)
+        if (r.second->textKind != TextKind::None)
+            kinds[r.first] = r.second->textKind;
+    return kinds;
+}
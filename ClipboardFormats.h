@@ -0,0 +1,133 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "TextExtract.h"
+
+// Standard clipboard format ids, so this builds without Windows.h
+const uint32_t FmtText = 1;
+const uint32_t FmtBitmap = 2;
+const uint32_t FmtOemText = 7;
+const uint32_t FmtDib = 8;
+const uint32_t FmtUnicodeText = 13;
+const uint32_t FmtEnhMetafile = 14;
+const uint32_t FmtHDrop = 15;
+const uint32_t FmtLocale = 16;
+const uint32_t FmtDibV5 = 17;
+
+// Formats synthesized from one another, only the first of a family is captured.
+enum class FormatFamily : uint8_t { None, Text, Bitmap, Metafile };
+enum class TextEncoding : uint8_t { None, Ansi, Oem, Utf8, Utf16 };
+
+enum class CaptureStrategy : uint8_t
+{
+    Global,         // HGLOBAL bytes
+    EnhMetafile,    // HENHMETAFILE bits
+    AsDib,          // requested as CF_DIB, synthesized again on restore
+    Never,
+};
+
+// Picks the decoder and the renderer of the viewer.
+enum class FormatView : uint8_t { None, Hex, Text, Image, Metafile, Locale, Files };
+
+struct FormatDesc
+{
+    uint32_t id;            // 0 for registered formats, their ids are only known at run time
+    const char* name;       // CF_ constant, or the registered name
+    const char* label;      // shown in menus
+    FormatFamily family;
+    TextEncoding encoding;
+    TextKind textKind;
+    CaptureStrategy capture;
+    FormatView view;
+};
+
+// The standard formats at their ids, followed by the registered formats known to the viewer.
+constexpr FormatDesc FormatTable[] = {
+    { 0, "", "", FormatFamily::None, TextEncoding::None, TextKind::None, CaptureStrategy::Global, FormatView::None },
+    { 1, "CF_TEXT", "Text", FormatFamily::Text, TextEncoding::Ansi, TextKind::Ansi, CaptureStrategy::Global, FormatView::Text },
+    { 2, "CF_BITMAP", "Bitmap", FormatFamily::Bitmap, TextEncoding::None, TextKind::None, CaptureStrategy::AsDib, FormatView::Image },
+    { 3, "CF_METAFILEPICT", "Metafile Picture", FormatFamily::Metafile, TextEncoding::None, TextKind::None, CaptureStrategy::Global, FormatView::Hex },
+    { 4, "CF_SYLK", "Symbolic Link", FormatFamily::None, TextEncoding::None, TextKind::None, CaptureStrategy::Global, FormatView::Hex },
+    { 5, "CF_DIF", "Data Interchange Format", FormatFamily::None, TextEncoding::None, TextKind::None, CaptureStrategy::Global, FormatView::Hex },
+    { 6, "CF_TIFF", "TIFF", FormatFamily::None, TextEncoding::None, TextKind::None, CaptureStrategy::Global, FormatView::Hex },
+    { 7, "CF_OEMTEXT", "OEM Text", FormatFamily::Text, TextEncoding::Oem, TextKind::Ansi, CaptureStrategy::Global, FormatView::Text },
+    { 8, "CF_DIB", "Device Independent Bitmap", FormatFamily::Bitmap, TextEncoding::None, TextKind::None, CaptureStrategy::Global, FormatView::Image },
+    // Bitmaps are kept as DIBs, which have their own colour table
+    { 9, "CF_PALETTE", "Palette", FormatFamily::None, TextEncoding::None, TextKind::None, CaptureStrategy::Never, FormatView::Hex },
+    { 10, "CF_PENDATA", "Pen Data", FormatFamily::None, TextEncoding::None, TextKind::None, CaptureStrategy::Global, FormatView::Hex },
+    { 11, "CF_RIFF", "RIFF Audio", FormatFamily::None, TextEncoding::None, TextKind::None, CaptureStrategy::Global, FormatView::Hex },
+    { 12, "CF_WAVE", "Wave Audio", FormatFamily::None, TextEncoding::None, TextKind::None, CaptureStrategy::Global, FormatView::Hex },
+    { 13, "CF_UNICODETEXT", "Unicode Text", FormatFamily::Text, TextEncoding::Utf16, TextKind::Unicode, CaptureStrategy::Global, FormatView::Text },
+    { 14, "CF_ENHMETAFILE", "Enhanced Metafile", FormatFamily::Metafile, TextEncoding::None, TextKind::None, CaptureStrategy::EnhMetafile, FormatView::Metafile },
+    { 15, "CF_HDROP", "Files", FormatFamily::None, TextEncoding::None, TextKind::FileList, CaptureStrategy::Global, FormatView::Files },
+    { 16, "CF_LOCALE", "Locale", FormatFamily::None, TextEncoding::None, TextKind::None, CaptureStrategy::Global, FormatView::Locale },
+    { 17, "CF_DIBV5", "Device Independent Bitmap V5", FormatFamily::Bitmap, TextEncoding::None, TextKind::None, CaptureStrategy::Global, FormatView::Image },
+
+    { 0, "HTML Format", "HTML Format", FormatFamily::None, TextEncoding::Utf8, TextKind::Html, CaptureStrategy::Global, FormatView::Text },
+    { 0, "Rich Text Format", "Rich Text Format", FormatFamily::None, TextEncoding::Utf8, TextKind::Rtf, CaptureStrategy::Global, FormatView::Text },
+    { 0, "Link Preview Format", "Link Preview Format", FormatFamily::None, TextEncoding::Utf8, TextKind::None, CaptureStrategy::Global, FormatView::Text },
+    { 0, "Titled Hyperlink Format", "Titled Hyperlink Format", FormatFamily::None, TextEncoding::Utf8, TextKind::None, CaptureStrategy::Global, FormatView::Text },
+    { 0, "Filename", "Filename", FormatFamily::None, TextEncoding::Ansi, TextKind::None, CaptureStrategy::Global, FormatView::Text },
+    { 0, "FilenameW", "FilenameW", FormatFamily::None, TextEncoding::Utf16, TextKind::None, CaptureStrategy::Global, FormatView::Text },
+};
+constexpr size_t FormatTableSize = sizeof(FormatTable) / sizeof(FormatTable[0]);
+constexpr size_t StandardFormatCount = 18;
+
+// Anything else, shown as a hex dump.
+constexpr FormatDesc UnknownFormat = { 0, "", "", FormatFamily::None, TextEncoding::None, TextKind::None, CaptureStrategy::Global, FormatView::Hex };
+
+constexpr const FormatDesc& StandardFormat(uint32_t id)
+{
+    return id < StandardFormatCount ? FormatTable[id] : UnknownFormat;
+}
+
+constexpr bool IsImageFormat(uint32_t id)
+{
+    return StandardFormat(id).view == FormatView::Image;
+}
+
+constexpr const char* FamilyName(FormatFamily family)
+{
+    return family == FormatFamily::Text ? "text" : family == FormatFamily::Bitmap ? "bitmap" : family == FormatFamily::Metafile ? "metafile" : "";
+}
+
+// Registers and names clipboard formats, so the registry can be used without Windows.
+class FormatBackend
+{
+public:
+    virtual ~FormatBackend() = default;
+    // Returns 0 on failure.
+    virtual uint32_t Register(const char* name) = 0;
+    // Empty if the id isn't a registered format.
+    virtual std::string Name(uint32_t id) = 0;
+};
+
+// Looks up the descriptor of a format id in constant time. The registered formats in the table
+// are registered once on construction, other registered formats are named once and cached.
+// Thread safe.
+class FormatRegistry
+{
+public:
+    explicit FormatRegistry(FormatBackend& backend);
+    FormatRegistry(const FormatRegistry&) = delete;
+    FormatRegistry& operator=(const FormatRegistry&) = delete;
+
+    const FormatDesc& Describe(uint32_t id) const;
+    // The CF_ constant or the registered name, empty for private formats.
+    std::string Name(uint32_t id) const;
+    // For menus, "Format: N" if there's no name.
+    std::string Label(uint32_t id) const;
+    // The registered formats that hold text.
+    TextKinds RegisteredTextKinds() const;
+
+private:
+    FormatBackend& m_backend;
+    std::unordered_map<uint32_t, const FormatDesc*> m_registered;
+
+    mutable std::mutex m_mutex;
+    mutable std::unordered_map<uint32_t, std::string> m_names;
+};
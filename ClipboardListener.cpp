@@ -0,0 +1,280 @@
+#include "ClipboardListener.h"
+#include <algorithm>
+#include <future>
+#include <numeric>
+
+#include "Rad/Convert.h"
+#include "Rad/MemoryPlus.h"
+#include "Rad/Trace.h"
+#include "Rad/Windowxx.h"
+#include "Rad/Log.h"
+
+namespace
+{
+    // Any of the formats the source uses to keep the contents away from clipboard monitors
+    bool IsExcluded()
+    {
+        static const std::vector<UINT> formats = []
+        {
+            std::vector<UINT> formats;
+            for (size_t i = 0; i < CapturePolicy::ExclusionFormatCount; ++i)
+                formats.push_back(RegisterClipboardFormatA(CapturePolicy::ExclusionFormats[i]));
+            return formats;
+        }();
+        return std::any_of(formats.begin(), formats.end(), [](UINT f) { return f != 0 && IsClipboardFormatAvailable(f); });
+    }
+
+    // Bytes Stage would copy, found without copying
+    size_t DataSize(const CaptureStrategy capture, const HANDLE hData)
+    {
+        if (hData == NULL)
+            return 0;
+        if (capture == CaptureStrategy::EnhMetafile)
+            return GetEnhMetaFileBits((HENHMETAFILE) hData, 0, nullptr);
+        return GlobalSize(hData);
+    }
+
+    // Copies the bytes while the clipboard is open, the rest is left to the CapturePipeline
+    PayloadBytes Stage(PayloadStore& payloads, const CaptureStrategy capture, const HANDLE hData, const size_t s)
+    {
+        if (hData == NULL || s <= 0)
+            return nullptr;
+
+        switch (capture)
+        {   // Copy according to https://learn.microsoft.com/en-gb/windows/win32/dataxchg/standard-clipboard-formats#constants
+        case CaptureStrategy::EnhMetafile:
+        {
+            std::vector<BYTE> bits(s);
+            if (GetEnhMetaFileBits((HENHMETAFILE) hData, UINT(s), bits.data()) != s)
+                return nullptr;
+            return payloads.Stage(bits.data(), bits.size());
+        }
+        default:
+        {
+            auto pSrc = AutoGlobalLock<void*>(hData);
+            if (!pSrc)
+                return nullptr;
+            return payloads.Stage(pSrc.get(), s);
+        }
+        }
+    }
+}
+
+class ClipboardListenerWnd : public Window
+{
+    friend WindowManager<ClipboardListenerWnd>;
+public:
+    static ATOM Register() { return WindowManager<ClipboardListenerWnd>::Register(); }
+    static ClipboardListenerWnd* Create(ClipboardListener& listener, HWND hWndOwner)
+    {
+        CREATESTRUCT cs = {};
+        WindowManager<ClipboardListenerWnd>::GetCreateWindow(cs);
+        ClipboardListenerWnd* self = WindowManager<ClipboardListenerWnd>::Create(cs);
+        if (self)
+        {
+            self->m_listener = &listener;
+            self->m_hWndOwner = hWndOwner;
+            CHECK_LE(AddClipboardFormatListener(*self));
+        }
+        return self;
+    }
+
+private:
+    ClipboardListenerWnd() = default;
+
+protected:
+    static void GetCreateWindow(CREATESTRUCT& cs);
+    LRESULT HandleMessage(UINT uMsg, WPARAM wParam, LPARAM lParam) override;
+
+private:
+    static LPCTSTR ClassName() { return TEXT("RadClipboardListener"); }
+
+    void OnDestroy();
+    void OnClipboardUpdate();
+    void OnTimer(UINT id);
+    void Schedule();
+    void Capture(uint64_t notified);
+
+    ClipboardListener* m_listener = nullptr;
+    HWND m_hWndOwner = NULL;
+};
+
+void ClipboardListenerWnd::GetCreateWindow(CREATESTRUCT& cs)
+{
+    Window::GetCreateWindow(cs);
+    cs.hwndParent = HWND_MESSAGE;
+}
+
+void ClipboardListenerWnd::OnDestroy()
+{
+    CHECK_LE(RemoveClipboardFormatListener(*this));
+    PostQuitMessage(0);
+}
+
+void ClipboardListenerWnd::OnClipboardUpdate()
+{
+    // The time the update was posted, it may have waited in the queue
+    const uint64_t notified = SteadyMicros() - uint64_t(DWORD(GetTickCount() - DWORD(GetMessageTime()))) * 1000;
+    m_listener->m_coalescer.Notify(notified, GetClipboardSequenceNumber());
+    Schedule();
+}
+
+void ClipboardListenerWnd::OnTimer(const UINT id)
+{
+    CHECK_LE(KillTimer(*this, id));
+    UpdateCoalescer& coalescer = m_listener->m_coalescer;
+    const uint64_t notified = coalescer.PendingSince();
+    if (coalescer.Poll(SteadyMicros()))
+        Capture(notified);
+    Schedule();
+}
+
+// Several notifications for one change are captured once, after the debounce
+void ClipboardListenerWnd::Schedule()
+{
+    const uint64_t due = m_listener->m_coalescer.Due();
+    if (due == UINT64_MAX)
+        return;
+    const uint64_t now = SteadyMicros();
+    const UINT ms = due > now ? UINT((due - now + 999) / 1000) : 0;
+    CHECK_LE(SetTimer(*this, 1, std::max<UINT>(ms, USER_TIMER_MINIMUM), nullptr));
+}
+
+void ClipboardListenerWnd::Capture(const uint64_t notified)
+{
+    TraceSpan span("Capture");
+    // No message boxes while the clipboard is open
+    RadLogDeferNotifications defer;
+    ClipboardChange change = {};
+    change.notified = notified;
+    change.time = HistNow();
+
+    // Only this thread waits, so it can wait longer than the UI would
+    BackoffPolicy policy;
+    policy.timeout = 2000;
+    TraceSpan openSpan("OpenClipboard");
+    const bool opened = OpenClipboardWait(*this, policy, m_listener->m_contention);
+    openSpan.End();
+    if (!opened)
+    {
+        RadLog(LOG_DEBUG, TEXT("Clipboard change missed, unable to open the clipboard"), SRC_LOC);
+        return;
+    }
+    // Our own restore, the entry is already at the front and capturing would render every format
+    change.own = GetClipboardOwner() == m_hWndOwner;
+
+    PolicyStats& stats = m_listener->m_policyStats;
+    if (!change.own && IsExcluded())
+    {
+        // Passed on empty, so the UI stops showing the previous contents as current
+        ++stats.excluded;
+        CHECK_LE(CloseClipboard());
+        change.captured = SteadyMicros();
+        m_listener->m_changes.Push(std::move(change));
+        return;
+    }
+
+    // Decided before GetClipboardData, which has delay rendered formats rendered
+    CaptureEvaluation policy(m_listener->m_policy, change.own ? std::string() : w2a(WindowProcessName(GetClipboardOwner())));
+    UINT f = 0;
+    while (!change.own && (f = EnumClipboardFormats(f)) != 0)
+    {
+        const std::string name = m_listener->m_formats.Name(f);
+        uint64_t maxSize = 0;
+        if (!policy.Wants(f, name, maxSize))
+        {
+            ++stats.skipped;
+            continue;
+        }
+
+        TraceSpan formatSpan("CaptureFormat");
+        formatSpan.Arg("format", f);
+        const CaptureStrategy capture = m_listener->m_formats.Describe(f).capture;
+        const UINT cf = capture == CaptureStrategy::AsDib ? CF_DIB : f;
+        const HANDLE hData = GetClipboardData(cf);
+        // The size is only known once the data has been requested, but it hasn't been copied yet
+        const size_t size = DataSize(capture, hData);
+        formatSpan.Arg("bytes", size);
+        if (size > maxSize)
+        {
+            ++stats.oversized;
+            continue;
+        }
+        PayloadBytes raw = Stage(m_listener->m_payloads, capture, hData, size);
+        if (!raw)
+            continue;
+
+        policy.Copied(f, name);
+        change.items.push_back({ cf, std::move(raw), 0 });
+    }
+
+    CHECK_LE(CloseClipboard());
+
+    span.Arg("formats", change.items.size());
+    span.Arg("bytes", std::accumulate(change.items.begin(), change.items.end(), uint64_t(0),
+        [](uint64_t n, const CaptureItem& i) { return n + i.raw->size(); }));
+    change.captured = SteadyMicros();
+    m_listener->m_changes.Push(std::move(change));
+}
+
+LRESULT ClipboardListenerWnd::HandleMessage(const UINT uMsg, const WPARAM wParam, const LPARAM lParam)
+{
+    LRESULT ret = 0;
+    switch (uMsg)
+    {
+        HANDLE_MSG(WM_DESTROY, OnDestroy);
+        HANDLE_MSG(WM_CLIPBOARDUPDATE, OnClipboardUpdate);
+        HANDLE_MSG(WM_TIMER, OnTimer);
+    }
+
+    if (!IsHandled())
+        ret = Window::HandleMessage(uMsg, wParam, lParam);
+
+    return ret;
+}
+
+bool ClipboardListener::Start(const HWND hWndOwner)
+{
+    static const ATOM atom = ClipboardListenerWnd::Register();
+    if (atom == 0)
+        return false;
+
+    std::promise<HWND> created;
+    std::future<HWND> hWnd = created.get_future();
+    m_thread = std::thread([this, hWndOwner, &created]
+    {
+        TraceThreadName("Clipboard listener");
+        ClipboardListenerWnd* const wnd = ClipboardListenerWnd::Create(*this, hWndOwner);
+        created.set_value(wnd != nullptr ? HWND(*wnd) : NULL);
+        if (wnd != nullptr)
+            Run();
+    });
+    m_hWnd = hWnd.get();
+    if (m_hWnd == NULL)
+    {
+        m_thread.join();
+        return false;
+    }
+
+    // The current contents
+    CHECK_LE(PostMessage(m_hWnd, WM_CLIPBOARDUPDATE, 0, 0));
+    return true;
+}
+
+void ClipboardListener::Stop()
+{
+    if (m_hWnd != NULL)
+    {
+        CHECK_LE(PostMessage(m_hWnd, WM_CLOSE, 0, 0));
+        m_hWnd = NULL;
+    }
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void ClipboardListener::Run()
+{
+    MSG msg;
+    while (GetMessage(&msg, NULL, 0, 0))
+        DispatchMessage(&msg);
+}
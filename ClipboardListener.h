@@ -0,0 +1,55 @@
+#pragma once
+#include <thread>
+
+#include "Rad/Window.h"
+#include "CapturePolicy.h"
+#include "ClipboardAccess.h"
+#include "ClipboardChange.h"
+#include "UpdateCoalescer.h"
+
+struct PolicyStats
+{
+    uint64_t excluded;      // changes marked as not to be captured
+    uint64_t skipped;       // formats the policy didn't want
+    uint64_t oversized;     // formats over their size cap
+};
+
+// Captures clipboard changes on its own thread, with a message-only window registered as a
+// clipboard format listener. Changes are copied as soon as they settle, however long the UI
+// thread is busy painting or in a menu, and passed on through a ChangeQueue.
+class ClipboardListener
+{
+    friend class ClipboardListenerWnd;
+public:
+    ClipboardListener(PayloadStore& payloads, const FormatRegistry& formats, ChangeQueue& changes, ContentionStats& contention)
+        : m_payloads(payloads), m_formats(formats), m_changes(changes), m_contention(contention)
+    {
+    }
+    ClipboardListener(const ClipboardListener&) = delete;
+    ClipboardListener& operator=(const ClipboardListener&) = delete;
+    ~ClipboardListener() { Stop(); }
+
+    // Only before Start.
+    void SetPolicy(const CapturePolicy& policy) { m_policy = policy; }
+    // Changes made while hWndOwner owns the clipboard aren't captured.
+    bool Start(HWND hWndOwner);
+    void Stop();
+
+    // Only read once stopped.
+    const CoalesceStats& Coalescing() const { return m_coalescer.Stats(); }
+    const PolicyStats& Policy() const { return m_policyStats; }
+
+private:
+    void Run();
+
+    PayloadStore& m_payloads;
+    const FormatRegistry& m_formats;
+    ChangeQueue& m_changes;
+    ContentionStats& m_contention;
+    CapturePolicy m_policy;
+    // Used by the listener thread
+    UpdateCoalescer m_coalescer;
+    PolicyStats m_policyStats = {};
+    std::thread m_thread;
+    HWND m_hWnd = NULL;     // of the listener window
+};
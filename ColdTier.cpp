@@ -0,0 +1,103 @@
+#include "ColdTier.h"
+
+#include "History.h"
+#include "Rad/Lz4.h"
+
+ColdTier::ColdTier(PayloadStore& payloads, std::function<void()> notify)
+    : m_payloads(payloads)
+    , m_notify(std::move(notify))
+    , m_thread(&ColdTier::Run, this)
+{
+}
+
+ColdTier::~ColdTier()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+}
+
+void ColdTier::Update(const History& history, const uint64_t now)
+{
+    std::unordered_set<PayloadId> hot;
+    size_t i = 0;
+    for (const HistId e : history)
+    {
+        // Most recent first
+        if (i++ == m_config.hotEntries)
+            break;
+        if (history.Accessed(e) + m_config.hotIdle > now)
+            for (const HistItem& item : history.Items(e))
+                hot.insert(item.payload);
+    }
+
+    std::vector<Job> jobs;
+    for (const HistId e : history)
+    {
+        for (const HistItem& item : history.Items(e))
+        {
+            const PayloadId id = item.payload;
+            if (hot.count(id) || m_queued.count(id) || m_payloads.IsCold(id) || m_payloads.IsIncompressible(id) || m_payloads.Size(id) < m_config.minSize)
+                continue;
+            m_queued.insert(id);
+            jobs.push_back({ id, m_payloads.Share(id), {} });
+        }
+    }
+
+    if (!jobs.empty())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (Job& j : jobs)
+                m_pending.push_back(std::move(j));
+        }
+        m_cv.notify_one();
+    }
+}
+
+void ColdTier::Commit()
+{
+    std::vector<Job> done;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        done.swap(m_done);
+    }
+    for (Job& j : done)
+    {
+        m_queued.erase(j.id);
+        m_payloads.SetCold(j.id, j.raw, std::move(j.packed));
+    }
+}
+
+void ColdTier::Run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_cv.wait(lock, [this] { return m_stop || !m_pending.empty(); });
+        if (m_stop)
+            break;
+
+        Job j = std::move(m_pending.front());
+        m_pending.pop_front();
+        lock.unlock();
+
+        Lz4Compress(j.raw->data(), j.raw->size(), j.packed);
+        // Not worth keeping compressed if it saves less than 1/8th
+        if (j.packed.size() > j.raw->size() - j.raw->size() / 8)
+            std::vector<uint8_t>().swap(j.packed);
+
+        lock.lock();
+        const bool first = m_done.empty();
+        m_done.push_back(std::move(j));
+        if (first && m_notify)
+        {
+            lock.unlock();
+            m_notify();
+            lock.lock();
+        }
+    }
+}
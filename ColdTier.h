@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "PayloadStore.h"
+
+class History;
+
+// An entry is hot while it is one of the hotEntries most recent and was accessed within hotIdle.
+struct ColdTierConfig
+{
+    size_t hotEntries = 16;
+    uint64_t hotIdle = 10 * 60 * 1000;  // ms
+    size_t minSize = 4 * 1024;
+};
+
+// Compresses payloads of older history entries on a background thread.
+// Compressed results are only applied to the PayloadStore by Commit, which must be
+// called on the thread that owns the store, after notify has been called.
+class ColdTier
+{
+public:
+    ColdTier(PayloadStore& payloads, std::function<void()> notify);
+    ColdTier(const ColdTier&) = delete;
+    ColdTier& operator=(const ColdTier&) = delete;
+    ~ColdTier();
+
+    void SetConfig(const ColdTierConfig& config) { m_config = config; }
+    const ColdTierConfig& Config() const { return m_config; }
+
+    // Queues payloads that are only referenced by cold entries.
+    void Update(const History& history, uint64_t now);
+    void Commit();
+
+private:
+    struct Job
+    {
+        PayloadId id;
+        PayloadBytes raw;
+        std::vector<uint8_t> packed;
+    };
+
+    void Run();
+
+    PayloadStore& m_payloads;
+    const std::function<void()> m_notify;
+    ColdTierConfig m_config;
+    std::unordered_set<PayloadId> m_queued;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<Job> m_pending;
+    std::vector<Job> m_done;
+    bool m_stop = false;
+    std::thread m_thread;
+};
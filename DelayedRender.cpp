@@ -0,0 +1,52 @@
+#include "DelayedRender.h"
+
+bool DelayedRender::Offer(const History& history, const HistId id, ClipboardTarget& target)
+{
+    Reset();
+    m_entry = id;
+    bool ok = true;
+    for (const HistItem& i : history.Items(id))
+    {
+        m_payloads.AddRef(i.payload);
+        m_items.push_back({ i.uFormat, i.payload, false });
+        ok = target.Offer(i.uFormat) && ok;
+    }
+    return ok;
+}
+
+bool DelayedRender::Render(Item& item, ClipboardTarget& target)
+{
+    item.rendered = true;
+    const size_t size = m_payloads.Size(item.payload);
+    const uint8_t* const data = m_payloads.Data(item.payload);
+    if (data == nullptr && size > 0)
+        return false;
+    m_renderedBytes += size;
+    return target.Put(item.uFormat, data, size);
+}
+
+bool DelayedRender::Render(const uint32_t uFormat, ClipboardTarget& target)
+{
+    for (Item& i : m_items)
+        if (i.uFormat == uFormat)
+            return Render(i, target);
+    return false;
+}
+
+bool DelayedRender::RenderAll(ClipboardTarget& target)
+{
+    bool ok = true;
+    for (Item& i : m_items)
+        if (!i.rendered)
+            ok = Render(i, target) && ok;
+    return ok;
+}
+
+void DelayedRender::Reset()
+{
+    for (const Item& i : m_items)
+        m_payloads.Release(i.payload);
+    m_items.clear();
+    m_entry = InvalidHist;
+    m_renderedBytes = 0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "History.h"
+
+// The clipboard operations used to restore an entry.
+class ClipboardTarget
+{
+public:
+    virtual ~ClipboardTarget() = default;
+    // Advertises a format without its data.
+    virtual bool Offer(uint32_t uFormat) = 0;
+    virtual bool Put(uint32_t uFormat, const uint8_t* data, size_t size) = 0;
+};
+
+// Restores a history entry with delayed rendering.
+// Formats are offered up front and only materialized when they are asked for.
+// Holds a reference to the payloads until Reset, so the entry can be evicted meanwhile.
+class DelayedRender
+{
+public:
+    explicit DelayedRender(PayloadStore& payloads)
+        : m_payloads(payloads)
+    {
+    }
+    DelayedRender(const DelayedRender&) = delete;
+    DelayedRender& operator=(const DelayedRender&) = delete;
+    ~DelayedRender() { Reset(); }
+
+    // Call with the clipboard open and emptied.
+    bool Offer(const History& history, HistId id, ClipboardTarget& target);
+    // WM_RENDERFORMAT
+    bool Render(uint32_t uFormat, ClipboardTarget& target);
+    // WM_RENDERALLFORMATS, renders what has not been asked for yet.
+    bool RenderAll(ClipboardTarget& target);
+    // WM_DESTROYCLIPBOARD
+    void Reset();
+
+    HistId Entry() const { return m_entry; }
+    size_t RenderedBytes() const { return m_renderedBytes; }
+
+private:
+    struct Item
+    {
+        uint32_t uFormat;
+        PayloadId payload;
+        bool rendered;
+    };
+
+    bool Render(Item& item, ClipboardTarget& target);
+
+    PayloadStore& m_payloads;
+    HistId m_entry = InvalidHist;
+    std::vector<Item> m_items;
+    size_t m_renderedBytes = 0;
+};
@@ -0,0 +1,248 @@
+#include "History.h"
+#include <algorithm>
+
+#include "Rad/Hash.h"
+
+const uint32_t History::NoSlot;
+
+History::~History()
+{
+    Clear();
+}
+
+uint64_t History::EntryKey(const PayloadStore& payloads, const std::vector<HistItem>& items)
+{
+    uint64_t key = HashBytes(nullptr, 0);
+    for (const HistItem& i : items)
+    {
+        key = HashCombine(key, i.uFormat);
+        key = HashCombine(key, payloads.Hash(i.payload));
+    }
+    return key;
+}
+
+HistId History::Add(std::vector<HistItem> items, const uint64_t now)
+{
+    return Restore(std::move(items), now, now, now);
+}
+
+HistId History::Restore(std::vector<HistItem> items, const uint64_t created, const uint64_t accessed, const uint64_t now)
+{
+    const uint64_t key = EntryKey(m_payloads, items);
+    const auto it = m_byKey.find(key);
+    if (it != m_byKey.end())
+    {
+        const uint32_t s = it->second;
+        const std::vector<HistItem>& e = m_items[s];
+        if (e.size() == items.size()
+            && std::equal(e.begin(), e.end(), items.begin(), [](const HistItem& a, const HistItem& b) { return a.uFormat == b.uFormat && a.payload == b.payload; }))
+        {
+            ReleaseItems(items);
+            m_accessed[s] = std::max(m_accessed[s], accessed);
+            Unlink(s);
+            Link(s);
+            for (HistoryListener* l : m_listeners)
+                l->OnTouch(*this, m_ids[s]);
+            return m_ids[s];
+        }
+    }
+
+    uint32_t s;
+    if (!m_free.empty())
+    {
+        s = m_free.back();
+        m_free.pop_back();
+    }
+    else
+    {
+        s = uint32_t(m_ids.size());
+        m_ids.push_back(InvalidHist);
+        m_keys.push_back(0);
+        m_created.push_back(0);
+        m_accessed.push_back(0);
+        m_formatMask.push_back(0);
+        m_totalBytes.push_back(0);
+        m_summary.push_back(InvalidSummary);
+        m_prev.push_back(NoSlot);
+        m_next.push_back(NoSlot);
+        m_items.emplace_back();
+    }
+
+    uint32_t mask = 0;
+    uint64_t bytes = 0;
+    for (const HistItem& i : items)
+    {
+        mask |= FormatBit(i.uFormat);
+        bytes += m_payloads.Size(i.payload);
+    }
+
+    const HistId id = (HistId(++m_serial) << 32) | s;
+    m_ids[s] = id;
+    m_keys[s] = key;
+    m_created[s] = created;
+    m_accessed[s] = accessed;
+    m_formatMask[s] = mask;
+    m_totalBytes[s] = bytes;
+    m_summary[s] = InvalidSummary;
+    m_items[s] = std::move(items);
+    m_byKey[key] = s;
+    Link(s);
+    ++m_count;
+
+    for (HistoryListener* l : m_listeners)
+        l->OnAdd(*this, id);
+    Evict(now);
+    return id;
+}
+
+void History::Touch(const HistId id, const uint64_t now)
+{
+    if (!Contains(id))
+        return;
+    const uint32_t s = Slot(id);
+    m_accessed[s] = now;
+    Unlink(s);
+    Link(s);
+    for (HistoryListener* l : m_listeners)
+        l->OnTouch(*this, id);
+}
+
+void History::RemoveListener(HistoryListener* listener)
+{
+    m_listeners.erase(std::remove(m_listeners.begin(), m_listeners.end(), listener), m_listeners.end());
+}
+
+void History::Erase(const HistId id)
+{
+    if (!Contains(id))
+        return;
+    for (HistoryListener* l : m_listeners)
+        l->OnErase(*this, id);
+
+    const uint32_t s = Slot(id);
+    const auto it = m_byKey.find(m_keys[s]);
+    if (it != m_byKey.end() && it->second == s)
+        m_byKey.erase(it);
+    Unlink(s);
+    ReleaseItems(m_items[s]);
+    std::vector<HistItem>().swap(m_items[s]);
+    m_ids[s] = InvalidHist;
+    m_free.push_back(s);
+    --m_count;
+}
+
+// Clear only releases memory, listeners are not told about the entries.
+void History::Clear()
+{
+    for (uint32_t s = m_head; s != NoSlot; s = m_next[s])
+        ReleaseItems(m_items[s]);
+    m_ids.clear();
+    m_keys.clear();
+    m_created.clear();
+    m_accessed.clear();
+    m_formatMask.clear();
+    m_totalBytes.clear();
+    m_summary.clear();
+    m_prev.clear();
+    m_next.clear();
+    m_items.clear();
+    m_free.clear();
+    m_byKey.clear();
+    m_head = m_tail = NoSlot;
+    m_count = 0;
+}
+
+void History::Link(const uint32_t s)
+{
+    m_prev[s] = NoSlot;
+    m_next[s] = m_head;
+    if (m_head != NoSlot)
+        m_prev[m_head] = s;
+    m_head = s;
+    if (m_tail == NoSlot)
+        m_tail = s;
+}
+
+void History::Unlink(const uint32_t s)
+{
+    if (m_prev[s] != NoSlot)
+        m_next[m_prev[s]] = m_next[s];
+    else
+        m_head = m_next[s];
+    if (m_next[s] != NoSlot)
+        m_prev[m_next[s]] = m_prev[s];
+    else
+        m_tail = m_prev[s];
+    m_prev[s] = m_next[s] = NoSlot;
+}
+
+void History::ReleaseItems(const std::vector<HistItem>& items)
+{
+    for (const HistItem& i : items)
+        m_payloads.Release(i.payload);
+}
+
+size_t History::ExclusiveBytes(const HistId id) const
+{
+    size_t bytes = 0;
+    for (const HistItem& e : Items(id))
+        if (m_payloads.RefCount(e.payload) == 1)
+            bytes += m_payloads.StoredSize(e.payload);
+    return bytes;
+}
+
+// Entries that have been idle the longest are the most expensive to keep.
+// Size only counts when the byte budget is exceeded.
+double History::EvictionScore(const HistId id, const uint64_t now, const bool bytes) const
+{
+    const size_t EntryOverhead = 256;
+    const uint64_t accessed = Accessed(id);
+    const uint64_t idle = now > accessed ? now - accessed : 0;
+    const size_t size = bytes ? ExclusiveBytes(id) + EntryOverhead : EntryOverhead;
+    return double(size) * (1.0 + double(idle) / double(m_budget.idleHalfLife));
+}
+
+// Bytes still stored once every entry but the front one is erased.
+size_t History::FrontBytes() const
+{
+    size_t bytes = 0;
+    if (m_head == NoSlot)
+        return bytes;
+    const std::vector<HistItem>& items = m_items[m_head];
+    for (auto i = items.begin(); i != items.end(); ++i)
+        if (std::find_if(items.begin(), i, [i](const HistItem& o) { return o.payload == i->payload; }) == i)
+            bytes += m_payloads.StoredSize(i->payload);
+    return bytes;
+}
+
+void History::Evict(const uint64_t now)
+{
+    // Only the least recent entries are scored so eviction doesn't depend on the length of the history
+    const int EvictionSample = 32;
+
+    // The front entry is the current clipboard and is never evicted.
+    while (m_count > 1)
+    {
+        const bool entries = m_count > m_budget.maxEntries;
+        const bool bytes = m_payloads.StoredBytes() > m_budget.maxBytes;
+        if (!entries && !bytes)
+            break;
+        // Don't empty the history for a byte budget it can't get under
+        if (!entries && FrontBytes() > m_budget.maxBytes)
+            break;
+        uint32_t worst = NoSlot;
+        double worstScore = 0;
+        int n = 0;
+        for (uint32_t s = m_tail; s != m_head && n < EvictionSample; s = m_prev[s], ++n)
+        {
+            const double score = EvictionScore(m_ids[s], now, bytes);
+            if (worst == NoSlot || score > worstScore)
+            {
+                worst = s;
+                worstScore = score;
+            }
+        }
+        Erase(m_ids[worst]);
+        ++m_evicted;
+    }
+}
@@ -0,0 +1,167 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <iterator>
+#include <unordered_map>
+#include <vector>
+
+#include "PayloadStore.h"
+
+struct HistItem
+{
+    uint32_t uFormat;
+    PayloadId payload;
+};
+
+// Stable id of a history entry, never reused.
+typedef uint64_t HistId;
+const HistId InvalidHist = 0;
+const uint32_t InvalidSummary = UINT32_MAX;
+
+struct HistBudget
+{
+    size_t maxBytes = 256 * 1024 * 1024;
+    size_t maxEntries = 1000;
+    uint64_t idleHalfLife = 60 * 60 * 1000;   // ms
+};
+
+// Wall clock time in ms, entry times are persisted.
+inline uint64_t HistNow()
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+// Formats above 30 share the top bit.
+inline uint32_t FormatBit(uint32_t uFormat)
+{
+    return uint32_t(1) << (uFormat < 31 ? uFormat : 31);
+}
+
+class History;
+
+class HistoryListener
+{
+public:
+    virtual ~HistoryListener() = default;
+    virtual void OnAdd(const History& h, HistId id) = 0;
+    // Moved to the front or accessed.
+    virtual void OnTouch(const History& h, HistId id) = 0;
+    // Called before the payloads are released.
+    virtual void OnErase(const History& h, HistId id) = 0;
+};
+
+// Clipboard history, most recent first.
+// Entries live in slots with their metadata kept in separate arrays, and are
+// linked in recency order. Add, Erase, Touch and lookup by id are O(1).
+// Entries own a reference to each of their payloads.
+class History
+{
+public:
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef HistId value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const HistId* pointer;
+        typedef HistId reference;
+
+        const_iterator(const History* h, uint32_t slot) : m_h(h), m_slot(slot) { }
+        HistId operator*() const { return m_h->m_ids[m_slot]; }
+        const_iterator& operator++() { m_slot = m_h->m_next[m_slot]; return *this; }
+        bool operator==(const const_iterator& o) const { return m_slot == o.m_slot; }
+        bool operator!=(const const_iterator& o) const { return m_slot != o.m_slot; }
+
+    private:
+        const History* m_h;
+        uint32_t m_slot;
+    };
+
+    explicit History(PayloadStore& payloads)
+        : m_payloads(payloads)
+    {
+    }
+    History(const History&) = delete;
+    History& operator=(const History&) = delete;
+    ~History();
+
+    // Takes ownership of the payload references in items.
+    // If an identical entry already exists it is moved to the front instead and its id returned.
+    HistId Add(std::vector<HistItem> items, uint64_t now);
+    // Adds a previously saved entry to the front.
+    HistId Restore(std::vector<HistItem> items, uint64_t created, uint64_t accessed, uint64_t now);
+    // Marks the entry as accessed and moves it to the front.
+    // Touch and Erase ignore ids of entries that are no longer in the history.
+    void Touch(HistId id, uint64_t now);
+    void Erase(HistId id);
+    void Clear();
+
+    void SetBudget(const HistBudget& budget, uint64_t now) { m_budget = budget; Evict(now); }
+    const HistBudget& Budget() const { return m_budget; }
+    // Bytes that would be freed by erasing the entry.
+    size_t ExclusiveBytes(HistId id) const;
+    size_t EvictedCount() const { return m_evicted; }
+
+    size_t size() const { return m_count; }
+    bool empty() const { return m_count == 0; }
+    const_iterator begin() const { return const_iterator(this, m_head); }
+    const_iterator end() const { return const_iterator(this, NoSlot); }
+    HistId Front() const { return m_head != NoSlot ? m_ids[m_head] : InvalidHist; }
+    HistId Back() const { return m_tail != NoSlot ? m_ids[m_tail] : InvalidHist; }
+    HistId Next(HistId id) const { const uint32_t s = m_next[Slot(id)]; return s != NoSlot ? m_ids[s] : InvalidHist; }
+    HistId Prev(HistId id) const { const uint32_t s = m_prev[Slot(id)]; return s != NoSlot ? m_ids[s] : InvalidHist; }
+
+    bool Contains(HistId id) const { const size_t s = size_t(id & SlotMask); return id != InvalidHist && s < m_ids.size() && m_ids[s] == id; }
+    uint64_t Key(HistId id) const { return m_keys[Slot(id)]; }
+    uint64_t Created(HistId id) const { return m_created[Slot(id)]; }
+    uint64_t Accessed(HistId id) const { return m_accessed[Slot(id)]; }
+    uint32_t FormatMask(HistId id) const { return m_formatMask[Slot(id)]; }
+    uint64_t TotalBytes(HistId id) const { return m_totalBytes[Slot(id)]; }
+    uint32_t Summary(HistId id) const { return m_summary[Slot(id)]; }
+    void SetSummary(HistId id, uint32_t summary) { m_summary[Slot(id)] = summary; }
+    const std::vector<HistItem>& Items(HistId id) const { return m_items[Slot(id)]; }
+
+    const PayloadStore& Payloads() const { return m_payloads; }
+
+    void AddListener(HistoryListener* listener) { m_listeners.push_back(listener); }
+    void RemoveListener(HistoryListener* listener);
+
+    static uint64_t EntryKey(const PayloadStore& payloads, const std::vector<HistItem>& items);
+
+private:
+    static const uint32_t NoSlot = UINT32_MAX;
+    static const uint64_t SlotMask = 0xFFFFFFFF;
+
+    uint32_t Slot(HistId id) const { return uint32_t(id & SlotMask); }
+    void Link(uint32_t s);
+    void Unlink(uint32_t s);
+    void ReleaseItems(const std::vector<HistItem>& items);
+    double EvictionScore(HistId id, uint64_t now, bool bytes) const;
+    size_t FrontBytes() const;
+    void Evict(uint64_t now);
+
+    PayloadStore& m_payloads;
+
+    std::vector<HistId> m_ids;          // InvalidHist when the slot is free
+    std::vector<uint64_t> m_keys;
+    std::vector<uint64_t> m_created;    // ms
+    std::vector<uint64_t> m_accessed;   // ms
+    std::vector<uint32_t> m_formatMask;
+    std::vector<uint64_t> m_totalBytes;
+    std::vector<uint32_t> m_summary;
+    std::vector<uint32_t> m_prev;
+    std::vector<uint32_t> m_next;
+    std::vector<std::vector<HistItem>> m_items;
+
+    std::vector<uint32_t> m_free;
+    std::unordered_map<uint64_t, uint32_t> m_byKey;
+    uint32_t m_head = NoSlot;
+    uint32_t m_tail = NoSlot;
+    size_t m_count = 0;
+    uint32_t m_serial = 0;
+
+    std::vector<HistoryListener*> m_listeners;
+    HistBudget m_budget;
+    size_t m_evicted = 0;
+};
@@ -0,0 +1,581 @@
+#include "Journal.h"
+#include <algorithm>
+#include <cstring>
+
+#include "Rad/Hash.h"
+#include "Rad/Lz4.h"
+
+namespace
+{
+    const char FileMagic[8] = { 'R', 'C', 'L', 'I', 'P', 'J', '0', '1' };
+    const uint32_t RecordMagic = 0x524A4352;    // RCJR
+    const size_t HeaderSize = 16;               // magic, type, codec, reserved, body size, check
+    const size_t PayloadMetaSize = 16;          // hash, size
+    const size_t EntryMetaSize = 28;            // key, created, accessed, count
+    const size_t EntryItemSize = 12;            // format, hash
+    const PathString::value_type TmpExt[] = { '.', 't', 'm', 'p', '\0' };
+
+    enum RecordType : uint8_t
+    {
+        RecPayload = 1,
+        RecEntry = 2,
+        RecRemove = 3,
+    };
+
+    enum Codec : uint8_t
+    {
+        CodecRaw = 0,
+        CodecLz4 = 1,
+    };
+
+    inline void Put32(std::vector<uint8_t>& v, uint32_t x) { const size_t o = v.size(); v.resize(o + sizeof(x)); memcpy(v.data() + o, &x, sizeof(x)); }
+    inline void Put64(std::vector<uint8_t>& v, uint64_t x) { const size_t o = v.size(); v.resize(o + sizeof(x)); memcpy(v.data() + o, &x, sizeof(x)); }
+    inline uint32_t Get32(const uint8_t* p) { uint32_t x; memcpy(&x, p, sizeof(x)); return x; }
+    inline uint64_t Get64(const uint8_t* p) { uint64_t x; memcpy(&x, p, sizeof(x)); return x; }
+
+    inline uint32_t Check(uint8_t type, uint8_t codec, uint32_t bodySize, const uint8_t* meta, size_t metaSize)
+    {
+        return uint32_t(HashBytes(meta, metaSize, (uint64_t(type) << 40) | (uint64_t(codec) << 32) | bodySize));
+    }
+
+    std::vector<uint8_t> EntryMeta(uint64_t key, uint64_t created, uint64_t accessed, const std::vector<std::pair<uint32_t, uint64_t>>& items)
+    {
+        std::vector<uint8_t> meta;
+        meta.reserve(EntryMetaSize + items.size() * EntryItemSize);
+        Put64(meta, key);
+        Put64(meta, created);
+        Put64(meta, accessed);
+        Put32(meta, uint32_t(items.size()));
+        for (const auto& i : items)
+        {
+            Put32(meta, i.first);
+            Put64(meta, i.second);
+        }
+        return meta;
+    }
+}
+
+Journal::Journal(PayloadStore& payloads)
+    : m_payloads(payloads)
+    , m_thread(&Journal::Run, this)
+{
+}
+
+Journal::~Journal()
+{
+    Close();
+    {
+        std::lock_guard<std::mutex> lock(m_queueMutex);
+        m_stop = true;
+    }
+    m_queueCv.notify_all();
+    m_thread.join();
+}
+
+bool Journal::Open(const PathString& path)
+{
+    Close();
+    m_path = path;
+    m_map.Open(m_path);
+    Scan();
+
+    if (m_map.size() == 0)
+    {
+        FILE* fp = FileOpen(m_path, "wb");
+        if (fp == nullptr)
+            return false;
+        const bool ok = fwrite(FileMagic, sizeof(FileMagic), 1, fp) == 1;
+        fclose(fp);
+        if (!ok)
+            return false;
+        m_fileSize = sizeof(FileMagic);
+    }
+    else if (m_corrupt || m_garbage > m_fileSize / 2)
+    {
+        // Unless it was corrupt, the old file is still usable if compacting failed
+        if (!m_corrupt)
+            m_file = FileOpen(m_path, "ab");
+        return Compact() || m_file != nullptr;
+    }
+
+    m_file = FileOpen(m_path, "ab");
+    return m_file != nullptr;
+}
+
+void Journal::Close()
+{
+    Flush();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_file != nullptr)
+    {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+    m_map.Close();
+    m_records.clear();
+    m_entries.clear();
+    m_fileSize = 0;
+    m_garbage = 0;
+}
+
+void Journal::Scan()
+{
+    m_records.clear();
+    m_entries.clear();
+    m_corrupt = false;
+    m_fileSize = 0;
+    m_garbage = 0;
+
+    const uint8_t* const data = m_map.data();
+    const size_t size = m_map.size();
+    if (size < sizeof(FileMagic) || memcmp(data, FileMagic, sizeof(FileMagic)) != 0)
+    {
+        m_corrupt = size != 0;
+        return;
+    }
+
+    size_t pos = sizeof(FileMagic);
+    while (pos + HeaderSize <= size)
+    {
+        const uint8_t* const h = data + pos;
+        const uint8_t type = h[4];
+        const uint8_t codec = h[5];
+        const uint32_t bodySize = Get32(h + 8);
+        if (Get32(h) != RecordMagic || bodySize > size - pos - HeaderSize)
+            break;
+
+        const uint8_t* const body = h + HeaderSize;
+        const size_t metaSize = type == RecPayload ? PayloadMetaSize : bodySize;
+        if (metaSize > bodySize || Get32(h + 12) != Check(type, codec, bodySize, body, metaSize))
+            break;
+
+        bool valid = true;
+        switch (type)
+        {
+        case RecPayload:
+            m_records[Get64(body)] = { pos, bodySize, codec, Get64(body + 8), 0 };
+            break;
+
+        case RecEntry:
+        {
+            const uint32_t count = bodySize >= EntryMetaSize ? Get32(body + 24) : 0;
+            if (bodySize != EntryMetaSize + size_t(count) * EntryItemSize)
+            {
+                valid = false;
+                break;
+            }
+            EntryRecord& r = m_entries[Get64(body)];
+            r.offset = pos;
+            r.bodySize = bodySize;
+            r.created = Get64(body + 8);
+            r.accessed = Get64(body + 16);
+            r.items.clear();
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                const uint8_t* const item = body + EntryMetaSize + i * EntryItemSize;
+                r.items.push_back({ Get32(item), Get64(item + 4) });
+            }
+            break;
+        }
+
+        case RecRemove:
+            if (bodySize == 8)
+                m_entries.erase(Get64(body));
+            else
+                valid = false;
+            break;
+
+        default:
+            valid = false;
+            break;
+        }
+        if (!valid)
+            break;
+
+        pos += HeaderSize + bodySize;
+    }
+    m_corrupt = pos != size;
+    m_fileSize = pos;
+
+    uint64_t live = sizeof(FileMagic);
+    for (const auto& e : m_entries)
+    {
+        live += HeaderSize + e.second.bodySize;
+        for (const auto& i : e.second.items)
+        {
+            const auto it = m_records.find(i.second);
+            if (it != m_records.end())
+                ++it->second.refs;
+        }
+    }
+    for (auto it = m_records.begin(); it != m_records.end();)
+    {
+        if (it->second.refs == 0)
+            it = m_records.erase(it);
+        else
+        {
+            live += HeaderSize + it->second.bodySize;
+            ++it;
+        }
+    }
+    m_garbage = m_fileSize - live;
+}
+
+void Journal::Load(History& history, const uint64_t now)
+{
+    std::vector<std::pair<uint64_t, const EntryRecord*>> entries;
+    for (const auto& e : m_entries)
+        entries.push_back({ e.first, &e.second });
+    std::sort(entries.begin(), entries.end(), [](const std::pair<uint64_t, const EntryRecord*>& a, const std::pair<uint64_t, const EntryRecord*>& b) { return a.second->offset < b.second->offset; });
+
+    m_loading = true;
+    for (const auto& e : entries)
+    {
+        const EntryRecord& r = *e.second;
+        const bool complete = std::all_of(r.items.begin(), r.items.end(), [this](const std::pair<uint32_t, uint64_t>& i) { return m_records.count(i.second) > 0; });
+        if (!complete || r.items.empty())
+            continue;
+
+        std::vector<HistItem> items;
+        for (const auto& i : r.items)
+            items.push_back({ i.first, m_payloads.AddSource(i.second, size_t(m_records[i.second].size), this) });
+        history.Restore(std::move(items), r.created, r.accessed, now);
+    }
+    m_loading = false;
+}
+
+uint64_t Journal::Append(FILE* fp, uint64_t& fileSize, const uint8_t type, const uint8_t codec, const std::vector<uint8_t>& meta, const uint8_t* data, const size_t size)
+{
+    const uint32_t bodySize = uint32_t(meta.size() + size);
+    std::vector<uint8_t> header;
+    Put32(header, RecordMagic);
+    header.push_back(type);
+    header.push_back(codec);
+    header.push_back(0);
+    header.push_back(0);
+    Put32(header, bodySize);
+    Put32(header, Check(type, codec, bodySize, meta.data(), meta.size()));
+
+    const uint64_t offset = fileSize;
+    fwrite(header.data(), header.size(), 1, fp);
+    fwrite(meta.data(), meta.size(), 1, fp);
+    if (size > 0)
+        fwrite(data, size, 1, fp);
+    fileSize += HeaderSize + bodySize;
+    return offset;
+}
+
+void Journal::WriteEntry(const uint64_t key, const EntryRecord& r)
+{
+    EntryRecord& n = m_entries[key];
+    if (n.bodySize != 0)
+        m_garbage += HeaderSize + n.bodySize;
+    n = r;
+    const std::vector<uint8_t> meta = EntryMeta(key, n.created, n.accessed, n.items);
+    n.bodySize = uint32_t(meta.size());
+    n.offset = Append(m_file, m_fileSize, RecEntry, CodecRaw, meta, nullptr, 0);
+}
+
+// The entry is written with its payloads if it isn't in the file yet, otherwise only its access
+// time is updated. Its payloads are held by the job until they are written.
+void Journal::OnAdd(const History& h, const HistId id)
+{
+    if (m_loading)
+        return;
+
+    WriteJob job = { false, h.Key(id), h.Created(id), h.Accessed(id), {} };
+    for (const HistItem& i : h.Items(id))
+        job.items.push_back({ i.uFormat, m_payloads.Ref(i.payload) });
+    Queue(std::move(job));
+}
+
+void Journal::OnTouch(const History& h, const HistId id)
+{
+    OnAdd(h, id);
+}
+
+void Journal::OnErase(const History& h, const HistId id)
+{
+    Queue({ true, h.Key(id), 0, 0, {} });
+}
+
+void Journal::Queue(WriteJob job)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_queueMutex);
+        m_pending.push_back(std::move(job));
+    }
+    m_queueCv.notify_one();
+}
+
+void Journal::Flush()
+{
+    std::unique_lock<std::mutex> lock(m_queueMutex);
+    m_idleCv.wait(lock, [this] { return m_pending.empty() && !m_writing; });
+}
+
+void Journal::Run()
+{
+    std::unique_lock<std::mutex> lock(m_queueMutex);
+    while (true)
+    {
+        m_queueCv.wait(lock, [this] { return m_stop || !m_pending.empty(); });
+        if (m_pending.empty())
+            break;
+
+        std::deque<WriteJob> jobs;
+        jobs.swap(m_pending);
+        m_writing = true;
+        lock.unlock();
+
+        for (const WriteJob& j : jobs)
+            Write(j);
+        {
+            std::lock_guard<std::mutex> fileLock(m_mutex);
+            if (m_file != nullptr && fflush(m_file) != 0)
+                ++m_errors;
+        }
+        // Releases the payloads before the next batch
+        jobs.clear();
+
+        lock.lock();
+        m_writing = false;
+        m_idleCv.notify_all();
+    }
+}
+
+void Journal::Write(const WriteJob& job)
+{
+    if (job.remove)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_file != nullptr)
+            Remove(job.key);
+        return;
+    }
+
+    std::vector<const PayloadRef*> missing;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_file == nullptr)
+            return;
+        const auto it = m_entries.find(job.key);
+        if (it != m_entries.end())
+        {
+            EntryRecord r = it->second;
+            r.accessed = job.accessed;
+            WriteEntry(job.key, r);
+            return;
+        }
+        for (const auto& i : job.items)
+        {
+            if (m_records.count(i.second.hash) == 0)
+                missing.push_back(&i.second);
+        }
+    }
+
+    // Read and compressed without the lock so Read isn't held up
+    struct Staged
+    {
+        const uint8_t* data;
+        std::vector<uint8_t> scratch;
+        std::vector<uint8_t> packed;
+    };
+    std::vector<Staged> staged(missing.size());
+    for (size_t n = 0; n < missing.size(); ++n)
+    {
+        const PayloadRef& p = *missing[n];
+        Staged& s = staged[n];
+        s.data = p.Read(p.size, s.scratch);
+        if (s.data == nullptr)
+        {
+            ++m_errors;
+            return;
+        }
+        Lz4Compress(s.data, p.size, s.packed);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_file == nullptr)
+        return;
+    for (size_t n = 0; n < missing.size(); ++n)
+    {
+        const PayloadRef& p = *missing[n];
+        if (m_records.count(p.hash) != 0)
+            continue;
+        const Staged& s = staged[n];
+        const uint8_t codec = s.packed.size() < p.size - p.size / 8 ? CodecLz4 : CodecRaw;
+        std::vector<uint8_t> meta;
+        Put64(meta, p.hash);
+        Put64(meta, p.size);
+        const uint64_t offset = codec == CodecLz4
+            ? Append(m_file, m_fileSize, RecPayload, codec, meta, s.packed.data(), s.packed.size())
+            : Append(m_file, m_fileSize, RecPayload, codec, meta, s.data, p.size);
+        m_records.insert({ p.hash, { offset, uint32_t(m_fileSize - offset - HeaderSize), codec, p.size, 0 } });
+    }
+
+    EntryRecord r = {};
+    r.created = job.created;
+    r.accessed = job.accessed;
+    for (const auto& i : job.items)
+    {
+        r.items.push_back({ i.first, i.second.hash });
+        ++m_records[i.second.hash].refs;
+    }
+    WriteEntry(job.key, r);
+}
+
+void Journal::Remove(const uint64_t key)
+{
+    const auto it = m_entries.find(key);
+    if (it == m_entries.end())
+        return;
+
+    for (const auto& i : it->second.items)
+    {
+        const auto rit = m_records.find(i.second);
+        if (rit != m_records.end() && --rit->second.refs == 0)
+        {
+            m_garbage += HeaderSize + rit->second.bodySize;
+            m_records.erase(rit);
+        }
+    }
+    m_garbage += HeaderSize + it->second.bodySize;
+    m_entries.erase(it);
+
+    std::vector<uint8_t> meta;
+    Put64(meta, key);
+    Append(m_file, m_fileSize, RecRemove, CodecRaw, meta, nullptr, 0);
+    m_garbage += HeaderSize + meta.size();
+
+    CompactIfNeeded();
+}
+
+void Journal::CompactIfNeeded()
+{
+    const uint64_t MinGarbage = 4 * 1024 * 1024;
+    if (m_garbage > MinGarbage && m_garbage > m_fileSize / 2)
+        CompactLocked();
+}
+
+bool Journal::Compact()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return CompactLocked();
+}
+
+// The old file stays open for appending until the new one has replaced it.
+bool Journal::CompactLocked()
+{
+    if (m_file != nullptr)
+        fflush(m_file);
+    m_map.Open(m_path);
+
+    PathString tmp = m_path + TmpExt;
+    FILE* fp = FileOpen(tmp, "wb");
+    if (fp == nullptr)
+    {
+        ++m_errors;
+        return false;
+    }
+
+    uint64_t fileSize = sizeof(FileMagic);
+    fwrite(FileMagic, sizeof(FileMagic), 1, fp);
+
+    std::unordered_map<uint64_t, PayloadRecord> records;
+    for (const auto& r : m_records)
+    {
+        if (r.second.offset + HeaderSize + r.second.bodySize > m_map.size())
+            continue;
+        const uint8_t* const body = m_map.data() + r.second.offset + HeaderSize;
+        const std::vector<uint8_t> meta(body, body + PayloadMetaSize);
+        PayloadRecord n = r.second;
+        n.offset = Append(fp, fileSize, RecPayload, r.second.codec, meta, body + PayloadMetaSize, r.second.bodySize - PayloadMetaSize);
+        records.insert({ r.first, n });
+    }
+
+    std::vector<std::pair<uint64_t, EntryRecord*>> entries;
+    for (auto& e : m_entries)
+        entries.push_back({ e.first, &e.second });
+    std::sort(entries.begin(), entries.end(), [](const std::pair<uint64_t, EntryRecord*>& a, const std::pair<uint64_t, EntryRecord*>& b) { return a.second->offset < b.second->offset; });
+    std::vector<uint64_t> offsets;
+    for (const auto& e : entries)
+    {
+        const std::vector<uint8_t> meta = EntryMeta(e.first, e.second->created, e.second->accessed, e.second->items);
+        offsets.push_back(Append(fp, fileSize, RecEntry, CodecRaw, meta, nullptr, 0));
+    }
+
+    const bool ok = fflush(fp) == 0 && ferror(fp) == 0;
+    fclose(fp);
+    if (!ok)
+    {
+        ++m_errors;
+        return false;
+    }
+
+    // Windows can't replace a file that is open or mapped
+    if (m_file != nullptr)
+    {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+    m_map.Close();
+    const bool renamed = FileRename(tmp, m_path);
+    if (renamed)
+    {
+        for (size_t i = 0; i < entries.size(); ++i)
+            entries[i].second->offset = offsets[i];
+        m_records.swap(records);
+        m_fileSize = fileSize;
+        m_garbage = 0;
+        m_corrupt = false;
+    }
+    m_map.Open(m_path);
+
+    // Appending after a corrupt tail would lose the new records
+    if (!m_corrupt)
+        m_file = FileOpen(m_path, "ab");
+    if (!renamed || m_file == nullptr)
+    {
+        ++m_errors;
+        return false;
+    }
+    return true;
+}
+
+bool Journal::Read(const uint64_t hash, uint8_t* dst, const size_t size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto it = m_records.find(hash);
+    if (it == m_records.end())
+        return false;
+
+    const PayloadRecord& r = it->second;
+    const uint64_t end = r.offset + HeaderSize + r.bodySize;
+    if (end > m_map.size())
+    {
+        // Appended since the file was mapped
+        if (m_file != nullptr)
+            fflush(m_file);
+        if (!m_map.Open(m_path) || end > m_map.size())
+            return false;
+    }
+
+    const uint8_t* const data = m_map.data() + r.offset + HeaderSize + PayloadMetaSize;
+    const size_t stored = r.bodySize - PayloadMetaSize;
+    if (size > r.size)
+        return false;
+    switch (r.codec)
+    {
+    case CodecRaw:
+        memcpy(dst, data, size);
+        break;
+    case CodecLz4:
+        if (Lz4Decompress(data, stored, dst, size) != size)
+            return false;
+        break;
+    default:
+        return false;
+    }
+    return size != r.size || HashBytes(dst, size) == hash;
+}
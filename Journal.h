@@ -0,0 +1,109 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "History.h"
+#include "Rad/MappedFile.h"
+
+// Append only file of history entries and their payloads.
+// Only the record headers are read on Open, payloads are read from the
+// mapped file when the PayloadStore needs them. Read may be called from any thread.
+// Changes to the history are written and flushed in batches on a background thread.
+class Journal : public HistoryListener, public PayloadSource
+{
+public:
+    explicit Journal(PayloadStore& payloads);
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+    ~Journal();
+
+    // Drops a torn or corrupt tail by compacting.
+    bool Open(const PathString& path);
+    void Close();
+    // Waits for the changes so far to be written.
+    void Flush();
+    // Restores the saved entries, oldest first.
+    void Load(History& history, uint64_t now);
+    // Rewrites the file with only the live records.
+    bool Compact();
+
+    size_t FileSize() const { std::lock_guard<std::mutex> lock(m_mutex); return size_t(m_fileSize); }
+    size_t GarbageSize() const { std::lock_guard<std::mutex> lock(m_mutex); return size_t(m_garbage); }
+    // Writes and compactions that failed.
+    size_t Errors() const { return m_errors; }
+
+    // HistoryListener
+    void OnAdd(const History& h, HistId id) override;
+    void OnTouch(const History& h, HistId id) override;
+    void OnErase(const History& h, HistId id) override;
+
+    // PayloadSource
+    bool Read(uint64_t hash, uint8_t* dst, size_t size) override;
+
+private:
+    struct PayloadRecord
+    {
+        uint64_t offset;
+        uint32_t bodySize;
+        uint8_t codec;
+        uint64_t size;
+        uint32_t refs;
+    };
+
+    struct EntryRecord
+    {
+        uint64_t offset;
+        uint32_t bodySize;
+        uint64_t created;
+        uint64_t accessed;
+        std::vector<std::pair<uint32_t, uint64_t>> items;  // format, payload hash
+    };
+
+    struct WriteJob
+    {
+        bool remove;
+        uint64_t key;
+        uint64_t created;
+        uint64_t accessed;
+        std::vector<std::pair<uint32_t, PayloadRef>> items;
+    };
+
+    void Run();
+    void Queue(WriteJob job);
+    void Write(const WriteJob& job);
+    void Remove(uint64_t key);
+    void Scan();
+    void WriteEntry(uint64_t key, const EntryRecord& r);
+    uint64_t Append(FILE* fp, uint64_t& fileSize, uint8_t type, uint8_t codec, const std::vector<uint8_t>& meta, const uint8_t* data, size_t size);
+    void CompactIfNeeded();
+    bool CompactLocked();
+
+    PayloadStore& m_payloads;
+    PathString m_path;
+    MappedFile m_map;
+    FILE* m_file = nullptr;
+    uint64_t m_fileSize = 0;
+    uint64_t m_garbage = 0;
+    bool m_corrupt = false;
+    bool m_loading = false;
+    mutable std::mutex m_mutex;     // Read against changes to the records and the mapping
+    std::unordered_map<uint64_t, PayloadRecord> m_records;
+    std::unordered_map<uint64_t, EntryRecord> m_entries;
+    std::atomic<size_t> m_errors{ 0 };
+
+    std::mutex m_queueMutex;
+    std::condition_variable m_queueCv;
+    std::condition_variable m_idleCv;
+    std::deque<WriteJob> m_pending;
+    bool m_writing = false;
+    bool m_stop = false;
+    std::thread m_thread;
+};
@@ -0,0 +1,260 @@
+#include "PayloadStore.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "Rad/Hash.h"
+#include "Rad/Lz4.h"
+
+PayloadId PayloadStore::Find(const uint64_t hash, const void* data, const size_t size) const
+{
+    std::vector<uint8_t> scratch;
+    const auto range = m_index.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (Size(it->second) != size)
+            continue;
+        const uint8_t* const stored = size != 0 ? Peek(it->second, size, scratch) : nullptr;
+        if (size == 0 || (stored != nullptr && memcmp(stored, data, size) == 0))
+            return it->second;
+    }
+    return InvalidPayload;
+}
+
+void PayloadStore::AddStored(const size_t size)
+{
+    m_storedBytes += size;
+    if (m_storedBytes > m_peakBytes)
+        m_peakBytes = m_storedBytes;
+}
+
+// The control block is allocated from the arena too so a payload costs no heap allocations.
+PayloadBytes PayloadStore::NewBlock(const size_t size)
+{
+    return std::allocate_shared<PayloadBlock>(ArenaAllocator<PayloadBlock>(m_arena), m_arena, size);
+}
+
+PayloadId PayloadStore::NewSlot(const uint64_t hash, const size_t size)
+{
+    PayloadId id;
+    if (!m_free.empty())
+    {
+        id = m_free.back();
+        m_free.pop_back();
+    }
+    else
+    {
+        id = PayloadId(m_slots.size());
+        m_slots.push_back({});
+    }
+
+    Slot& s = m_slots[id];
+    s.hash = hash;
+    s.refs = 1;
+    s.incompressible = false;
+    s.size = size;
+    s.source = nullptr;
+    m_index.insert({ hash, id });
+    m_logicalBytes += size;
+    return id;
+}
+
+PayloadId PayloadStore::Add(const void* data, const size_t size)
+{
+    const uint64_t hash = HashBytes(data, size);
+    PayloadId id = Find(hash, data, size);
+    if (id != InvalidPayload)
+    {
+        AddRef(id);
+        return id;
+    }
+
+    id = NewSlot(hash, size);
+    PayloadBytes raw = NewBlock(size);
+    if (size > 0)
+        memcpy(raw->data(), data, size);
+    m_slots[id].raw = std::move(raw);
+    AddStored(size);
+    return id;
+}
+
+PayloadBytes PayloadStore::Stage(const void* const data, const size_t size)
+{
+    PayloadBytes raw = NewBlock(size);
+    if (size > 0)
+        memcpy(raw->data(), data, size);
+    return raw;
+}
+
+PayloadId PayloadStore::AddStaged(const uint64_t hash, const PayloadBytes& raw)
+{
+    PayloadId id = Find(hash, raw->data(), raw->size());
+    if (id != InvalidPayload)
+    {
+        AddRef(id);
+        return id;
+    }
+
+    id = NewSlot(hash, raw->size());
+    m_slots[id].raw = raw;
+    AddStored(raw->size());
+    return id;
+}
+
+PayloadId PayloadStore::AddSource(const uint64_t hash, const size_t size, PayloadSource* source)
+{
+    // Trust the hash rather than reading the payload to compare
+    const auto range = m_index.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (Size(it->second) == size)
+        {
+            AddRef(it->second);
+            return it->second;
+        }
+    }
+
+    const PayloadId id = NewSlot(hash, size);
+    m_slots[id].source = source;
+    return id;
+}
+
+void PayloadStore::AddRef(const PayloadId id)
+{
+    Slot& s = m_slots[id];
+    assert(s.refs > 0);
+    ++s.refs;
+    m_logicalBytes += s.size;
+}
+
+void PayloadStore::Release(const PayloadId id)
+{
+    Slot& s = m_slots[id];
+    assert(s.refs > 0);
+    m_logicalBytes -= s.size;
+    if (--s.refs > 0)
+        return;
+
+    const auto range = m_index.equal_range(s.hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (it->second == id)
+        {
+            m_index.erase(it);
+            break;
+        }
+    }
+    if (s.raw)
+        m_storedBytes -= s.size;
+    else if (s.source == nullptr)
+    {
+        m_storedBytes -= s.packed->size();
+        --m_coldCount;
+    }
+    s.raw.reset();
+    s.source = nullptr;
+    s.packed.reset();
+    m_free.push_back(id);
+}
+
+const uint8_t* PayloadStore::Data(const PayloadId id)
+{
+    Slot& s = m_slots[id];
+    if (!s.raw && s.source != nullptr)
+    {
+        PayloadBytes raw = NewBlock(s.size);
+        if (!s.source->Read(s.hash, raw->data(), raw->size()) && s.size > 0)
+            return nullptr;
+        s.raw = std::move(raw);
+        s.source = nullptr;
+        AddStored(s.size);
+    }
+    else if (!s.raw)
+    {
+        PayloadBytes raw = NewBlock(s.size);
+        if (Lz4Decompress(s.packed->data(), s.packed->size(), raw->data(), raw->size()) != s.size)
+            return nullptr;
+        m_storedBytes -= s.packed->size();
+        AddStored(s.size);
+        --m_coldCount;
+        s.raw = std::move(raw);
+        s.packed.reset();
+    }
+    return s.raw->data();
+}
+
+const uint8_t* PayloadRef::Read(size_t n, std::vector<uint8_t>& scratch) const
+{
+    if (raw)
+        return raw->data();
+
+    n = std::min(n, size);
+    scratch.resize(n);
+    if (source != nullptr)
+        return source->Read(hash, scratch.data(), n) || n == 0 ? scratch.data() : nullptr;
+    return Lz4Decompress(packed->data(), packed->size(), scratch.data(), n) == n ? scratch.data() : nullptr;
+}
+
+size_t PayloadStore::StoredSize(const PayloadId id) const
+{
+    const Slot& s = m_slots[id];
+    if (s.raw)
+        return s.size;
+    return s.source == nullptr ? s.packed->size() : 0;
+}
+
+PayloadRef PayloadStore::Ref(const PayloadId id) const
+{
+    const Slot& s = m_slots[id];
+    return { s.hash, s.size, s.raw, s.packed, s.source };
+}
+
+const uint8_t* PayloadStore::Peek(const PayloadId id, const size_t size, std::vector<uint8_t>& scratch) const
+{
+    const Slot& s = m_slots[id];
+    if (s.raw)
+        return s.raw->data();
+    return Ref(id).Read(size, scratch);
+}
+
+void PayloadStore::SetCold(const PayloadId id, const PayloadBytes& raw, std::vector<uint8_t> packed)
+{
+    Slot& s = m_slots[id];
+    if (s.refs == 0 || s.raw != raw)
+        return;
+
+    if (packed.empty())
+    {
+        s.incompressible = true;
+        return;
+    }
+
+    m_storedBytes -= s.size;
+    AddStored(packed.size());
+    ++m_coldCount;
+    s.raw.reset();
+    s.packed = std::make_shared<const std::vector<uint8_t>>(std::move(packed));
+}
+
+size_t PayloadStore::Compact(const size_t maxBytes)
+{
+    size_t moved = 0;
+    for (size_t n = 0; n < m_slots.size() && moved < maxBytes; ++n)
+    {
+        if (m_compactPos >= m_slots.size())
+            m_compactPos = 0;
+        Slot& s = m_slots[m_compactPos++];
+        // Payloads shared with the cold tier worker are left where they are
+        if (s.refs == 0 || !s.raw || s.raw.use_count() > 1)
+            continue;
+
+        void* const dst = m_arena.AllocDenser(s.raw->data(), s.size);
+        if (dst == nullptr)
+            continue;
+        memcpy(dst, s.raw->data(), s.size);
+        s.raw = std::allocate_shared<PayloadBlock>(ArenaAllocator<PayloadBlock>(m_arena), m_arena, static_cast<uint8_t*>(dst), s.size);
+        moved += s.size;
+    }
+    m_arena.Trim();
+    return moved;
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+#include "Rad/Arena.h"
+
+typedef uint32_t PayloadId;
+const PayloadId InvalidPayload = UINT32_MAX;
+
+// Raw payload bytes held in the payload arena.
+class PayloadBlock
+{
+public:
+    PayloadBlock(Arena& arena, size_t size)
+        : m_arena(arena), m_data(static_cast<uint8_t*>(arena.Alloc(size))), m_size(size)
+    {
+    }
+    // Takes ownership of data allocated from arena.
+    PayloadBlock(Arena& arena, uint8_t* data, size_t size)
+        : m_arena(arena), m_data(data), m_size(size)
+    {
+    }
+    PayloadBlock(const PayloadBlock&) = delete;
+    PayloadBlock& operator=(const PayloadBlock&) = delete;
+    ~PayloadBlock() { m_arena.Free(m_data, m_size); }
+
+    uint8_t* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    Arena& m_arena;
+    uint8_t* const m_data;
+    const size_t m_size;
+};
+
+typedef std::shared_ptr<const PayloadBlock> PayloadBytes;
+typedef std::shared_ptr<const std::vector<uint8_t>> PackedBytes;
+
+// Backing storage for payloads that are loaded on demand.
+class PayloadSource
+{
+public:
+    virtual ~PayloadSource() = default;
+    // Reads the first size bytes of the payload.
+    virtual bool Read(uint64_t hash, uint8_t* dst, size_t size) = 0;
+};
+
+// The bytes of a payload in whichever tier they are, readable on any thread.
+struct PayloadRef
+{
+    uint64_t hash;
+    size_t size;
+    PayloadBytes raw;
+    PackedBytes packed;
+    PayloadSource* source;
+
+    // Returns at least the first min(size, this->size) bytes, or null if they can't be read.
+    const uint8_t* Read(size_t size, std::vector<uint8_t>& scratch) const;
+};
+
+// Content addressed store for clipboard payloads.
+// Identical payloads are stored once and reference counted.
+// Payloads are either hot (raw bytes), cold (LZ4 compressed) or left in a PayloadSource.
+class PayloadStore
+{
+public:
+    // Returns a new reference to the payload with this content.
+    PayloadId Add(const void* data, size_t size);
+    // Copies the bytes into a block of the store for AddStaged, so they can be hashed off the
+    // thread that owns the store. Thread safe.
+    PayloadBytes Stage(const void* data, size_t size);
+    // Returns a new reference to the payload with the content of raw, taking the block if it is new.
+    PayloadId AddStaged(uint64_t hash, const PayloadBytes& raw);
+    // Returns a new reference to a payload that is read from source when needed.
+    PayloadId AddSource(uint64_t hash, size_t size, PayloadSource* source);
+    void AddRef(PayloadId id);
+    void Release(PayloadId id);
+
+    // Loads a cold or sourced payload back into the hot tier.
+    // Null if it can't be read, and the payload is left where it was.
+    const uint8_t* Data(PayloadId id);
+    // Returns at least the first min(size, Size(id)) bytes without changing tier, or null.
+    const uint8_t* Peek(PayloadId id, size_t size, std::vector<uint8_t>& scratch) const;
+    // Reading a sourced payload through the ref must be thread safe for the source.
+    PayloadRef Ref(PayloadId id) const;
+    size_t Size(PayloadId id) const { return m_slots[id].size; }
+    // What the payload adds to StoredBytes.
+    size_t StoredSize(PayloadId id) const;
+    uint64_t Hash(PayloadId id) const { return m_slots[id].hash; }
+    uint32_t RefCount(PayloadId id) const { return m_slots[id].refs; }
+
+    bool IsCold(PayloadId id) const { return !m_slots[id].raw; }
+    bool IsSourced(PayloadId id) const { return m_slots[id].source != nullptr; }
+    bool IsIncompressible(PayloadId id) const { return m_slots[id].incompressible; }
+    // Raw bytes of a hot payload, shared so they can be compressed off the UI thread.
+    PayloadBytes Share(PayloadId id) const { return m_slots[id].raw; }
+    // Moves the payload to the cold tier if it still holds raw.
+    // An empty packed marks the payload as not worth compressing.
+    void SetCold(PayloadId id, const PayloadBytes& raw, std::vector<uint8_t> packed);
+    // Moves up to maxBytes of hot payloads out of sparse slabs and frees the empty ones.
+    // Returns the bytes moved.
+    size_t Compact(size_t maxBytes);
+    Arena::Stats ArenaStats() const { return m_arena.GetStats(); }
+
+    size_t Count() const { return m_slots.size() - m_free.size(); }
+    size_t ColdCount() const { return m_coldCount; }
+    // Bytes actually stored.
+    size_t StoredBytes() const { return m_storedBytes; }
+    // Bytes that would be stored without deduplication.
+    size_t LogicalBytes() const { return m_logicalBytes; }
+    // High-water mark of StoredBytes.
+    size_t PeakBytes() const { return m_peakBytes; }
+
+private:
+    struct Slot
+    {
+        uint64_t hash;
+        uint32_t refs;
+        bool incompressible;
+        size_t size;
+        PayloadBytes raw;
+        PackedBytes packed;
+        PayloadSource* source;
+    };
+
+    PayloadId Find(uint64_t hash, const void* data, size_t size) const;
+    PayloadId NewSlot(uint64_t hash, size_t size);
+    void AddStored(size_t size);
+    PayloadBytes NewBlock(size_t size);
+
+    Arena m_arena;
+    std::vector<Slot> m_slots;
+    std::vector<PayloadId> m_free;
+    std::unordered_multimap<uint64_t, PayloadId> m_index;
+    size_t m_coldCount = 0;
+    size_t m_storedBytes = 0;
+    size_t m_logicalBytes = 0;
+    size_t m_peakBytes = 0;
+    PayloadId m_compactPos = 0;
+};
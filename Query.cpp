@@ -0,0 +1,398 @@
+#include "Query.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "ClipboardFormats.h"
+#include "Rad/Glob.h"
+
+namespace
+{
+    const size_t MaxText = 1024 * 1024;
+    // The standard regex engines backtrack recursively, a few hundred bytes of stack per character,
+    // so a regex runs over a line at a time, long lines in overlapping windows, and only over the
+    // start of the text
+    const size_t RegexWindow = 512;
+    const size_t RegexOverlap = 64;
+    const size_t MaxRegexText = 64 * 1024;
+
+    inline char Lower(char c) { return c >= 'A' && c <= 'Z' ? char(c + 'a' - 'A') : c; }
+
+    bool StartsWith(const std::string& s, const char* prefix)
+    {
+        return s.compare(0, strlen(prefix), prefix) == 0;
+    }
+
+    std::vector<std::string> Tokenize(const std::string& text)
+    {
+        std::vector<std::string> tokens;
+        size_t i = 0;
+        while (i < text.size())
+        {
+            while (i < text.size() && text[i] == ' ')
+                ++i;
+            if (i >= text.size())
+                break;
+            std::string t;
+            bool quoted = false;
+            while (i < text.size() && (quoted || text[i] != ' '))
+            {
+                if (text[i] == '"')
+                    quoted = !quoted;
+                else
+                    t += text[i];
+                ++i;
+            }
+            tokens.push_back(t);
+        }
+        return tokens;
+    }
+
+    // Longest run of literal characters every match of a simple regex must contain,
+    // so most entries can be rejected without running the regex.
+    std::string RequiredLiteral(const std::string& re)
+    {
+        if (re.find_first_of("|(") != std::string::npos)
+            return std::string();
+
+        std::string best;
+        std::string run;
+        for (size_t i = 0; i < re.size(); ++i)
+        {
+            char c = re[i];
+            bool literal = false;
+            if (c == '\\' && i + 1 < re.size() && strchr(".^$*+?()[]{}|\\/-", re[i + 1]) != nullptr)
+            {
+                c = re[++i];
+                literal = true;
+            }
+            else if (c == '[')
+            {
+                while (i < re.size() && re[i] != ']')
+                    i += re[i] == '\\' ? 2 : 1;
+            }
+            else if (c == '{')
+            {
+                // The counts of a quantifier aren't part of the text
+                while (i < re.size() && re[i] != '}')
+                    ++i;
+            }
+            else if (c != '\\' && strchr(".^$*+?()[]{}|", c) == nullptr)
+                literal = true;
+            else if (c == '\\')
+                ++i;
+
+            // A quantifier that allows zero repeats makes the character optional
+            const char q = i + 1 < re.size() ? re[i + 1] : '\0';
+            if (literal && q != '?' && q != '*' && q != '{')
+                run += Lower(c);
+            if (!literal || q == '?' || q == '*' || q == '{' || q == '+')
+            {
+                if (run.size() > best.size())
+                    best = run;
+                run.clear();
+            }
+        }
+        if (run.size() > best.size())
+            best = run;
+        return best.size() >= 3 ? best : std::string();
+    }
+
+    bool RegexSearch(const std::string& text, const std::regex& re)
+    {
+        const size_t size = std::min(text.size(), MaxRegexText);
+        size_t start = 0;
+        do
+        {
+            size_t end = text.find('\n', start);
+            const size_t next = end == std::string::npos || end >= size ? size : end;
+            end = next > start && text[next - 1] == '\r' ? next - 1 : next;
+            for (size_t w = start;; w += RegexWindow - RegexOverlap)
+            {
+                const size_t e = std::min(end, w + RegexWindow);
+                auto flags = std::regex_constants::match_default;
+                if (w != start)
+                    flags |= std::regex_constants::match_not_bol;
+                if (e != end)
+                    flags |= std::regex_constants::match_not_eol;
+                if (std::regex_search(text.begin() + w, text.begin() + e, re, flags))
+                    return true;
+                if (e == end)
+                    break;
+            }
+            start = next + 1;
+        } while (start < size);
+        return false;
+    }
+
+    int Cost(int type)
+    {
+        // Text, Regex, Kind, Width, Height, Size, Files, Format
+        static const int Costs[] = { 6, 7, 0, 2, 2, 0, 5, 0 };
+        return Costs[type];
+    }
+
+    bool ImageSize(const QueryEntry& e, uint64_t& width, uint64_t& height, uint64_t& bytes)
+    {
+        for (const QueryItem& i : e.items)
+        {
+            if (!IsImageFormat(i.uFormat))
+                continue;
+            std::vector<uint8_t> scratch;
+            const size_t size = std::min<size_t>(i.payload.size, 12);
+            if (size < 12)
+                continue;
+            const uint8_t* const p = i.payload.Read(size, scratch);
+            if (p == nullptr)
+                continue;
+            bytes += size;
+            uint32_t headerSize;
+            memcpy(&headerSize, p, sizeof(headerSize));
+            if (headerSize == 12)
+            {
+                uint16_t w, h;
+                memcpy(&w, p + 4, sizeof(w));
+                memcpy(&h, p + 6, sizeof(h));
+                width = w;
+                height = h;
+            }
+            else
+            {
+                int32_t w, h;
+                memcpy(&w, p + 4, sizeof(w));
+                memcpy(&h, p + 8, sizeof(h));
+                width = uint64_t(w < 0 ? -int64_t(w) : w);
+                height = uint64_t(h < 0 ? -int64_t(h) : h);
+            }
+            return true;
+        }
+        return false;
+    }
+}
+
+bool Query::Parse(const std::string& text)
+{
+    m_terms.clear();
+    for (const std::string& t : Tokenize(text))
+    {
+        Term term = {};
+        term.type = Type::Text;
+        term.op = Op::Equal;
+        const size_t name = t.find_first_not_of("abcdefghijklmnopqrstuvwxyz");
+        const bool compare = name != std::string::npos && strchr("<>=", t[name]) != nullptr;
+
+        if (t.size() >= 2 && t.front() == '/' && t.back() == '/')
+        {
+            term.type = Type::Regex;
+            term.text = t.substr(1, t.size() - 2);
+        }
+        else if (StartsWith(t, "re:"))
+        {
+            term.type = Type::Regex;
+            term.text = t.substr(3);
+        }
+        else if (StartsWith(t, "is:"))
+        {
+            term.type = Type::Kind;
+            term.text = t.substr(3);
+            if (term.text != "text" && term.text != "image" && term.text != "files" && term.text != "html" && term.text != "rtf")
+                return false;
+        }
+        else if (StartsWith(t, "files:"))
+        {
+            term.type = Type::Files;
+            term.text = t.substr(6);
+        }
+        else if (StartsWith(t, "format:"))
+        {
+            term.type = Type::Format;
+            char* end = nullptr;
+            term.value = strtoull(t.c_str() + 7, &end, 10);
+            if (end == t.c_str() + 7 || *end != '\0')
+                return false;
+        }
+        else if (compare && (t.compare(0, name, "width") == 0 || t.compare(0, name, "height") == 0 || t.compare(0, name, "size") == 0))
+        {
+            term.type = t[0] == 'w' ? Type::Width : t[0] == 'h' ? Type::Height : Type::Size;
+            const std::string rest = t.substr(name);
+            size_t n = 2;
+            if (StartsWith(rest, "<="))
+                term.op = Op::LessEqual;
+            else if (StartsWith(rest, ">="))
+                term.op = Op::GreaterEqual;
+            else
+            {
+                n = 1;
+                term.op = rest[0] == '<' ? Op::Less : rest[0] == '>' ? Op::Greater : Op::Equal;
+            }
+
+            char* end = nullptr;
+            term.value = strtoull(rest.c_str() + n, &end, 10);
+            if (end == rest.c_str() + n)
+                return false;
+            switch (Lower(*end))
+            {
+            case 'k': term.value <<= 10; ++end; break;
+            case 'm': term.value <<= 20; ++end; break;
+            case 'g': term.value <<= 30; ++end; break;
+            }
+            if (Lower(*end) == 'b')
+                ++end;
+            if (*end != '\0')
+                return false;
+        }
+        else
+            term.text = t;
+
+        if (term.type == Type::Text)
+            std::transform(term.text.begin(), term.text.end(), term.text.begin(), Lower);
+        if (term.type == Type::Regex)
+        {
+            term.literal = RequiredLiteral(term.text);
+            try
+            {
+                term.regex = std::make_shared<const std::regex>(term.text, std::regex::ECMAScript | std::regex::icase | std::regex::optimize);
+            }
+            catch (const std::regex_error&)
+            {
+                return false;
+            }
+        }
+        m_terms.push_back(term);
+    }
+
+    // Cheapest terms first, the text is only extracted when needed
+    std::stable_sort(m_terms.begin(), m_terms.end(), [](const Term& a, const Term& b) { return Cost(int(a.type)) < Cost(int(b.type)); });
+    return true;
+}
+
+bool Query::Compare(const uint64_t a, const Op op, const uint64_t b)
+{
+    switch (op)
+    {
+    case Op::Less:          return a < b;
+    case Op::LessEqual:     return a <= b;
+    case Op::Equal:         return a == b;
+    case Op::GreaterEqual:  return a >= b;
+    case Op::Greater:       return a > b;
+    }
+    return false;
+}
+
+bool Query::HasKind(const QueryEntry& e, const std::string& kind) const
+{
+    for (const QueryItem& i : e.items)
+    {
+        const TextKind k = GetTextKind(m_kinds, i.uFormat);
+        if ((kind == "text" && (k == TextKind::Unicode || k == TextKind::Ansi))
+            || (kind == "image" && IsImageFormat(i.uFormat))
+            || (kind == "files" && k == TextKind::FileList)
+            || (kind == "html" && k == TextKind::Html)
+            || (kind == "rtf" && k == TextKind::Rtf))
+            return true;
+    }
+    return false;
+}
+
+bool Query::Match(const QueryEntry& e, uint64_t& bytes) const
+{
+    bool haveText = false;
+    std::string text;
+    std::string folded;
+    bool haveImage = false;
+    bool isImage = false;
+    uint64_t width = 0, height = 0;
+
+    for (const Term& t : m_terms)
+    {
+        bool match = false;
+        switch (t.type)
+        {
+        case Type::Text:
+        case Type::Regex:
+            if (!haveText)
+            {
+                std::vector<std::pair<TextKind, PayloadRef>> items;
+                for (const QueryItem& i : e.items)
+                {
+                    const TextKind kind = GetTextKind(m_kinds, i.uFormat);
+                    if (kind != TextKind::None)
+                    {
+                        items.push_back({ kind, i.payload });
+                        bytes += i.payload.size;
+                    }
+                }
+                text = EntryText(items, MaxText);
+                haveText = true;
+            }
+            if (folded.empty() && !text.empty())
+            {
+                folded = text;
+                std::transform(folded.begin(), folded.end(), folded.begin(), Lower);
+            }
+            if (t.type == Type::Regex)
+            {
+                try
+                {
+                    match = folded.find(t.literal) != std::string::npos && RegexSearch(text, *t.regex);
+                }
+                catch (const std::regex_error&)
+                {
+                    // Too complex for the engine, error_stack or error_complexity on MSVC
+                    match = false;
+                }
+            }
+            else
+                match = folded.find(t.text) != std::string::npos;
+            break;
+
+        case Type::Kind:
+            match = HasKind(e, t.text);
+            break;
+
+        case Type::Width:
+        case Type::Height:
+            if (!haveImage)
+            {
+                isImage = ImageSize(e, width, height, bytes);
+                haveImage = true;
+            }
+            match = isImage && Compare(t.type == Type::Width ? width : height, t.op, t.value);
+            break;
+
+        case Type::Size:
+            match = Compare(e.totalBytes, t.op, t.value);
+            break;
+
+        case Type::Files:
+        {
+            std::vector<uint8_t> scratch;
+            for (const QueryItem& i : e.items)
+            {
+                if (i.uFormat != FmtHDrop)
+                    continue;
+                bytes += i.payload.size;
+                std::string paths;
+                ExtractText(TextKind::FileList, i.payload.Read(i.payload.size, scratch), i.payload.size, paths);
+                size_t start = 0;
+                while (!match && start < paths.size())
+                {
+                    size_t end = paths.find('\n', start);
+                    if (end == std::string::npos)
+                        end = paths.size();
+                    match = Glob(paths.substr(start, end - start).c_str(), t.text.c_str());
+                    start = end + 1;
+                }
+            }
+            break;
+        }
+
+        case Type::Format:
+            match = std::any_of(e.items.begin(), e.items.end(), [&t](const QueryItem& i) { return i.uFormat == t.value; });
+            break;
+        }
+        if (!match)
+            return false;
+    }
+    return true;
+}
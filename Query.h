@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "History.h"
+#include "TextExtract.h"
+
+struct QueryItem
+{
+    uint32_t uFormat;
+    PayloadRef payload;
+};
+
+// Copy of an entry that can be read away from the thread that owns the history.
+struct QueryEntry
+{
+    HistId id;
+    uint64_t created;
+    uint64_t totalBytes;
+    std::vector<QueryItem> items;
+};
+
+// Terms separated by spaces, all of which must match:
+//   word "some words"      text contains, ignoring ASCII case
+//   /regex/ re:regex       ECMAScript regex search in each line of the first 64 KB of text,
+//                          ignoring case
+//   is:text|image|files|html|rtf
+//   width>N height<=N size>=N[k|m|g]
+//   files:*.log            a path in the file list matches the glob
+//   format:N
+class Query
+{
+public:
+    // Returns false if the query is malformed.
+    bool Parse(const std::string& text);
+    void SetTextKinds(const TextKinds& kinds) { m_kinds = kinds; }
+
+    // True for a single text term, which SearchIndex can answer.
+    bool IsPlainText() const { return m_terms.size() == 1 && m_terms.front().type == Type::Text; }
+    const std::string& PlainText() const { return m_terms.front().text; }
+    bool Empty() const { return m_terms.empty(); }
+
+    // Thread safe. bytes is increased by the payload bytes read.
+    bool Match(const QueryEntry& e, uint64_t& bytes) const;
+
+private:
+    enum class Type { Text, Regex, Kind, Width, Height, Size, Files, Format };
+    enum class Op { Less, LessEqual, Equal, GreaterEqual, Greater };
+
+    struct Term
+    {
+        Type type;
+        Op op;
+        uint64_t value;
+        std::string text;
+        std::string literal;    // required in the folded text for a regex to match
+        std::shared_ptr<const std::regex> regex;
+    };
+
+    static bool Compare(uint64_t a, Op op, uint64_t b);
+    bool HasKind(const QueryEntry& e, const std::string& kind) const;
+
+    TextKinds m_kinds;
+    std::vector<Term> m_terms;
+};
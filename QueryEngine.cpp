@@ -0,0 +1,172 @@
+#include "QueryEngine.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+QueryEngine::QueryEngine(std::function<void()> notify, const size_t threads)
+    : m_pool(threads)
+    , m_notify(std::move(notify))
+    , m_thread(&QueryEngine::RunJobs, this)
+{
+}
+
+QueryEngine::~QueryEngine()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+        m_cancel = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+}
+
+std::vector<QueryEntry> QueryEngine::Snapshot(const History& history)
+{
+    std::vector<QueryEntry> entries;
+    entries.reserve(history.size());
+    for (const HistId id : history)
+    {
+        QueryEntry e = { id, history.Created(id), history.TotalBytes(id), {} };
+        for (const HistItem& i : history.Items(id))
+            e.items.push_back({ i.uFormat, history.Payloads().Ref(i.payload) });
+        entries.push_back(std::move(e));
+    }
+    return entries;
+}
+
+QueryStats QueryEngine::Run(const std::vector<QueryEntry>& entries, const Query& query, const size_t maxHits, const std::function<void(HistId)>& onHit, const std::atomic<bool>* const cancel)
+{
+    const size_t ChunkBytes = 4 * 1024 * 1024;
+    const size_t ChunkEntries = 64;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<size_t> chunks;     // first entry of each chunk
+    {
+        size_t bytes = 0;
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            if (chunks.empty() || bytes >= ChunkBytes || i - chunks.back() >= ChunkEntries)
+            {
+                chunks.push_back(i);
+                bytes = 0;
+            }
+            bytes += size_t(entries[i].totalBytes);
+        }
+    }
+
+    struct Chunk
+    {
+        bool done;
+        std::vector<HistId> hits;
+    };
+    std::vector<Chunk> results(chunks.size());
+    std::mutex mutex;
+    size_t next = 0;        // next chunk to report
+    size_t reported = 0;
+    std::atomic<size_t> scanned{ 0 };
+    std::atomic<uint64_t> bytes{ 0 };
+
+    m_pool.Run(chunks.size(), [&](const size_t c)
+    {
+        if (cancel != nullptr && *cancel)
+            return false;
+        const size_t end = c + 1 < chunks.size() ? chunks[c + 1] : entries.size();
+        std::vector<HistId> hits;
+        uint64_t read = 0;
+        for (size_t i = chunks[c]; i < end; ++i)
+        {
+            if (query.Match(entries[i], read))
+                hits.push_back(entries[i].id);
+        }
+        scanned += end - chunks[c];
+        bytes += read;
+
+        // Report in order, once all the newer chunks are done
+        std::lock_guard<std::mutex> lock(mutex);
+        results[c].done = true;
+        results[c].hits.swap(hits);
+        while (next < results.size() && results[next].done && reported < maxHits)
+        {
+            for (const HistId id : results[next].hits)
+            {
+                if (reported >= maxHits)
+                    break;
+                onHit(id);
+                ++reported;
+            }
+            std::vector<HistId>().swap(results[next].hits);
+            ++next;
+        }
+        return reported < maxHits;
+    });
+
+    QueryStats stats = {};
+    stats.entries = scanned;
+    stats.hits = reported;
+    stats.bytes = bytes;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+uint64_t QueryEngine::Start(std::vector<QueryEntry> entries, Query query, const size_t maxHits)
+{
+    std::unique_ptr<Job> job(new Job{ ++m_serial, std::move(entries), std::move(query), maxHits });
+    const uint64_t serial = job->serial;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_next = std::move(job);
+        m_cancel = true;
+    }
+    m_cv.notify_one();
+    return serial;
+}
+
+bool QueryEngine::TakeResult(uint64_t& serial, std::vector<HistId>& hits)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_done)
+        return false;
+    m_done = false;
+    serial = m_doneSerial;
+    hits.swap(m_doneHits);
+    m_doneHits.clear();
+    return true;
+}
+
+void QueryEngine::RunJobs()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_cv.wait(lock, [this] { return m_stop || m_next; });
+        if (m_stop)
+            break;
+
+        std::unique_ptr<Job> job = std::move(m_next);
+        m_cancel = false;
+        lock.unlock();
+
+        std::vector<HistId> hits;
+        Run(job->entries, job->query, job->maxHits, [&hits](const HistId id) { hits.push_back(id); }, &m_cancel);
+        // The payloads can be released once the entries are gone
+        const uint64_t serial = job->serial;
+        job.reset();
+
+        lock.lock();
+        // A newer query cancelled this one
+        if (m_next)
+            continue;
+        m_done = true;
+        m_doneSerial = serial;
+        m_doneHits.swap(hits);
+        if (m_notify)
+        {
+            lock.unlock();
+            m_notify();
+            lock.lock();
+        }
+    }
+}
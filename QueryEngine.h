@@ -0,0 +1,74 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Query.h"
+#include "Rad/WorkStealing.h"
+
+struct QueryStats
+{
+    size_t entries;     // scanned
+    size_t hits;
+    uint64_t bytes;     // payload bytes read
+    double seconds;
+
+    double GBps() const { return seconds > 0 ? double(bytes) / seconds / 1e9 : 0; }
+};
+
+// Scans history entries with a Query on all cores.
+// The entries are split into chunks of roughly equal bytes, run newest first on a
+// WorkStealingPool, and hits are reported in recency order.
+// Start runs a query in the background and calls notify when it is done, so the thread that
+// owns the history can collect the hits with TakeResult.
+class QueryEngine
+{
+public:
+    explicit QueryEngine(std::function<void()> notify = nullptr, size_t threads = std::thread::hardware_concurrency());
+    QueryEngine(const QueryEngine&) = delete;
+    QueryEngine& operator=(const QueryEngine&) = delete;
+    ~QueryEngine();
+
+    // Call on the thread that owns the history.
+    static std::vector<QueryEntry> Snapshot(const History& history);
+
+    // Calls onHit at most maxHits times and stops scanning once that many are found, or once
+    // cancel is set. onHit is called on the pool threads, one at a time.
+    QueryStats Run(const std::vector<QueryEntry>& entries, const Query& query, size_t maxHits, const std::function<void(HistId)>& onHit, const std::atomic<bool>* cancel = nullptr);
+
+    // Cancels the query that is running, if any. Returns the serial of the new one.
+    uint64_t Start(std::vector<QueryEntry> entries, Query query, size_t maxHits);
+    // The hits of the last query that finished, most recent first.
+    bool TakeResult(uint64_t& serial, std::vector<HistId>& hits);
+
+private:
+    struct Job
+    {
+        uint64_t serial;
+        std::vector<QueryEntry> entries;
+        Query query;
+        size_t maxHits;
+    };
+
+    void RunJobs();
+
+    WorkStealingPool m_pool;
+    const std::function<void()> m_notify;
+    uint64_t m_serial = 0;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::unique_ptr<Job> m_next;
+    std::atomic<bool> m_cancel{ false };
+    bool m_done = false;
+    uint64_t m_doneSerial = 0;
+    std::vector<HistId> m_doneHits;
+    bool m_stop = false;
+    std::thread m_thread;
+};
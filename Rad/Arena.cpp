@@ -0,0 +1,245 @@
+#include "Arena.h"
+#include <algorithm>
+#include <cassert>
+#include <new>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+const size_t Arena::SlabSize;
+const size_t Arena::MaxSmall;
+
+namespace
+{
+    const size_t Granularity = 16;
+
+#ifdef _WIN32
+    void* PageAlloc(size_t size)
+    {
+        return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    }
+
+    void PageFree(void* p, size_t /*size*/)
+    {
+        VirtualFree(p, 0, MEM_RELEASE);
+    }
+#else
+    void* PageAlloc(size_t size)
+    {
+        void* const p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return p != MAP_FAILED ? p : nullptr;
+    }
+
+    void PageFree(void* p, size_t size)
+    {
+        munmap(p, size);
+    }
+#endif
+}
+
+Arena::Arena()
+{
+    // 16 byte steps up to 128, then four classes per power of two so at most 25% is wasted
+    for (size_t s = Granularity; s <= 128; s += Granularity)
+        m_classes.push_back({ s, nullptr });
+    for (size_t p = 128; p < MaxSmall; p *= 2)
+        for (size_t s = p + p / 4; s <= p * 2; s += p / 4)
+            m_classes.push_back({ s, nullptr });
+    assert(m_classes.back().size == MaxSmall);
+}
+
+Arena::~Arena()
+{
+    for (const auto& s : m_slabs)
+    {
+        PageFree(s.second->base, SlabSize);
+        delete s.second;
+    }
+    for (const auto& l : m_large)
+        PageFree(reinterpret_cast<void*>(l.first), l.second);
+}
+
+size_t Arena::ClassOf(const size_t size) const
+{
+    const auto it = std::lower_bound(m_classes.begin(), m_classes.end(), size, [](const Class& c, size_t s) { return c.size < s; });
+    return size_t(it - m_classes.begin());
+}
+
+void Arena::Link(Slab* const slab)
+{
+    Class& c = m_classes[slab->cls];
+    slab->prev = nullptr;
+    slab->next = c.avail;
+    if (c.avail != nullptr)
+        c.avail->prev = slab;
+    c.avail = slab;
+}
+
+void Arena::Unlink(Slab* const slab)
+{
+    Class& c = m_classes[slab->cls];
+    if (slab->prev != nullptr)
+        slab->prev->next = slab->next;
+    else
+        c.avail = slab->next;
+    if (slab->next != nullptr)
+        slab->next->prev = slab->prev;
+    slab->prev = slab->next = nullptr;
+}
+
+Arena::Slab* Arena::NewSlab(const size_t cls)
+{
+    void* const base = PageAlloc(SlabSize);
+    if (base == nullptr)
+        throw std::bad_alloc();
+
+    Slab* const slab = new Slab();
+    slab->base = static_cast<uint8_t*>(base);
+    slab->cls = uint32_t(cls);
+    slab->capacity = uint32_t(SlabSize / m_classes[cls].size);
+    m_slabs[reinterpret_cast<uintptr_t>(base)] = slab;
+    m_reserved += SlabSize;
+    Link(slab);
+    return slab;
+}
+
+void Arena::FreeSlab(Slab* const slab)
+{
+    Unlink(slab);
+    m_slabs.erase(reinterpret_cast<uintptr_t>(slab->base));
+    m_reserved -= SlabSize;
+    PageFree(slab->base, SlabSize);
+    delete slab;
+}
+
+Arena::Slab* Arena::SlabOf(const void* const p) const
+{
+    auto it = m_slabs.upper_bound(reinterpret_cast<uintptr_t>(p));
+    assert(it != m_slabs.begin());
+    --it;
+    return it->second;
+}
+
+void* Arena::AllocFrom(Slab* const slab)
+{
+    void* p;
+    if (slab->free != nullptr)
+    {
+        p = slab->free;
+        slab->free = *static_cast<void**>(p);
+    }
+    else
+    {
+        p = slab->base + size_t(slab->bump) * m_classes[slab->cls].size;
+        ++slab->bump;
+    }
+    if (++slab->used == slab->capacity)
+        Unlink(slab);
+    return p;
+}
+
+void* Arena::Alloc(size_t size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_requested += size;
+    ++m_allocations;
+    if (size > MaxSmall)
+    {
+        void* const p = PageAlloc(size);
+        if (p == nullptr)
+            throw std::bad_alloc();
+        m_large[reinterpret_cast<uintptr_t>(p)] = size;
+        m_reserved += size;
+        return p;
+    }
+
+    const size_t cls = ClassOf(std::max<size_t>(size, 1));
+    Slab* const slab = m_classes[cls].avail != nullptr ? m_classes[cls].avail : NewSlab(cls);
+    return AllocFrom(slab);
+}
+
+void Arena::Free(void* const p, const size_t size)
+{
+    if (p == nullptr)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_requested -= size;
+    --m_allocations;
+    if (size > MaxSmall)
+    {
+        m_large.erase(reinterpret_cast<uintptr_t>(p));
+        m_reserved -= size;
+        PageFree(p, size);
+        return;
+    }
+
+    Slab* const slab = SlabOf(p);
+    assert(slab->cls == ClassOf(std::max<size_t>(size, 1)));
+    *static_cast<void**>(p) = slab->free;
+    slab->free = p;
+    if (slab->used-- == slab->capacity)
+        Link(slab);
+}
+
+void* Arena::AllocDenser(const void* const p, const size_t size)
+{
+    if (size > MaxSmall)
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const Slab* const from = SlabOf(p);
+    if (from->used * 4 > from->capacity)
+        return nullptr;
+
+    for (Slab* s = m_classes[from->cls].avail; s != nullptr; s = s->next)
+    {
+        if (s != from && s->used >= from->used)
+        {
+            m_requested += size;
+            ++m_allocations;
+            return AllocFrom(s);
+        }
+    }
+    return nullptr;
+}
+
+size_t Arena::Trim()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t freed = 0;
+    for (Class& c : m_classes)
+    {
+        for (Slab* s = c.avail; s != nullptr;)
+        {
+            Slab* const next = s->next;
+            if (s->used == 0)
+            {
+                FreeSlab(s);
+                freed += SlabSize;
+            }
+            s = next;
+        }
+    }
+    return freed;
+}
+
+Arena::Stats Arena::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Stats stats = {};
+    stats.reserved = m_reserved;
+    stats.requested = m_requested;
+    stats.slabs = m_slabs.size();
+    for (const auto& s : m_slabs)
+        if (s.second->used == 0)
+            ++stats.emptySlabs;
+    stats.largeBlocks = m_large.size();
+    stats.allocations = m_allocations;
+    return stats;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Allocator for many variable sized, long lived blocks.
+// Small blocks come from slabs of a fixed size class, large blocks get their own pages.
+// Memory comes straight from the system so it does not fragment the process heap.
+// Thread safe, blocks can be freed on any thread.
+class Arena
+{
+public:
+    static const size_t SlabSize = 256 * 1024;
+    static const size_t MaxSmall = 32 * 1024;
+
+    struct Stats
+    {
+        size_t reserved;    // bytes mapped from the system
+        size_t requested;   // bytes asked for by live allocations
+        size_t slabs;
+        size_t emptySlabs;
+        size_t largeBlocks;
+        size_t allocations;
+    };
+
+    Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena();
+
+    void* Alloc(size_t size);
+    // size must be the size passed to Alloc.
+    void Free(void* p, size_t size);
+
+    // For compaction, returns a block in a fuller slab than the one holding p,
+    // or null if p is not in a sparse slab. The caller copies and frees p.
+    void* AllocDenser(const void* p, size_t size);
+    // Returns empty slabs to the system.
+    size_t Trim();
+
+    Stats GetStats() const;
+
+private:
+    struct Slab
+    {
+        uint8_t* base;
+        uint32_t cls;
+        uint32_t used;
+        uint32_t capacity;
+        uint32_t bump;
+        void* free;
+        Slab* prev;     // in the list of slabs with space
+        Slab* next;
+    };
+
+    struct Class
+    {
+        size_t size;
+        Slab* avail;
+    };
+
+    size_t ClassOf(size_t size) const;
+    void* AllocFrom(Slab* slab);
+    Slab* NewSlab(size_t cls);
+    void FreeSlab(Slab* slab);
+    Slab* SlabOf(const void* p) const;
+    void Link(Slab* slab);
+    void Unlink(Slab* slab);
+
+    mutable std::mutex m_mutex;
+    std::vector<Class> m_classes;
+    std::map<uintptr_t, Slab*> m_slabs;     // by base address
+    std::map<uintptr_t, size_t> m_large;
+    size_t m_reserved = 0;
+    size_t m_requested = 0;
+    size_t m_allocations = 0;
+};
+
+// Standard allocator over an Arena, so containers and shared_ptr control blocks can live in it.
+template <class T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    explicit ArenaAllocator(Arena& arena) : m_arena(&arena) { }
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& o) : m_arena(o.arena()) { }
+
+    T* allocate(size_t n) { return static_cast<T*>(m_arena->Alloc(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) { m_arena->Free(p, n * sizeof(T)); }
+
+    Arena* arena() const { return m_arena; }
+
+private:
+    Arena* m_arena;
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena() == b.arena(); }
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena() != b.arena(); }
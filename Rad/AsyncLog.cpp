@@ -0,0 +1,609 @@
+#include "AsyncLog.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
+#include <cwchar>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#include <share.h>
+#endif
+
+namespace
+{
+    const uint64_t Second = 1000000000;     // ns
+    const auto DrainInterval = std::chrono::milliseconds(100);
+
+    uint64_t Now()
+    {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+    }
+
+    // Records of different threads can be slightly out of order.
+    uint64_t Elapsed(const uint64_t from, const uint64_t to)
+    {
+        return to > from ? to - from : 0;
+    }
+
+    struct LogRecord
+    {
+        uint64_t time;          // ns since the epoch
+        const void* file;
+        const void* function;
+        long line;
+        LogLevel level;
+        bool wide;
+        uint16_t length;        // bytes of text
+        char text[LogTextBytes];
+    };
+
+    // A ring buffer written only by its thread and emptied by the logging thread.
+    class LogBuffer
+    {
+    public:
+        explicit LogBuffer(uint32_t tid) : m_tid(tid) { }
+
+        // Null if the buffer is full.
+        LogRecord* Claim()
+        {
+            const uint64_t head = m_head.load(std::memory_order_relaxed);
+            if (head - m_tail.load(std::memory_order_acquire) >= LogBufferCapacity)
+            {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            return &m_slots[head % LogBufferCapacity];
+        }
+
+        // Returns the number of records waiting.
+        uint64_t Commit()
+        {
+            const uint64_t head = m_head.load(std::memory_order_relaxed) + 1;
+            m_head.store(head, std::memory_order_release);
+            return head - m_tail.load(std::memory_order_relaxed);
+        }
+
+        void Take(std::vector<std::pair<uint32_t, LogRecord>>& records)
+        {
+            const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+            const uint64_t head = m_head.load(std::memory_order_acquire);
+            for (uint64_t n = tail; n < head; ++n)
+                records.emplace_back(m_tid, m_slots[n % LogBufferCapacity]);
+            m_tail.store(head, std::memory_order_release);
+        }
+
+        uint64_t TakeDropped() { return m_dropped.exchange(0, std::memory_order_relaxed); }
+
+        const uint32_t m_tid;
+
+    private:
+        LogRecord m_slots[LogBufferCapacity];
+        std::atomic<uint64_t> m_head{ 0 };
+        std::atomic<uint64_t> m_tail{ 0 };
+        std::atomic<uint64_t> m_dropped{ 0 };
+    };
+
+    const char* LevelName(const LogLevel l)
+    {
+        switch (l)
+        {
+        case LOG_DEBUG:  return "DEBUG";
+        case LOG_INFO:   return "INFO";
+        case LOG_WARN:   return "WARN";
+        case LOG_ERROR:  return "ERROR";
+        case LOG_ASSERT: return "ASSERT";
+        default:         return "UNKNOWN";
+        }
+    }
+
+    void AppendUtf8(std::string& out, uint32_t c)
+    {
+        // Each message is on one line
+        if (c < 0x20)
+            c = ' ';
+        if (c < 0x80)
+            out += char(c);
+        else if (c < 0x800)
+        {
+            out += char(0xC0 | (c >> 6));
+            out += char(0x80 | (c & 0x3F));
+        }
+        else if (c < 0x10000)
+        {
+            out += char(0xE0 | (c >> 12));
+            out += char(0x80 | ((c >> 6) & 0x3F));
+            out += char(0x80 | (c & 0x3F));
+        }
+        else
+        {
+            out += char(0xF0 | (c >> 18));
+            out += char(0x80 | ((c >> 12) & 0x3F));
+            out += char(0x80 | ((c >> 6) & 0x3F));
+            out += char(0x80 | (c & 0x3F));
+        }
+    }
+
+    void AppendText(std::string& out, const char* s, const size_t length)
+    {
+        for (size_t i = 0; i < length; ++i)
+            out += uint8_t(s[i]) < 0x20 ? ' ' : s[i];
+    }
+
+    void AppendText(std::string& out, const wchar_t* s, const size_t length)
+    {
+        for (size_t i = 0; i < length; ++i)
+        {
+            uint32_t c = uint32_t(s[i]);
+            if (c >= 0xD800 && c < 0xE000)
+            {
+                const uint32_t low = i + 1 < length ? uint32_t(s[i + 1]) : 0;
+                if (c < 0xDC00 && low >= 0xDC00 && low < 0xE000)
+                {
+                    c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                    ++i;
+                }
+                else
+                    c = 0xFFFD;
+            }
+            AppendUtf8(out, c > 0x10FFFF ? 0xFFFD : c);
+        }
+    }
+
+    // A string literal of either width.
+    void AppendLiteral(std::string& out, const void* s, const bool wide)
+    {
+        if (s == nullptr)
+            return;
+        if (wide)
+            AppendText(out, static_cast<const wchar_t*>(s), wcslen(static_cast<const wchar_t*>(s)));
+        else
+            AppendText(out, static_cast<const char*>(s), strlen(static_cast<const char*>(s)));
+    }
+
+    void AppendTime(std::string& out, const uint64_t ns)
+    {
+        const time_t t = time_t(ns / Second);
+        tm local = {};
+#ifdef _WIN32
+        localtime_s(&local, &t);
+#else
+        localtime_r(&t, &local);
+#endif
+        char buf[32];
+        const size_t n = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &local);
+        snprintf(buf + n, sizeof(buf) - n, ".%03u", unsigned(ns / 1000000 % 1000));
+        out += buf;
+    }
+
+    // Where a message was logged, the key of the rate limit.
+    struct LogSite
+    {
+        const void* file;
+        long line;
+
+        bool operator<(const LogSite& o) const { return file != o.file ? std::less<const void*>()(file, o.file) : line < o.line; }
+    };
+
+    struct SiteState
+    {
+        uint64_t windowStart;
+        uint32_t count;
+        uint64_t suppressed;
+        LogLevel level;         // the highest suppressed
+        uint32_t tid;           // of the last suppressed
+        const void* function;
+        bool wide;
+    };
+
+    class LogCore
+    {
+    public:
+        LogCore()
+            : m_thread(&LogCore::Run, this)
+        {
+        }
+        LogCore(const LogCore&) = delete;
+        LogCore& operator=(const LogCore&) = delete;
+
+        ~LogCore()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_cv.notify_one();
+            m_thread.join();
+        }
+
+        LogBuffer& ThreadBuffer()
+        {
+            thread_local std::shared_ptr<LogBuffer> buffer;
+            if (!buffer)
+            {
+                std::lock_guard<std::mutex> lock(m_buffersMutex);
+                // Kept after their thread exits, so its last messages are still written
+                buffer = std::make_shared<LogBuffer>(uint32_t(m_buffers.size() + 1));
+                m_buffers.push_back(buffer);
+            }
+            return *buffer;
+        }
+
+        // Doesn't wait for the logging thread, it drains at least every DrainInterval.
+        void Wake()
+        {
+            if (m_waiting.load(std::memory_order_relaxed) && m_waiting.exchange(false))
+                m_cv.notify_one();
+        }
+
+        void AddSink(std::shared_ptr<LogSink> sink)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_sinks.push_back(std::move(sink));
+        }
+
+        void Flush()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            const uint64_t request = ++m_flushRequested;
+            m_cv.notify_one();
+            m_flushedCv.wait(lock, [this, request] { return m_flushed >= request; });
+        }
+
+        LogStats Stats()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_stats;
+        }
+
+    private:
+        void Run()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (true)
+            {
+                const uint64_t request = m_flushRequested;
+                const bool stop = m_stop;
+                const std::vector<std::shared_ptr<LogSink>> sinks = m_sinks;
+                lock.unlock();
+                // Repeats and suppressed messages are counted until a flush
+                Drain(sinks, stop || request != m_flushed);
+                lock.lock();
+                m_stats = m_pendingStats;
+                m_flushed = request;
+                m_flushedCv.notify_all();
+                if (stop)
+                    break;
+                if (m_flushRequested == request && !m_stop)
+                {
+                    m_waiting.store(true);
+                    m_cv.wait_for(lock, DrainInterval);
+                    m_waiting.store(false);
+                }
+            }
+        }
+
+        void Drain(const std::vector<std::shared_ptr<LogSink>>& sinks, const bool flush)
+        {
+            std::vector<std::shared_ptr<LogBuffer>> buffers;
+            {
+                std::lock_guard<std::mutex> lock(m_buffersMutex);
+                buffers = m_buffers;
+            }
+
+            const uint64_t now = Now();
+            m_records.clear();
+            for (const auto& buffer : buffers)
+            {
+                const uint64_t dropped = buffer->TakeDropped();
+                if (dropped != 0)
+                {
+                    m_pendingStats.dropped += dropped;
+                    Emit(sinks, LOG_WARN, now, buffer->m_tid, std::to_string(dropped) + " messages dropped, the log buffer was full", nullptr, 0, nullptr, false);
+                }
+                buffer->Take(m_records);
+            }
+            // The order they were logged in, across threads
+            std::stable_sort(m_records.begin(), m_records.end(),
+                [](const std::pair<uint32_t, LogRecord>& a, const std::pair<uint32_t, LogRecord>& b) { return a.second.time < b.second.time; });
+            for (const auto& r : m_records)
+                Process(sinks, r.first, r.second);
+
+            if (m_repeats != 0 && (flush || Elapsed(m_lastRepeat, now) >= Second))
+                EmitRepeats(sinks, now);
+            for (auto it = m_sites.begin(); it != m_sites.end(); )
+            {
+                if (!flush && Elapsed(it->second.windowStart, now) < Second)
+                    ++it;
+                else
+                {
+                    EmitSuppressed(sinks, now, it->first, it->second);
+                    it = m_sites.erase(it);
+                }
+            }
+
+            for (const auto& sink : sinks)
+                sink->Flush();
+        }
+
+        static bool Same(const LogRecord& a, const LogRecord& b)
+        {
+            return a.file == b.file && a.line == b.line && a.level == b.level && a.wide == b.wide
+                && a.length == b.length && memcmp(a.text, b.text, a.length) == 0;
+        }
+
+        void Process(const std::vector<std::shared_ptr<LogSink>>& sinks, const uint32_t tid, const LogRecord& r)
+        {
+            // Repeats after a pause are written again
+            if (m_hasLast && Same(r, m_last) && Elapsed(std::max(m_last.time, m_lastRepeat), r.time) < Second)
+            {
+                ++m_repeats;
+                ++m_pendingStats.coalesced;
+                m_lastRepeat = r.time;
+                return;
+            }
+            EmitRepeats(sinks, r.time);
+
+            const LogSite site = { r.file, r.line };
+            auto it = m_sites.find(site);
+            if (it != m_sites.end() && Elapsed(it->second.windowStart, r.time) >= Second)
+            {
+                EmitSuppressed(sinks, r.time, it->first, it->second);
+                m_sites.erase(it);
+                it = m_sites.end();
+            }
+            if (it == m_sites.end())
+                it = m_sites.emplace(site, SiteState{ r.time, 0, 0, r.level, tid, r.function, r.wide }).first;
+            SiteState& s = it->second;
+            if (s.count >= LogSiteRate)
+            {
+                ++s.suppressed;
+                ++m_pendingStats.suppressed;
+                s.level = std::max(s.level, r.level);
+                s.tid = tid;
+                return;
+            }
+            ++s.count;
+
+            std::string text;
+            if (r.wide)
+            {
+                std::wstring w(r.length / sizeof(wchar_t), L'\0');
+                memcpy(&w[0], r.text, w.size() * sizeof(wchar_t));
+                AppendText(text, w.data(), w.size());
+            }
+            else
+                AppendText(text, r.text, r.length);
+            Emit(sinks, r.level, r.time, tid, text, r.file, r.line, r.function, r.wide);
+            m_last = r;
+            m_lastTid = tid;
+            m_lastRepeat = 0;
+            m_hasLast = true;
+        }
+
+        void EmitRepeats(const std::vector<std::shared_ptr<LogSink>>& sinks, const uint64_t time)
+        {
+            if (m_repeats != 0)
+                Emit(sinks, m_last.level, time, m_lastTid, "Last message repeated " + std::to_string(m_repeats) + " times", m_last.file, m_last.line, m_last.function, m_last.wide);
+            m_repeats = 0;
+        }
+
+        void EmitSuppressed(const std::vector<std::shared_ptr<LogSink>>& sinks, const uint64_t time, const LogSite& site, const SiteState& s)
+        {
+            if (s.suppressed != 0)
+                Emit(sinks, s.level, time, s.tid, std::to_string(s.suppressed) + " more messages suppressed", site.file, site.line, s.function, s.wide);
+        }
+
+        // "2024-01-31 12:34:56.789 [1] WARN: message    file(line) function"
+        void Emit(const std::vector<std::shared_ptr<LogSink>>& sinks, const LogLevel level, const uint64_t time, const uint32_t tid, const std::string& text,
+            const void* file, const long line, const void* function, const bool wide)
+        {
+            std::string& out = m_line;
+            out.clear();
+            AppendTime(out, time);
+            out += " [" + std::to_string(tid) + "] ";
+            out += LevelName(level);
+            out += ": ";
+            out += text;
+            if (file != nullptr)
+            {
+                out += "    ";
+                AppendLiteral(out, file, wide);
+                out += '(' + std::to_string(line) + ") ";
+                AppendLiteral(out, function, wide);
+            }
+            for (const auto& sink : sinks)
+                sink->Write(level, out);
+            ++m_pendingStats.written;
+        }
+
+        std::mutex m_buffersMutex;
+        std::vector<std::shared_ptr<LogBuffer>> m_buffers;
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::condition_variable m_flushedCv;
+        std::atomic<bool> m_waiting{ false };
+        std::vector<std::shared_ptr<LogSink>> m_sinks;
+        uint64_t m_flushRequested = 0;
+        uint64_t m_flushed = 0;
+        LogStats m_stats = {};
+        bool m_stop = false;
+
+        // Only used by the logging thread
+        std::vector<std::pair<uint32_t, LogRecord>> m_records;
+        std::map<LogSite, SiteState> m_sites;
+        LogRecord m_last = {};
+        uint32_t m_lastTid = 0;
+        bool m_hasLast = false;
+        uint64_t m_repeats = 0;
+        uint64_t m_lastRepeat = 0;
+        std::string m_line;
+        LogStats m_pendingStats = {};
+
+        std::thread m_thread;   // last, started once the rest is constructed
+    };
+
+    LogCore& Core()
+    {
+        static LogCore core;
+        return core;
+    }
+
+    size_t Length(const char* s, const size_t max) { return strnlen(s, max); }
+    size_t Length(const wchar_t* s, const size_t max) { return wcsnlen(s, max); }
+
+    template <class C>
+    void Write(const LogLevel level, const C* msg, const bool wide, const void* file, const long line, const void* function)
+    {
+        LogCore& core = Core();
+        LogBuffer& buffer = core.ThreadBuffer();
+        LogRecord* const r = buffer.Claim();
+        if (r == nullptr)
+        {
+            core.Wake();
+            return;
+        }
+        r->time = Now();
+        r->file = file;
+        r->function = function;
+        r->line = line;
+        r->level = level;
+        r->wide = wide;
+        const size_t max = LogTextBytes / sizeof(C);
+        size_t n = msg != nullptr ? Length(msg, max) : 0;
+        // Not leaving a partial UTF-8 sequence
+        if (!wide && n == max)
+            while (n > 0 && (uint8_t(msg[n]) & 0xC0) == 0x80)
+                --n;
+        if (n != 0)
+            memcpy(r->text, msg, n * sizeof(C));
+        r->length = uint16_t(n * sizeof(C));
+        if (buffer.Commit() >= LogBufferCapacity / 2 || level >= LOG_WARN)
+            core.Wake();
+    }
+}
+
+RotatingFileSink::RotatingFileSink(std::string path, const uint64_t maxBytes, const int maxFiles)
+    : m_path(std::move(path)), m_maxBytes(maxBytes), m_maxFiles(maxFiles)
+{
+    m_file = Open(m_path, "ab");
+    if (m_file != nullptr)
+    {
+        fseek(m_file, 0, SEEK_END);
+        m_size = uint64_t(ftell(m_file));
+    }
+}
+
+RotatingFileSink::~RotatingFileSink()
+{
+    if (m_file != nullptr)
+        fclose(m_file);
+}
+
+void RotatingFileSink::Write(LogLevel /*level*/, const std::string& line)
+{
+    if (m_size + line.size() + 1 > m_maxBytes && m_size > 0)
+        Rotate();
+    if (m_file == nullptr)
+        return;
+    fwrite(line.data(), 1, line.size(), m_file);
+    fputc('\n', m_file);
+    m_size += line.size() + 1;
+}
+
+void RotatingFileSink::Flush()
+{
+    if (m_file != nullptr)
+        fflush(m_file);
+}
+
+void RotatingFileSink::Rotate()
+{
+    if (m_file != nullptr)
+        fclose(m_file);
+    const auto name = [this](const int i) { return i == 0 ? m_path : m_path + '.' + std::to_string(i); };
+    Remove(name(m_maxFiles));
+    for (int i = m_maxFiles - 1; i >= 0; --i)
+        Rename(name(i), name(i + 1));
+    m_file = Open(m_path, "wb");
+    m_size = 0;
+}
+
+#ifdef _WIN32
+namespace
+{
+    std::wstring Widen(const std::string& s)
+    {
+        std::wstring w(MultiByteToWideChar(CP_UTF8, 0, s.data(), int(s.size()), nullptr, 0), L'\0');
+        MultiByteToWideChar(CP_UTF8, 0, s.data(), int(s.size()), &w[0], int(w.size()));
+        return w;
+    }
+}
+
+FILE* RotatingFileSink::Open(const std::string& path, const char* mode)
+{
+    const wchar_t* const wmode = strcmp(mode, "ab") == 0 ? L"ab" : L"wb";
+    // Shared, so the log can be read while it is written
+    return _wfsopen(Widen(path).c_str(), wmode, _SH_DENYWR);
+}
+
+void RotatingFileSink::Remove(const std::string& path)
+{
+    _wremove(Widen(path).c_str());
+}
+
+void RotatingFileSink::Rename(const std::string& from, const std::string& to)
+{
+    _wrename(Widen(from).c_str(), Widen(to).c_str());
+}
+#else
+FILE* RotatingFileSink::Open(const std::string& path, const char* mode)
+{
+    return fopen(path.c_str(), mode);
+}
+
+void RotatingFileSink::Remove(const std::string& path)
+{
+    remove(path.c_str());
+}
+
+void RotatingFileSink::Rename(const std::string& from, const std::string& to)
+{
+    rename(from.c_str(), to.c_str());
+}
+#endif
+
+void LogWrite(const LogLevel level, const char* const msg, const char* const file, const long line, const char* const function)
+{
+    Write(level, msg, false, file, line, function);
+}
+
+void LogWrite(const LogLevel level, const wchar_t* const msg, const wchar_t* const file, const long line, const wchar_t* const function)
+{
+    Write(level, msg, true, file, line, function);
+}
+
+void LogAddSink(std::shared_ptr<LogSink> sink)
+{
+    Core().AddSink(std::move(sink));
+}
+
+void LogFlush()
+{
+    Core().Flush();
+}
+
+LogStats LogGetStats()
+{
+    return Core().Stats();
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include "LogLevel.h"
+
+// Log messages are copied into a ring buffer per thread and written to the sinks by a background
+// thread, so logging never waits on a sink or a lock once a thread has its buffer.
+// A message that doesn't fit in a full buffer is dropped and counted.
+// Identical messages in a row are written once followed by the number of repeats, and each
+// source location is limited to LogSiteRate messages a second.
+// Locations are kept as pointers, so they must be string literals such as __FILE__.
+
+const size_t LogBufferCapacity = 256;   // messages per thread
+const size_t LogTextBytes = 464;        // longer messages are truncated
+const uint32_t LogSiteRate = 10;
+
+// Receives the formatted lines on the logging thread.
+class LogSink
+{
+public:
+    virtual ~LogSink() = default;
+    // UTF-8, without the line break.
+    virtual void Write(LogLevel level, const std::string& line) = 0;
+    // After each batch of lines.
+    virtual void Flush() { }
+};
+
+// Appends to a file, and once it reaches maxBytes moves it to path.1, path.1 to path.2 and so
+// on, keeping maxFiles old files.
+class RotatingFileSink : public LogSink
+{
+public:
+    // path is UTF-8.
+    RotatingFileSink(std::string path, uint64_t maxBytes = 4 << 20, int maxFiles = 3);
+    RotatingFileSink(const RotatingFileSink&) = delete;
+    RotatingFileSink& operator=(const RotatingFileSink&) = delete;
+    ~RotatingFileSink();
+
+    bool IsOpen() const { return m_file != nullptr; }
+    void Write(LogLevel level, const std::string& line) override;
+    void Flush() override;
+
+private:
+    static FILE* Open(const std::string& path, const char* mode);
+    static void Remove(const std::string& path);
+    static void Rename(const std::string& from, const std::string& to);
+    void Rotate();
+
+    const std::string m_path;
+    const uint64_t m_maxBytes;
+    const int m_maxFiles;
+    FILE* m_file = nullptr;
+    uint64_t m_size = 0;
+};
+
+struct LogStats
+{
+    uint64_t written;       // lines passed to the sinks
+    uint64_t dropped;       // buffer full
+    uint64_t coalesced;     // repeats of the previous message
+    uint64_t suppressed;    // over the rate of their location
+};
+
+// Narrow text is passed through as it is, wide text is converted to UTF-8.
+void LogWrite(LogLevel level, const char* msg, const char* file, long line, const char* function);
+void LogWrite(LogLevel level, const wchar_t* msg, const wchar_t* file, long line, const wchar_t* function);
+
+void LogAddSink(std::shared_ptr<LogSink> sink);
+// Waits until everything logged before the call has been written.
+void LogFlush();
+LogStats LogGetStats();
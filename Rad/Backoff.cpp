@@ -0,0 +1,58 @@
+#include "Backoff.h"
+#include <algorithm>
+
+const size_t ContentionStats::MaxHolders;
+
+Backoff::Backoff(const BackoffPolicy& policy, const uint64_t start)
+    : m_policy(policy)
+    , m_deadline(start + uint64_t(policy.timeout) * 1000)
+    , m_sleep(std::max<uint32_t>(policy.firstSleep, 1))
+{
+}
+
+Backoff::Step Backoff::Next(const uint64_t now, uint32_t& sleep)
+{
+    ++m_failures;
+    if (now >= m_deadline)
+        return Step::GiveUp;
+    if (m_failures <= m_policy.spins)
+        return Step::Retry;
+    if (m_failures <= m_policy.spins + m_policy.yields)
+        return Step::Yield;
+
+    // Rounded up so the last sleep reaches the deadline
+    const uint64_t left = (m_deadline - now + 999) / 1000;
+    sleep = uint32_t(std::min<uint64_t>(m_sleep, left));
+    m_sleep = std::min(m_sleep * 2, std::max(m_policy.maxSleep, m_policy.firstSleep));
+    return Step::Sleep;
+}
+
+void ContentionStats::Record(const AcquireResult& result, const std::wstring& holder)
+{
+    ++(result.acquired ? m_acquired : m_failed);
+    if (result.attempts > 1)
+        ++m_contended;
+    m_attempts.Add(result.attempts);
+    m_wait.Add(result.waited);
+
+    if (!holder.empty())
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto it = m_holders.find(holder);
+        if (it != m_holders.end())
+            ++it->second;
+        else if (m_holders.size() < MaxHolders)
+            m_holders.emplace(holder, 1);
+    }
+}
+
+std::vector<std::pair<std::wstring, uint64_t>> ContentionStats::Holders() const
+{
+    std::vector<std::pair<std::wstring, uint64_t>> holders;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        holders.assign(m_holders.begin(), m_holders.end());
+    }
+    std::stable_sort(holders.begin(), holders.end(), [](const std::pair<std::wstring, uint64_t>& a, const std::pair<std::wstring, uint64_t>& b) { return a.second > b.second; });
+    return holders;
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Histogram.h"
+
+struct BackoffPolicy
+{
+    uint32_t spins = 2;         // attempts straight after a failure
+    uint32_t yields = 4;        // attempts after giving up the time slice
+    uint32_t firstSleep = 1;    // ms, doubled after each sleep
+    uint32_t maxSleep = 50;     // ms
+    uint32_t timeout = 1000;    // ms from the first attempt
+};
+
+// What to do after each failed attempt to take a contended resource: a few immediate
+// retries, then yields, then sleeps growing exponentially, until the timeout.
+class Backoff
+{
+public:
+    enum class Step
+    {
+        Retry,
+        Yield,
+        Sleep,
+        GiveUp,
+    };
+
+    // Times are in us.
+    Backoff(const BackoffPolicy& policy, uint64_t start);
+
+    // For Sleep, sleep is set to the ms to wait, which never goes past the timeout.
+    Step Next(uint64_t now, uint32_t& sleep);
+    uint32_t Failures() const { return m_failures; }
+
+private:
+    BackoffPolicy m_policy;
+    uint64_t m_deadline;
+    uint32_t m_failures = 0;
+    uint32_t m_sleep;
+};
+
+struct AcquireResult
+{
+    bool acquired;
+    uint32_t attempts;
+    uint64_t waited;    // us
+};
+
+// Calls tryAcquire until it returns true or the policy gives up.
+// clock returns us, sleep takes ms.
+template <class Try, class Clock, class Sleep, class Yield>
+AcquireResult Acquire(const BackoffPolicy& policy, Try tryAcquire, Clock clock, Sleep sleep, Yield yield)
+{
+    const uint64_t start = clock();
+    Backoff backoff(policy, start);
+    uint32_t attempts = 0;
+    while (true)
+    {
+        ++attempts;
+        if (tryAcquire())
+            return { true, attempts, clock() - start };
+        uint32_t ms = 0;
+        switch (backoff.Next(clock(), ms))
+        {
+        case Backoff::Step::Retry:  break;
+        case Backoff::Step::Yield:  yield(); break;
+        case Backoff::Step::Sleep:  sleep(ms); break;
+        case Backoff::Step::GiveUp: return { false, attempts, clock() - start };
+        }
+    }
+}
+
+// Counters for a contended resource, recorded from any thread.
+class ContentionStats
+{
+public:
+    static const size_t MaxHolders = 64;
+
+    // holder is whoever had the resource when an attempt failed, if known.
+    void Record(const AcquireResult& result, const std::wstring& holder);
+
+    uint64_t Acquired() const { return m_acquired; }
+    uint64_t Failed() const { return m_failed; }
+    // Acquired or failed after more than one attempt.
+    uint64_t Contended() const { return m_contended; }
+    const Histogram& Attempts() const { return m_attempts; }
+    // us
+    const Histogram& Wait() const { return m_wait; }
+    // Most often seen first.
+    std::vector<std::pair<std::wstring, uint64_t>> Holders() const;
+
+private:
+    std::atomic<uint64_t> m_acquired{ 0 };
+    std::atomic<uint64_t> m_failed{ 0 };
+    std::atomic<uint64_t> m_contended{ 0 };
+    Histogram m_attempts;
+    Histogram m_wait;
+
+    mutable std::mutex m_mutex;
+    std::map<std::wstring, uint64_t> m_holders;
+};
@@ -1,13 +1,23 @@
 #pragma once
+#include <cstdlib>
 #include <string>
 
 inline std::string w2a(const wchar_t* sw)
 {
+#ifdef _MSC_VER
     size_t sz;
     wcstombs_s(&sz, nullptr, 0, sw, 0);
     // TODO Throw on error?
     std::string s(sz - 1, '-');
     wcstombs_s(nullptr, const_cast<char*>(s.data()), sz, sw, sz);
+#else
+    const size_t sz = wcstombs(nullptr, sw, 0);
+    // TODO Throw on error?
+    if (sz == size_t(-1))
+        return std::string();
+    std::string s(sz, '-');
+    wcstombs(const_cast<char*>(s.data()), sw, sz + 1);
+#endif
     return s;
 }
 
@@ -18,11 +28,20 @@ inline std::string w2a(const std::wstring& sw)
 
 inline std::wstring a2w(const char* sa)
 {
+#ifdef _MSC_VER
     size_t sz;
     mbstowcs_s(&sz, nullptr, 0, sa, 0);
     // TODO Throw on error?
     std::wstring s(sz - 1, '-');
     mbstowcs_s(nullptr, const_cast<wchar_t*>(s.data()), sz, sa, sz);
+#else
+    const size_t sz = mbstowcs(nullptr, sa, 0);
+    // TODO Throw on error?
+    if (sz == size_t(-1))
+        return std::wstring();
+    std::wstring s(sz, '-');
+    mbstowcs(const_cast<wchar_t*>(s.data()), sa, sz + 1);
+#endif
     return s;
 }
 
@@ -0,0 +1,367 @@
+#include "Dib.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RAD_DIB_SSE2
+#endif
+
+namespace
+{
+    // Values from wingdi.h, so this builds without Windows.h
+    const uint32_t BiRgb = 0;
+    const uint32_t BiBitfields = 3;
+    const uint32_t BiAlphaBitfields = 6;
+
+    const uint32_t CoreHeaderSize = 12;
+    const uint32_t InfoHeaderSize = 40;
+    const uint64_t MaxPixels = uint64_t(1) << 27;
+
+    const uint32_t Opaque = 0xFF000000;
+
+    inline uint16_t Get16(const uint8_t* p) { uint16_t v; memcpy(&v, p, sizeof(v)); return v; }
+    inline uint32_t Get32(const uint8_t* p) { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+
+    struct Channel
+    {
+        uint32_t mask;
+        int shift;
+        uint32_t max;
+    };
+
+    Channel MakeChannel(const uint32_t mask)
+    {
+        Channel c = { mask, 0, 0 };
+        if (mask != 0)
+        {
+            while (((mask >> c.shift) & 1) == 0)
+                ++c.shift;
+            c.max = mask >> c.shift;
+        }
+        return c;
+    }
+
+    inline uint32_t Scale(const uint32_t px, const Channel& c)
+    {
+        return c.max == 0 ? 0 : ((((px & c.mask) >> c.shift) * 255 + c.max / 2) / c.max);
+    }
+
+    inline uint8_t Mul255(const uint32_t c, const uint32_t a)
+    {
+        const uint32_t t = c * a + 128;
+        return uint8_t((t + (t >> 8)) >> 8);
+    }
+}
+
+void PremultiplyBgra(uint32_t* const pixels, const size_t count)
+{
+    size_t i = 0;
+#ifdef RAD_DIB_SSE2
+    // Four pixels at a time, widened to 16 bits, with the same rounding as Mul255
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(128);
+    const __m128i alpha = _mm_set1_epi32(int(Opaque));
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128i px = _mm_loadu_si128((const __m128i*) (pixels + i));
+        __m128i lo = _mm_unpacklo_epi8(px, zero);
+        __m128i hi = _mm_unpackhi_epi8(px, zero);
+        const __m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xFF), 0xFF);
+        const __m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xFF), 0xFF);
+        lo = _mm_add_epi16(_mm_mullo_epi16(lo, alo), round);
+        hi = _mm_add_epi16(_mm_mullo_epi16(hi, ahi), round);
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+        const __m128i out = _mm_packus_epi16(lo, hi);
+        _mm_storeu_si128((__m128i*) (pixels + i), _mm_or_si128(_mm_andnot_si128(alpha, out), _mm_and_si128(px, alpha)));
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        const uint32_t p = pixels[i];
+        const uint32_t a = p >> 24;
+        pixels[i] = (a << 24) | (uint32_t(Mul255((p >> 16) & 0xFF, a)) << 16) | (uint32_t(Mul255((p >> 8) & 0xFF, a)) << 8) | Mul255(p & 0xFF, a);
+    }
+}
+
+bool ParseDib(const uint8_t* const data, const size_t size, DibInfo& info)
+{
+    if (data == nullptr || size < 4)
+        return false;
+
+    const uint32_t headerSize = Get32(data);
+    int64_t width, height;
+    uint32_t bitCount, compression = BiRgb, clrUsed = 0;
+    uint32_t masks[4] = {};
+    uint64_t maskBytes = 0;
+    if (headerSize == CoreHeaderSize && size >= CoreHeaderSize)
+    {
+        width = Get16(data + 4);
+        height = Get16(data + 6);
+        bitCount = Get16(data + 10);
+    }
+    else if (headerSize >= InfoHeaderSize && headerSize <= size)
+    {
+        width = int32_t(Get32(data + 4));
+        height = int32_t(Get32(data + 8));
+        bitCount = Get16(data + 14);
+        compression = Get32(data + 16);
+        clrUsed = Get32(data + 32);
+        // The masks are part of the later headers, and follow a BITMAPINFOHEADER
+        const uint32_t maskCount = compression == BiAlphaBitfields ? 4 : compression == BiBitfields ? 3 : 0;
+        const uint32_t headerMasks = std::min<uint32_t>((headerSize - InfoHeaderSize) / 4, 4);
+        if (headerMasks >= maskCount)
+        {
+            for (uint32_t i = 0; i < headerMasks; ++i)
+                masks[i] = Get32(data + InfoHeaderSize + i * 4);
+        }
+        else
+        {
+            maskBytes = maskCount * 4;
+            if (headerSize + maskBytes > size)
+                return false;
+            for (uint32_t i = 0; i < maskCount; ++i)
+                masks[i] = Get32(data + headerSize + i * 4);
+        }
+    }
+    else
+        return false;
+
+    const bool topDown = height < 0;
+    height = topDown ? -height : height;
+    if (width <= 0 || height == 0 || uint64_t(width) * uint64_t(height) > MaxPixels)
+        return false;
+
+    switch (bitCount)
+    {
+    case 1: case 4: case 8: case 24:
+        if (compression != BiRgb)
+            return false;
+        break;
+    case 16: case 32:
+        if (compression != BiRgb && compression != BiBitfields && compression != BiAlphaBitfields)
+            return false;
+        break;
+    default:
+        return false;
+    }
+
+    if (compression == BiRgb)
+    {
+        // Masks in a later header are only used with BI_BITFIELDS, except for alpha
+        const uint32_t alphaMask = bitCount == 32 ? (masks[3] != 0 ? masks[3] : Opaque) : 0;
+        const bool rgb555 = bitCount == 16;
+        masks[0] = rgb555 ? 0x7C00 : 0xFF0000;
+        masks[1] = rgb555 ? 0x03E0 : 0x00FF00;
+        masks[2] = rgb555 ? 0x001F : 0x0000FF;
+        masks[3] = alphaMask;
+    }
+
+    // Colour table, which can also be present above 8 bpp
+    const uint64_t entrySize = headerSize == CoreHeaderSize ? 3 : 4;
+    const uint64_t colors = bitCount <= 8 ? (clrUsed != 0 ? std::min<uint64_t>(clrUsed, uint64_t(1) << bitCount) : uint64_t(1) << bitCount) : clrUsed;
+    const uint64_t paletteOffset = uint64_t(headerSize) + maskBytes;
+    uint64_t offset = paletteOffset + colors * entrySize;
+
+    const uint64_t stride = (uint64_t(width) * bitCount + 31) / 32 * 4;
+    const uint64_t bitsSize = stride * uint64_t(height);
+    // Some applications repeat the masks of a later header after it
+    if (headerSize > InfoHeaderSize && compression != BiRgb && maskBytes == 0 && offset + 12 + bitsSize <= size
+        && memcmp(data + headerSize, masks, 12) == 0)
+        offset += 12;
+    if (offset > size || bitsSize > size - offset)
+        return false;
+
+    info.width = int32_t(width);
+    info.height = int32_t(height);
+    info.topDown = topDown;
+    info.bitCount = bitCount;
+    info.offset = offset;
+    info.stride = stride;
+    std::copy(std::begin(masks), std::end(masks), std::begin(info.masks));
+
+    // Indices past the table are black
+    std::fill(std::begin(info.palette), std::end(info.palette), Opaque);
+    if (bitCount <= 8)
+    {
+        for (uint64_t i = 0; i < colors; ++i)
+        {
+            const uint8_t* const c = data + paletteOffset + i * entrySize;
+            info.palette[i] = Opaque | (uint32_t(c[2]) << 16) | (uint32_t(c[1]) << 8) | c[0];
+        }
+    }
+
+    // Straight alpha, unless there isn't really any
+    info.alpha = false;
+    if (masks[3] != 0)
+    {
+        for (uint64_t y = 0; y < uint64_t(height) && !info.alpha; ++y)
+        {
+            const uint8_t* const src = data + offset + stride * y;
+            for (uint64_t x = 0; x < uint64_t(width) && !info.alpha; ++x)
+                info.alpha = ((bitCount == 16 ? Get16(src + x * 2) : Get32(src + x * 4)) & masks[3]) != 0;
+        }
+    }
+    return true;
+}
+
+
+void DecodeDibRow(const DibInfo& info, const uint8_t* const data, const int32_t y, uint32_t* const dst)
+{
+    const uint32_t* const masks = info.masks;
+    const uint32_t* const palette = info.palette;
+    const uint8_t* const src = data + info.offset + info.stride * uint64_t(info.topDown ? y : info.height - 1 - y);
+    const Channel r = MakeChannel(masks[0]), g = MakeChannel(masks[1]), b = MakeChannel(masks[2]), a = MakeChannel(masks[3]);
+    const size_t w = size_t(info.width);
+    switch (info.bitCount)
+    {
+    case 1: case 4: case 8:
+    {
+        const uint32_t perByte = 8 / info.bitCount;
+        const uint32_t mask = (1u << info.bitCount) - 1;
+        for (size_t x = 0; x < w; ++x)
+        {
+            const uint32_t shift = (perByte - 1 - uint32_t(x % perByte)) * info.bitCount;
+            dst[x] = palette[(src[x / perByte] >> shift) & mask];
+        }
+        break;
+    }
+    case 24:
+        for (size_t x = 0; x < w; ++x)
+            dst[x] = Opaque | (uint32_t(src[x * 3 + 2]) << 16) | (uint32_t(src[x * 3 + 1]) << 8) | src[x * 3];
+        break;
+    case 16:
+        for (size_t x = 0; x < w; ++x)
+        {
+            const uint32_t p = Get16(src + x * 2);
+            dst[x] = (a.max != 0 ? Scale(p, a) << 24 : Opaque) | (Scale(p, r) << 16) | (Scale(p, g) << 8) | Scale(p, b);
+        }
+        break;
+    case 32:
+        if (masks[0] == 0xFF0000 && masks[1] == 0xFF00 && masks[2] == 0xFF && (masks[3] == 0 || masks[3] == Opaque))
+            memcpy(dst, src, w * 4);
+        else
+        {
+            for (size_t x = 0; x < w; ++x)
+            {
+                const uint32_t p = Get32(src + x * 4);
+                dst[x] = (a.max != 0 ? Scale(p, a) << 24 : Opaque) | (Scale(p, r) << 16) | (Scale(p, g) << 8) | Scale(p, b);
+            }
+        }
+        break;
+    }
+
+    if (info.alpha)
+        PremultiplyBgra(dst, w);
+    else if (masks[3] != 0 || info.bitCount == 32)
+        for (size_t x = 0; x < w; ++x)
+            dst[x] |= Opaque;
+}
+
+bool DecodeDib(const uint8_t* const data, const size_t size, BgraImage& image)
+{
+    DibInfo info;
+    if (!ParseDib(data, size, info))
+        return false;
+
+    image.width = info.width;
+    image.height = info.height;
+    image.pixels.resize(size_t(info.width) * size_t(info.height));
+    for (int32_t y = 0; y < info.height; ++y)
+        DecodeDibRow(info, data, y, image.pixels.data() + size_t(y) * size_t(info.width));
+    return true;
+}
+
+BoxScaler::BoxScaler(const int32_t srcWidth, const int32_t srcHeight, const int32_t width, const int32_t height)
+    : m_srcWidth(srcWidth)
+    , m_srcHeight(srcHeight)
+{
+    // A box of up to 4096 x 4096 pixels can't overflow the 32 bit sums
+    m_image.width = std::max(std::min(width, srcWidth), (srcWidth + 4095) / 4096);
+    m_image.height = std::max(std::min(height, srcHeight), (srcHeight + 4095) / 4096);
+    m_image.pixels.resize(size_t(m_image.width) * size_t(m_image.height));
+    m_sums.resize(size_t(m_image.width) * 4);
+    for (int32_t i = 0; i <= m_image.width; ++i)
+        m_columns.push_back(int32_t(int64_t(i) * srcWidth / m_image.width));
+}
+
+void BoxScaler::AddRow(const uint32_t* const row)
+{
+    if (m_srcRow >= m_srcHeight)
+        return;
+
+    for (int32_t i = 0; i < m_image.width; ++i)
+    {
+        int32_t x = m_columns[i];
+        const int32_t end = m_columns[i + 1];
+        uint32_t* const sum = m_sums.data() + size_t(i) * 4;
+#ifdef RAD_DIB_SSE2
+        // Channels of 4 pixels at a time in 16 bit lanes, widened every 128 steps
+        const __m128i zero = _mm_setzero_si128();
+        __m128i acc = _mm_setzero_si128();
+        while (x + 4 <= end)
+        {
+            __m128i acc16 = _mm_setzero_si128();
+            for (int32_t n = 0; n < 128 && x + 4 <= end; ++n, x += 4)
+            {
+                const __m128i px = _mm_loadu_si128((const __m128i*) (row + x));
+                acc16 = _mm_add_epi16(acc16, _mm_add_epi16(_mm_unpacklo_epi8(px, zero), _mm_unpackhi_epi8(px, zero)));
+            }
+            acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_unpacklo_epi16(acc16, zero), _mm_unpackhi_epi16(acc16, zero)));
+        }
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i*) lanes, acc);
+        for (int c = 0; c < 4; ++c)
+            sum[c] += lanes[c];
+#endif
+        for (; x < end; ++x)
+        {
+            const uint32_t p = row[x];
+            sum[0] += p & 0xFF;
+            sum[1] += (p >> 8) & 0xFF;
+            sum[2] += (p >> 16) & 0xFF;
+            sum[3] += p >> 24;
+        }
+    }
+    ++m_rows;
+    ++m_srcRow;
+
+    const int32_t next = int32_t(int64_t(m_srcRow) * m_image.height / m_srcHeight);
+    if (m_srcRow == m_srcHeight || next != m_row)
+        Flush();
+}
+
+void BoxScaler::Flush()
+{
+    uint32_t* const out = m_image.pixels.data() + size_t(m_row) * size_t(m_image.width);
+    for (int32_t i = 0; i < m_image.width; ++i)
+    {
+        const uint32_t count = uint32_t(m_columns[i + 1] - m_columns[i]) * uint32_t(m_rows);
+        uint32_t* const sum = m_sums.data() + size_t(i) * 4;
+        uint32_t p = 0;
+        for (int c = 0; c < 4; ++c)
+            p |= uint32_t((uint64_t(sum[c]) + count / 2) / count) << (c * 8);
+        out[i] = p;
+        std::fill(sum, sum + 4, 0);
+    }
+    m_rows = 0;
+    ++m_row;
+}
+
+void FitSize(const int32_t width, const int32_t height, const int32_t maxWidth, const int32_t maxHeight, int32_t& outWidth, int32_t& outHeight)
+{
+    outWidth = width;
+    outHeight = height;
+    if (outWidth > maxWidth)
+    {
+        outHeight = std::max<int32_t>(1, int32_t(int64_t(outHeight) * maxWidth / outWidth));
+        outWidth = maxWidth;
+    }
+    if (outHeight > maxHeight)
+    {
+        outWidth = std::max<int32_t>(1, int32_t(int64_t(outWidth) * maxHeight / outHeight));
+        outHeight = maxHeight;
+    }
+}
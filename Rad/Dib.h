@@ -0,0 +1,68 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Premultiplied BGRA, B first in memory, with the top row first.
+struct BgraImage
+{
+    int32_t width = 0;
+    int32_t height = 0;
+    std::vector<uint32_t> pixels;
+};
+
+// Layout of a packed DIB, from ParseDib.
+struct DibInfo
+{
+    int32_t width;
+    int32_t height;
+    bool topDown;
+    uint32_t bitCount;
+    uint64_t offset;        // of the bits
+    uint64_t stride;
+    uint32_t masks[4];      // red, green, blue and alpha
+    bool alpha;             // there is straight alpha to premultiply
+    uint32_t palette[256];
+};
+
+// Decodes a packed DIB as held by CF_DIB and CF_DIBV5: a BITMAPCOREHEADER, BITMAPINFOHEADER
+// or later header, any colour masks and colour table, then the bits.
+// Handles 1, 4, 8, 16, 24 and 32 bpp with BI_RGB, BI_BITFIELDS or BI_ALPHABITFIELDS, in either
+// row order. A 32 bpp alpha channel that is all zero is taken as opaque.
+// Returns false for compressed, truncated or malformed data.
+bool DecodeDib(const uint8_t* data, size_t size, BgraImage& image);
+
+// The same as DecodeDib a row at a time, so a large image can be scaled without decoding all of it.
+bool ParseDib(const uint8_t* data, size_t size, DibInfo& info);
+// Row y counts from the top, out receives info.width pixels.
+void DecodeDibRow(const DibInfo& info, const uint8_t* data, int32_t y, uint32_t* out);
+
+// Converts straight alpha to premultiplied, in place.
+void PremultiplyBgra(uint32_t* pixels, size_t count);
+
+// Area averaging downscale of premultiplied BGRA, fed the source rows from the top.
+class BoxScaler
+{
+public:
+    // The output is no larger than the source, and no smaller than 1/4096th of it.
+    BoxScaler(int32_t srcWidth, int32_t srcHeight, int32_t width, int32_t height);
+
+    void AddRow(const uint32_t* row);
+    // Complete once every source row has been added.
+    BgraImage& Result() { return m_image; }
+
+private:
+    void Flush();
+
+    int32_t m_srcWidth;
+    int32_t m_srcHeight;
+    std::vector<int32_t> m_columns;     // first source column of each output column, then m_srcWidth
+    std::vector<uint32_t> m_sums;       // per output pixel and channel
+    int32_t m_srcRow = 0;
+    int32_t m_row = 0;
+    int32_t m_rows = 0;                 // source rows in m_sums
+    BgraImage m_image;
+};
+
+// Largest size within maxWidth x maxHeight with the same aspect ratio, never larger than the source.
+void FitSize(int32_t width, int32_t height, int32_t maxWidth, int32_t maxHeight, int32_t& outWidth, int32_t& outHeight);
@@ -3,25 +3,66 @@
 #include <ctime>
 #include <cassert>
 #include <cstdarg>
+#include <cstdio>
+#include <cwchar>
+
+#ifndef _In_z_
+#define _In_z_
+#endif
+#ifndef _Printf_format_string_
+#define _Printf_format_string_
+#endif
 
 inline void Format(std::string& buffer, _In_z_ _Printf_format_string_ char const* format, va_list args)
 {
+#ifdef _MSC_VER
     int const _Result1 = _vscprintf_l(format, NULL, args);
     //if (buffer.size() < _Result1 + 1)
     buffer.resize(_Result1);
     int const _Result2 = _vsprintf_s_l(const_cast<char*>(buffer.data()), static_cast<size_t>(_Result1) + 1, format, NULL, args);
+#else
+    va_list measure;
+    va_copy(measure, args);
+    int const _Result1 = vsnprintf(nullptr, 0, format, measure);
+    va_end(measure);
+    buffer.resize(_Result1);
+    int const _Result2 = vsnprintf(const_cast<char*>(buffer.data()), static_cast<size_t>(_Result1) + 1, format, args);
+#endif
     assert(-1 != _Result2);
     assert(_Result1 == _Result2);
 }
 
 inline void Format(std::wstring& buffer, _In_z_ _Printf_format_string_ wchar_t const* format, va_list args)
 {
+#ifdef _MSC_VER
     int const _Result1 = _vscwprintf_l(format, NULL, args);
     //if (buffer.size() < _Result1 + 1)
     buffer.resize(_Result1);
     int const _Result2 = _vswprintf_s_l(const_cast<wchar_t*>(buffer.data()), static_cast<size_t>(_Result1) + 1, format, NULL, args);
     assert(-1 != _Result2);
     assert(_Result1 == _Result2);
+#else
+    // vswprintf doesn't measure, so grow until it fits
+    buffer.resize(64);
+    for (;;)
+    {
+        va_list attempt;
+        va_copy(attempt, args);
+        int const _Result = vswprintf(const_cast<wchar_t*>(buffer.data()), buffer.size() + 1, format, attempt);
+        va_end(attempt);
+        if (_Result >= 0)
+        {
+            buffer.resize(_Result);
+            break;
+        }
+        if (buffer.size() >= (1 << 20))
+        {
+            buffer.clear();
+            break;
+        }
+        buffer.resize(buffer.size() * 2);
+    }
+#endif
 }
 
 inline void Format(std::string& buffer, _In_z_ _Printf_format_string_ char const* format, ...)
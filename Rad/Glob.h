@@ -0,0 +1,32 @@
+#pragma once
+
+// * and ? wildcards, ignoring ASCII case.
+inline bool Glob(const char* s, const char* p)
+{
+    auto lower = [](char c) { return c >= 'A' && c <= 'Z' ? char(c + 'a' - 'A') : c; };
+    const char* star = nullptr;
+    const char* retry = nullptr;
+    while (*s != '\0')
+    {
+        if (*p == '*')
+        {
+            star = ++p;
+            retry = s;
+        }
+        else if (*p != '\0' && (*p == '?' || lower(*p) == lower(*s)))
+        {
+            ++p;
+            ++s;
+        }
+        else if (star != nullptr)
+        {
+            p = star;
+            s = ++retry;
+        }
+        else
+            return false;
+    }
+    while (*p == '*')
+        ++p;
+    return *p == '\0';
+}
@@ -0,0 +1,79 @@
+#include "HexDump.h"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    const size_t OffsetChars = 8;
+    const size_t HexColumn = OffsetChars + 2;
+    const size_t TextColumn = HexColumn + HexRowBytes * 3 + 2;
+
+    // One lookup per byte instead of a printf
+    struct Tables
+    {
+        char hex[256][3];   // "XX "
+        char text[256];
+
+        Tables()
+        {
+            const char digits[] = "0123456789ABCDEF";
+            for (int b = 0; b < 256; ++b)
+            {
+                hex[b][0] = digits[b >> 4];
+                hex[b][1] = digits[b & 0xF];
+                hex[b][2] = ' ';
+                text[b] = b >= 0x20 && b < 0x7F ? char(b) : '.';
+            }
+        }
+    };
+
+    const Tables s_tables;
+
+    inline size_t HexPos(size_t i) { return HexColumn + i * 3 + (i >= HexRowBytes / 2 ? 1 : 0); }
+}
+
+void HexDumpRow(char* const out, const uint64_t offset, const uint8_t* const data, const size_t size)
+{
+    const Tables& t = s_tables;
+    for (size_t i = 0; i < OffsetChars / 2; ++i)
+        memcpy(out + i * 2, t.hex[uint8_t(offset >> (24 - i * 8))], 2);
+    memset(out + OffsetChars, ' ', HexRowChars - OffsetChars);
+
+    if (size >= HexRowBytes)
+    {
+        // Unrolled for the full rows, which is nearly all of them
+        char* const h = out + HexColumn;
+        for (size_t i = 0; i < HexRowBytes / 2; ++i)
+            memcpy(h + i * 3, t.hex[data[i]], 3);
+        for (size_t i = HexRowBytes / 2; i < HexRowBytes; ++i)
+            memcpy(h + i * 3 + 1, t.hex[data[i]], 3);
+        char* const a = out + TextColumn;
+        for (size_t i = 0; i < HexRowBytes; ++i)
+            a[i] = t.text[data[i]];
+    }
+    else
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            memcpy(out + HexPos(i), t.hex[data[i]], 2);
+            out[TextColumn + i] = t.text[data[i]];
+        }
+    }
+}
+
+size_t HexDumpRows(std::vector<char>& out, const uint8_t* const data, const size_t size, const size_t firstRow, const size_t rowCount)
+{
+    const size_t total = HexRowCount(size);
+    if (firstRow >= total)
+        return 0;
+    const size_t rows = std::min(rowCount, total - firstRow);
+    if (out.size() < rows * HexRowChars)
+        out.resize(rows * HexRowChars);
+
+    for (size_t r = 0; r < rows; ++r)
+    {
+        const size_t offset = (firstRow + r) * HexRowBytes;
+        HexDumpRow(out.data() + r * HexRowChars, offset, data + offset, std::min(HexRowBytes, size - offset));
+    }
+    return rows;
+}
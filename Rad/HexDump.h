@@ -0,0 +1,18 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Rows of 16 bytes, "00000010  48 65 6C 6C 6F 2C 20 77  6F 72 6C 64 21 0D 0A 00  Hello, world!..."
+// Offsets are the low 32 bits.
+const size_t HexRowBytes = 16;
+const size_t HexRowChars = 76;
+
+inline size_t HexRowCount(size_t size) { return (size + HexRowBytes - 1) / HexRowBytes; }
+
+// Writes HexRowChars characters for up to HexRowBytes bytes, padded with spaces and not terminated.
+void HexDumpRow(char* out, uint64_t offset, const uint8_t* data, size_t size);
+
+// Formats rows [firstRow, firstRow + rowCount) of data into out, HexRowChars apart.
+// out is only grown so it can be reused. Returns the number of rows formatted.
+size_t HexDumpRows(std::vector<char>& out, const uint8_t* data, size_t size, size_t firstRow, size_t rowCount);
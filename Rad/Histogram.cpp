@@ -0,0 +1,67 @@
+#include "Histogram.h"
+#include <algorithm>
+#include <cmath>
+
+const int Histogram::SubBits;
+const size_t Histogram::Buckets;
+
+Histogram::Histogram()
+{
+    Clear();
+}
+
+void Histogram::Clear()
+{
+    for (std::atomic<uint64_t>& c : m_counts)
+        c.store(0, std::memory_order_relaxed);
+    m_count = 0;
+    m_total = 0;
+    m_max = 0;
+}
+
+// The top SubBits + 1 bits of the value
+size_t Histogram::Bucket(const uint64_t value)
+{
+    if (value < (uint64_t(1) << SubBits))
+        return size_t(value);
+    int msb = SubBits;
+    while (msb < 63 && (value >> (msb + 1)) != 0)
+        ++msb;
+    const int shift = msb - SubBits;
+    return (size_t(shift + 1) << SubBits) + size_t((value >> shift) & ((uint64_t(1) << SubBits) - 1));
+}
+
+uint64_t Histogram::BucketMax(const size_t bucket)
+{
+    if (bucket < (size_t(1) << SubBits))
+        return bucket;
+    const int shift = int(bucket >> SubBits) - 1;
+    const uint64_t mantissa = (uint64_t(1) << SubBits) + (bucket & ((size_t(1) << SubBits) - 1));
+    return ((mantissa + 1) << shift) - 1;   // wraps to UINT64_MAX for the last bucket
+}
+
+void Histogram::Add(const uint64_t value)
+{
+    m_counts[Bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    m_total.fetch_add(value, std::memory_order_relaxed);
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+        ;
+    m_count.fetch_add(1, std::memory_order_release);
+}
+
+uint64_t Histogram::Percentile(const double p) const
+{
+    const uint64_t count = m_count.load(std::memory_order_acquire);
+    if (count == 0)
+        return 0;
+    const uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(std::min(std::max(p, 0.0), 1.0) * double(count))));
+    uint64_t seen = 0;
+    for (size_t b = 0; b < Buckets; ++b)
+    {
+        seen += m_counts[b].load(std::memory_order_relaxed);
+        if (seen >= rank)
+            return std::min<uint64_t>(BucketMax(b), m_max);
+    }
+    return m_max;
+}
@@ -1,7 +1,11 @@
 #include "Log.h"
 
 #include <Windows.h>
+#include <memory>
+#include <string>
+#include <vector>
 
+#include "AsyncLog.h"
 #include "Format.h"
 
 thread_local HRESULT g_radloghr = ERROR_SUCCESS;
@@ -40,14 +44,27 @@ namespace {
         }
     }
 
-    void LogOutputDebug(LogLevel l, const char* msg, SrcLocA src)
+    // Written from the logging thread
+    class DebugOutputSink : public LogSink
     {
-        OutputDebugStringA(Format("%s: %s\n%s\n%s(%u)\n", AsStringA(l), msg, src.funcsig, src.file, src.line).c_str());
+    public:
+        void Write(LogLevel /*l*/, const std::string& line) override
+        {
+            std::wstring w(MultiByteToWideChar(CP_UTF8, 0, line.data(), int(line.size()), nullptr, 0), L'\0');
+            MultiByteToWideChar(CP_UTF8, 0, line.data(), int(line.size()), &w[0], int(w.size()));
+            w += L'\n';
+            OutputDebugStringW(w.c_str());
+        }
+    };
+
+    void LogOutput(LogLevel l, const char* msg, SrcLocA src)
+    {
+        LogWrite(l, msg, src.file, src.line, src.funcsig);
     }
 
-    void LogOutputDebug(LogLevel l, const wchar_t* msg, SrcLocW src)
+    void LogOutput(LogLevel l, const wchar_t* msg, SrcLocW src)
     {
-        OutputDebugStringW(Format(L"%s: %s\n%s\n%s(%u)\n", AsStringW(l), msg, src.funcsig, src.file, src.line).c_str());
+        LogWrite(l, msg, src.file, src.line, src.funcsig);
     }
 
     UINT GetIcon(LogLevel l)
@@ -63,49 +80,110 @@ namespace {
         }
     }
 
+    struct Notification
+    {
+        LogLevel l;
+        bool wide;
+        std::string a;
+        std::wstring w;
+        unsigned count;
+    };
+
+    thread_local int t_deferDepth = 0;
+    thread_local std::vector<Notification> t_pending;
+    thread_local UINT_PTR t_pendingTimer = 0;
+
+    void Show(const Notification& n)
+    {
+        if (n.wide)
+            MessageBoxW(g_hWndLog, (n.count > 1 ? n.w + Format(L"\n\nRepeated %u times", n.count) : n.w).c_str(), g_strLogCaptionW, MB_OK | GetIcon(n.l));
+        else
+            MessageBoxA(g_hWndLog, (n.count > 1 ? n.a + Format("\n\nRepeated %u times", n.count) : n.a).c_str(), g_strLogCaptionA, MB_OK | GetIcon(n.l));
+    }
+
+    void CALLBACK ShowPending(HWND, UINT, UINT_PTR id, DWORD)
+    {
+        KillTimer(NULL, id);
+        t_pendingTimer = 0;
+        const std::vector<Notification> pending = std::move(t_pending);
+        t_pending.clear();
+        for (const Notification& n : pending)
+            Show(n);
+    }
+
+    void Notify(Notification n)
+    {
+        if (t_deferDepth == 0)
+        {
+            Show(n);
+            return;
+        }
+        for (Notification& p : t_pending)
+        {
+            if (p.l == n.l && p.wide == n.wide && p.a == n.a && p.w == n.w)
+            {
+                ++p.count;
+                return;
+            }
+        }
+        t_pending.push_back(std::move(n));
+    }
+
     void LogMessageBox(LogLevel l, const char* msg, SrcLocA src)
     {
-        MessageBoxA(g_hWndLog, Format("%s: %s\n%s %s:%u", AsStringA(l), msg, src.funcsig, src.file, src.line).c_str(), g_strLogCaptionA, MB_OK | GetIcon(l));
+        Notify({ l, false, Format("%s: %s\n%s %s:%u", AsStringA(l), msg, src.funcsig, src.file, src.line), std::wstring(), 1 });
     }
 
     void LogMessageBox(LogLevel l, const wchar_t* msg, SrcLocW src)
     {
-        MessageBoxW(g_hWndLog, Format(L"%s: %s\n%s %s:%u", AsStringW(l), msg, src.funcsig, src.file, src.line).c_str(), g_strLogCaptionW, MB_OK | GetIcon(l));
+        Notify({ l, true, std::string(), Format(L"%s: %s\n%s %s:%u", AsStringW(l), msg, src.funcsig, src.file, src.line), 1 });
     }
 }
 
 LogFA LogRegistryA[5][2] = {
 #ifdef _DEBUG
-    { LogOutputDebug },
+    { LogOutput },
 #else
     { },
 #endif
-    { LogOutputDebug, LogMessageBox },
-    { LogOutputDebug, LogMessageBox },
-    { LogOutputDebug, LogMessageBox },
+    { LogOutput, LogMessageBox },
+    { LogOutput, LogMessageBox },
+    { LogOutput, LogMessageBox },
 #ifdef _DEBUG
-    { LogOutputDebug, LogMessageBox },
+    { LogOutput, LogMessageBox },
 #else
-    { },
+    { LogOutput },
 #endif
 };
 
 LogFW LogRegistryW[5][2] = {
 #ifdef _DEBUG
-    { LogOutputDebug },
+    { LogOutput },
 #else
     { },
 #endif
-    { LogOutputDebug, LogMessageBox },
-    { LogOutputDebug, LogMessageBox },
-    { LogOutputDebug, LogMessageBox },
+    { LogOutput, LogMessageBox },
+    { LogOutput, LogMessageBox },
+    { LogOutput, LogMessageBox },
 #ifdef _DEBUG
-    { LogOutputDebug, LogMessageBox },
+    { LogOutput, LogMessageBox },
 #else
-    { },
+    { LogOutput },
 #endif
 };
 
+RadLogDeferNotifications::RadLogDeferNotifications()
+{
+    ++t_deferDepth;
+}
+
+RadLogDeferNotifications::~RadLogDeferNotifications()
+{
+    // Shown from the message loop, after the message being handled has returned
+    if (--t_deferDepth == 0 && !t_pending.empty() && t_pendingTimer == 0)
+        t_pendingTimer = SetTimer(NULL, 0, USER_TIMER_MINIMUM, ShowPending);
+}
+
 extern "C" {
 
     void RadLogInitWnd(HWND hWndLog, LPCSTR strLogCaptionA, LPCWSTR strLogCaptionW)
@@ -113,6 +191,23 @@ extern "C" {
         g_hWndLog = hWndLog;
         g_strLogCaptionA = strLogCaptionA;
         g_strLogCaptionW = strLogCaptionW;
+
+        static bool s_debugOutput = false;
+        if (!s_debugOutput)
+        {
+            LogAddSink(std::make_shared<DebugOutputSink>());
+            s_debugOutput = true;
+        }
+    }
+
+    void RadLogOpenFile(LPCWSTR strPath)
+    {
+        std::string path(WideCharToMultiByte(CP_UTF8, 0, strPath, -1, nullptr, 0, nullptr, nullptr), '\0');
+        WideCharToMultiByte(CP_UTF8, 0, strPath, -1, &path[0], int(path.size()), nullptr, nullptr);
+        path.resize(strlen(path.c_str()));
+        auto file = std::make_shared<RotatingFileSink>(path);
+        if (file->IsOpen())
+            LogAddSink(file);
     }
 
     void RadLogA(LogLevel l, const char* msg, SrcLocA src)
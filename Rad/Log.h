@@ -1,6 +1,7 @@
 #pragma once
 #include <Windows.h>
 
+#include "LogLevel.h"
 #include "SourceLocation.h"
 
 #define CHECK(x) if (!(x)) RadLog(LOG_ASSERT, TEXT(#x), SRC_LOC)
@@ -15,18 +16,12 @@
 extern thread_local HRESULT g_radloghr;
 #endif
 
-enum LogLevel {
-    LOG_DEBUG,
-    LOG_INFO,
-    LOG_WARN,
-    LOG_ERROR,
-    LOG_ASSERT,
-};
-
 #ifdef __cplusplus
 extern "C" {
 #endif
     void RadLogInitWnd(HWND hWndLog, LPCSTR strLogCaptionA, LPCWSTR strLogCaptionW);
+    // Also writes the log to a file, rotated as it grows.
+    void RadLogOpenFile(LPCWSTR strPath);
     void RadLogA(enum LogLevel l, const char* msg, SrcLocA src);
     void RadLogW(enum LogLevel l, const wchar_t* msg, SrcLocW src);
 #ifdef __cplusplus
@@ -40,6 +35,53 @@ inline void RadLog(LogLevel l, const char* msg, SrcLocA src) { RadLogA(l, msg, s
 inline void RadLog(LogLevel l, const wchar_t* msg, SrcLocW src) { RadLogW(l, msg, src); }
 inline void RadLog(LogLevel l, const std::string& msg, SrcLocA src) { RadLogA(l, msg.c_str(), src); }
 inline void RadLog(LogLevel l, const std::wstring& msg, SrcLocW src) { RadLogW(l, msg.c_str(), src); }
+
+#include "TypedFormat.h"
+
+// RADLOG calls below this level are compiled out, along with the evaluation of their arguments.
+#ifndef RADLOG_MIN_LEVEL
+#ifdef _DEBUG
+#define RADLOG_MIN_LEVEL LOG_DEBUG
+#else
+#define RADLOG_MIN_LEVEL LOG_INFO
+#endif
+#endif
+
+// Longer messages are truncated.
+const size_t RadLogMessageLength = 512;
+
+template <class S, class... Args>
+void RadLogFormat(LogLevel l, SrcLocA src, S fmt, const Args&... args)
+{
+    char msg[RadLogMessageLength];
+    FormatTo(msg, fmt, args...);
+    RadLogA(l, msg, src);
+}
+
+template <class S, class... Args>
+void RadLogFormat(LogLevel l, SrcLocW src, S fmt, const Args&... args)
+{
+    wchar_t msg[RadLogMessageLength];
+    FormatTo(msg, fmt, args...);
+    RadLogW(l, msg, src);
+}
+
+// Formats the message on the stack, with the format string checked against the arguments at
+// compile time:
+//   RADLOG(LOG_WARN, TEXT("Unable to open %ls"), path.c_str());
+#define RADLOG(l, fmt, ...) do { if ((l) >= RADLOG_MIN_LEVEL) RadLogFormat((l), SRC_LOC, RAD_FMT(fmt), ##__VA_ARGS__); } while (0)
+
+// Messages are written by a background thread, but message boxes are modal. While one of these
+// is held on a thread, such as while it has the clipboard open, its message boxes are held back
+// and shown from the message loop once the last hold is released.
+class RadLogDeferNotifications
+{
+public:
+    RadLogDeferNotifications();
+    RadLogDeferNotifications(const RadLogDeferNotifications&) = delete;
+    RadLogDeferNotifications& operator=(const RadLogDeferNotifications&) = delete;
+    ~RadLogDeferNotifications();
+};
 #else
 #ifdef _UNICODE
 #define RadLog RadLogW
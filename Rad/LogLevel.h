@@ -0,0 +1,9 @@
+#pragma once
+
+enum LogLevel {
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR,
+    LOG_ASSERT,
+};
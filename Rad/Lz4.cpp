@@ -0,0 +1,207 @@
+#include "Lz4.h"
+#include <cstring>
+#include <algorithm>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+    const size_t MinMatch = 4;
+    const size_t LastLiterals = 5;
+    const size_t MfLimit = 12;
+    const size_t MaxOffset = 65535;
+    const int MaxHashLog = 16;
+    const int MinHashLog = 8;
+
+    inline uint32_t Read32(const uint8_t* p) { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+    inline uint64_t Read64(const uint8_t* p) { uint64_t v; memcpy(&v, p, sizeof(v)); return v; }
+
+    inline uint32_t HashSeq(uint32_t v, int hashLog) { return (v * 2654435761U) >> (32 - hashLog); }
+
+    inline unsigned TrailingZeroBytes(uint64_t v)
+    {
+#if defined(_MSC_VER) && defined(_M_X64)
+        unsigned long r;
+        _BitScanForward64(&r, v);
+        return unsigned(r) / 8;
+#elif defined(__GNUC__)
+        return unsigned(__builtin_ctzll(v)) / 8;
+#else
+        unsigned n = 0;
+        while ((v & 0xFF) == 0)
+        {
+            v >>= 8;
+            ++n;
+        }
+        return n;
+#endif
+    }
+
+    inline const uint8_t* MatchEnd(const uint8_t* p, const uint8_t* ref, const uint8_t* const limit)
+    {
+        while (p + 8 <= limit)
+        {
+            const uint64_t diff = Read64(p) ^ Read64(ref);
+            if (diff != 0)
+                return p + TrailingZeroBytes(diff);
+            p += 8;
+            ref += 8;
+        }
+        while (p < limit && *p == *ref)
+        {
+            ++p;
+            ++ref;
+        }
+        return p;
+    }
+
+    inline void WriteLength(uint8_t*& op, size_t len)
+    {
+        while (len >= 255)
+        {
+            *op++ = 255;
+            len -= 255;
+        }
+        *op++ = uint8_t(len);
+    }
+
+    inline uint8_t* WriteLiterals(uint8_t* op, const uint8_t* lit, size_t len, uint8_t*& token)
+    {
+        token = op++;
+        *token = uint8_t(std::min<size_t>(len, 15) << 4);
+        if (len >= 15)
+            WriteLength(op, len - 15);
+        if (len > 0)
+            memcpy(op, lit, len);
+        return op + len;
+    }
+
+    inline bool ReadLength(const uint8_t*& ip, const uint8_t* const iend, size_t& len)
+    {
+        uint8_t b;
+        do
+        {
+            if (ip >= iend)
+                return false;
+            b = *ip++;
+            len += b;
+        } while (b == 255);
+        return true;
+    }
+}
+
+void Lz4Compress(const void* src, const size_t size, std::vector<uint8_t>& dst)
+{
+    dst.resize(Lz4CompressBound(size));
+    const uint8_t* const base = static_cast<const uint8_t*>(src);
+    const uint8_t* const end = base + size;
+    const uint8_t* ip = base;
+    const uint8_t* anchor = base;
+    uint8_t* op = dst.data();
+    uint8_t* token = nullptr;
+
+    if (size > MfLimit)
+    {
+        const uint8_t* const matchLimit = end - LastLiterals;
+        const uint8_t* const mfLimit = end - MfLimit;
+        // Sized to the input so small payloads don't pay for clearing a large table,
+        // and kept per thread so it isn't allocated per call
+        int hashLog = MinHashLog;
+        while (hashLog < MaxHashLog && (size_t(1) << hashLog) < size)
+            ++hashLog;
+        thread_local std::vector<uint32_t> tableBuffer;
+        tableBuffer.assign(size_t(1) << hashLog, 0);
+        uint32_t* const table = tableBuffer.data();
+        size_t misses = 0;
+        while (ip < mfLimit)
+        {
+            const uint32_t seq = Read32(ip);
+            const uint32_t h = HashSeq(seq, hashLog);
+            const uint8_t* ref = base + table[h];
+            table[h] = uint32_t(ip - base);
+            if (ref >= ip || size_t(ip - ref) > MaxOffset || Read32(ref) != seq)
+            {
+                // Skip faster through incompressible data
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+
+            while (ip > anchor && ref > base && ip[-1] == ref[-1])
+            {
+                --ip;
+                --ref;
+            }
+            const uint8_t* const mend = MatchEnd(ip + MinMatch, ref + MinMatch, matchLimit);
+
+            op = WriteLiterals(op, anchor, size_t(ip - anchor), token);
+            const size_t offset = size_t(ip - ref);
+            *op++ = uint8_t(offset);
+            *op++ = uint8_t(offset >> 8);
+            const size_t matchLen = size_t(mend - ip) - MinMatch;
+            *token |= uint8_t(std::min<size_t>(matchLen, 15));
+            if (matchLen >= 15)
+                WriteLength(op, matchLen - 15);
+
+            ip = anchor = mend;
+            if (ip < mfLimit)
+                table[HashSeq(Read32(ip - 2), hashLog)] = uint32_t(ip - 2 - base);
+        }
+    }
+
+    op = WriteLiterals(op, anchor, size_t(end - anchor), token);
+    dst.resize(size_t(op - dst.data()));
+}
+
+size_t Lz4Decompress(const void* src, const size_t srcSize, void* dst, const size_t dstSize)
+{
+    const uint8_t* ip = static_cast<const uint8_t*>(src);
+    const uint8_t* const iend = ip + srcSize;
+    uint8_t* const obegin = static_cast<uint8_t*>(dst);
+    uint8_t* op = obegin;
+    uint8_t* const oend = op + dstSize;
+
+    while (ip < iend && op < oend)
+    {
+        const uint8_t token = *ip++;
+
+        size_t litLen = token >> 4;
+        if (litLen == 15 && !ReadLength(ip, iend, litLen))
+            break;
+        if (litLen > size_t(iend - ip))
+            break;
+        const size_t litCopy = std::min(litLen, size_t(oend - op));
+        memcpy(op, ip, litCopy);
+        op += litCopy;
+        ip += litLen;
+        if (ip >= iend || op >= oend)
+            break;
+
+        if (iend - ip < 2)
+            break;
+        const size_t offset = size_t(ip[0]) | (size_t(ip[1]) << 8);
+        ip += 2;
+        if (offset == 0 || offset > size_t(op - obegin))
+            break;
+
+        size_t matchLen = token & 15;
+        if (matchLen == 15 && !ReadLength(ip, iend, matchLen))
+            break;
+        matchLen = std::min(matchLen + MinMatch, size_t(oend - op));
+
+        const uint8_t* ref = op - offset;
+        if (offset >= matchLen)
+        {
+            memcpy(op, ref, matchLen);
+            op += matchLen;
+        }
+        else
+        {
+            for (size_t i = 0; i < matchLen; ++i)
+                *op++ = *ref++;
+        }
+    }
+    return size_t(op - obegin);
+}
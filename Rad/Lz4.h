@@ -0,0 +1,16 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// LZ4 block format
+// See https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+
+inline size_t Lz4CompressBound(size_t size) { return size + size / 255 + 16; }
+
+void Lz4Compress(const void* src, size_t size, std::vector<uint8_t>& dst);
+
+// Returns the number of bytes written to dst.
+// Stops early when dst is full, so a prefix can be decoded by passing a smaller dstSize.
+// Malformed input also stops early, so compare against the expected size.
+size_t Lz4Decompress(const void* src, size_t srcSize, void* dst, size_t dstSize);
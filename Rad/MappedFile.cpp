@@ -0,0 +1,129 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#include <share.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+FILE* FileOpen(const PathString& path, const char* mode)
+{
+    wchar_t wmode[8] = L"";
+    for (size_t i = 0; mode[i] != '\0' && i < 7; ++i)
+        wmode[i] = wchar_t(mode[i]);
+    // Shared so the file can be mapped while it is being appended to
+    return _wfsopen(path.c_str(), wmode, _SH_DENYNO);
+}
+
+bool FileRename(const PathString& from, const PathString& to)
+{
+    return MoveFileExW(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != FALSE;
+}
+
+bool MappedFile::Open(const PathString& path)
+{
+    Close();
+    m_hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_hFile == INVALID_HANDLE_VALUE)
+    {
+        m_hFile = nullptr;
+        return false;
+    }
+
+    LARGE_INTEGER size = {};
+    if (!GetFileSizeEx(m_hFile, &size))
+    {
+        Close();
+        return false;
+    }
+    m_size = size_t(size.QuadPart);
+    if (m_size == 0)
+        return true;
+
+    m_hMapping = CreateFileMappingW(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_hMapping == NULL)
+    {
+        Close();
+        return false;
+    }
+    m_data = static_cast<const uint8_t*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0));
+    if (m_data == nullptr)
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (m_data != nullptr)
+        UnmapViewOfFile(m_data);
+    if (m_hMapping != nullptr)
+        CloseHandle(m_hMapping);
+    if (m_hFile != nullptr)
+        CloseHandle(m_hFile);
+    m_data = nullptr;
+    m_size = 0;
+    m_hMapping = nullptr;
+    m_hFile = nullptr;
+}
+
+#else
+
+FILE* FileOpen(const PathString& path, const char* mode)
+{
+    return fopen(path.c_str(), mode);
+}
+
+bool FileRename(const PathString& from, const PathString& to)
+{
+    return rename(from.c_str(), to.c_str()) == 0;
+}
+
+bool MappedFile::Open(const PathString& path)
+{
+    Close();
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st = {};
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    m_size = size_t(st.st_size);
+    if (m_size > 0)
+    {
+        void* p = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            close(fd);
+            m_size = 0;
+            return false;
+        }
+        m_data = static_cast<const uint8_t*>(p);
+    }
+    close(fd);
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (m_data != nullptr)
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+    m_data = nullptr;
+    m_size = 0;
+}
+
+#endif
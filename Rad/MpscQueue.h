@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <utility>
+
+// Unbounded lock-free queue for many producers and a single consumer.
+// A linked list with a dummy node at the tail, after Dmitry Vyukov's MPSC queue.
+// Push never waits. Pop can miss an item whose Push hasn't returned yet, so producers
+// should signal the consumer after pushing.
+template <class T>
+class MpscQueue
+{
+public:
+    MpscQueue()
+        : m_head(new Node()), m_tail(m_head.load())
+    {
+    }
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+    ~MpscQueue()
+    {
+        T value;
+        while (Pop(value))
+            ;
+        delete m_tail;
+    }
+
+    // Any thread.
+    void Push(T value)
+    {
+        Node* const n = new Node(std::move(value));
+        Node* const prev = m_head.exchange(n, std::memory_order_acq_rel);
+        prev->next.store(n, std::memory_order_release);
+    }
+
+    // The consumer thread only.
+    bool Pop(T& value)
+    {
+        Node* const next = m_tail->next.load(std::memory_order_acquire);
+        if (next == nullptr)
+            return false;
+        value = std::move(next->value);
+        delete m_tail;
+        m_tail = next;   // now the dummy, its value has been moved out
+        return true;
+    }
+
+private:
+    struct Node
+    {
+        Node() = default;
+        explicit Node(T v) : value(std::move(v)) { }
+
+        T value;
+        std::atomic<Node*> next{ nullptr };
+    };
+
+    std::atomic<Node*> m_head;  // last pushed
+    Node* m_tail;               // dummy, the consumer's end
+};
@@ -0,0 +1,182 @@
+#include "TextLayout.h"
+#include <algorithm>
+#include <cwchar>
+
+TextLayout::TextLayout()
+{
+    SetText(std::wstring());
+}
+
+void TextLayout::SetText(std::wstring text)
+{
+    m_text = std::move(text);
+    m_lineStart.clear();
+    m_lineStart.push_back(0);
+    for (const wchar_t* p = m_text.c_str(), *end = p + m_text.size(); (p = std::wmemchr(p, L'\n', end - p)) != nullptr; ++p)
+        m_lineStart.push_back(p - m_text.c_str() + 1);
+    m_lineStart.push_back(m_text.size() + 1);
+
+    m_lineWidth.clear();
+    m_layouts.clear();
+}
+
+void TextLayout::SetMeasure(MeasureFn measure)
+{
+    m_measure = std::move(measure);
+    m_charWidth.clear();
+    m_lineWidth.clear();
+    m_layouts.clear();
+}
+
+void TextLayout::SetWidth(const int width)
+{
+    m_width = std::max(width, 0);
+}
+
+int TextLayout::TabWidth() const
+{
+    return std::max(Width(L' ') * TabChars, 1);
+}
+
+size_t TextLayout::LineEnd(const size_t line) const
+{
+    size_t end = m_lineStart[line + 1] - 1;
+    if (end > m_lineStart[line] && m_text[end - 1] == L'\r')
+        --end;
+    return end;
+}
+
+int TextLayout::Width(const wchar_t c) const
+{
+    if (!m_measure)
+        return 1;
+    if (size_t(c) >= 0x10000)
+        return m_measure(c);
+    if (m_charWidth.empty())
+        m_charWidth.resize(0x10000, -1);
+    int& w = m_charWidth[size_t(c)];
+    if (w < 0)
+        w = m_measure(c);
+    return w;
+}
+
+int TextLayout::Advance(const wchar_t c, const int x) const
+{
+    if (c == L'\t')
+    {
+        const int tab = TabWidth();
+        return tab - x % tab;
+    }
+    else
+        return Width(c);
+}
+
+const TextLayout::Layout& TextLayout::Current() const
+{
+    auto it = std::find_if(m_layouts.begin(), m_layouts.end(), [this](const Layout& l) { return l.width == m_width; });
+    if (it != m_layouts.end())
+    {
+        if (it != m_layouts.begin())
+        {
+            Layout l = std::move(*it);
+            m_layouts.erase(it);
+            m_layouts.push_front(std::move(l));
+        }
+        return m_layouts.front();
+    }
+
+    const size_t lines = LineCount();
+    if (m_width > 0 && m_lineWidth.empty())
+    {
+        m_lineWidth.resize(lines);
+        for (size_t i = 0; i < lines; ++i)
+        {
+            int x = 0;
+            for (size_t j = m_lineStart[i], end = LineEnd(i); j < end; ++j)
+                x += Advance(m_text[j], x);
+            m_lineWidth[i] = x;
+        }
+    }
+
+    Layout l;
+    l.width = m_width;
+    l.rowStart.reserve(lines + 1);
+    size_t rows = 0;
+    for (size_t i = 0; i < lines; ++i)
+    {
+        l.rowStart.push_back(rows);
+        ++rows;
+        if (m_width > 0 && m_lineWidth[i] > m_width)
+        {
+            std::vector<size_t> breaks;
+            Wrap(m_lineStart[i], LineEnd(i), m_width, breaks);
+            rows += breaks.size();
+            if (!breaks.empty())
+                l.breaks.emplace(i, std::move(breaks));
+        }
+    }
+    l.rowStart.push_back(rows);
+
+    m_layouts.push_front(std::move(l));
+    if (m_layouts.size() > MaxLayouts)
+        m_layouts.pop_back();
+    return m_layouts.front();
+}
+
+void TextLayout::Wrap(const size_t begin, const size_t end, const int width, std::vector<size_t>& breaks) const
+{
+    size_t rowBegin = begin;
+    size_t lastBreak = begin;   // after the last space
+    int x = 0;
+    for (size_t i = begin; i < end; ++i)
+    {
+        int w = Advance(m_text[i], x);
+        if (x + w > width && i > rowBegin)
+        {
+            // Break after the last space, or mid word if there isn't one
+            rowBegin = lastBreak > rowBegin ? lastBreak : i;
+            x = 0;
+            for (size_t j = rowBegin; j < i; ++j)
+                x += Advance(m_text[j], x);
+            w = Advance(m_text[i], x);
+            if (x + w > width && i > rowBegin)
+            {
+                rowBegin = i;
+                x = 0;
+                w = Advance(m_text[i], x);
+            }
+            breaks.push_back(rowBegin);
+        }
+        x += w;
+        if (m_text[i] == L' ' || m_text[i] == L'\t')
+            lastBreak = i + 1;
+    }
+}
+
+void TextLayout::Row(const size_t row, size_t& begin, size_t& end) const
+{
+    const Layout& l = Current();
+    const size_t line = std::upper_bound(l.rowStart.begin(), l.rowStart.end() - 1, row) - l.rowStart.begin() - 1;
+    const size_t sub = row - l.rowStart[line];
+    begin = m_lineStart[line];
+    end = LineEnd(line);
+    if (sub > 0 || l.rowStart[line + 1] - l.rowStart[line] > 1)
+    {
+        const std::vector<size_t>& breaks = l.breaks.at(line);
+        if (sub > 0)
+            begin = breaks[sub - 1];
+        if (sub < breaks.size())
+            end = breaks[sub];
+    }
+}
+
+size_t TextLayout::RowOf(const size_t pos) const
+{
+    const Layout& l = Current();
+    const size_t line = std::upper_bound(m_lineStart.begin(), m_lineStart.end() - 1, pos) - m_lineStart.begin() - 1;
+    size_t row = l.rowStart[line];
+    const auto it = l.breaks.find(line);
+    if (it != l.breaks.end())
+        row += std::upper_bound(it->second.begin(), it->second.end(), pos) - it->second.begin();
+    return row;
+}
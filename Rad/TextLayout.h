@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Line index and word wrap of a block of text, so only the visible rows need to be drawn.
+// Character widths come from a callback and are cached, tabs stop every TabChars spaces.
+// Layouts of the most recent widths are kept, and as the unwrapped width of each line is
+// known only the lines wider than the window are wrapped again on a resize.
+class TextLayout
+{
+public:
+    typedef std::function<int(wchar_t)> MeasureFn;
+    static const int TabChars = 8;
+    static const size_t MaxLayouts = 4;
+
+    TextLayout();
+
+    void SetText(std::wstring text);
+    // Defaults to a width of 1 for every character.
+    void SetMeasure(MeasureFn measure);
+    // Width to wrap at, 0 or less to not wrap.
+    void SetWidth(int width);
+
+    const std::wstring& Text() const { return m_text; }
+    size_t LineCount() const { return m_lineStart.size() - 1; }
+    size_t RowCount() const { return Current().rowStart.back(); }
+    int TabWidth() const;
+
+    // Characters [begin, end) of a row, not including the line break.
+    void Row(size_t row, size_t& begin, size_t& end) const;
+    // Row containing the character at pos.
+    size_t RowOf(size_t pos) const;
+
+private:
+    struct Layout
+    {
+        int width;
+        std::vector<size_t> rowStart;   // first row of each line, followed by the row count
+        std::unordered_map<size_t, std::vector<size_t>> breaks;  // start of the rows after the first, for the lines that wrap
+    };
+
+    size_t LineEnd(size_t line) const;
+    int Width(wchar_t c) const;
+    int Advance(wchar_t c, int x) const;
+    const Layout& Current() const;
+    void Wrap(size_t begin, size_t end, int width, std::vector<size_t>& breaks) const;
+
+    std::wstring m_text;
+    std::vector<size_t> m_lineStart;    // followed by the text size + 1
+    MeasureFn m_measure;
+    int m_width = 0;
+
+    mutable std::vector<int> m_charWidth;   // -1 until measured
+    mutable std::vector<int> m_lineWidth;   // unwrapped, empty until needed
+    mutable std::deque<Layout> m_layouts;   // most recently used first
+};
@@ -0,0 +1,242 @@
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+    enum class EventType : uint64_t { Span, Counter };
+
+    struct Event
+    {
+        const char* name;
+        const char* argNames[2];
+        uint64_t args[2];   // the value of a counter
+        uint64_t begin;     // ns
+        uint64_t duration;  // ns
+        EventType type;
+    };
+
+    const size_t SlotWords = 8;
+    static_assert(sizeof(Event) <= SlotWords * sizeof(uint64_t), "event doesn't fit a slot");
+    static_assert((TraceCapacity & (TraceCapacity - 1)) == 0, "capacity must be a power of two");
+
+    // Written only by its thread, read by the exporter while it is being written.
+    // The slot of event n is overwritten by event n + TraceCapacity, so the exporter copies the
+    // slots and then drops any that the writer may have reached in the meantime.
+    class TraceBuffer
+    {
+    public:
+        void Write(const Event& e)
+        {
+            uint64_t words[SlotWords] = {};
+            memcpy(words, &e, sizeof(e));
+            const uint64_t n = m_written.load(std::memory_order_relaxed);
+            m_claimed.store(n + 1, std::memory_order_relaxed);
+            // A reader that sees any of the slot's stores then sees it claimed
+            std::atomic_thread_fence(std::memory_order_release);
+            std::atomic<uint64_t>* const slot = m_slots[n & (TraceCapacity - 1)];
+            for (size_t i = 0; i < SlotWords; ++i)
+                slot[i].store(words[i], std::memory_order_relaxed);
+            m_written.store(n + 1, std::memory_order_release);
+        }
+
+        void Read(std::vector<Event>& events) const
+        {
+            const uint64_t written = m_written.load(std::memory_order_acquire);
+            const uint64_t start = std::max(m_start.load(std::memory_order_relaxed), written > TraceCapacity ? written - TraceCapacity : 0);
+            std::vector<Event> copied(size_t(written - start));
+            for (uint64_t n = start; n < written; ++n)
+            {
+                uint64_t words[SlotWords];
+                const std::atomic<uint64_t>* const slot = m_slots[n & (TraceCapacity - 1)];
+                for (size_t i = 0; i < SlotWords; ++i)
+                    words[i] = slot[i].load(std::memory_order_relaxed);
+                memcpy(&copied[size_t(n - start)], words, sizeof(Event));
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            // Slots claimed since may have been overwritten while they were copied
+            const uint64_t claimed = m_claimed.load(std::memory_order_relaxed);
+            const uint64_t valid = std::max(start, claimed > TraceCapacity ? claimed - TraceCapacity : 0);
+            if (valid < written)
+                events.insert(events.end(), copied.begin() + size_t(valid - start), copied.end());
+        }
+
+        void Clear() { m_start.store(m_written.load(std::memory_order_acquire), std::memory_order_relaxed); }
+
+    private:
+        std::atomic<uint64_t> m_slots[TraceCapacity][SlotWords] = {};
+        std::atomic<uint64_t> m_written{ 0 };
+        std::atomic<uint64_t> m_claimed{ 0 };   // m_written, or one more while a slot is written
+        std::atomic<uint64_t> m_start{ 0 };
+    };
+
+    // A thread that is only named doesn't get a buffer until it records an event
+    struct TraceThread
+    {
+        explicit TraceThread(uint32_t tid) : tid(tid) { }
+        ~TraceThread() { delete buffer.load(std::memory_order_relaxed); }
+
+        const uint32_t tid;
+        std::atomic<const char*> name{ nullptr };
+        std::atomic<TraceBuffer*> buffer{ nullptr };
+    };
+
+    struct TraceThreads
+    {
+        std::mutex mutex;
+        // Kept after their thread exits, so its events can still be exported
+        std::vector<std::shared_ptr<TraceThread>> threads;
+    };
+
+    TraceThreads& Threads()
+    {
+        static TraceThreads threads;
+        return threads;
+    }
+
+    TraceThread& CurrentThread()
+    {
+        thread_local std::shared_ptr<TraceThread> thread;
+        if (!thread)
+        {
+            TraceThreads& t = Threads();
+            std::lock_guard<std::mutex> lock(t.mutex);
+            thread = std::make_shared<TraceThread>(uint32_t(t.threads.size() + 1));
+            t.threads.push_back(thread);
+        }
+        return *thread;
+    }
+
+    TraceBuffer& ThreadBuffer()
+    {
+        thread_local TraceBuffer* buffer = nullptr;
+        if (buffer == nullptr)
+        {
+            buffer = new TraceBuffer();
+            CurrentThread().buffer.store(buffer, std::memory_order_release);
+        }
+        return *buffer;
+    }
+
+    void AppendJson(std::string& out, const char* s)
+    {
+        out += '"';
+        for (; *s != '\0'; ++s)
+        {
+            if (*s == '"' || *s == '\\')
+                out += '\\';
+            if (uint8_t(*s) < 0x20)
+                out += ' ';
+            else
+                out += *s;
+        }
+        out += '"';
+    }
+
+    void AppendEvent(std::string& out, const Event& e, const uint32_t tid)
+    {
+        char buf[128];
+        out += out.back() == '[' ? "\n{\"name\":" : ",\n{\"name\":";
+        AppendJson(out, e.name);
+        if (e.type == EventType::Counter)
+        {
+            snprintf(buf, sizeof(buf), ",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"value\":%" PRId64 "}}",
+                double(e.begin) / 1000, tid, int64_t(e.args[0]));
+            out += buf;
+            return;
+        }
+        snprintf(buf, sizeof(buf), ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{",
+            double(e.begin) / 1000, double(e.duration) / 1000, tid);
+        out += buf;
+        for (int i = 0; i < 2 && e.argNames[i] != nullptr; ++i)
+        {
+            if (i > 0)
+                out += ',';
+            AppendJson(out, e.argNames[i]);
+            snprintf(buf, sizeof(buf), ":%" PRIu64, e.args[i]);
+            out += buf;
+        }
+        out += "}}";
+    }
+}
+
+std::atomic<bool> TraceDetail::g_enabled{ false };
+
+uint64_t TraceDetail::Now()
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void TraceDetail::Span(const char* const name, const uint64_t begin, const char* const argNames[2], const uint64_t args[2])
+{
+    const Event e = { name, { argNames[0], argNames[1] }, { args[0], args[1] }, begin, Now() - begin, EventType::Span };
+    ThreadBuffer().Write(e);
+}
+
+void TraceEnable(const bool enable)
+{
+    TraceDetail::g_enabled.store(enable, std::memory_order_relaxed);
+}
+
+void TraceThreadName(const char* const name)
+{
+    CurrentThread().name.store(name, std::memory_order_relaxed);
+}
+
+void TraceCounter(const char* const name, const int64_t value)
+{
+    if (!TraceEnabled())
+        return;
+    const Event e = { name, { nullptr, nullptr }, { uint64_t(value), 0 }, TraceDetail::Now(), 0, EventType::Counter };
+    ThreadBuffer().Write(e);
+}
+
+void TraceClear()
+{
+    TraceThreads& t = Threads();
+    std::lock_guard<std::mutex> lock(t.mutex);
+    for (const auto& thread : t.threads)
+    {
+        if (TraceBuffer* const buffer = thread->buffer.load(std::memory_order_acquire))
+            buffer->Clear();
+    }
+}
+
+std::string TraceExport()
+{
+    std::vector<std::shared_ptr<TraceThread>> threads;
+    {
+        TraceThreads& t = Threads();
+        std::lock_guard<std::mutex> lock(t.mutex);
+        threads = t.threads;
+    }
+
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    std::vector<Event> events;
+    for (const auto& thread : threads)
+    {
+        const char* const name = thread->name.load(std::memory_order_relaxed);
+        if (name != nullptr)
+        {
+            out += out.back() == '[' ? "\n" : ",\n";
+            out += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + std::to_string(thread->tid) + ",\"args\":{\"name\":";
+            AppendJson(out, name);
+            out += "}}";
+        }
+        const TraceBuffer* const buffer = thread->buffer.load(std::memory_order_acquire);
+        if (buffer == nullptr)
+            continue;
+        events.clear();
+        buffer->Read(events);
+        for (const Event& e : events)
+            AppendEvent(out, e, thread->tid);
+    }
+    out += "\n]}\n";
+    return out;
+}
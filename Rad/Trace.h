@@ -0,0 +1,67 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Spans and counters recorded into a ring buffer per thread, exported as Chrome trace event JSON
+// for chrome://tracing or https://ui.perfetto.dev.
+// Recording is off until TraceEnable, and then costs a clock read and a few stores per event,
+// without locks once a thread has its buffer. Each buffer keeps the latest TraceCapacity events.
+// Names are kept as pointers, so they must be string literals.
+
+const size_t TraceCapacity = 8192;
+
+namespace TraceDetail
+{
+    extern std::atomic<bool> g_enabled;
+    uint64_t Now();
+    void Span(const char* name, uint64_t begin, const char* const argNames[2], const uint64_t args[2]);
+}
+
+inline bool TraceEnabled() { return TraceDetail::g_enabled.load(std::memory_order_relaxed); }
+void TraceEnable(bool enable);
+// Names the calling thread in the export. Its buffer is still only allocated by its first event.
+void TraceThreadName(const char* name);
+void TraceCounter(const char* name, int64_t value);
+// Events recorded before this aren't exported.
+void TraceClear();
+// Every thread's events, oldest first.
+std::string TraceExport();
+
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char* name)
+        : m_name(name), m_begin(TraceEnabled() ? TraceDetail::Now() : 0)
+    {
+    }
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+    ~TraceSpan() { End(); }
+
+    // Up to two, such as the format and the size.
+    void Arg(const char* name, uint64_t value)
+    {
+        const int i = m_argNames[0] == nullptr ? 0 : 1;
+        m_argNames[i] = name;
+        m_args[i] = value;
+    }
+
+    // Ends the span before the end of the scope.
+    void End()
+    {
+        if (m_begin != 0)
+            TraceDetail::Span(m_name, m_begin, m_argNames, m_args);
+        m_begin = 0;
+    }
+
+private:
+    const char* const m_name;
+    uint64_t m_begin;           // 0 if not recording
+    const char* m_argNames[2] = {};
+    uint64_t m_args[2] = {};
+};
+
+#define TRACE_CAT2(a, b) a##b
+#define TRACE_CAT(a, b) TRACE_CAT2(a, b)
+#define TRACE_SCOPE(name) TraceSpan TRACE_CAT(traceSpan, __LINE__)(name)
@@ -0,0 +1,274 @@
+#include "TypedFormat.h"
+#include <algorithm>
+#include <cstdio>
+
+using namespace FormatDetail;
+
+namespace
+{
+    template <class C>
+    class Output
+    {
+    public:
+        Output(C* const buffer, const size_t capacity) : m_buffer(buffer), m_capacity(capacity) { }
+
+        void Put(const C c)
+        {
+            if (m_length + 1 < m_capacity)
+                m_buffer[m_length] = c;
+            ++m_length;
+        }
+
+        void Fill(const C c, size_t n)
+        {
+            for (; n > 0; --n)
+                Put(c);
+        }
+
+        template <class S>
+        void Write(const S* s, size_t n)
+        {
+            for (; n > 0; --n)
+                Put(C(*s++));
+        }
+
+        size_t Finish()
+        {
+            if (m_capacity > 0)
+                m_buffer[std::min(m_length, m_capacity - 1)] = 0;
+            return m_length;
+        }
+
+    private:
+        C* const m_buffer;
+        const size_t m_capacity;
+        size_t m_length = 0;
+    };
+
+    const size_t NoPrecision = SIZE_MAX;
+    const size_t MaxWidth = 128;
+
+    struct Spec
+    {
+        bool left = false;
+        bool plus = false;
+        bool space = false;
+        bool alt = false;
+        bool zero = false;
+        size_t width = 0;
+        size_t precision = NoPrecision;
+        Length length = Length::None;
+        char conv = 0;
+    };
+
+    template <class C>
+    Spec ParseSpec(const C* const fmt, size_t& i)
+    {
+        Spec s;
+        for (;; ++i)
+        {
+            if (fmt[i] == '-')
+                s.left = true;
+            else if (fmt[i] == '+')
+                s.plus = true;
+            else if (fmt[i] == ' ')
+                s.space = true;
+            else if (fmt[i] == '#')
+                s.alt = true;
+            else if (fmt[i] == '0')
+                s.zero = true;
+            else
+                break;
+        }
+        for (; IsDigit(fmt[i]); ++i)
+            s.width = std::min(s.width * 10 + (fmt[i] - '0'), MaxWidth);
+        if (fmt[i] == '.')
+        {
+            s.precision = 0;
+            for (++i; IsDigit(fmt[i]); ++i)
+                s.precision = std::min(s.precision * 10 + (fmt[i] - '0'), MaxWidth);
+        }
+        s.length = ParseLength(fmt, i);
+        s.conv = char(fmt[i]);
+        return s;
+    }
+
+    // Pads the prefix and digits to the width, as printf does.
+    template <class C>
+    void PutPadded(Output<C>& out, const Spec& s, const char* const prefix, const size_t prefixLength, const char* const digits, const size_t digitsLength, const size_t zeros)
+    {
+        const size_t length = prefixLength + zeros + digitsLength;
+        const size_t pad = s.width > length ? s.width - length : 0;
+        const bool zeroPad = s.zero && !s.left && s.precision == NoPrecision && s.conv != 's' && s.conv != 'c';
+        if (!s.left && !zeroPad)
+            out.Fill(' ', pad);
+        out.Write(prefix, prefixLength);
+        out.Fill('0', zeros + (zeroPad ? pad : 0));
+        out.Write(digits, digitsLength);
+        if (s.left)
+            out.Fill(' ', pad);
+    }
+
+    template <class C>
+    void PutInteger(Output<C>& out, const Spec& s, const FormatArg& a)
+    {
+        // Like printf, reinterpret the value at the size of the length
+        const unsigned bits = unsigned(LengthSize(s.length) * 8);
+        const uint64_t mask = bits < 64 ? (uint64_t(1) << bits) - 1 : ~uint64_t(0);
+        uint64_t v = (a.kind == ArgKind::Int ? uint64_t(a.i) : a.u) & mask;
+        char sign = 0;
+        if (s.conv == 'd' || s.conv == 'i')
+        {
+            if ((v >> (bits - 1)) & 1)
+            {
+                v = (0 - v) & mask;
+                sign = '-';
+            }
+            else if (s.plus)
+                sign = '+';
+            else if (s.space)
+                sign = ' ';
+        }
+
+        const unsigned base = s.conv == 'o' ? 8 : s.conv == 'x' || s.conv == 'X' ? 16 : 10;
+        const char* const symbols = s.conv == 'X' ? "0123456789ABCDEF" : "0123456789abcdef";
+        char digits[24];
+        size_t n = sizeof(digits);
+        for (uint64_t d = v; d != 0; d /= base)
+            digits[--n] = symbols[d % base];
+        if (v == 0 && s.precision != 0)
+            digits[--n] = '0';
+        const size_t digitsLength = sizeof(digits) - n;
+
+        char prefix[2];
+        size_t prefixLength = 0;
+        if (sign != 0)
+            prefix[prefixLength++] = sign;
+        if (s.alt && base == 16 && v != 0)
+        {
+            prefix[prefixLength++] = '0';
+            prefix[prefixLength++] = s.conv;
+        }
+        size_t zeros = s.precision != NoPrecision && s.precision > digitsLength ? s.precision - digitsLength : 0;
+        if (s.alt && base == 8 && zeros == 0 && (digitsLength == 0 || digits[n] != '0'))
+            zeros = 1;
+        PutPadded(out, s, prefix, prefixLength, digits + n, digitsLength, zeros);
+    }
+
+    // MSVC style, in full and without 0x
+    template <class C>
+    void PutPointer(Output<C>& out, const Spec& s, const void* const p)
+    {
+        const char* const symbols = "0123456789ABCDEF";
+        char digits[sizeof(void*) * 2];
+        uintptr_t v = uintptr_t(p);
+        for (size_t n = sizeof(digits); n > 0; v >>= 4)
+            digits[--n] = symbols[v & 0xF];
+        Spec padded = s;
+        padded.zero = false;
+        PutPadded(out, padded, "", 0, digits, sizeof(digits), 0);
+    }
+
+    template <class C>
+    void PutString(Output<C>& out, const Spec& s, const FormatArg& a)
+    {
+        const C* const str = static_cast<const C*>(a.p);
+        size_t n = 0;
+        if (str != nullptr)
+        {
+            const size_t limit = std::min(a.length, s.precision);
+            while (n < limit && (a.length != SIZE_MAX || str[n] != 0))
+                ++n;
+        }
+        const size_t pad = s.width > n ? s.width - n : 0;
+        if (!s.left)
+            out.Fill(' ', pad);
+        out.Write(str, n);
+        if (s.left)
+            out.Fill(' ', pad);
+    }
+
+    // Left to the C library, in a buffer big enough for any double at the largest precision
+    template <class C>
+    void PutFloat(Output<C>& out, const Spec& s, const double d)
+    {
+        char fmt[16];
+        size_t f = 0;
+        fmt[f++] = '%';
+        if (s.left)
+            fmt[f++] = '-';
+        if (s.plus)
+            fmt[f++] = '+';
+        if (s.space)
+            fmt[f++] = ' ';
+        if (s.alt)
+            fmt[f++] = '#';
+        if (s.zero)
+            fmt[f++] = '0';
+        fmt[f++] = '*';
+        fmt[f++] = '.';
+        fmt[f++] = '*';
+        fmt[f++] = s.conv;
+        fmt[f] = '\0';
+        char text[512];
+        const int n = snprintf(text, sizeof(text), fmt, int(s.width), s.precision == NoPrecision ? 6 : int(s.precision), d);
+        if (n > 0)
+            out.Write(text, std::min(size_t(n), sizeof(text) - 1));
+    }
+
+    template <class C>
+    size_t FormatArgs(C* const buffer, const size_t capacity, const C* const fmt, const FormatArg* args)
+    {
+        Output<C> out(buffer, capacity);
+        for (size_t i = 0; fmt[i] != 0; ++i)
+        {
+            if (fmt[i] != '%')
+            {
+                out.Put(fmt[i]);
+                continue;
+            }
+            ++i;
+            if (fmt[i] == '%')
+            {
+                out.Put('%');
+                continue;
+            }
+            const Spec s = ParseSpec(fmt, i);
+            const FormatArg& a = *args++;
+            switch (s.conv)
+            {
+            case 'c':
+            {
+                const C c = C(a.kind == ArgKind::Int ? a.i : int64_t(a.u));
+                FormatArg str = MakeString(&c);
+                str.length = 1;
+                PutString(out, s, str);
+                break;
+            }
+            case 's':
+                PutString(out, s, a);
+                break;
+            case 'p':
+                PutPointer(out, s, a.p);
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+                PutFloat(out, s, a.d);
+                break;
+            default:
+                PutInteger(out, s, a);
+                break;
+            }
+        }
+        return out.Finish();
+    }
+}
+
+size_t FormatDetail::Format(char* const buffer, const size_t capacity, const char* const fmt, const FormatArg* const args)
+{
+    return FormatArgs(buffer, capacity, fmt, args);
+}
+
+size_t FormatDetail::Format(wchar_t* const buffer, const size_t capacity, const wchar_t* const fmt, const FormatArg* const args)
+{
+    return FormatArgs(buffer, capacity, fmt, args);
+}
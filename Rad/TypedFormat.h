@@ -0,0 +1,240 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+// printf style formatting into a buffer the caller provides, on the stack or in an arena, in one
+// pass and without allocating. The format string is checked against the types of the arguments
+// at compile time, so it has to be passed through RAD_FMT:
+//   char buf[64];
+//   FormatTo(buf, RAD_FMT("%s: %llu bytes"), name, size);
+// Supports the flags - + space # 0, a width and a precision, the lengths hh h l ll z j and the
+// conversions d i u o x X c s p f F e E g G and %%.
+// An integer has to fit its length, as an int for none, hh and h. %s takes a pointer to a string
+// or a std::basic_string of the width of the format, and %hs and %ls spell out that width;
+// there is no conversion between widths.
+// Output that doesn't fit is truncated, and the buffer is always terminated.
+
+namespace FormatDetail
+{
+    struct FormatStringTag { };
+
+    enum class ArgKind : uint8_t { Int, UInt, Float, String, WString, Pointer, Other };
+
+    struct ArgInfo
+    {
+        ArgKind kind;
+        uint8_t size;
+    };
+
+    template <class T, class = void> struct ArgType { static constexpr ArgKind kind = ArgKind::Other; };
+    template <class T> struct ArgType<T, std::enable_if_t<std::is_integral<T>::value>> { static constexpr ArgKind kind = std::is_signed<T>::value ? ArgKind::Int : ArgKind::UInt; };
+    template <class T> struct ArgType<T, std::enable_if_t<std::is_enum<T>::value>> { static constexpr ArgKind kind = std::is_signed<std::underlying_type_t<T>>::value ? ArgKind::Int : ArgKind::UInt; };
+    template <class T> struct ArgType<T, std::enable_if_t<std::is_floating_point<T>::value>> { static constexpr ArgKind kind = ArgKind::Float; };
+    template <class T> struct ArgType<T*> { static constexpr ArgKind kind = ArgKind::Pointer; };
+    template <> struct ArgType<std::nullptr_t> { static constexpr ArgKind kind = ArgKind::Pointer; };
+    template <> struct ArgType<char*> { static constexpr ArgKind kind = ArgKind::String; };
+    template <> struct ArgType<const char*> { static constexpr ArgKind kind = ArgKind::String; };
+    template <> struct ArgType<std::string> { static constexpr ArgKind kind = ArgKind::String; };
+    template <> struct ArgType<wchar_t*> { static constexpr ArgKind kind = ArgKind::WString; };
+    template <> struct ArgType<const wchar_t*> { static constexpr ArgKind kind = ArgKind::WString; };
+    template <> struct ArgType<std::wstring> { static constexpr ArgKind kind = ArgKind::WString; };
+
+    template <class T>
+    constexpr ArgInfo InfoOf()
+    {
+        return { ArgType<T>::kind, uint8_t(sizeof(T)) };
+    }
+
+    enum class Length : uint8_t { None, hh, h, l, ll, z, j };
+
+    constexpr size_t LengthSize(const Length l)
+    {
+        return l == Length::hh ? sizeof(char)
+            : l == Length::h ? sizeof(short)
+            : l == Length::l ? sizeof(long)
+            : l == Length::ll || l == Length::j ? sizeof(long long)
+            : l == Length::z ? sizeof(size_t)
+            : sizeof(int);
+    }
+
+    enum class FormatError { None, TooFewArguments, TooManyArguments, BadConversion, TypeMismatch };
+
+    constexpr bool IsDigit(const int c) { return c >= '0' && c <= '9'; }
+
+    // Where fmt[i] is the first character after the %, moves i past the length.
+    template <class C>
+    constexpr Length ParseLength(const C* const fmt, size_t& i)
+    {
+        switch (fmt[i])
+        {
+        case 'h': ++i; return fmt[i] == 'h' ? (++i, Length::hh) : Length::h;
+        case 'l': ++i; return fmt[i] == 'l' ? (++i, Length::ll) : Length::l;
+        case 'z': ++i; return Length::z;
+        case 'j': ++i; return Length::j;
+        default: return Length::None;
+        }
+    }
+
+    // Moves i past the flags, width and precision.
+    template <class C>
+    constexpr void SkipSpec(const C* const fmt, size_t& i)
+    {
+        while (fmt[i] == '-' || fmt[i] == '+' || fmt[i] == ' ' || fmt[i] == '#' || fmt[i] == '0')
+            ++i;
+        while (IsDigit(fmt[i]))
+            ++i;
+        if (fmt[i] == '.')
+        {
+            ++i;
+            while (IsDigit(fmt[i]))
+                ++i;
+        }
+    }
+
+    template <class C>
+    constexpr FormatError CheckConversion(const C conv, const Length l, const ArgInfo a)
+    {
+        const bool integer = a.kind == ArgKind::Int || a.kind == ArgKind::UInt;
+        switch (conv)
+        {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+            if (!integer)
+                return FormatError::TypeMismatch;
+            if (l == Length::None || l == Length::hh || l == Length::h)
+                return a.size <= sizeof(int) ? FormatError::None : FormatError::TypeMismatch;
+            return a.size == LengthSize(l) ? FormatError::None : FormatError::TypeMismatch;
+        case 'c':
+            return integer && a.size <= sizeof(int) && l == Length::None ? FormatError::None : FormatError::TypeMismatch;
+        case 's':
+        {
+            const ArgKind s = l == Length::h ? ArgKind::String : l == Length::l ? ArgKind::WString
+                : sizeof(C) == sizeof(char) ? ArgKind::String : ArgKind::WString;
+            const ArgKind own = sizeof(C) == sizeof(char) ? ArgKind::String : ArgKind::WString;
+            if (l != Length::None && l != Length::h && l != Length::l)
+                return FormatError::BadConversion;
+            return a.kind == s && s == own ? FormatError::None : FormatError::TypeMismatch;
+        }
+        case 'p':
+            return a.kind == ArgKind::Pointer && l == Length::None ? FormatError::None : FormatError::TypeMismatch;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+            return a.kind == ArgKind::Float && (l == Length::None || l == Length::l) ? FormatError::None : FormatError::TypeMismatch;
+        default:
+            return FormatError::BadConversion;
+        }
+    }
+
+    template <class C>
+    constexpr FormatError Check(const C* const fmt, const ArgInfo* const args, const size_t count)
+    {
+        size_t n = 0;
+        for (size_t i = 0; fmt[i] != 0; ++i)
+        {
+            if (fmt[i] != '%')
+                continue;
+            ++i;
+            if (fmt[i] == '%')
+                continue;
+            SkipSpec(fmt, i);
+            const Length l = ParseLength(fmt, i);
+            if (fmt[i] == 0)
+                return FormatError::BadConversion;
+            if (n == count)
+                return FormatError::TooFewArguments;
+            const FormatError e = CheckConversion(fmt[i], l, args[n++]);
+            if (e != FormatError::None)
+                return e;
+        }
+        return n < count ? FormatError::TooManyArguments : FormatError::None;
+    }
+
+    template <class C, class... Args>
+    constexpr FormatError CheckArgs(const C* const fmt)
+    {
+        const ArgInfo args[] = { InfoOf<Args>()..., { ArgKind::Other, 0 } };
+        return Check(fmt, args, sizeof...(Args));
+    }
+
+    struct FormatArg
+    {
+        ArgKind kind;
+        size_t length;      // of a string, or SIZE_MAX if it is terminated
+        union
+        {
+            int64_t i;
+            uint64_t u;
+            double d;
+            const void* p;
+        };
+    };
+
+    template <ArgKind K> using Kind = std::integral_constant<ArgKind, K>;
+
+    template <class T> FormatArg MakeArg(const T& v, Kind<ArgKind::Int>) { FormatArg a = { ArgKind::Int, 0, {} }; a.i = int64_t(v); return a; }
+    template <class T> FormatArg MakeArg(const T& v, Kind<ArgKind::UInt>) { FormatArg a = { ArgKind::UInt, 0, {} }; a.u = uint64_t(v); return a; }
+    template <class T> FormatArg MakeArg(const T& v, Kind<ArgKind::Float>) { FormatArg a = { ArgKind::Float, 0, {} }; a.d = double(v); return a; }
+    template <class T> FormatArg MakeArg(const T& v, Kind<ArgKind::Pointer>) { FormatArg a = { ArgKind::Pointer, 0, {} }; a.p = v; return a; }
+    template <class T> FormatArg MakeArg(const T&, Kind<ArgKind::Other>) { return { ArgKind::Other, 0, {} }; }
+
+    template <class C> FormatArg MakeString(const C* const s) { FormatArg a = { ArgKind::Other, SIZE_MAX, {} }; a.p = s; return a; }
+    template <class C> FormatArg MakeString(const std::basic_string<C>& s) { FormatArg a = { ArgKind::Other, s.size(), {} }; a.p = s.data(); return a; }
+    template <class T> FormatArg MakeArg(const T& v, Kind<ArgKind::String>) { FormatArg a = MakeString<char>(v); a.kind = ArgKind::String; return a; }
+    template <class T> FormatArg MakeArg(const T& v, Kind<ArgKind::WString>) { FormatArg a = MakeString<wchar_t>(v); a.kind = ArgKind::WString; return a; }
+
+    template <class T>
+    FormatArg MakeArg(const T& v)
+    {
+        return MakeArg(v, Kind<ArgType<std::decay_t<T>>::kind>());
+    }
+
+    // Returns the length of the whole output, as snprintf does.
+    size_t Format(char* buffer, size_t capacity, const char* fmt, const FormatArg* args);
+    size_t Format(wchar_t* buffer, size_t capacity, const wchar_t* fmt, const FormatArg* args);
+}
+
+// A format string checked at compile time, as a type with a static Get.
+#define RAD_FMT(s) [] { struct Str : FormatDetail::FormatStringTag { static constexpr std::decay_t<decltype(s)> Get() { return s; } }; return Str(); }()
+
+// Returns the length of the whole output, without the terminator, so a null buffer with a
+// capacity of 0 measures it.
+template <class C, class S, class... Args>
+size_t FormatTo(C* const buffer, const size_t capacity, S, const Args&... args)
+{
+    static_assert(std::is_base_of<FormatDetail::FormatStringTag, S>::value, "pass the format string through RAD_FMT");
+    static_assert(std::is_same<const C*, decltype(S::Get())>::value, "the format string and the buffer are of different widths");
+    using FormatDetail::FormatError;
+    constexpr FormatError error = FormatDetail::CheckArgs<C, std::decay_t<Args>...>(S::Get());
+    static_assert(error != FormatError::TooFewArguments, "more conversions in the format string than arguments");
+    static_assert(error != FormatError::TooManyArguments, "more arguments than conversions in the format string");
+    static_assert(error != FormatError::BadConversion, "unsupported conversion in the format string");
+    static_assert(error != FormatError::TypeMismatch, "an argument doesn't match its conversion in the format string");
+    const FormatDetail::FormatArg a[] = { FormatDetail::MakeArg(args)..., { FormatDetail::ArgKind::Other, 0, {} } };
+    return FormatDetail::Format(buffer, capacity, S::Get(), a);
+}
+
+template <class C, size_t N, class S, class... Args>
+std::enable_if_t<std::is_base_of<FormatDetail::FormatStringTag, S>::value, size_t> FormatTo(C (&buffer)[N], const S fmt, const Args&... args)
+{
+    return FormatTo(buffer, N, fmt, args...);
+}
+
+// A formatted string on the stack, truncated to N - 1 characters.
+template <class C, size_t N>
+class FormatBuffer
+{
+public:
+    template <class S, class... Args>
+    explicit FormatBuffer(const S fmt, const Args&... args)
+        : m_length(FormatTo(m_data, fmt, args...))
+    {
+    }
+
+    const C* c_str() const { return m_data; }
+    size_t size() const { return m_length < N ? m_length : N - 1; }
+    bool truncated() const { return m_length >= N; }
+
+private:
+    C m_data[N];
+    size_t m_length;    // before truncation
+};
@@ -0,0 +1,110 @@
+#include "WorkStealing.h"
+
+WorkStealingPool::WorkStealingPool(size_t threads)
+{
+    if (threads < 1)
+        threads = 1;
+    for (size_t i = 0; i < threads; ++i)
+        m_queues.emplace_back(new Queue());
+    for (size_t i = 0; i + 1 < threads; ++i)
+        m_threads.emplace_back(&WorkStealingPool::ThreadProc, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_start.notify_all();
+    for (std::thread& t : m_threads)
+        t.join();
+}
+
+void WorkStealingPool::Run(const size_t count, const std::function<bool(size_t)>& fn)
+{
+    const size_t n = m_queues.size();
+    for (size_t i = 0; i < count; ++i)
+    {
+        Queue& q = *m_queues[i % n];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.tasks.push_back(i);
+    }
+
+    m_stop = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_fn = &fn;
+        m_busy = m_threads.size();
+        ++m_generation;
+    }
+    m_start.notify_all();
+
+    Work(n - 1);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return m_busy == 0; });
+    m_fn = nullptr;
+}
+
+void WorkStealingPool::ThreadProc(const size_t worker)
+{
+    uint64_t generation = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_start.wait(lock, [this, generation] { return m_exit || m_generation != generation; });
+            if (m_exit)
+                break;
+            generation = m_generation;
+        }
+
+        Work(worker);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_busy == 0)
+            m_done.notify_all();
+    }
+}
+
+void WorkStealingPool::Work(const size_t worker)
+{
+    const std::function<bool(size_t)>& fn = *m_fn;
+    size_t task;
+    while (Pop(worker, task))
+    {
+        if (!m_stop && !fn(task))
+            m_stop = true;
+    }
+}
+
+// Tasks left after a stop are still popped so the queues end up empty.
+bool WorkStealingPool::Pop(const size_t worker, size_t& task)
+{
+    {
+        Queue& q = *m_queues[worker];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty())
+        {
+            task = q.tasks.front();
+            q.tasks.pop_front();
+            return true;
+        }
+    }
+
+    const size_t n = m_queues.size();
+    for (size_t i = 1; i < n; ++i)
+    {
+        Queue& q = *m_queues[(worker + i) % n];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty())
+        {
+            task = q.tasks.back();
+            q.tasks.pop_back();
+            ++m_steals;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs a batch of indexed tasks on a fixed set of threads.
+// Each thread owns a queue of task indices, dealt out in order. It takes from the front
+// of its own queue and steals from the back of the others when it runs out, so the
+// lower indices are run first.
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(size_t threads = std::thread::hardware_concurrency());
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+    ~WorkStealingPool();
+
+    // Runs fn(index) for each index in [0, count), the calling thread helps.
+    // Stops handing out tasks once fn returns false. Not reentrant.
+    void Run(size_t count, const std::function<bool(size_t)>& fn);
+
+    size_t ThreadCount() const { return m_threads.size() + 1; }
+    size_t StealCount() const { return m_steals; }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    void ThreadProc(size_t worker);
+    void Work(size_t worker);
+    bool Pop(size_t worker, size_t& task);
+
+    std::vector<std::unique_ptr<Queue>> m_queues;   // one per thread, the caller is the last
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+    const std::function<bool(size_t)>* m_fn = nullptr;
+    uint64_t m_generation = 0;
+    size_t m_busy = 0;
+    bool m_exit = false;
+
+    std::atomic<bool> m_stop{ false };
+    std::atomic<size_t> m_steals{ 0 };
+};
@@ -1,92 +1,231 @@
 #include "Rad/Window.h"
 #include "Rad/Windowxx.h"
-//#include <tchar.h>
+#include <tchar.h>
 #include <strsafe.h>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
 #include <memory>
 #include <string>
 #include <vector>
-#include <set>
-#include <ctime>
 
 #include <Shlobj.h>
 
+#include "Rad/Convert.h"
+#include "Rad/Dib.h"
+#include "Rad/HexDump.h"
 #include "Rad/MemoryPlus.h"
+#include "Rad/TextLayout.h"
+#include "Rad/Trace.h"
 #include "Rad/WinError.h"
 #include "Rad/Log.h"
 
-const UINT CF_HTML = RegisterClipboardFormat(TEXT("HTML Format"));
-const UINT CF_LINK = RegisterClipboardFormat(TEXT("Link Preview Format"));
-const UINT CF_HYPERLINK = RegisterClipboardFormat(TEXT("Titled Hyperlink Format"));
-const UINT CF_RICH = RegisterClipboardFormat(TEXT("Rich Text Format"));
-const UINT CF_FILENAME = RegisterClipboardFormat(TEXT("Filename"));
-const UINT CF_FILENAMEW = RegisterClipboardFormat(TEXT("FilenameW"));
+#include "History.h"
+#include "CapturePipeline.h"
+#include "ClipboardAccess.h"
+#include "ClipboardListener.h"
+#include "ColdTier.h"
+#include "DelayedRender.h"
+#include "Journal.h"
+#include "QueryEngine.h"
+#include "SearchIndex.h"
+#include "Summary.h"
+#include "Thumbnails.h"
+#include "ViewCache.h"
 
 #define HK_HIST (4)
+#define CMD_TRACE (1)
+#define CMD_SAVETRACE (2)
+#define TIMER_COLDTIER (1)
+#define TIMER_CLIPBOARD (2)
+#define WM_COLDTIER (WM_APP + 1)
+#define WM_THUMBNAILS (WM_APP + 2)
+#define WM_CAPTURED (WM_APP + 3)
+#define WM_CLIPBOARDCHANGE (WM_APP + 4)
+#define WM_QUERYDONE (WM_APP + 5)
 
-template <class T, class U>
-bool contains(const std::set<T>& s, const U& t)
+HANDLE Materialize(const UINT f, const BYTE* data, const size_t size)
 {
-    return s.find(t) != s.end();
+    switch (StandardFormat(f).capture)
+    {
+    case CaptureStrategy::EnhMetafile:
+        return SetEnhMetaFileBits(UINT(size), data);
+    default:
+    {
+        const HGLOBAL hCopy = GlobalAlloc(GMEM_MOVEABLE, size);
+        if (hCopy == NULL)
+            return NULL;
+        auto pDst = AutoGlobalLock<void*>(hCopy);
+        memcpy(pDst.get(), data, size);
+        return hCopy;
+    }
+    }
 }
 
-HGLOBAL Duplicate(HGLOBAL hData)
+class Win32Clipboard : public ClipboardTarget
 {
-    if (hData == NULL)
-        return NULL;
-
-    const SIZE_T s = GlobalSize(hData);
-    if (s <= 0)
-        return NULL;
-    HANDLE hCopy = GlobalAlloc(GHND, s);
-    if (hCopy == NULL)
-        return NULL;
+public:
+    bool Offer(const uint32_t uFormat) override
+    {
+        SetClipboardData(uFormat, NULL);
+        return true;
+    }
 
+    bool Put(const uint32_t uFormat, const uint8_t* const data, const size_t size) override
     {
-        auto pSrc = AutoGlobalLock<void*>(hData);
-        auto pDst = AutoGlobalLock<void*>(hCopy);
-        memcpy(pDst.get(), pSrc.get(), s);
+        TraceSpan span("Materialize");
+        span.Arg("format", uFormat);
+        span.Arg("bytes", size);
+        const HANDLE hData = Materialize(uFormat, data, size);
+        if (hData == NULL)
+            return false;
+        if (SetClipboardData(uFormat, hData) == NULL)
+        {
+            if (StandardFormat(uFormat).capture == CaptureStrategy::EnhMetafile)
+                DeleteEnhMetaFile((HENHMETAFILE) hData);
+            else
+                GlobalFree(hData);
+            return false;
+        }
+        return true;
     }
+};
 
-    return hCopy;
+std::wstring GetDataPath(const WCHAR* name)
+{
+    auto pPath = AutoUniquePtr<WCHAR>(nullptr, CoTaskMemFree);
+    if (FAILED(SHGetKnownFolderPath(FOLDERID_LocalAppData, KF_FLAG_CREATE, NULL, OutPtr(pPath))))
+        return std::wstring();
+    std::wstring path = pPath.get();
+    path += L"\\RadClipboard";
+    CreateDirectoryW(path.c_str(), nullptr);
+    path += L"\\";
+    path += name;
+    return path;
 }
 
-inline std::tstring GetFormatName(const UINT f)
+// The built-in rules, after any in the file
+CapturePolicy LoadCapturePolicy(const std::wstring& path)
 {
-    switch (f)
-    {
-    case CF_TEXT:           return TEXT("Text");
-    case CF_BITMAP:         return TEXT("Bitmap");
-    case CF_METAFILEPICT:   return TEXT("Metafile Picture");
-    case CF_OEMTEXT:        return TEXT("OEM Text");
-    case CF_DIB:            return TEXT("Device Independent Bitmap");
-    case CF_UNICODETEXT:    return TEXT("Unicode Text");
-    case CF_LOCALE:         return TEXT("Locale");
-    case CF_HDROP:          return TEXT("Files");
-    case CF_DIBV5:          return TEXT("Device Independent Bitmap V5");
-    default:
+    CapturePolicy policy;
+    std::ifstream file(path);
+    if (!file)
+        return policy;
+    const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    size_t line = 0;
+    if (!policy.Load(text, line))
+        RADLOG(LOG_WARN, TEXT("Capture policy not loaded, error on line %zu of %ls"), line, path.c_str());
+    return policy;
+}
+
+// Formats without a viewer are shown as a hex dump
+bool IsHexView(const FormatDesc& d)
+{
+    return d.view == FormatView::Hex;
+}
+
+bool IsImageView(const FormatDesc& d)
+{
+    return d.view == FormatView::Image;
+}
+
+bool IsTextView(const FormatDesc& d)
+{
+    return d.view == FormatView::Text;
+}
+
+// 32 bpp top down DIB section holding premultiplied BGRA
+std::shared_ptr<void> MakeBitmap(const BgraImage& image)
+{
+    BITMAPINFO bmi = {};
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = image.width;
+    bmi.bmiHeader.biHeight = -image.height;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    void* pBits = nullptr;
+    const HBITMAP hbm = CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, &pBits, NULL, 0);
+    if (hbm == NULL)
+        return nullptr;
+    memcpy(pBits, image.pixels.data(), image.pixels.size() * sizeof(uint32_t));
+    return std::shared_ptr<void>(hbm, [](void* h) { DeleteObject((HBITMAP) h); });
+}
+
+// Scaled down to fit the rect, from the top left
+void DrawBitmap(const HDC hdc, const HBITMAP hbm, const RECT& rc)
+{
+    BITMAP bm = {};
+    CHECK_LE(GetObject(hbm, sizeof(bm), &bm) != 0);
+    int32_t cx, cy;
+    FitSize(bm.bmWidth, bm.bmHeight, rc.right - rc.left, rc.bottom - rc.top, cx, cy);
+    const auto hdcMem = MakeUniqueHandle(CreateCompatibleDC(hdc), DeleteDC);
+    if (hdcMem && cx > 0 && cy > 0)
     {
-        TCHAR name[1024] = TEXT("");
-        if (GetClipboardFormatName(f, name, ARRAYSIZE(name)) == 0)
-            StringCchPrintf(name, ARRAYSIZE(name), TEXT("Format: %u"), f);
-        return name;
-    }
+        auto hOldBitmap = AutoSelectObject(hdcMem.get(), hbm);
+        const BLENDFUNCTION bf = { AC_SRC_OVER, 0, 255, AC_SRC_ALPHA };
+        GdiAlphaBlend(hdc, rc.left, rc.top, cx, cy, hdcMem.get(), 0, 0, bm.bmWidth, bm.bmHeight, bf);
     }
 }
 
-BOOL OpenClipboardTimeout(HWND hWnd, UINT timeout)
+HGDIOBJ ViewFont(const FormatDesc& d)
 {
-    const std::clock_t t = std::clock() + timeout * 1000 / CLOCKS_PER_SEC;
-    while (!OpenClipboard(hWnd))
-        if (std::clock() > t)
-            return FALSE;
-    return TRUE;
+    return GetStockObject(d.encoding == TextEncoding::Oem ? OEM_FIXED_FONT : IsHexView(d) ? SYSTEM_FIXED_FONT : SYSTEM_FONT);
 }
 
-struct HistItem
+std::wstring ToWide(const UINT cp, const char* const s, const size_t len)
 {
-    UINT uFormat;
-    HANDLE hData;
-};
+    std::wstring text(MultiByteToWideChar(cp, 0, s, int(len), nullptr, 0), L'\0');
+    if (!text.empty())
+        MultiByteToWideChar(cp, 0, s, int(len), &text[0], int(text.size()));
+    return text;
+}
+
+std::wstring DecodeText(const FormatDesc& d, const BYTE* const data, const size_t size)
+{
+    if (d.encoding == TextEncoding::Utf16)
+    {
+        const LPCWSTR pStr = (LPCWSTR) data;
+        return std::wstring(pStr, wcsnlen(pStr, size / sizeof(WCHAR)));
+    }
+    else
+    {
+        const UINT cp = d.encoding == TextEncoding::Ansi ? CP_ACP : d.encoding == TextEncoding::Oem ? CP_OEMCP : CP_UTF8;
+        const LPCSTR pStr = (LPCSTR) data;
+        return ToWide(cp, pStr, strnlen(pStr, size));
+    }
+}
+
+std::vector<std::wstring> DecodeFiles(const BYTE* const data, const size_t size)
+{
+    std::vector<std::wstring> files;
+    const DROPFILES* const pDropFiles = (const DROPFILES*) data;
+    if (size < sizeof(DROPFILES) || pDropFiles->pFiles >= size)
+        return files;
+    if (pDropFiles->fWide)
+    {
+        LPCWSTR pStr = (LPCWSTR) (data + pDropFiles->pFiles);
+        const LPCWSTR pEnd = pStr + (size - pDropFiles->pFiles) / sizeof(WCHAR);
+        while (pStr < pEnd && *pStr)
+        {
+            const size_t len = wcsnlen(pStr, pEnd - pStr);
+            files.emplace_back(pStr, len);
+            pStr += len + 1;
+        }
+    }
+    else
+    {
+        LPCSTR pStr = (LPCSTR) (data + pDropFiles->pFiles);
+        const LPCSTR pEnd = (LPCSTR) data + size;
+        while (pStr < pEnd && *pStr)
+        {
+            const size_t len = strnlen(pStr, pEnd - pStr);
+            files.push_back(ToWide(CP_ACP, pStr, len));
+            pStr += len + 1;
+        }
+    }
+    return files;
+}
 
 class RadClipboardViewerWnd : public Window
 {
@@ -106,19 +245,75 @@ protected:
 private:
     BOOL OnCreate(LPCREATESTRUCT lpCreateStruct);
     void OnDestroy();
-    void OnClipboardUpdate();
+    void OnClipboardChange();
     void OnContextMenu(HWND hWndContext, UINT xPos, UINT yPos);
     void OnHotKey(int idHotKey, UINT fuModifiers, UINT vk);
+    void OnTimer(UINT id);
+    void OnChar(TCHAR ch, int cRepeat);
+    void OnKeyDown(UINT vk, int cRepeat, UINT flags);
+    void OnSize(UINT state, int cx, int cy);
+    void OnVScroll(HWND hWndCtl, UINT code, int pos);
+    void OnMouseWheel(int xPos, int yPos, int zDelta, UINT fwKeys);
+    HANDLE OnRenderFormat(UINT fmt);
+    void OnRenderAllFormats();
+    void OnDestroyClipboard();
+
+    void ShowEntry(HistId id);
+    void ResetView();
+    void Decode(ViewProduct& product, UINT uFormat);
+    void OnCaptured();
+    void OnQueryDone();
+    void ShowHistoryMenu(const std::vector<HistId>& entries);
+    bool ThumbnailFits() const;
+    const FormatDesc& ViewDesc() const { return m_formatRegistry.Describe(m_uFormat); }
+    void UpdateScrollBar();
+    size_t RowCount() const;
+    RECT RowsRect() const;
+    size_t PageRows() const;
+    void PaintRows(const RECT& rcPaint, size_t& first, size_t& last) const;
+    void ScrollTo(size_t row);
+    void SaveTrace() const;
 
     virtual void OnDraw(const PAINTSTRUCT* pps) const override;
 
     static LPCTSTR ClassName() { return TEXT("RadClipboard"); }
 
+    // The entry being shown, drawn from its snapshot
+    HistId m_entry = InvalidHist;
     std::vector<UINT> m_formats;
     UINT m_uFormat = 0;
-    mutable std::tstring m_text;
+    std::shared_ptr<ViewProduct> m_view;
+    // Images are drawn from the thumbnail while it is big enough
+    std::shared_ptr<const Thumbnail> m_thumbnail;
+    std::shared_ptr<void> m_thumbnailBitmap;
+    // Text and hex views only draw the visible rows
+    size_t m_top = 0;
+    HGDIOBJ m_font = NULL;
+    int m_lineHeight = 16;
+    mutable std::vector<char> m_hexRows;
 
-    std::vector<std::vector<HistItem>> m_history;
+    Win32FormatBackend m_formatBackend;
+    FormatRegistry m_formatRegistry{ m_formatBackend };
+    PayloadStore m_payloads;
+    History m_history{ m_payloads };
+    Journal m_journal{ m_payloads };
+    size_t m_journalErrors = 0;     // journal errors already logged
+    ColdTier m_coldTier{ m_payloads, [this] { PostMessage(*this, WM_COLDTIER, 0, 0); } };
+    DelayedRender m_render{ m_payloads };
+    SearchIndex m_search;
+    SummaryTable m_summaries{ m_history };
+    ViewCache m_views{ m_history, [this](ViewProduct& p, uint32_t f) { Decode(p, f); } };
+    ThumbnailCache m_thumbnails{ [this] { PostMessage(*this, WM_THUMBNAILS, 0, 0); } };
+    CapturePipeline m_captures{ [this] { PostMessage(*this, WM_CAPTURED, 0, 0); } };
+    ChangeQueue m_changes{ [this] { PostMessage(*this, WM_CLIPBOARDCHANGE, 0, 0); } };
+    ContentionStats m_contention;
+    ClipboardListener m_listener{ m_payloads, m_formatRegistry, m_changes, m_contention };
+    ClipboardOpener m_opener{ TIMER_CLIPBOARD, BackoffPolicy(), m_contention };
+    uint64_t m_lastCapture = UINT64_MAX;    // serial of the capture of the latest clipboard change
+    QueryEngine m_queryEngine{ [this] { PostMessage(*this, WM_QUERYDONE, 0, 0); } };
+    uint64_t m_querySerial = 0;     // of the query the history menu is waiting for
+    POINT m_menuPos = {};
+    std::tstring m_query;
 };
 
 void RadClipboardViewerWnd::GetWndClass(WNDCLASS& wc)
@@ -132,7 +327,7 @@ void RadClipboardViewerWnd::GetCreateWindow(CREATESTRUCT& cs)
 {
     Window::GetCreateWindow(cs);
     cs.lpszName = TEXT("Rad Clipboard");
-    cs.style = WS_OVERLAPPED | WS_CAPTION | WS_THICKFRAME;
+    cs.style = WS_OVERLAPPED | WS_CAPTION | WS_THICKFRAME | WS_VSCROLL;
     cs.cx = 300;
     cs.cy = 100;
     cs.dwExStyle = WS_EX_TOOLWINDOW | WS_EX_TOPMOST;
@@ -140,87 +335,116 @@ void RadClipboardViewerWnd::GetCreateWindow(CREATESTRUCT& cs)
 
 BOOL RadClipboardViewerWnd::OnCreate(const LPCREATESTRUCT lpCreateStruct)
 {
-    CHECK_LE(AddClipboardFormatListener(*this));
-    OnClipboardUpdate();
+    TraceThreadName("UI");
+    for (const auto& k : m_formatRegistry.RegisteredTextKinds())
+        m_search.SetTextKind(k.first, k.second);
+    m_summaries.SetTextKinds(m_search.GetTextKinds());
+    m_captures.SetTextKinds(m_search.GetTextKinds());
+
+    const std::wstring journal = GetDataPath(L"History.journal");
+    if (!journal.empty() && m_journal.Open(journal))
+    {
+        m_journal.Load(m_history, HistNow());
+        m_history.AddListener(&m_journal);
+    }
+    else
+        RadLog(LOG_WARN, TEXT("Unable to open history journal"), SRC_LOC);
+
+    // Loaded entries are summarized and indexed by the pipeline, most recent first, and get a
+    // thumbnail when they are shown
+    for (const HistId i : m_history)
+    {
+        std::vector<std::pair<uint32_t, PayloadRef>> refs;
+        for (const HistItem& item : m_history.Items(i))
+            refs.push_back({ item.uFormat, m_payloads.Ref(item.payload) });
+        m_captures.Prepare(i, std::move(refs));
+    }
+    m_history.AddListener(&m_search);
+    m_history.AddListener(&m_summaries);
+    m_history.AddListener(&m_thumbnails);
+
+    m_listener.SetPolicy(LoadCapturePolicy(GetDataPath(L"CapturePolicy.txt")));
+    if (!m_listener.Start(*this))
+        RadLog(LOG_ERROR, TEXT("Unable to listen for clipboard changes"), SRC_LOC);
     RegisterHotKey(*this, HK_HIST, MOD_CONTROL | MOD_SHIFT, 'V');
+    CHECK_LE(SetTimer(*this, TIMER_COLDTIER, 60 * 1000, nullptr));
     return TRUE;
 }
 
 void RadClipboardViewerWnd::OnDestroy()
 {
-    CHECK_LE(RemoveClipboardFormatListener(*this));
+    m_listener.Stop();
+    m_opener.Cancel();
+    const Histogram& latency = m_changes.CaptureLatency();
+    RADLOG(LOG_DEBUG, TEXT("Clipboard capture latency: %llu changes, p50 %llu us, p99 %llu us, max %llu us"),
+        latency.Count(), latency.Percentile(0.5), latency.Percentile(0.99), latency.Max());
+    const CoalesceStats& coalescing = m_listener.Coalescing();
+    RADLOG(LOG_DEBUG, TEXT("Clipboard updates: %llu notified, %llu captured, %llu duplicates, %llu coalesced, %llu throttled"),
+        coalescing.notifications, coalescing.captures, coalescing.duplicates, coalescing.coalesced, coalescing.throttled);
+    const PolicyStats& policy = m_listener.Policy();
+    RADLOG(LOG_DEBUG, TEXT("Capture policy: %llu changes excluded, %llu formats skipped, %llu over their size cap"),
+        policy.excluded, policy.skipped, policy.oversized);
+    const Histogram& wait = m_contention.Wait();
+    const auto holders = m_contention.Holders();
+    RADLOG(LOG_DEBUG, TEXT("Clipboard contention: %llu opened, %llu contended, %llu failed, wait p50 %llu us, p99 %llu us, most often held by %ls"),
+        m_contention.Acquired(), m_contention.Contended(), m_contention.Failed(), wait.Percentile(0.5), wait.Percentile(0.99),
+        holders.empty() ? L"-" : holders.front().first.c_str());
+    CHECK_LE(KillTimer(*this, TIMER_COLDTIER));
+    m_history.RemoveListener(&m_journal);
+    m_history.RemoveListener(&m_search);
+    m_history.RemoveListener(&m_summaries);
+    m_history.RemoveListener(&m_thumbnails);
+    m_journal.Close();
     PostQuitMessage(0);
 }
 
-void RadClipboardViewerWnd::OnClipboardUpdate()
+void RadClipboardViewerWnd::OnClipboardChange()
 {
-    CHECK_LE(OpenClipboardTimeout(*this, 100));
-    m_formats.clear();
-    {
-        UINT format = 0;
-        while (format = EnumClipboardFormats(format))
-            m_formats.push_back(format);
-    }
-
-    m_uFormat = 0;
-    for (const UINT f : m_formats)
+    ClipboardChange c;
+    while (m_changes.Pop(c))
     {
-        //TCHAR name[1024] = TEXT("");
-        //GetClipboardFormatName(f, name, ARRAYSIZE(name));
-        if (f <= CF_MAX)
+        // The entry is shown once the pipeline has finished with it
+        if (!c.items.empty())
+            m_lastCapture = m_captures.Add(c.time, std::move(c.items));
+        else
         {
-            m_uFormat = f;
-            break;
+            m_lastCapture = UINT64_MAX;
+            ShowEntry(c.own ? m_render.Entry() : InvalidHist);
         }
     }
-    
-    std::set<UINT> format_done;
-    m_history.insert(m_history.begin(), 1, {});
-    std::vector<HistItem>& n = m_history.front();
-    for (const UINT f : m_formats)
+}
+
+void RadClipboardViewerWnd::OnCaptured()
+{
+    TraceSpan span("CommitCaptures");
+    bool added = false;
+    Capture c;
+    while (m_captures.Pop(c))
     {
-        bool skip = false;
-        // Skip according to https://learn.microsoft.com/en-us/windows/win32/dataxchg/clipboard-formats#synthesized-clipboard-formats
-        switch (f)
+        if (c.entry != InvalidHist)
         {
-        case CF_TEXT: case CF_UNICODETEXT: case CF_OEMTEXT:
-            skip = contains(format_done, CF_TEXT) || contains(format_done, CF_UNICODETEXT) || contains(format_done, CF_OEMTEXT);
-            break;
-        case CF_BITMAP: case CF_DIB: case CF_DIBV5:
-            skip = contains(format_done, CF_BITMAP) || contains(format_done, CF_DIB) || contains(format_done, CF_DIBV5);
-            break;
-        case CF_PALETTE:
-            skip = contains(format_done, CF_DIB) || contains(format_done, CF_DIBV5);
-            break;
-        case CF_ENHMETAFILE: case CF_METAFILEPICT:
-            skip = contains(format_done, CF_ENHMETAFILE) || contains(format_done, CF_METAFILEPICT);
-            break;
-        }
-        if (skip)
+            if (m_history.Contains(c.entry))
+            {
+                m_summaries.Set(c.entry, c.summary);
+                m_search.Insert(c.entry, std::move(c.text));
+            }
             continue;
-
-        const HANDLE hData = GetClipboardData(f);
-        HANDLE hCopy = NULL;
-        switch (f)
-        {   // Copy according to https://learn.microsoft.com/en-gb/windows/win32/dataxchg/standard-clipboard-formats#constants
-        case CF_BITMAP:
-            hCopy = CopyImage(hData, IMAGE_BITMAP, 0, 0, LR_DEFAULTSIZE);
-            break;
-        default:
-            hCopy = Duplicate(hData);
-            break;
         }
-        if (hCopy == NULL)
-            continue;
-
-        format_done.insert(f);
-        n.push_back({ f, hCopy});
+        std::vector<HistItem> items;
+        for (const CaptureItem& i : c.items)
+            items.push_back({ i.uFormat, m_payloads.AddStaged(i.hash, i.raw) });
+        const uint64_t key = History::EntryKey(m_payloads, items);
+        m_summaries.Provide(key, c.summary);
+        m_search.Provide(key, std::move(c.text));
+        const HistId entry = m_history.Add(std::move(items), c.time);
+        added = true;
+        if (c.serial == m_lastCapture)
+            ShowEntry(entry);
     }
-
-    CHECK_LE(CloseClipboard());
-
-    m_text.clear();
-    CHECK_LE(InvalidateRect(*this, nullptr, TRUE));
+    if (added)
+        m_coldTier.Update(m_history, HistNow());
+    TraceCounter("History entries", int64_t(m_history.size()));
+    TraceCounter("Stored bytes", int64_t(m_payloads.StoredBytes()));
 }
 
 void RadClipboardViewerWnd::OnContextMenu(HWND hWndContext, UINT xPos, UINT yPos)
@@ -228,14 +452,20 @@ void RadClipboardViewerWnd::OnContextMenu(HWND hWndContext, UINT xPos, UINT yPos
     auto hMenu = MakeUniqueHandle(CreatePopupMenu(), DestroyMenu);
     static const UINT CommandBegin = 0x100;
     for (const UINT f : m_formats)
-        CHECK_LE(AppendMenu(hMenu.get(), MF_STRING | (f == m_uFormat ? MF_CHECKED : MF_UNCHECKED), CommandBegin + f, GetFormatName(f).c_str()));
+        CHECK_LE(AppendMenu(hMenu.get(), MF_STRING | (f == m_uFormat ? MF_CHECKED : MF_UNCHECKED), CommandBegin + f, s2t(m_formatRegistry.Label(f)).c_str()));
+    CHECK_LE(AppendMenu(hMenu.get(), MF_SEPARATOR, 0, nullptr));
+    CHECK_LE(AppendMenu(hMenu.get(), MF_STRING | (TraceEnabled() ? MF_CHECKED : MF_UNCHECKED), CMD_TRACE, TEXT("Trace")));
+    CHECK_LE(AppendMenu(hMenu.get(), MF_STRING, CMD_SAVETRACE, TEXT("Save Trace")));
 
     const int Command = TrackPopupMenu(hMenu.get(), TPM_LEFTBUTTON | TPM_LEFTALIGN | TPM_RETURNCMD, xPos, yPos, 0, *this, nullptr);
-    if (Command > 0)
+    if (Command == CMD_TRACE)
+        TraceEnable(!TraceEnabled());
+    else if (Command == CMD_SAVETRACE)
+        SaveTrace();
+    else if (Command >= CommandBegin)
     {
         m_uFormat = Command - CommandBegin;
-        m_text.clear();
-        CHECK_LE(InvalidateRect(*this, nullptr, TRUE));
+        ResetView();
     }
 }
 
@@ -244,110 +474,442 @@ void RadClipboardViewerWnd::OnHotKey(int idHotKey, UINT fuModifiers, UINT vk)
     if (idHotKey == HK_HIST)
     {
         SetForegroundWindow(*this);
-        POINT pt;
-        CHECK_LE(GetCursorPos(&pt));
-
-        auto hMenu = MakeUniqueHandle(CreatePopupMenu(), DestroyMenu);
+        CHECK_LE(GetCursorPos(&m_menuPos));
+        m_querySerial = 0;
 
-        static const UINT CommandBegin = 0x100;
-        UINT id = CommandBegin;
-        for (const auto& i : m_history)
+        // Typing into the window filters the history
+        std::vector<HistId> entries;
+        if (m_query.empty())
+            entries.assign(m_history.begin(), m_history.end());
+        else
         {
-            TCHAR name[1024] = TEXT("");
-            for (const auto& e : i)
+            std::string text;
+            ExtractText(TextKind::Unicode, (const uint8_t*) m_query.data(), m_query.size() * sizeof(TCHAR), text);
+            Query query;
+            query.SetTextKinds(m_search.GetTextKinds());
+            if (!query.Parse(text))
+                RadLog(LOG_WARN, TEXT("Invalid history query"), SRC_LOC);
+            else if (query.IsPlainText())
+                entries = m_search.Find(m_history, query.PlainText(), 100);
+            else
             {
-                bool dobreak = true;
-                switch (e.uFormat)
-                {
-                case CF_TEXT:
-                {
-                    auto pStr = AutoGlobalLock<LPCSTR>(e.hData);
-                    StringCchPrintf(name, ARRAYSIZE(name), TEXT("%.50S"), pStr.get());
-                    break;
-                }
-                case CF_UNICODETEXT:
-                {
-                    auto pStr = AutoGlobalLock<LPWSTR>(e.hData);
-                    StringCchPrintf(name, ARRAYSIZE(name), TEXT("%.50s"), pStr.get());
-                    break;
-                }
-                case CF_BITMAP:
-                {
-                    const HBITMAP hbmp = (HBITMAP) e.hData;
-                    BITMAP bm;
-                    GetObject(hbmp, sizeof(bm), &bm);
-                    StringCchPrintf(name, ARRAYSIZE(name), TEXT("Image %d x %d x %d"), bm.bmWidth, bm.bmHeight, bm.bmBitsPixel);
-                    break;
-                }
-                case CF_DIB:
-                {
-                    auto pBitmapInfo = AutoGlobalLock<LPBITMAPINFO>(e.hData);
-                    StringCchPrintf(name, ARRAYSIZE(name), TEXT("Image %d x %d x %d"), pBitmapInfo->bmiHeader.biWidth, pBitmapInfo->bmiHeader.biHeight, pBitmapInfo->bmiHeader.biBitCount);
-                    break;
-                }
-                case CF_HDROP:
-                {
-                    int count = 0;
-                    auto pDropFiles = AutoGlobalLock<LPDROPFILES>(e.hData);
-                    if (pDropFiles->fWide)
-                    {
-                        LPWSTR pStr = (LPWSTR)((BYTE*)pDropFiles.get() + pDropFiles->pFiles);
-                        while (*pStr)
-                        {
-                            size_t len = 0;
-                            CHECK_HR(StringCchLengthW(pStr, MAX_PATH, &len));
-
-                            ++count;
-
-                            pStr += len + 1;
-                        }
-                    }
-                    else
-                    {
-                        LPSTR pStr = (LPSTR)((BYTE*)pDropFiles.get() + pDropFiles->pFiles);
-                        while (*pStr)
-                        {
-                            size_t len = 0;
-                            CHECK_HR(StringCchLengthA(pStr, MAX_PATH, &len));
-
-                            ++count;
-
-                            pStr += len + 1;
-                        }
-                    }
-                    StringCchPrintf(name, ARRAYSIZE(name), TEXT("%d Files"), count);
-                    break;
-                }
-                default:
-                    dobreak = false;
-                    break;
-                }
-
-                if (dobreak)
-                    break;
+                // Scanning the payloads can take a while, the menu is shown once it is done
+                m_querySerial = m_queryEngine.Start(QueryEngine::Snapshot(m_history), std::move(query), 100);
+                return;
             }
+        }
+        ShowHistoryMenu(entries);
+    }
+}
+
+void RadClipboardViewerWnd::OnQueryDone()
+{
+    uint64_t serial;
+    std::vector<HistId> entries;
+    if (!m_queryEngine.TakeResult(serial, entries) || serial != m_querySerial)
+        return;
+    m_querySerial = 0;
+    // Erased while the query ran
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [this](const HistId i) { return !m_history.Contains(i); }), entries.end());
+    ShowHistoryMenu(entries);
+}
+
+void RadClipboardViewerWnd::ShowHistoryMenu(const std::vector<HistId>& entries)
+{
+    // Up to the menu being shown, not the time it is open
+    TraceSpan span("HistoryMenu");
+    auto hMenu = MakeUniqueHandle(CreatePopupMenu(), DestroyMenu);
+
+    static const UINT CommandBegin = 0x100;
+    UINT id = CommandBegin;
 
-            if (name[0] == TEXT('\0'))
-                StringCchPrintf(name, ARRAYSIZE(name), TEXT("Item: %u"), i.front().uFormat);
-            AppendMenu(hMenu.get(), MF_STRING, id++, name);
+    // Labels are worked out when the entries are captured, images get a preview
+    std::vector<std::shared_ptr<void>> bitmaps;
+    size_t requested = 0;
+    for (const HistId i : entries)
+    {
+        WCHAR name[EntrySummary::LabelChars * 2 + 1] = L"";
+        MultiByteToWideChar(CP_UTF8, 0, m_summaries.Get(i).label, -1, name, ARRAYSIZE(name));
+        AppendMenuW(hMenu.get(), MF_STRING, id, name);
+
+        const auto thumbnail = m_thumbnails.Get(i);
+        // For the next time the menu is shown
+        if (!thumbnail && requested < ThumbnailCache::MaxThumbnails && m_summaries.Get(i).kind == SummaryKind::Image)
+        {
+            m_thumbnails.Request(m_history, i);
+            ++requested;
         }
+        if (thumbnail)
+        {
+            const auto bitmap = MakeBitmap(thumbnail->menuImage);
+            if (bitmap)
+            {
+                MENUITEMINFOW mii = { sizeof(MENUITEMINFOW), MIIM_BITMAP };
+                mii.hbmpItem = (HBITMAP) bitmap.get();
+                CHECK_LE(SetMenuItemInfoW(hMenu.get(), id, FALSE, &mii));
+                bitmaps.push_back(bitmap);
+            }
+        }
+        ++id;
+    }
+    span.Arg("entries", entries.size());
+    span.End();
 
-        const int Command = TrackPopupMenu(hMenu.get(), TPM_LEFTBUTTON | TPM_LEFTALIGN | TPM_RETURNCMD, pt.x, pt.y, 0, *this, nullptr);
-        if (Command > CommandBegin)
+    const int Command = TrackPopupMenu(hMenu.get(), TPM_LEFTBUTTON | TPM_LEFTALIGN | TPM_RETURNCMD, m_menuPos.x, m_menuPos.y, 0, *this, nullptr);
+    if (Command >= CommandBegin)
+    {
+        const HistId i = entries[Command - CommandBegin];
+        // Captures while the menu was open can evict the entry
+        if (!m_history.Contains(i))
+            return;
+        m_history.Touch(i, HistNow());
+        ShowEntry(i);
+        // Waits on a timer if another application has the clipboard open
+        m_opener.Open(*this, [this, i](const bool opened)
         {
-            const auto& i = m_history[Command - CommandBegin];
-            CHECK_LE(OpenClipboardTimeout(*this, 100));
+            RadLogDeferNotifications defer;
+            if (!opened)
+            {
+                RadLog(LOG_WARN, TEXT("Unable to restore the entry, the clipboard is in use"), SRC_LOC);
+                return;
+            }
+            if (!m_history.Contains(i))
+            {
+                CHECK_LE(CloseClipboard());
+                return;
+            }
+
+            // Clears the previous delayed render through WM_DESTROYCLIPBOARD
             CHECK_LE(EmptyClipboard());
 
-            for (const auto& e : i)
-                //SetClipboardData(e.uFormat, Duplicate(e.hData));
-                SetClipboardData(e.uFormat, e.hData);
+            // Formats are only materialized when an application asks for them
+            Win32Clipboard clipboard;
+            m_render.Offer(m_history, i, clipboard);
 
             CHECK_LE(CloseClipboard());
+        });
+    }
+}
+
+void RadClipboardViewerWnd::OnTimer(UINT id)
+{
+    if (m_opener.OnTimer(id))
+        return;
+    if (id == TIMER_COLDTIER)
+    {
+        m_coldTier.Update(m_history, HistNow());
+        m_payloads.Compact(4 * 1024 * 1024);
+        const size_t errors = m_journal.Errors();
+        if (errors != m_journalErrors)
+        {
+            RADLOG(LOG_WARN, TEXT("History journal: %zu writes or compactions failed"), errors - m_journalErrors);
+            m_journalErrors = errors;
+        }
+    }
+}
+
+HANDLE RadClipboardViewerWnd::OnRenderFormat(UINT fmt)
+{
+    TraceSpan span("RenderFormat");
+    span.Arg("format", fmt);
+    // The clipboard is already opened by the requesting application, which waits for this to return
+    RadLogDeferNotifications defer;
+    Win32Clipboard clipboard;
+    if (!m_render.Render(fmt, clipboard))
+        RadLog(LOG_WARN, TEXT("Unable to render clipboard format"), SRC_LOC);
+    return NULL;
+}
+
+void RadClipboardViewerWnd::OnRenderAllFormats()
+{
+    RadLogDeferNotifications defer;
+    // Has to be done before returning
+    if (!OpenClipboardWait(*this, BackoffPolicy(), m_contention))
+    {
+        RadLog(LOG_WARN, TEXT("Unable to render clipboard formats, the clipboard is in use"), SRC_LOC);
+        return;
+    }
+    if (GetClipboardOwner() == *this)
+    {
+        Win32Clipboard clipboard;
+        m_render.RenderAll(clipboard);
+    }
+    CHECK_LE(CloseClipboard());
+}
+
+void RadClipboardViewerWnd::OnDestroyClipboard()
+{
+    m_render.Reset();
+}
+
+void RadClipboardViewerWnd::OnChar(TCHAR ch, int cRepeat)
+{
+    switch (ch)
+    {
+    case TEXT('\b'):
+        if (!m_query.empty())
+            m_query.pop_back();
+        break;
+    case 27:    // Escape
+        m_query.clear();
+        break;
+    case TEXT('\r'):
+        // @offset in hex moves the hex view
+        if (!m_query.empty() && m_query.front() == TEXT('@'))
+        {
+            ScrollTo(size_t(_tcstoui64(m_query.c_str() + 1, nullptr, 16) / HexRowBytes));
+            m_query.clear();
+        }
+        break;
+    default:
+        if (ch >= TEXT(' '))
+            m_query.append(cRepeat, ch);
+        break;
+    }
+    const std::tstring title = m_query.empty() ? std::tstring(TEXT("Rad Clipboard")) : TEXT("Rad Clipboard - ") + m_query;
+    CHECK_LE(SetWindowText(*this, title.c_str()));
+}
+
+void RadClipboardViewerWnd::OnKeyDown(UINT vk, int cRepeat, UINT flags)
+{
+    const size_t page = PageRows();
+    switch (vk)
+    {
+    case VK_UP:     ScrollTo(m_top - std::min<size_t>(m_top, cRepeat)); break;
+    case VK_DOWN:   ScrollTo(m_top + cRepeat); break;
+    case VK_PRIOR:  ScrollTo(m_top - std::min(m_top, page * cRepeat)); break;
+    case VK_NEXT:   ScrollTo(m_top + page * cRepeat); break;
+    case VK_HOME:   ScrollTo(0); break;
+    case VK_END:    ScrollTo(RowCount()); break;
+    }
+}
+
+void RadClipboardViewerWnd::OnSize(UINT state, int cx, int cy)
+{
+    if (!m_view && m_thumbnail && !ThumbnailFits())
+        m_view = m_views.Get(m_entry, m_uFormat);
+    if (m_view && IsTextView(ViewDesc()) && cx > 0)
+    {
+        // Keep the same text at the top
+        TextLayout& text = m_view->text;
+        size_t begin, end;
+        text.Row(std::min(m_top, text.RowCount() - 1), begin, end);
+        text.SetWidth(cx);
+        m_top = text.RowOf(begin);
+    }
+    UpdateScrollBar();
+    ScrollTo(m_top);
+}
+
+void RadClipboardViewerWnd::OnVScroll(HWND hWndCtl, UINT code, int pos)
+{
+    const size_t page = PageRows();
+    switch (code)
+    {
+    case SB_LINEUP:     ScrollTo(m_top - std::min<size_t>(m_top, 1)); break;
+    case SB_LINEDOWN:   ScrollTo(m_top + 1); break;
+    case SB_PAGEUP:     ScrollTo(m_top - std::min(m_top, page)); break;
+    case SB_PAGEDOWN:   ScrollTo(m_top + page); break;
+    case SB_TOP:        ScrollTo(0); break;
+    case SB_BOTTOM:     ScrollTo(RowCount()); break;
+    case SB_THUMBTRACK:
+    case SB_THUMBPOSITION:
+    {
+        // pos is only 16 bits
+        SCROLLINFO si = { sizeof(SCROLLINFO), SIF_TRACKPOS };
+        CHECK_LE(GetScrollInfo(*this, SB_VERT, &si));
+        ScrollTo(size_t(si.nTrackPos));
+        break;
+    }
+    }
+}
 
-            m_history.erase(std::next(m_history.begin(), Command - CommandBegin));
+void RadClipboardViewerWnd::OnMouseWheel(int xPos, int yPos, int zDelta, UINT fwKeys)
+{
+    const int rows = -zDelta * 3 / WHEEL_DELTA;
+    ScrollTo(rows < 0 ? m_top - std::min<size_t>(m_top, -rows) : m_top + rows);
+}
+
+void RadClipboardViewerWnd::ShowEntry(const HistId id)
+{
+    m_entry = id;
+    m_formats.clear();
+    m_uFormat = 0;
+    if (m_history.Contains(id))
+    {
+        for (const HistItem& i : m_history.Items(id))
+        {
+            m_formats.push_back(i.uFormat);
+            if (m_uFormat == 0 && i.uFormat <= CF_MAX)
+                m_uFormat = i.uFormat;
         }
+        m_thumbnails.Request(m_history, id);
     }
+    ResetView();
+}
+
+void RadClipboardViewerWnd::ResetView()
+{
+    m_top = 0;
+    m_thumbnail = IsImageView(ViewDesc()) ? m_thumbnails.Get(m_entry) : nullptr;
+    m_thumbnailBitmap = m_thumbnail ? MakeBitmap(m_thumbnail->image) : nullptr;
+    // Full images are only decoded when the window is bigger than the thumbnail
+    const bool preview = IsImageView(ViewDesc()) && (ThumbnailFits() || m_thumbnails.Pending(m_entry));
+    m_view = m_uFormat != 0 && !preview ? m_views.Get(m_entry, m_uFormat) : nullptr;
+
+    m_font = ViewFont(ViewDesc());
+    {
+        auto hDC = AutoGetDC(*this);
+        auto hOldFont = AutoSelectObject(hDC.get(), m_font);
+        TEXTMETRIC tm = {};
+        CHECK_LE(GetTextMetrics(hDC.get(), &tm));
+        m_lineHeight = tm.tmHeight + tm.tmExternalLeading;
+    }
+
+    if (m_view && IsTextView(ViewDesc()))
+    {
+        RECT rc;
+        CHECK_LE(GetClientRect(*this, &rc));
+        m_view->text.SetWidth(rc.right - rc.left);
+    }
+    UpdateScrollBar();
+    CHECK_LE(InvalidateRect(*this, nullptr, TRUE));
+}
+
+bool RadClipboardViewerWnd::ThumbnailFits() const
+{
+    if (!m_thumbnail || !m_thumbnailBitmap)
+        return false;
+    RECT rc;
+    CHECK_LE(GetClientRect(*this, &rc));
+    int32_t cx, cy;
+    FitSize(m_thumbnail->sourceWidth, m_thumbnail->sourceHeight, rc.right - rc.left, rc.bottom - rc.top, cx, cy);
+    return cx <= m_thumbnail->image.width && cy <= m_thumbnail->image.height;
+}
+
+// Done once per entry and format, the products are kept by m_views
+void RadClipboardViewerWnd::Decode(ViewProduct& product, const UINT uFormat)
+{
+    TraceSpan span("Decode");
+    span.Arg("format", uFormat);
+    span.Arg("bytes", product.size);
+    const FormatDesc& d = m_formatRegistry.Describe(uFormat);
+    switch (d.view)
+    {
+    case FormatView::Text:
+    {
+        // The text is indexed once, wrapping is cached per width
+        const HGDIOBJ hFont = ViewFont(d);
+        product.text.SetMeasure([this, hFont](wchar_t c)
+            {
+                auto hDC = AutoGetDC(*this);
+                auto hOldFont = AutoSelectObject(hDC.get(), hFont);
+                INT w = 0;
+                GetCharWidth32W(hDC.get(), c, c, &w);
+                return int(w);
+            });
+        product.text.SetText(DecodeText(d, product.data, product.size));
+        break;
+    }
+    case FormatView::Image:
+    {
+        // Converted once, so painting is a single blit
+        BgraImage image;
+        if (!DecodeDib(product.data, product.size, image))
+            break;
+        product.object = MakeBitmap(image);
+        product.bytes = image.pixels.size() * sizeof(uint32_t);
+        break;
+    }
+    case FormatView::Files:
+        product.files = DecodeFiles(product.data, product.size);
+        break;
+    case FormatView::Metafile:
+    {
+        const HENHMETAFILE hEmf = SetEnhMetaFileBits(UINT(product.size), product.data);
+        if (hEmf != NULL)
+            product.object = std::shared_ptr<void>(hEmf, [](void* h) { DeleteEnhMetaFile((HENHMETAFILE) h); });
+        break;
+    }
+    }
+}
+
+void RadClipboardViewerWnd::UpdateScrollBar()
+{
+    // The scroll bar hides itself when everything fits
+    SCROLLINFO si = { sizeof(SCROLLINFO), SIF_RANGE | SIF_PAGE | SIF_POS };
+    si.nMax = int(std::min<size_t>(RowCount(), INT_MAX)) - 1;
+    si.nPage = UINT(PageRows());
+    si.nPos = int(m_top);
+    SetScrollInfo(*this, SB_VERT, &si, TRUE);
+}
+
+size_t RadClipboardViewerWnd::RowCount() const
+{
+    if (!m_view)
+        return 0;
+    else if (IsHexView(ViewDesc()))
+        return HexRowCount(m_view->size);
+    else if (IsTextView(ViewDesc()))
+        return m_view->text.RowCount();
+    else
+        return 0;
+}
+
+RECT RadClipboardViewerWnd::RowsRect() const
+{
+    RECT rc;
+    CHECK_LE(GetClientRect(*this, &rc));
+    // The hex view starts with the format name
+    if (IsHexView(ViewDesc()))
+        rc.top += m_lineHeight;
+    return rc;
+}
+
+size_t RadClipboardViewerWnd::PageRows() const
+{
+    const RECT rc = RowsRect();
+    return size_t(std::max(1, int(rc.bottom - rc.top) / m_lineHeight));
+}
+
+// Rows that intersect rcPaint
+void RadClipboardViewerWnd::PaintRows(const RECT& rcPaint, size_t& first, size_t& last) const
+{
+    const RECT rc = RowsRect();
+    first = m_top + size_t(std::max(0, int(rcPaint.top - rc.top)) / m_lineHeight);
+    last = m_top + size_t(std::max(0, int(rcPaint.bottom - rc.top) + m_lineHeight - 1) / m_lineHeight);
+    last = std::min(last, RowCount());
+    first = std::min(first, last);
+}
+
+void RadClipboardViewerWnd::ScrollTo(size_t row)
+{
+    const size_t rows = RowCount();
+    const size_t page = PageRows();
+    row = std::min(row, rows > page ? rows - page : 0);
+    if (row == m_top)
+        return;
+
+    const RECT rc = RowsRect();
+    const ptrdiff_t delta = (ptrdiff_t(m_top) - ptrdiff_t(row)) * m_lineHeight;
+    m_top = row;
+    // Only the rows scrolled into view are repainted
+    if (delta > -(rc.bottom - rc.top) && delta < rc.bottom - rc.top)
+        ScrollWindowEx(*this, 0, int(delta), &rc, &rc, NULL, nullptr, SW_INVALIDATE | SW_ERASE);
+    else
+        CHECK_LE(InvalidateRect(*this, &rc, TRUE));
+    SetScrollPos(*this, SB_VERT, int(row), TRUE);
+}
+
+void RadClipboardViewerWnd::SaveTrace() const
+{
+    const std::wstring path = GetDataPath(L"Trace.json");
+    std::ofstream file(path, std::ios::binary);
+    file << TraceExport();
+    if (file)
+        RADLOG(LOG_INFO, TEXT("Trace saved to %ls, open it in https://ui.perfetto.dev"), path.c_str());
+    else
+        RADLOG(LOG_WARN, TEXT("Unable to save the trace to %ls"), path.c_str());
 }
 
 LRESULT RadClipboardViewerWnd::HandleMessage(const UINT uMsg, const WPARAM wParam, const LPARAM lParam)
@@ -357,9 +919,41 @@ LRESULT RadClipboardViewerWnd::HandleMessage(const UINT uMsg, const WPARAM wPara
     {
         HANDLE_MSG(WM_CREATE, OnCreate);
         HANDLE_MSG(WM_DESTROY, OnDestroy);
-        HANDLE_MSG(WM_CLIPBOARDUPDATE, OnClipboardUpdate);
         HANDLE_MSG(WM_CONTEXTMENU, OnContextMenu);
         HANDLE_MSG(WM_HOTKEY, OnHotKey);
+        HANDLE_MSG(WM_TIMER, OnTimer);
+        HANDLE_MSG(WM_CHAR, OnChar);
+        HANDLE_MSG(WM_KEYDOWN, OnKeyDown);
+        HANDLE_MSG(WM_SIZE, OnSize);
+        HANDLE_MSG(WM_VSCROLL, OnVScroll);
+        HANDLE_MSG(WM_MOUSEWHEEL, OnMouseWheel);
+        HANDLE_MSG(WM_RENDERFORMAT, OnRenderFormat);
+        HANDLE_MSG(WM_RENDERALLFORMATS, OnRenderAllFormats);
+        HANDLE_MSG(WM_DESTROYCLIPBOARD, OnDestroyClipboard);
+    case WM_COLDTIER:
+        SetHandled(true);
+        m_coldTier.Commit();
+        break;
+    case WM_CLIPBOARDCHANGE:
+        SetHandled(true);
+        OnClipboardChange();
+        break;
+    case WM_CAPTURED:
+        SetHandled(true);
+        OnCaptured();
+        break;
+    case WM_QUERYDONE:
+        SetHandled(true);
+        OnQueryDone();
+        break;
+    case WM_THUMBNAILS:
+    {
+        SetHandled(true);
+        const std::vector<HistId> ids = m_thumbnails.Commit();
+        if (!m_view && IsImageView(ViewDesc()) && std::find(ids.begin(), ids.end(), m_entry) != ids.end())
+            ResetView();
+        break;
+    }
     }
 
     if (!IsHandled())
@@ -370,197 +964,108 @@ LRESULT RadClipboardViewerWnd::HandleMessage(const UINT uMsg, const WPARAM wPara
 
 void RadClipboardViewerWnd::OnDraw(const PAINTSTRUCT* pps) const
 {
+    TraceSpan span("Paint");
+    span.Arg("format", m_uFormat);
+    span.Arg("bytes", m_view ? m_view->size : 0);
     RECT rc;
     CHECK_LE(GetClientRect(*this, &rc));
 
     SetBkMode(pps->hdc, TRANSPARENT);
     SetTextColor(pps->hdc, RGB(250, 250, 223));
-    if (m_uFormat == 0)
+    if (m_uFormat == 0 || (!m_view && !m_thumbnailBitmap && !m_thumbnails.Pending(m_entry)))
     {
         DrawText(pps->hdc, TEXT("The clipboard is empty."), -1, &rc, DT_CENTER | DT_VCENTER | DT_NOPREFIX | DT_WORDBREAK);
     }
+    else if (!m_view)
+    {
+        // Image preview, the full image isn't decoded
+        if (m_thumbnailBitmap)
+            DrawBitmap(pps->hdc, (HBITMAP) m_thumbnailBitmap.get(), rc);
+    }
     else
     {
-        CHECK_LE(OpenClipboardTimeout(*this, 100));
-        const HANDLE hData = GetClipboardData(m_uFormat);
-        if (hData != NULL)
+        // Drawn from the snapshot, the clipboard isn't opened
+        const ViewProduct& v = *m_view;
+        auto hOldFont = AutoSelectObject(pps->hdc, m_font);
+        switch (ViewDesc().view)
         {
-            UINT uFormat = m_uFormat;
-            if (uFormat == CF_HTML || uFormat == CF_LINK || uFormat == CF_HYPERLINK || uFormat == CF_RICH || uFormat == CF_FILENAME)
-                uFormat = CF_TEXT;  // UTF-8
-            else if (uFormat == CF_FILENAMEW)
-                uFormat = CF_UNICODETEXT;
-            auto hOldFont = AutoSelectObject(pps->hdc, GetStockObject(SYSTEM_FONT));
-            switch (uFormat)
-            {
-            case CF_OEMTEXT:
-                SelectObject(pps->hdc, GetStockObject(OEM_FIXED_FONT));
-                // Fallthrough
-            case CF_TEXT:
-            {
-                auto pStr = AutoGlobalLock<LPCSTR>(hData);
-                if (pStr)
-                    DrawTextA(pps->hdc, pStr.get(), -1, &rc, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_WORDBREAK | DT_EXPANDTABS);
-                break;
-            }
-            case CF_UNICODETEXT:
-            {
-                auto pStr = AutoGlobalLock<LPWSTR>(hData);
-                if (pStr)
-                    DrawTextW(pps->hdc, pStr.get(), -1, &rc, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_WORDBREAK | DT_EXPANDTABS);
-                break;
-            }
-            case CF_BITMAP:
-            {
-                const HBITMAP hbm = (HBITMAP) hData;
-                const auto hdcMem = MakeUniqueHandle(CreateCompatibleDC(pps->hdc), DeleteDC);
-                if (hdcMem)
-                {
-                    SelectObject(hdcMem.get(), hbm);
-                    BitBlt(pps->hdc, rc.left, rc.top, rc.right - rc.left, rc.bottom - rc.top, hdcMem.get(), 0, 0, SRCCOPY);
-                }
-                break;
-            }
-            case CF_DIB:
-            {
-                auto pBitmapInfo = AutoGlobalLock<LPBITMAPINFO>(hData);
-                size_t offset = pBitmapInfo->bmiHeader.biClrUsed * sizeof(RGBQUAD);
-                if (pBitmapInfo->bmiHeader.biCompression == BI_BITFIELDS
-                    and (pBitmapInfo->bmiHeader.biBitCount == 16 or pBitmapInfo->bmiHeader.biBitCount == 32)
-                    and pBitmapInfo->bmiHeader.biSize == 40)
-                    offset += 12; // mask-bytes
-                //offset += sizeof(RGBQUAD);
-                void *pDIBBits = (BYTE*) ((LPBITMAPINFOHEADER) pBitmapInfo.get() + 1) + offset;
-                ::StretchDIBits(pps->hdc,
-                    rc.left, rc.top, rc.right - rc.left, rc.bottom - rc.top,
-                    //0, 0, pBitmapInfo->bmiHeader.biWidth, pBitmapInfo->bmiHeader.biHeight,
-                    0, pBitmapInfo->bmiHeader.biHeight - (rc.bottom - rc.top), rc.right - rc.left, rc.bottom - rc.top,
-                    pDIBBits, pBitmapInfo.get(), DIB_RGB_COLORS, SRCCOPY);
-                break;
-            }
-            case CF_DIBV5:
-            {
-                auto pBitmapInfo = AutoGlobalLock<LPBITMAPV5HEADER>(hData);
-                size_t offset = pBitmapInfo->bV5ClrUsed * sizeof(RGBQUAD);
-                if (pBitmapInfo->bV5Compression == BI_BITFIELDS
-                    and (pBitmapInfo->bV5BitCount == 16 or pBitmapInfo->bV5BitCount == 32)
-                    and pBitmapInfo->bV5Size == 40)
-                    offset += 12; // mask-bytes
-                offset += sizeof(RGBQUAD) * 3; // TODO Not sure why this is here?
-                void* pDIBBits = (BYTE*) (pBitmapInfo.get() + 1) + offset;
-                ::StretchDIBits(pps->hdc,
-                    rc.left, rc.top, rc.right - rc.left, rc.bottom - rc.top,
-                    //0, 0, pBitmapInfo->bmiHeader.biWidth, pBitmapInfo->bmiHeader.biHeight,
-                    0, pBitmapInfo->bV5Height - (rc.bottom - rc.top), rc.right - rc.left, rc.bottom - rc.top,
-                    pDIBBits, (LPBITMAPINFO) pBitmapInfo.get(), DIB_RGB_COLORS, SRCCOPY);
-                break;
-            }
-            case CF_ENHMETAFILE:
-            {
-                const HENHMETAFILE hEmf = (HENHMETAFILE) hData;
-                PlayEnhMetaFile(pps->hdc, hEmf, &rc);
-                break;
-            }
-            case CF_OWNERDISPLAY:
-            {
-                const HWND hWndOwner = GetClipboardOwner();
-                const auto hglb = MakeUniqueHandle(GlobalAlloc(GMEM_MOVEABLE, sizeof(PAINTSTRUCT)), &GlobalFree);
-                if (hglb)
-                {
-                    {
-                        auto lpps = AutoGlobalLock<LPPAINTSTRUCT>(hglb.get());
-                        if (lpps)
-                            memcpy(lpps.get(), pps, sizeof(PAINTSTRUCT));
-                    }
-
-                    SendMessage(hWndOwner, WM_PAINTCLIPBOARD, (WPARAM) (HWND) *this, (LPARAM) hglb.get());
-                }
-                break;
-            }
-            case CF_LOCALE:
+        case FormatView::Text:
+        {
+            // Laid out in ResetView, only the rows being painted are drawn
+            size_t first, last;
+            PaintRows(pps->rcPaint, first, last);
+            const INT tab = v.text.TabWidth();
+            const std::wstring& text = v.text.Text();
+            for (size_t r = first; r < last; ++r)
             {
-                auto pLCID = AutoGlobalLock<LCID*>(hData);
-                TCHAR name[100];
-                LCIDToLocaleName(*(pLCID.get()), name, ARRAYSIZE(name), LOCALE_ALLOW_NEUTRAL_NAMES);
-                DrawText(pps->hdc, name, -1, &rc, DT_TOP | DT_LEFT);
-                break;
+                size_t begin, end;
+                v.text.Row(r, begin, end);
+                TabbedTextOutW(pps->hdc, rc.left, rc.top + int(r - m_top) * m_lineHeight, text.c_str() + begin, int(end - begin), 1, &tab, rc.left);
             }
-            case CF_HDROP:
-            {
-                auto pDropFiles = AutoGlobalLock<LPDROPFILES>(hData);
-                if (pDropFiles->fWide)
-                {
-                    LPWSTR pStr = (LPWSTR) ((BYTE*) pDropFiles.get() + pDropFiles->pFiles);
-                    while (*pStr)
-                    {
-                        size_t len = 0;
-                        CHECK_HR(StringCchLengthW(pStr, MAX_PATH, &len));
-
-                        RECT src = rc;
-                        DrawTextW(pps->hdc, pStr, int(len), &src, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_PATH_ELLIPSIS | DT_EXPANDTABS);
-                        DrawTextW(pps->hdc, pStr, int(len), &src, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_PATH_ELLIPSIS | DT_EXPANDTABS | DT_CALCRECT);
-                        rc.top += src.bottom - src.top;
-
-                        pStr += len + 1;
-                    }
-                }
-                else
-                {
-                    LPSTR pStr = (LPSTR) ((BYTE*) pDropFiles.get() + pDropFiles->pFiles);
-                    while (*pStr)
-                    {
-                        size_t len = 0;
-                        CHECK_HR(StringCchLengthA(pStr, MAX_PATH, &len));
-
-                        RECT src = rc;
-                        DrawTextA(pps->hdc, pStr, int(len), &src, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_PATH_ELLIPSIS | DT_EXPANDTABS);
-                        DrawTextA(pps->hdc, pStr, int(len), &src, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_PATH_ELLIPSIS | DT_EXPANDTABS | DT_CALCRECT);
-                        rc.top += src.bottom - src.top;
-
-                        pStr += len + 1;
-                    }
-                }
+            break;
+        }
+        case FormatView::Image:
+        {
+            // Premultiplied BGRA from Decode, scaled down to fit the window as the preview is
+            if (v.object)
+                DrawBitmap(pps->hdc, (HBITMAP) v.object.get(), rc);
+            break;
+        }
+        case FormatView::Metafile:
+        {
+            if (v.object)
+                PlayEnhMetaFile(pps->hdc, (HENHMETAFILE) v.object.get(), &rc);
+            break;
+        }
+        case FormatView::Locale:
+        {
+            LCID lcid = 0;
+            if (v.size < sizeof(lcid))
                 break;
-            }
-            default:
+            memcpy(&lcid, v.data, sizeof(lcid));
+            TCHAR name[100];
+            LCIDToLocaleName(lcid, name, ARRAYSIZE(name), LOCALE_ALLOW_NEUTRAL_NAMES);
+            DrawText(pps->hdc, name, -1, &rc, DT_TOP | DT_LEFT);
+            break;
+        }
+        case FormatView::Files:
+        {
+            for (const std::wstring& f : v.files)
             {
-                if (m_text.empty())
-                {
-                    m_text += TEXT("Unknown format: ");
-                    m_text += GetFormatName(m_uFormat);
-                    const SIZE_T sz = GlobalSize(hData);
-                    auto pData = AutoGlobalLock<BYTE*>(hData);
-                    for (SIZE_T i = 0; i < sz; i += 16)
-                    {
-                        m_text += TEXT('\n');
-                        for (SIZE_T j = 0; j < 16 && (i + j) < sz; ++j)
-                        {
-                            const BYTE b = pData.get()[i + j];
-                            TCHAR tmp[100];
-                            CHECK_HR(StringCchPrintf(tmp, ARRAYSIZE(tmp), TEXT(" %02X"), b));
-                            m_text += tmp;
-                        }
-                        m_text += TEXT('\t');
-                        for (SIZE_T j = 0; j < 16 && (i + j) < sz; ++j)
-                        {
-                            const BYTE b = pData.get()[i + j];
-                            m_text += std::isprint(b) ? b : TEXT('.');
-                        }
-                    }
-                }
-                SelectObject(pps->hdc, GetStockObject(SYSTEM_FIXED_FONT));
-                DrawText(pps->hdc, m_text.data(), int(m_text.length()), &rc, DT_TOP | DT_LEFT | DT_EXPANDTABS);
-                break;
-            }
+                RECT src = rc;
+                DrawTextW(pps->hdc, f.c_str(), int(f.length()), &src, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_PATH_ELLIPSIS | DT_EXPANDTABS);
+                DrawTextW(pps->hdc, f.c_str(), int(f.length()), &src, DT_TOP | DT_LEFT | DT_NOPREFIX | DT_PATH_ELLIPSIS | DT_EXPANDTABS | DT_CALCRECT);
+                rc.top += src.bottom - src.top;
             }
+            break;
+        }
+        default:
+        {
+            const std::tstring title = TEXT("Unknown format: ") + s2t(m_formatRegistry.Label(m_uFormat));
+            TextOut(pps->hdc, rc.left, rc.top, title.c_str(), int(title.length()));
+
+            // Format just the rows in the part of the viewport being painted
+            const int top = rc.top + m_lineHeight;
+            size_t first, last;
+            PaintRows(pps->rcPaint, first, last);
+            const size_t rows = HexDumpRows(m_hexRows, v.data, v.size, first, last - first);
+            for (size_t r = 0; r < rows; ++r)
+                TextOutA(pps->hdc, rc.left, top + int(first - m_top + r) * m_lineHeight, m_hexRows.data() + r * HexRowChars, int(HexRowChars));
+            break;
+        }
         }
-        CHECK_LE(CloseClipboard());
     }
 }
 
 bool Run(_In_ const LPCTSTR lpCmdLine, _In_ const int nShowCmd)
 {
     RadLogInitWnd(NULL, "Rad Clipboard", L"Rad Clipboard");
+    const std::wstring log = GetDataPath(L"RadClipboard.log");
+    if (!log.empty())
+        RadLogOpenFile(log.c_str());
+    // Traced from the start, otherwise from the context menu
+    if (_tcsstr(lpCmdLine, TEXT("/trace")) != nullptr)
+        TraceEnable(true);
 
     if (RadClipboardViewerWnd::Register() == 0)
     {
@@ -0,0 +1,194 @@
+#include "SearchIndex.h"
+#include <algorithm>
+#include <unordered_set>
+
+const size_t SearchIndex::MaxText;
+
+void SearchIndex::Fold(std::string& s)
+{
+    for (char& c : s)
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+}
+
+std::string SearchIndex::EntryText(const History& history, const HistId id, const size_t maxSize) const
+{
+    std::vector<std::pair<TextKind, PayloadRef>> items;
+    for (const HistItem& i : history.Items(id))
+    {
+        const TextKind kind = GetTextKind(m_kinds, i.uFormat);
+        if (kind != TextKind::None)
+            items.push_back({ kind, history.Payloads().Ref(i.payload) });
+    }
+    return ::EntryText(items, maxSize);
+}
+
+IndexText SearchIndex::Prepare(std::string text)
+{
+    IndexText t;
+    Fold(text);
+    if (text.size() >= 3)
+    {
+        t.trigrams.reserve(text.size() - 2);
+        for (size_t i = 0; i + 3 <= text.size(); ++i)
+            t.trigrams.push_back(Trigram(text.data() + i));
+        std::sort(t.trigrams.begin(), t.trigrams.end());
+        t.trigrams.erase(std::unique(t.trigrams.begin(), t.trigrams.end()), t.trigrams.end());
+    }
+    t.text = std::move(text);
+    return t;
+}
+
+void SearchIndex::Add(const HistId id, IndexText text)
+{
+    const uint32_t doc = uint32_t(m_docs.size());
+    for (const uint32_t t : text.trigrams)
+        m_postings[t].push_back(doc);
+    m_postingCount += text.trigrams.size();
+    m_docs.push_back({ id, std::move(text.text) });
+    m_byId[id] = doc;
+}
+
+void SearchIndex::OnAdd(const History& h, const HistId id)
+{
+    IndexText text;
+    if (m_providedKey != 0 && m_providedKey == h.Key(id))
+    {
+        text = std::move(m_provided);
+        m_providedKey = 0;
+    }
+    else
+        text = Prepare(EntryText(h, id));
+    if (text.text.empty())
+        return;
+    Add(id, std::move(text));
+}
+
+void SearchIndex::Insert(const HistId id, IndexText text)
+{
+    if (text.text.empty() || m_byId.count(id) != 0)
+        return;
+    Add(id, std::move(text));
+}
+
+// Text provided for an entry that was already in the history isn't needed
+void SearchIndex::OnTouch(const History& /*h*/, HistId /*id*/)
+{
+    m_providedKey = 0;
+    m_provided = IndexText();
+}
+
+void SearchIndex::OnErase(const History& /*h*/, const HistId id)
+{
+    const auto it = m_byId.find(id);
+    if (it == m_byId.end())
+        return;
+
+    Doc& d = m_docs[it->second];
+    d.id = InvalidHist;
+    std::string().swap(d.text);
+    m_byId.erase(it);
+    ++m_dead;
+
+    // Postings of erased documents are only dropped in bulk
+    if (m_dead >= 64 && m_dead * 2 > m_docs.size())
+        Purge();
+}
+
+// Renumbers the live documents, which keeps their order and so the postings sorted.
+void SearchIndex::Purge()
+{
+    std::vector<uint32_t> remap(m_docs.size(), UINT32_MAX);
+    std::vector<Doc> docs;
+    docs.reserve(m_docs.size() - m_dead);
+    for (uint32_t i = 0; i < m_docs.size(); ++i)
+    {
+        if (m_docs[i].id == InvalidHist)
+            continue;
+        remap[i] = uint32_t(docs.size());
+        m_byId[m_docs[i].id] = uint32_t(docs.size());
+        docs.push_back(std::move(m_docs[i]));
+    }
+    m_docs.swap(docs);
+    m_dead = 0;
+
+    m_postingCount = 0;
+    for (auto it = m_postings.begin(); it != m_postings.end();)
+    {
+        std::vector<uint32_t>& p = it->second;
+        size_t n = 0;
+        for (const uint32_t d : p)
+            if (remap[d] != UINT32_MAX)
+                p[n++] = remap[d];
+        if (n == 0)
+            it = m_postings.erase(it);
+        else
+        {
+            p.resize(n);
+            p.shrink_to_fit();
+            m_postingCount += n;
+            ++it;
+        }
+    }
+}
+
+void SearchIndex::Clear()
+{
+    m_docs.clear();
+    m_byId.clear();
+    m_postings.clear();
+    m_postingCount = 0;
+    m_dead = 0;
+}
+
+std::vector<HistId> SearchIndex::Find(const History& history, const std::string& text, const size_t maxResults) const
+{
+    std::vector<HistId> results;
+    std::string q = text;
+    Fold(q);
+    if (q.empty())
+        return results;
+
+    // Documents are in the order they were added, not the order they were last used
+    std::unordered_set<HistId> matches;
+    auto match = [&](uint32_t doc)
+    {
+        const Doc& d = m_docs[doc];
+        if (d.id != InvalidHist && d.text.find(q) != std::string::npos)
+            matches.insert(d.id);
+    };
+
+    if (q.size() < 3)
+    {
+        for (size_t i = 0; i < m_docs.size(); ++i)
+            match(uint32_t(i));
+    }
+    else
+    {
+        std::vector<const std::vector<uint32_t>*> lists;
+        for (size_t i = 0; i + 3 <= q.size(); ++i)
+        {
+            const auto it = m_postings.find(Trigram(q.data() + i));
+            if (it == m_postings.end())
+                return results;
+            lists.push_back(&it->second);
+        }
+        std::sort(lists.begin(), lists.end(), [](const std::vector<uint32_t>* a, const std::vector<uint32_t>* b) { return a->size() < b->size(); });
+        lists.erase(std::unique(lists.begin(), lists.end()), lists.end());
+
+        for (const uint32_t doc : *lists.front())
+        {
+            const bool all = std::all_of(lists.begin() + 1, lists.end(), [doc](const std::vector<uint32_t>* p) { return std::binary_search(p->begin(), p->end(), doc); });
+            // Trigrams match anywhere, the text still has to be checked
+            if (all)
+                match(doc);
+        }
+    }
+
+    for (auto it = history.begin(); it != history.end() && results.size() < std::min(matches.size(), maxResults); ++it)
+    {
+        if (matches.count(*it) != 0)
+            results.push_back(*it);
+    }
+    return results;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "History.h"
+#include "TextExtract.h"
+
+// Folded text of an entry and its distinct trigrams, sorted.
+struct IndexText
+{
+    std::string text;
+    std::vector<uint32_t> trigrams;
+};
+
+// Trigram inverted index over the text of the history entries.
+// Kept up to date as a HistoryListener. Text is matched as UTF-8 with ASCII case folding.
+class SearchIndex : public HistoryListener
+{
+public:
+    static const size_t MaxText = 256 * 1024;   // bytes indexed per entry
+
+    // Registered formats that hold text, such as HTML Format.
+    void SetTextKind(uint32_t uFormat, TextKind kind) { m_kinds[uFormat] = kind; }
+    const TextKinds& GetTextKinds() const { return m_kinds; }
+
+    // Entries of history containing text, most recent first.
+    std::vector<HistId> Find(const History& history, const std::string& text, size_t maxResults = SIZE_MAX) const;
+    void Clear();
+
+    size_t DocumentCount() const { return m_docs.size() - m_dead; }
+    size_t TrigramCount() const { return m_postings.size(); }
+    size_t PostingCount() const { return m_postingCount; }
+
+    // Plain text of the entry as it is indexed.
+    std::string EntryText(const History& history, HistId id, size_t maxSize = MaxText) const;
+    // ASCII lower case.
+    static void Fold(std::string& s);
+    // The work of indexing that doesn't touch the index, so it can be done on any thread.
+    static IndexText Prepare(std::string text);
+    // Used by the next OnAdd of an entry with this History::Key instead of reading its payloads.
+    void Provide(uint64_t key, IndexText text) { m_providedKey = key; m_provided = std::move(text); }
+    // For an entry added before the index was listening, such as one loaded from the journal.
+    void Insert(HistId id, IndexText text);
+
+    // HistoryListener
+    void OnAdd(const History& h, HistId id) override;
+    void OnTouch(const History& h, HistId id) override;
+    void OnErase(const History& h, HistId id) override;
+
+private:
+    struct Doc
+    {
+        HistId id;      // InvalidHist once erased
+        std::string text;
+    };
+
+    static uint32_t Trigram(const char* p) { return (uint32_t(uint8_t(p[0])) << 16) | (uint32_t(uint8_t(p[1])) << 8) | uint8_t(p[2]); }
+    void Add(HistId id, IndexText text);
+    void Purge();
+
+    TextKinds m_kinds;
+    // Documents are numbered in the order they are added so the postings stay sorted.
+    std::vector<Doc> m_docs;
+    std::unordered_map<HistId, uint32_t> m_byId;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> m_postings;
+    size_t m_postingCount = 0;
+    size_t m_dead = 0;
+    uint64_t m_providedKey = 0;
+    IndexText m_provided;
+};
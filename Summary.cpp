@@ -0,0 +1,256 @@
+#include "Summary.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "ClipboardFormats.h"
+
+const size_t EntrySummary::LabelChars;
+
+namespace
+{
+    const size_t DibHeaderSize = 16;    // enough for the size, width, height and bit count
+
+    void SetLabel(EntrySummary& s, const std::string& text)
+    {
+        // Whitespace runs become a single space, and only whole characters are copied
+        size_t n = 0;
+        size_t chars = 0;
+        bool space = true;
+        for (const char c : text)
+        {
+            const uint8_t b = uint8_t(c);
+            const bool lead = (b & 0xC0) != 0x80;
+            const bool white = c == ' ' || c == '\t' || c == '\r' || c == '\n';
+            if (lead && chars == EntrySummary::LabelChars)
+                break;
+            // Stray continuation bytes can't run past the label
+            const size_t length = !lead || b < 0x80 ? 1 : b < 0xE0 ? 2 : b < 0xF0 ? 3 : 4;
+            if (n + length >= sizeof(s.label))
+                break;
+            if (white && space)
+                continue;
+            s.label[n++] = white ? ' ' : c;
+            if (lead)
+                ++chars;
+            space = white;
+        }
+        while (n > 0 && s.label[n - 1] == ' ')
+            --n;
+        s.label[n] = '\0';
+    }
+
+    // Counts characters and lines up to the nul, without converting the whole text.
+    void CountText(TextKind kind, const uint8_t* data, size_t size, uint32_t& chars, uint32_t& lines)
+    {
+        chars = 0;
+        lines = 0;
+        uint32_t last = 0;
+        if (kind == TextKind::Unicode)
+        {
+            for (size_t i = 0; i + 2 <= size; i += 2)
+            {
+                uint16_t c;
+                memcpy(&c, data + i, sizeof(c));
+                if (c == 0)
+                    break;
+                if (c < 0xDC00 || c >= 0xE000)
+                    ++chars;
+                if (c == '\n')
+                    ++lines;
+                last = c;
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < size && data[i] != 0; ++i)
+            {
+                ++chars;
+                if (data[i] == '\n')
+                    ++lines;
+                last = data[i];
+            }
+        }
+        if (chars > 0 && last != '\n')
+            ++lines;
+    }
+
+    void CountText(const std::string& text, uint32_t& chars, uint32_t& lines)
+    {
+        chars = 0;
+        lines = 0;
+        for (const char c : text)
+        {
+            if ((uint8_t(c) & 0xC0) != 0x80)
+                ++chars;
+            if (c == '\n')
+                ++lines;
+        }
+        if (!text.empty() && text.back() != '\n')
+            ++lines;
+    }
+}
+
+EntrySummary Summarize(const std::vector<std::pair<uint32_t, PayloadRef>>& items, const TextKinds& kinds)
+{
+    EntrySummary s = {};
+    for (const auto& i : items)
+        s.totalBytes += i.second.size;
+
+    // The first text, image or file list, like the order the formats were offered in
+    const std::pair<uint32_t, PayloadRef>* primary = nullptr;
+    const std::pair<uint32_t, PayloadRef>* markup = nullptr;
+    const std::pair<uint32_t, PayloadRef>* largest = nullptr;
+    for (const auto& i : items)
+    {
+        const TextKind kind = GetTextKind(kinds, i.first);
+        if (primary == nullptr && (kind == TextKind::Unicode || kind == TextKind::Ansi || kind == TextKind::FileList || IsImageFormat(i.first)))
+            primary = &i;
+        if (markup == nullptr && (kind == TextKind::Html || kind == TextKind::Rtf))
+            markup = &i;
+        if (largest == nullptr || i.second.size > largest->second.size)
+            largest = &i;
+    }
+    if (primary == nullptr)
+        primary = markup;
+    if (primary == nullptr)
+    {
+        if (largest != nullptr)
+        {
+            s.uFormat = largest->first;
+            snprintf(s.label, sizeof(s.label), "Item: %u", s.uFormat);
+        }
+        return s;
+    }
+
+    s.uFormat = primary->first;
+    const PayloadRef& p = primary->second;
+    const TextKind kind = GetTextKind(kinds, s.uFormat);
+    std::vector<uint8_t> scratch;
+    if (IsImageFormat(s.uFormat))
+    {
+        s.kind = SummaryKind::Image;
+        if (p.size >= DibHeaderSize)
+        {
+            const uint8_t* const h = p.Read(DibHeaderSize, scratch);
+            if (h == nullptr)
+            {
+                snprintf(s.label, sizeof(s.label), "Image (unreadable)");
+                return s;
+            }
+            uint32_t headerSize;
+            memcpy(&headerSize, h, sizeof(headerSize));
+            if (headerSize == 12)   // BITMAPCOREHEADER
+            {
+                uint16_t w, hh;
+                memcpy(&w, h + 4, sizeof(w));
+                memcpy(&hh, h + 6, sizeof(hh));
+                memcpy(&s.bitCount, h + 10, sizeof(s.bitCount));
+                s.width = w;
+                s.height = hh;
+            }
+            else
+            {
+                memcpy(&s.width, h + 4, sizeof(s.width));
+                memcpy(&s.height, h + 8, sizeof(s.height));
+                memcpy(&s.bitCount, h + 14, sizeof(s.bitCount));
+                // Negative for a top-down DIB
+                if (s.height < 0 && s.height != INT32_MIN)
+                    s.height = -s.height;
+            }
+        }
+        snprintf(s.label, sizeof(s.label), "Image %d x %d x %d", int(s.width), int(s.height), int(s.bitCount));
+    }
+    else if (kind == TextKind::FileList)
+    {
+        s.kind = SummaryKind::Files;
+        std::string paths;
+        ExtractText(kind, p.Read(p.size, scratch), p.size, paths);
+        s.files = uint32_t(std::count(paths.begin(), paths.end(), '\n'));
+        snprintf(s.label, sizeof(s.label), "%u Files", s.files);
+    }
+    else
+    {
+        s.kind = SummaryKind::Text;
+        std::string text;
+        if (kind == TextKind::Unicode || kind == TextKind::Ansi)
+        {
+            const uint8_t* const data = p.Read(p.size, scratch);
+            if (data == nullptr)
+            {
+                snprintf(s.label, sizeof(s.label), "Text (unreadable)");
+                return s;
+            }
+            CountText(kind, data, p.size, s.chars, s.lines);
+            ExtractText(kind, data, p.size, text, EntrySummary::LabelChars * 8);
+        }
+        else
+        {
+            ExtractText(kind, p.Read(p.size, scratch), p.size, text);
+            CountText(text, s.chars, s.lines);
+        }
+        SetLabel(s, text);
+    }
+    return s;
+}
+
+const EntrySummary& SummaryTable::Get(const HistId id) const
+{
+    static const EntrySummary Pending = { "...", SummaryKind::Other, 0, 0, 0, 0, 0, 0, 0, 0 };
+    const uint32_t index = m_history.Summary(id);
+    return index != InvalidSummary ? m_summaries[index] : Pending;
+}
+
+void SummaryTable::Set(const HistId id, const EntrySummary& summary)
+{
+    uint32_t index = m_history.Summary(id);
+    if (index == InvalidSummary)
+    {
+        index = Allocate();
+        m_history.SetSummary(id, index);
+    }
+    m_summaries[index] = summary;
+}
+
+uint32_t SummaryTable::Allocate()
+{
+    if (!m_free.empty())
+    {
+        const uint32_t index = m_free.back();
+        m_free.pop_back();
+        return index;
+    }
+    m_summaries.emplace_back();
+    return uint32_t(m_summaries.size() - 1);
+}
+
+void SummaryTable::OnAdd(const History& h, const HistId id)
+{
+    const uint32_t index = Allocate();
+    if (m_providedKey != 0 && m_providedKey == h.Key(id))
+    {
+        m_summaries[index] = m_provided;
+        m_providedKey = 0;
+    }
+    else
+    {
+        std::vector<std::pair<uint32_t, PayloadRef>> items;
+        for (const HistItem& i : h.Items(id))
+            items.push_back({ i.uFormat, h.Payloads().Ref(i.payload) });
+        m_summaries[index] = Summarize(items, m_kinds);
+    }
+    m_history.SetSummary(id, index);
+}
+
+// A summary provided for an entry that was already in the history isn't needed
+void SummaryTable::OnTouch(const History& /*h*/, HistId /*id*/)
+{
+    m_providedKey = 0;
+}
+
+void SummaryTable::OnErase(const History& h, const HistId id)
+{
+    const uint32_t index = h.Summary(id);
+    if (index != InvalidSummary)
+        m_free.push_back(index);
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "History.h"
+#include "TextExtract.h"
+
+enum class SummaryKind : uint8_t
+{
+    Other,
+    Text,
+    Image,
+    Files,
+};
+
+// What the history menu shows for an entry, worked out once when it is captured.
+struct EntrySummary
+{
+    static const size_t LabelChars = 50;
+
+    char label[LabelChars * 4 + 1];     // UTF-8
+    SummaryKind kind;
+    uint32_t uFormat;       // the item the summary is based on
+    uint32_t chars;
+    uint32_t lines;
+    int32_t width;
+    int32_t height;
+    uint16_t bitCount;
+    uint32_t files;
+    uint64_t totalBytes;
+};
+
+EntrySummary Summarize(const std::vector<std::pair<uint32_t, PayloadRef>>& items, const TextKinds& kinds);
+
+// Summaries of the history entries, indexed by History::Summary.
+class SummaryTable : public HistoryListener
+{
+public:
+    explicit SummaryTable(History& history)
+        : m_history(history)
+    {
+    }
+
+    void SetTextKinds(const TextKinds& kinds) { m_kinds = kinds; }
+
+    // Or a placeholder, for an entry that hasn't been summarized yet.
+    const EntrySummary& Get(HistId id) const;
+    // Used by the next OnAdd of an entry with this History::Key instead of reading its payloads.
+    void Provide(uint64_t key, const EntrySummary& summary) { m_providedKey = key; m_provided = summary; }
+    // For an entry added before the table was listening, such as one loaded from the journal.
+    void Set(HistId id, const EntrySummary& summary);
+
+    // HistoryListener
+    void OnAdd(const History& h, HistId id) override;
+    void OnTouch(const History& h, HistId id) override;
+    void OnErase(const History& h, HistId id) override;
+
+private:
+    uint32_t Allocate();
+
+    History& m_history;
+    TextKinds m_kinds;
+    std::vector<EntrySummary> m_summaries;
+    std::vector<uint32_t> m_free;
+    uint64_t m_providedKey = 0;
+    EntrySummary m_provided;
+};
@@ -0,0 +1,142 @@
+// Fuzz target for the DIB decoder, which reads whatever another application put on the clipboard.
+//
+// With libFuzzer, from the repository root:
+//   clang++ -std=c++14 -g -O1 -fsanitize=fuzzer,address,undefined -DRAD_LIBFUZZER -I. Tests/FuzzDib.cpp Rad/Dib.cpp -o FuzzDib
+// Without it the built in driver mutates generated DIBs:
+//   g++ -std=c++14 -g -O1 -fsanitize=address,undefined -I. Tests/FuzzDib.cpp Rad/Dib.cpp -o FuzzDib
+//
+// FuzzDib [ITERATIONS [SEED]]
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "Rad/Dib.h"
+
+namespace
+{
+    unsigned long g_decoded;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    DibInfo info;
+    if (!ParseDib(data, size, info))
+        return 0;
+
+    // Every row must decode from the data that was given, and scale
+    std::vector<uint32_t> row(size_t(info.width));
+    int32_t width, height;
+    FitSize(info.width, info.height, 64, 48, width, height);
+    BoxScaler scaler(info.width, info.height, width, height);
+    for (int32_t y = 0; y < info.height; ++y)
+    {
+        DecodeDibRow(info, data, y, row.data());
+        scaler.AddRow(row.data());
+    }
+    if (scaler.Result().pixels.size() != size_t(scaler.Result().width) * size_t(scaler.Result().height))
+        abort();
+    ++g_decoded;
+    return 0;
+}
+
+#ifndef RAD_LIBFUZZER
+namespace
+{
+    void Put32(std::vector<uint8_t>& data, const size_t offset, const uint32_t v)
+    {
+        for (size_t i = 0; i < 4; ++i)
+            data[offset + i] = uint8_t(v >> (i * 8));
+    }
+
+    // A valid DIB to start mutating from, with a header of headerSize bytes.
+    std::vector<uint8_t> Seed(std::mt19937& rng, const uint32_t headerSize, const int32_t width, const int32_t height, const uint32_t bitCount, const uint32_t compression)
+    {
+        const size_t colors = bitCount <= 8 ? size_t(1) << bitCount : 0;
+        const size_t masks = compression == 3 && headerSize == 40 ? 12 : 0;
+        const size_t stride = (size_t(width) * bitCount + 31) / 32 * 4;
+        std::vector<uint8_t> data(headerSize + masks + colors * 4 + stride * size_t(std::abs(height)));
+        for (uint8_t& b : data)
+            b = uint8_t(rng());
+        std::fill(data.begin(), data.begin() + headerSize, uint8_t(0));
+        Put32(data, 0, headerSize);
+        Put32(data, 4, uint32_t(width));
+        Put32(data, 8, uint32_t(height));
+        Put32(data, 12, 1 | (bitCount << 16));
+        Put32(data, 16, compression);
+        // The masks follow a BITMAPINFOHEADER and are part of the later headers
+        if (compression == 3)
+        {
+            Put32(data, 40, bitCount == 16 ? 0xF800 : 0xFF0000);
+            Put32(data, 44, bitCount == 16 ? 0x07E0 : 0x00FF00);
+            Put32(data, 48, bitCount == 16 ? 0x001F : 0x0000FF);
+            if (headerSize > 52)
+                Put32(data, 52, 0xFF000000);
+        }
+        return data;
+    }
+
+    // Header fields, the values most likely to be mishandled.
+    const size_t Fields[] = { 0, 4, 8, 12, 14, 16, 20, 32, 40, 44, 48, 52 };
+    const uint32_t Edges[] = { 0, 1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 40, 108, 124, 255, 256, 0x7FFF, 0xFFFF, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF };
+
+    void Mutate(std::mt19937& rng, std::vector<uint8_t>& data)
+    {
+        const int count = 1 + int(rng() % 4);
+        for (int n = 0; n < count && !data.empty(); ++n)
+        {
+            switch (rng() % 4)
+            {
+            case 0:
+                data[rng() % data.size()] ^= uint8_t(1 << (rng() % 8));
+                break;
+            case 1:
+                data[rng() % data.size()] = uint8_t(rng());
+                break;
+            case 2:
+            {
+                const size_t field = Fields[rng() % (sizeof(Fields) / sizeof(Fields[0]))];
+                if (field + 4 <= data.size())
+                    Put32(data, field, Edges[rng() % (sizeof(Edges) / sizeof(Edges[0]))]);
+                break;
+            }
+            case 3:
+                data.resize(rng() % (data.size() + 1));
+                break;
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const unsigned long iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+    const uint32_t seed = argc > 2 ? uint32_t(strtoul(argv[2], nullptr, 10)) : 1;
+    std::mt19937 rng(seed);
+
+    const std::vector<std::vector<uint8_t>> seeds = {
+        Seed(rng, 40, 7, 5, 1, 0),
+        Seed(rng, 40, 9, -4, 4, 0),
+        Seed(rng, 40, 17, 3, 8, 0),
+        Seed(rng, 40, 5, 6, 16, 3),
+        Seed(rng, 40, 11, -2, 24, 0),
+        Seed(rng, 108, 4, 4, 32, 3),
+        Seed(rng, 124, 6, -3, 32, 3),
+    };
+    for (unsigned long i = 0; i < iterations; ++i)
+    {
+        // Exactly the size of the input, so reading past it is caught by the address sanitizer
+        std::vector<uint8_t> data = seeds[rng() % seeds.size()];
+        Mutate(rng, data);
+        std::unique_ptr<uint8_t[]> copy(new uint8_t[data.size()]);
+        std::copy(data.begin(), data.end(), copy.get());
+        LLVMFuzzerTestOneInput(copy.get(), data.size());
+    }
+    printf("%lu inputs, %lu decoded\n", iterations, g_decoded);
+    return 0;
+}
+#endif
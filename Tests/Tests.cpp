@@ -0,0 +1,2433 @@
+// Tests of the platform neutral parts of RadClipboard, with fake clocks, clipboards and locks in
+// place of Windows.
+//
+// Builds with the RadClipboardTests project, or on Linux from the repository root with
+//   g++ -std=c++14 -O2 -I. Tests/Tests.cpp CapturePipeline.cpp PayloadStore.cpp History.cpp Journal.cpp ClipboardChange.cpp ColdTier.cpp DelayedRender.cpp SearchIndex.cpp Summary.cpp Thumbnails.cpp Query.cpp QueryEngine.cpp UpdateCoalescer.cpp CapturePolicy.cpp ClipboardFormats.cpp TextExtract.cpp Rad/Arena.cpp Rad/AsyncLog.cpp Rad/Backoff.cpp Rad/Dib.cpp Rad/HexDump.cpp Rad/Histogram.cpp Rad/Lz4.cpp Rad/MappedFile.cpp Rad/TextLayout.cpp Rad/Trace.cpp Rad/TypedFormat.cpp Rad/WorkStealing.cpp -lpthread -o RadClipboardTests
+//
+// RadClipboardTests [--filter TEXT]
+//
+// Prints each failed check and a line per test, and exits with 1 if any test failed.
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "ClipboardFormats.h"
+#include "CapturePipeline.h"
+#include "CapturePolicy.h"
+#include "ClipboardChange.h"
+#include "ColdTier.h"
+#include "DelayedRender.h"
+#include "History.h"
+#include "Journal.h"
+#include "PayloadStore.h"
+#include "Query.h"
+#include "QueryEngine.h"
+#include "SearchIndex.h"
+#include "Summary.h"
+#include "Thumbnails.h"
+#include "UpdateCoalescer.h"
+#include "Rad/Arena.h"
+#include "Rad/AsyncLog.h"
+#include "Rad/Backoff.h"
+#include "Rad/Convert.h"
+#include "Rad/Dib.h"
+#include "Rad/Hash.h"
+#include "Rad/HexDump.h"
+#include "Rad/Lz4.h"
+#include "Rad/TextLayout.h"
+#include "Rad/Trace.h"
+#include "Rad/TypedFormat.h"
+
+namespace
+{
+    // Failed checks of the test that is running.
+    size_t g_failed;
+
+    void Check(const bool ok, const char* const expr, const char* const file, const int line)
+    {
+        if (!ok)
+        {
+            printf("%s(%d): CHECK(%s) failed\n", file, line, expr);
+            ++g_failed;
+        }
+    }
+
+#define CHECK(e) Check(bool(e), #e, __FILE__, __LINE__)
+
+    struct TestCase
+    {
+        const char* name;
+        std::function<void()> run;
+    };
+
+    std::vector<uint8_t> RandomBytes(const size_t size, const uint32_t seed)
+    {
+        std::vector<uint8_t> data(size);
+        std::mt19937 rng(seed);
+        for (uint8_t& b : data)
+            b = uint8_t(rng());
+        return data;
+    }
+
+    std::vector<uint8_t> Bytes(const std::string& s)
+    {
+        return std::vector<uint8_t>(s.begin(), s.end());
+    }
+
+    // Null terminated UTF-16 of ASCII text.
+    std::vector<uint8_t> Utf16(const std::string& s)
+    {
+        std::vector<uint8_t> data;
+        for (const char c : s)
+        {
+            data.push_back(uint8_t(c));
+            data.push_back(0);
+        }
+        data.push_back(0);
+        data.push_back(0);
+        return data;
+    }
+
+    std::vector<uint8_t> Contents(const PayloadStore& payloads, const PayloadId id)
+    {
+        std::vector<uint8_t> scratch;
+        const PayloadRef ref = payloads.Ref(id);
+        const uint8_t* const data = ref.Read(ref.size, scratch);
+        return data != nullptr ? std::vector<uint8_t>(data, data + ref.size) : std::vector<uint8_t>();
+    }
+
+    HistId AddEntry(History& history, PayloadStore& payloads, const uint32_t uFormat, const std::vector<uint8_t>& data, const uint64_t now)
+    {
+        std::vector<HistItem> items = { { uFormat, payloads.Add(data.data(), data.size()) } };
+        return history.Add(std::move(items), now);
+    }
+
+    HistBudget Unlimited()
+    {
+        HistBudget budget;
+        budget.maxBytes = SIZE_MAX;
+        budget.maxEntries = SIZE_MAX;
+        return budget;
+    }
+
+    PathString TempPath(const char* const name)
+    {
+#ifdef _WIN32
+        wchar_t* dir = nullptr;
+        size_t length = 0;
+        _wdupenv_s(&dir, &length, L"TEMP");
+        const PathString path = PathString(dir != nullptr ? dir : L".") + L"\\" + a2w(name);
+        free(dir);
+        return path;
+#else
+        return PathString("/tmp/") + name;
+#endif
+    }
+
+    void RemoveFile(const PathString& path)
+    {
+#ifdef _WIN32
+        _wremove(path.c_str());
+#else
+        remove(path.c_str());
+#endif
+    }
+
+    void MakeDir(const PathString& path)
+    {
+#ifdef _WIN32
+        _wmkdir(path.c_str());
+#else
+        mkdir(path.c_str(), 0700);
+#endif
+    }
+
+    void RemoveDir(const PathString& path)
+    {
+#ifdef _WIN32
+        _wrmdir(path.c_str());
+#else
+        rmdir(path.c_str());
+#endif
+    }
+
+    std::vector<uint8_t> ReadFile(const PathString& path)
+    {
+        std::vector<uint8_t> data;
+        FILE* const fp = FileOpen(path, "rb");
+        if (fp == nullptr)
+            return data;
+        uint8_t buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+            data.insert(data.end(), buf, buf + n);
+        fclose(fp);
+        return data;
+    }
+
+    void WriteFile(const PathString& path, const std::vector<uint8_t>& data)
+    {
+        FILE* const fp = FileOpen(path, "wb");
+        if (fp == nullptr)
+            return;
+        fwrite(data.data(), 1, data.size(), fp);
+        fclose(fp);
+    }
+
+    class FailingSource : public PayloadSource
+    {
+    public:
+        bool Read(uint64_t /*hash*/, uint8_t* /*dst*/, size_t /*size*/) override { return false; }
+    };
+
+    void AddPayloadTests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "payload.dedupe", []()
+        {
+            PayloadStore payloads;
+            const std::vector<uint8_t> a = Bytes("some text"), b = Bytes("other text");
+            const PayloadId x = payloads.Add(a.data(), a.size());
+            const PayloadId y = payloads.Add(a.data(), a.size());
+            const PayloadId z = payloads.Add(b.data(), b.size());
+            CHECK(x == y);
+            CHECK(x != z);
+            CHECK(payloads.RefCount(x) == 2);
+            CHECK(payloads.Count() == 2);
+            CHECK(payloads.StoredBytes() == a.size() + b.size());
+            CHECK(payloads.LogicalBytes() == 2 * a.size() + b.size());
+            payloads.Release(x);
+            payloads.Release(y);
+            payloads.Release(z);
+            CHECK(payloads.Count() == 0);
+            CHECK(payloads.StoredBytes() == 0);
+        } });
+
+        tests.push_back({ "payload.peak_bytes", []()
+        {
+            PayloadStore payloads;
+            const std::vector<uint8_t> a = RandomBytes(1000, 1), b = RandomBytes(3000, 2);
+            const PayloadId x = payloads.Add(a.data(), a.size());
+            const PayloadId y = payloads.Add(b.data(), b.size());
+            payloads.Release(y);
+            CHECK(payloads.StoredBytes() == 1000);
+            CHECK(payloads.PeakBytes() == 4000);
+            payloads.Release(x);
+            CHECK(payloads.PeakBytes() == 4000);
+        } });
+
+        tests.push_back({ "payload.cold", []()
+        {
+            PayloadStore payloads;
+            const std::vector<uint8_t> text = Utf16(std::string(4000, 'a') + "end");
+            const PayloadId id = payloads.Add(text.data(), text.size());
+            std::vector<uint8_t> packed;
+            Lz4Compress(text.data(), text.size(), packed);
+            payloads.SetCold(id, payloads.Share(id), std::move(packed));
+            CHECK(payloads.IsCold(id));
+            CHECK(payloads.ColdCount() == 1);
+            CHECK(payloads.StoredBytes() < text.size());
+            CHECK(Contents(payloads, id) == text);
+            CHECK(payloads.IsCold(id));
+
+            // Data brings it back
+            const uint8_t* const data = payloads.Data(id);
+            CHECK(data != nullptr && memcmp(data, text.data(), text.size()) == 0);
+            CHECK(!payloads.IsCold(id));
+            CHECK(payloads.StoredBytes() == text.size());
+            payloads.Release(id);
+        } });
+
+        tests.push_back({ "payload.unreadable", []()
+        {
+            PayloadStore payloads;
+            FailingSource source;
+            const PayloadId id = payloads.AddSource(42, 100, &source);
+            std::vector<uint8_t> scratch;
+            CHECK(payloads.Data(id) == nullptr);
+            CHECK(payloads.Ref(id).Read(100, scratch) == nullptr);
+            CHECK(payloads.Peek(id, 10, scratch) == nullptr);
+            CHECK(payloads.IsSourced(id));
+            payloads.Release(id);
+        } });
+    }
+
+    void AddLz4Tests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "lz4.round_trip", []()
+        {
+            std::string text;
+            while (text.size() < 100000)
+                text += "The quick brown fox jumps over the lazy dog " + std::to_string(text.size()) + "\n";
+            for (const std::vector<uint8_t>& data : { std::vector<uint8_t>(), Bytes("a"), Bytes("abcabcabcabcabcabcabc"), Bytes(text), RandomBytes(100000, 3), std::vector<uint8_t>(100000, 0) })
+            {
+                std::vector<uint8_t> packed;
+                Lz4Compress(data.data(), data.size(), packed);
+                CHECK(packed.size() <= Lz4CompressBound(data.size()));
+                std::vector<uint8_t> out(data.size() + 1);
+                CHECK(Lz4Decompress(packed.data(), packed.size(), out.data(), out.size()) == data.size());
+                out.resize(data.size());
+                CHECK(out == data);
+            }
+        } });
+
+        tests.push_back({ "lz4.truncated", []()
+        {
+            const std::vector<uint8_t> data = Bytes(std::string(5000, 'x') + "tail");
+            std::vector<uint8_t> packed;
+            Lz4Compress(data.data(), data.size(), packed);
+
+            // A prefix
+            std::vector<uint8_t> out(100);
+            CHECK(Lz4Decompress(packed.data(), packed.size(), out.data(), out.size()) == out.size());
+            CHECK(std::all_of(out.begin(), out.end(), [](const uint8_t b) { return b == 'x'; }));
+
+            // Damaged input stops short rather than overrunning
+            out.assign(data.size(), 0);
+            CHECK(Lz4Decompress(packed.data(), packed.size() / 2, out.data(), out.size()) < data.size());
+        } });
+    }
+
+    // The size classes of Arena, 16 byte steps to 128 then four per power of two.
+    std::vector<size_t> ArenaClasses()
+    {
+        std::vector<size_t> classes;
+        for (size_t s = 16; s <= 128; s += 16)
+            classes.push_back(s);
+        for (size_t p = 128; p < Arena::MaxSmall; p *= 2)
+            for (size_t s = p + p / 4; s <= p * 2; s += p / 4)
+                classes.push_back(s);
+        return classes;
+    }
+
+    void AddArenaTests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "arena.size_classes", []()
+        {
+            Arena arena;
+            std::vector<size_t> sizes = { 0, 1, Arena::MaxSmall + 1, 3 * Arena::SlabSize + 5 };
+            for (const size_t c : ArenaClasses())
+            {
+                sizes.push_back(c - 1);
+                sizes.push_back(c);
+                sizes.push_back(c + 1);
+            }
+            std::vector<std::pair<uint8_t*, size_t>> blocks;
+            size_t requested = 0;
+            for (size_t i = 0; i < sizes.size(); ++i)
+            {
+                uint8_t* const p = static_cast<uint8_t*>(arena.Alloc(sizes[i]));
+                CHECK(p != nullptr && uintptr_t(p) % 16 == 0);
+                memset(p, int(i), sizes[i]);
+                blocks.push_back({ p, sizes[i] });
+                requested += sizes[i];
+            }
+            // No block overlaps another
+            bool intact = true;
+            for (size_t i = 0; i < blocks.size(); ++i)
+                intact = intact && std::all_of(blocks[i].first, blocks[i].first + blocks[i].second, [i](const uint8_t b) { return b == uint8_t(i); });
+            CHECK(intact);
+
+            Arena::Stats stats = arena.GetStats();
+            CHECK(stats.requested == requested);
+            CHECK(stats.allocations == sizes.size());
+            CHECK(stats.largeBlocks == size_t(std::count_if(sizes.begin(), sizes.end(), [](const size_t n) { return n > Arena::MaxSmall; })));
+            CHECK(stats.reserved >= requested);
+
+            for (const auto& b : blocks)
+                arena.Free(b.first, b.second);
+            stats = arena.GetStats();
+            CHECK(stats.requested == 0 && stats.allocations == 0 && stats.largeBlocks == 0);
+            CHECK(stats.slabs > 0 && stats.emptySlabs == stats.slabs);
+            CHECK(stats.reserved == stats.slabs * Arena::SlabSize);
+        } });
+
+        tests.push_back({ "arena.slabs", []()
+        {
+            Arena arena;
+            const size_t Size = 1024, PerSlab = Arena::SlabSize / Size;
+            std::vector<void*> blocks;
+            for (size_t i = 0; i < PerSlab + 1; ++i)
+                blocks.push_back(arena.Alloc(Size));
+            CHECK(arena.GetStats().slabs == 2);
+
+            // Freed blocks are reused before a slab is added
+            arena.Free(blocks[5], Size);
+            CHECK(arena.Alloc(Size) == blocks[5]);
+            CHECK(arena.GetStats().slabs == 2);
+
+            // Only empty slabs are trimmed
+            arena.Free(blocks.back(), Size);
+            blocks.pop_back();
+            CHECK(arena.GetStats().emptySlabs == 1);
+            CHECK(arena.Trim() == Arena::SlabSize);
+            CHECK(arena.GetStats().slabs == 1 && arena.GetStats().emptySlabs == 0);
+            CHECK(arena.Trim() == 0);
+            for (void* const p : blocks)
+                arena.Free(p, Size);
+            CHECK(arena.Trim() == Arena::SlabSize);
+            const Arena::Stats stats = arena.GetStats();
+            CHECK(stats.slabs == 0 && stats.reserved == 0);
+        } });
+
+        tests.push_back({ "arena.denser", []()
+        {
+            Arena arena;
+            const size_t Size = 1024, PerSlab = Arena::SlabSize / Size;
+            std::vector<void*> a, b;
+            for (size_t i = 0; i < PerSlab; ++i)
+                a.push_back(arena.Alloc(Size));
+            for (size_t i = 0; i < PerSlab; ++i)
+                b.push_back(arena.Alloc(Size));
+            void* const large = arena.Alloc(Arena::MaxSmall + 1);
+            CHECK(arena.AllocDenser(large, Arena::MaxSmall + 1) == nullptr);
+
+            // Neither slab is sparse
+            for (size_t i = 0; i < 10; ++i)
+                arena.Free(b[i], Size);
+            CHECK(arena.AllocDenser(a.back(), Size) == nullptr);
+
+            // a is a quarter full, b has room
+            for (size_t i = 0; i < PerSlab * 3 / 4; ++i)
+                arena.Free(a[i], Size);
+            CHECK(arena.AllocDenser(b.back(), Size) == nullptr);
+            size_t moved = 0;
+            for (size_t i = PerSlab * 3 / 4; i < PerSlab; ++i)
+            {
+                void* const p = arena.AllocDenser(a[i], Size);
+                if (p == nullptr)
+                    break;
+                CHECK(std::find(b.begin(), b.begin() + 10, p) != b.begin() + 10);
+                arena.Free(a[i], Size);
+                a[i] = p;
+                ++moved;
+            }
+            CHECK(moved == 10);
+            CHECK(arena.GetStats().allocations == PerSlab / 4 + PerSlab - 10 + 1);
+
+            for (size_t i = PerSlab * 3 / 4; i < PerSlab; ++i)
+                arena.Free(a[i], Size);
+            for (size_t i = 10; i < PerSlab; ++i)
+                arena.Free(b[i], Size);
+            arena.Free(large, Arena::MaxSmall + 1);
+            CHECK(arena.GetStats().requested == 0);
+        } });
+
+        tests.push_back({ "arena.compact_payloads", []()
+        {
+            PayloadStore payloads;
+            const size_t Size = 1024, PerSlab = Arena::SlabSize / Size;
+            std::vector<PayloadId> ids;
+            std::vector<std::vector<uint8_t>> data;
+            for (size_t i = 0; i < 2 * PerSlab; ++i)
+            {
+                data.push_back(RandomBytes(Size, uint32_t(i)));
+                ids.push_back(payloads.Add(data.back().data(), Size));
+            }
+            // The first slab a quarter full, ten free blocks in the second
+            for (size_t i = 0; i < PerSlab * 3 / 4; ++i)
+                payloads.Release(ids[i]);
+            for (size_t i = PerSlab; i < PerSlab + 10; ++i)
+                payloads.Release(ids[i]);
+            const size_t slabs = payloads.ArenaStats().slabs;
+
+            // A payload shared with the cold tier worker stays where it is
+            const size_t first = PerSlab * 3 / 4;
+            PayloadBytes shared = payloads.Share(ids[first]);
+            std::vector<const uint8_t*> before;
+            for (size_t i = first; i < PerSlab; ++i)
+                before.push_back(payloads.Share(ids[i])->data());
+
+            CHECK(payloads.Compact(SIZE_MAX) == 10 * Size);
+            CHECK(payloads.Share(ids[first])->data() == before[0]);
+            size_t changed = 0;
+            for (size_t i = first; i < PerSlab; ++i)
+                if (payloads.Share(ids[i])->data() != before[i - first])
+                    ++changed;
+            CHECK(changed == 10);
+
+            // Ids and bytes are kept
+            bool same = true;
+            for (size_t i = first; i < 2 * PerSlab; ++i)
+                if (i < PerSlab || i >= PerSlab + 10)
+                    same = same && Contents(payloads, ids[i]) == data[i] && payloads.Hash(ids[i]) == HashBytes(data[i].data(), Size);
+            CHECK(same);
+            CHECK(payloads.ArenaStats().slabs <= slabs);
+
+            // Emptied slabs are returned
+            shared.reset();
+            for (size_t i = first; i < 2 * PerSlab; ++i)
+                if (i < PerSlab || i >= PerSlab + 10)
+                    payloads.Release(ids[i]);
+            CHECK(payloads.ArenaStats().slabs > 0);
+            payloads.Compact(0);
+            const Arena::Stats stats = payloads.ArenaStats();
+            CHECK(stats.slabs == 0 && stats.reserved == 0 && stats.requested == 0);
+        } });
+    }
+
+    void AddHistoryTests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "history.order", []()
+        {
+            PayloadStore payloads;
+            History history(payloads);
+            const HistId a = AddEntry(history, payloads, FmtText, Bytes("a"), 1);
+            const HistId b = AddEntry(history, payloads, FmtText, Bytes("b"), 2);
+            const HistId c = AddEntry(history, payloads, FmtText, Bytes("c"), 3);
+            CHECK(history.size() == 3);
+            CHECK(history.Front() == c && history.Back() == a);
+            CHECK(history.Next(c) == b && history.Prev(b) == c);
+
+            history.Touch(a, 4);
+            CHECK(history.Front() == a && history.Back() == b);
+            CHECK(history.Accessed(a) == 4 && history.Created(a) == 1);
+
+            history.Erase(c);
+            CHECK(!history.Contains(c));
+            CHECK(history.size() == 2);
+            // Ids aren't reused
+            const HistId d = AddEntry(history, payloads, FmtText, Bytes("d"), 5);
+            CHECK(d != c);
+            CHECK(!history.Contains(c));
+        } });
+
+        tests.push_back({ "history.stale_id", []()
+        {
+            struct TouchCounter : HistoryListener
+            {
+                size_t touched = 0;
+                void OnAdd(const History&, HistId) override { }
+                void OnTouch(const History&, HistId) override { ++touched; }
+                void OnErase(const History&, HistId) override { }
+            } counter;
+
+            PayloadStore payloads;
+            History history(payloads);
+            history.AddListener(&counter);
+            const HistId a = AddEntry(history, payloads, FmtText, Bytes("a"), 1);
+            const HistId b = AddEntry(history, payloads, FmtText, Bytes("b"), 2);
+            history.Erase(a);
+
+            // Freed slot
+            history.Touch(a, 3);
+            history.Erase(a);
+            CHECK(counter.touched == 0);
+            CHECK(history.size() == 1);
+            CHECK(history.Front() == b && history.Back() == b);
+
+            // Reused slot
+            const HistId c = AddEntry(history, payloads, FmtText, Bytes("c"), 4);
+            AddEntry(history, payloads, FmtText, Bytes("d"), 5);
+            CHECK((c & 0xFFFFFFFF) == (a & 0xFFFFFFFF));
+            history.Touch(a, 6);
+            history.Erase(a);
+            CHECK(counter.touched == 0);
+            CHECK(history.size() == 3);
+            CHECK(history.Contains(c) && history.Accessed(c) == 4);
+            CHECK(history.Back() == b && history.Prev(b) == c);
+            history.RemoveListener(&counter);
+        } });
+
+        tests.push_back({ "history.dedupe", []()
+        {
+            PayloadStore payloads;
+            History history(payloads);
+            const HistId a = AddEntry(history, payloads, FmtText, Bytes("same"), 1);
+            AddEntry(history, payloads, FmtText, Bytes("other"), 2);
+            const HistId b = AddEntry(history, payloads, FmtText, Bytes("same"), 3);
+            CHECK(a == b);
+            CHECK(history.size() == 2);
+            CHECK(history.Front() == a);
+            CHECK(payloads.RefCount(history.Items(a)[0].payload) == 1);
+        } });
+
+        tests.push_back({ "history.evict_entries", []()
+        {
+            PayloadStore payloads;
+            History history(payloads);
+            HistBudget budget;
+            budget.maxEntries = 3;
+            history.SetBudget(budget, 0);
+            HistId last = InvalidHist;
+            for (int i = 0; i < 5; ++i)
+                last = AddEntry(history, payloads, FmtText, Bytes(std::to_string(i)), uint64_t(i + 1));
+            CHECK(history.size() == 3);
+            CHECK(history.EvictedCount() == 2);
+            CHECK(history.Front() == last);
+            CHECK(payloads.Count() == 3);
+        } });
+
+        tests.push_back({ "history.evict_bytes", []()
+        {
+            PayloadStore payloads;
+            History history(payloads);
+            HistBudget budget;
+            budget.maxBytes = 1000;
+            history.SetBudget(budget, 0);
+            for (int i = 0; i < 10; ++i)
+                AddEntry(history, payloads, FmtText, std::vector<uint8_t>(300, uint8_t('a' + i)), uint64_t(i + 1));
+            CHECK(history.size() == 3);
+            CHECK(payloads.StoredBytes() <= 1000);
+        } });
+
+        // Bytes evicting can't free don't drain the history
+        tests.push_back({ "history.evict_unfreeable", []()
+        {
+            PayloadStore payloads;
+            History history(payloads);
+            HistBudget budget;
+            budget.maxBytes = 1000;
+            history.SetBudget(budget, 0);
+            const std::vector<uint8_t> shared(600, 's');
+            const PayloadId pin = payloads.Add(shared.data(), shared.size());
+            for (int i = 0; i < 10; ++i)
+            {
+                const std::vector<uint8_t> unique = Bytes(std::to_string(i));
+                std::vector<HistItem> items = { { FmtText, payloads.Add(shared.data(), shared.size()) }, { FmtOemText, payloads.Add(unique.data(), unique.size()) } };
+                history.Add(std::move(items), uint64_t(i + 1));
+            }
+            CHECK(history.size() == 10);
+            CHECK(history.ExclusiveBytes(history.Back()) == 1);
+
+            // Nothing but the front entry itself could bring it under
+            AddEntry(history, payloads, FmtText, std::vector<uint8_t>(5000, 'b'), 20);
+            CHECK(history.size() == 11);
+            CHECK(history.EvictedCount() == 0);
+            payloads.Release(pin);
+        } });
+
+        // A payload shared by older entries is freed once all of them are evicted
+        tests.push_back({ "history.evict_shared", []()
+        {
+            PayloadStore payloads;
+            History history(payloads);
+            HistBudget budget;
+            budget.maxBytes = 1000;
+            history.SetBudget(budget, 0);
+            const std::vector<uint8_t> shared(800, 's');
+            for (int i = 0; i < 4; ++i)
+            {
+                const std::vector<uint8_t> unique = Bytes(std::to_string(i));
+                std::vector<HistItem> items = { { FmtText, payloads.Add(shared.data(), shared.size()) }, { FmtOemText, payloads.Add(unique.data(), unique.size()) } };
+                history.Add(std::move(items), uint64_t(i + 1));
+            }
+            CHECK(history.size() == 4);
+            CHECK(history.ExclusiveBytes(history.Back()) == 1);
+
+            const HistId front = AddEntry(history, payloads, FmtText, std::vector<uint8_t>(600, 'f'), 10);
+            CHECK(payloads.StoredBytes() <= 1000);
+            CHECK(history.size() == 1);
+            CHECK(history.Front() == front);
+        } });
+
+        tests.push_back({ "history.exclusive_bytes", []()
+        {
+            PayloadStore payloads;
+            History history(payloads);
+            const std::vector<uint8_t> shared(100, 's'), own(50, 'o');
+            std::vector<HistItem> items = { { FmtText, payloads.Add(shared.data(), shared.size()) } };
+            const HistId a = history.Add(std::move(items), 1);
+            items = { { FmtText, payloads.Add(shared.data(), shared.size()) }, { FmtOemText, payloads.Add(own.data(), own.size()) } };
+            const HistId b = history.Add(std::move(items), 2);
+            CHECK(history.ExclusiveBytes(a) == 0);
+            CHECK(history.ExclusiveBytes(b) == 50);
+            history.Erase(b);
+            CHECK(history.ExclusiveBytes(a) == 100);
+        } });
+    }
+
+    // Every item of every entry, most recent first.
+    std::vector<std::pair<uint32_t, std::vector<uint8_t>>> Dump(const History& history)
+    {
+        std::vector<std::pair<uint32_t, std::vector<uint8_t>>> dump;
+        for (const HistId id : history)
+            for (const HistItem& i : history.Items(id))
+                dump.push_back({ i.uFormat, Contents(history.Payloads(), i.payload) });
+        return dump;
+    }
+
+    void AddJournalTests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "journal.round_trip", []()
+        {
+            const PathString path = TempPath("RadClipboardTests.journal");
+            RemoveFile(path);
+            std::vector<std::pair<uint32_t, std::vector<uint8_t>>> saved;
+            {
+                PayloadStore payloads;
+                History history(payloads);
+                history.SetBudget(Unlimited(), 0);
+                Journal journal(payloads);
+                CHECK(journal.Open(path));
+                history.AddListener(&journal);
+                std::vector<HistId> ids;
+                for (int i = 0; i < 20; ++i)
+                {
+                    // Compressible and not, to store both ways
+                    const std::vector<uint8_t> data = i % 2 == 0 ? Utf16(std::string(2000, char('a' + i))) : RandomBytes(3000, uint32_t(i));
+                    std::vector<HistItem> items = { { FmtUnicodeText, payloads.Add(data.data(), data.size()) }, { FmtLocale, payloads.Add("\x09\x04\0\0", 4) } };
+                    ids.push_back(history.Add(std::move(items), uint64_t(i + 1)));
+                }
+                history.Erase(ids[3]);
+                history.Touch(ids[5], 100);
+                journal.Flush();
+                CHECK(journal.Errors() == 0);
+                saved = Dump(history);
+                history.RemoveListener(&journal);
+            }
+
+            PayloadStore payloads;
+            History history(payloads);
+            history.SetBudget(Unlimited(), 0);
+            Journal journal(payloads);
+            CHECK(journal.Open(path));
+            journal.Load(history, 200);
+            CHECK(history.size() == 19);
+            CHECK(history.Accessed(history.Front()) == 100);
+            CHECK(Dump(history) == saved);
+            journal.Close();
+            RemoveFile(path);
+        } });
+
+        // A crash part way through a record loses that record only
+        tests.push_back({ "journal.torn_tail", []()
+        {
+            const PathString path = TempPath("RadClipboardTests.journal");
+            RemoveFile(path);
+            {
+                PayloadStore payloads;
+                History history(payloads);
+                Journal journal(payloads);
+                journal.Open(path);
+                history.AddListener(&journal);
+                for (int i = 0; i < 3; ++i)
+                    AddEntry(history, payloads, FmtText, Bytes(std::string(500, char('a' + i))), uint64_t(i + 1));
+                journal.Flush();
+                history.RemoveListener(&journal);
+            }
+            std::vector<uint8_t> file = ReadFile(path);
+            CHECK(file.size() > 10);
+            file.resize(file.size() - 10);
+            WriteFile(path, file);
+
+            {
+                PayloadStore payloads;
+                History history(payloads);
+                Journal journal(payloads);
+                CHECK(journal.Open(path));
+                journal.Load(history, 10);
+                CHECK(history.size() == 2);
+                CHECK(Contents(payloads, history.Items(history.Front())[0].payload) == Bytes(std::string(500, 'b')));
+
+                // Still appends after the recovery
+                history.AddListener(&journal);
+                AddEntry(history, payloads, FmtText, Bytes("after"), 11);
+                journal.Flush();
+                history.RemoveListener(&journal);
+            }
+
+            // Garbage after the last record
+            file = ReadFile(path);
+            const std::vector<uint8_t> garbage = RandomBytes(37, 4);
+            file.insert(file.end(), garbage.begin(), garbage.end());
+            WriteFile(path, file);
+
+            PayloadStore payloads;
+            History history(payloads);
+            Journal journal(payloads);
+            CHECK(journal.Open(path));
+            journal.Load(history, 20);
+            CHECK(history.size() == 3);
+            CHECK(Contents(payloads, history.Items(history.Front())[0].payload) == Bytes("after"));
+            journal.Close();
+            RemoveFile(path);
+        } });
+
+        tests.push_back({ "journal.compact", []()
+        {
+            const PathString path = TempPath("RadClipboardTests.journal");
+            RemoveFile(path);
+            PayloadStore payloads;
+            History history(payloads);
+            history.SetBudget(Unlimited(), 0);
+            Journal journal(payloads);
+            journal.Open(path);
+            history.AddListener(&journal);
+            std::vector<HistId> ids;
+            for (int i = 0; i < 10; ++i)
+                ids.push_back(AddEntry(history, payloads, FmtText, RandomBytes(1000, uint32_t(i)), uint64_t(i + 1)));
+            for (int i = 0; i < 8; ++i)
+                history.Erase(ids[size_t(i)]);
+            journal.Flush();
+            const size_t before = journal.FileSize();
+            CHECK(journal.GarbageSize() > 0);
+            CHECK(journal.Compact());
+            CHECK(journal.GarbageSize() == 0);
+            CHECK(journal.FileSize() < before);
+            const auto saved = Dump(history);
+            history.RemoveListener(&journal);
+            journal.Close();
+
+            PayloadStore loadedPayloads;
+            History loaded(loadedPayloads);
+            Journal reopened(loadedPayloads);
+            CHECK(reopened.Open(path));
+            reopened.Load(loaded, 20);
+            CHECK(Dump(loaded) == saved);
+            reopened.Close();
+            RemoveFile(path);
+        } });
+
+        // Open keeps the old file when compacting it fails
+        tests.push_back({ "journal.compact_fails", []()
+        {
+            const PathString path = TempPath("RadClipboardTests.journal");
+            const PathString tmp = TempPath("RadClipboardTests.journal.tmp");
+            RemoveFile(path);
+            std::vector<std::pair<uint32_t, std::vector<uint8_t>>> saved;
+            {
+                PayloadStore payloads;
+                History history(payloads);
+                history.SetBudget(Unlimited(), 0);
+                Journal journal(payloads);
+                journal.Open(path);
+                history.AddListener(&journal);
+                std::vector<HistId> ids;
+                for (int i = 0; i < 10; ++i)
+                    ids.push_back(AddEntry(history, payloads, FmtText, RandomBytes(1000, uint32_t(i)), uint64_t(i + 1)));
+                for (int i = 0; i < 8; ++i)
+                    history.Erase(ids[size_t(i)]);
+                journal.Flush();
+                CHECK(journal.GarbageSize() > journal.FileSize() / 2);
+                saved = Dump(history);
+                history.RemoveListener(&journal);
+            }
+
+            // The temporary file can't be created
+            MakeDir(tmp);
+            {
+                PayloadStore payloads;
+                History history(payloads);
+                history.SetBudget(Unlimited(), 0);
+                Journal journal(payloads);
+                CHECK(journal.Open(path));
+                CHECK(journal.Errors() == 1);
+                journal.Load(history, 20);
+                CHECK(Dump(history) == saved);
+
+                // Still appends to the old file
+                history.AddListener(&journal);
+                AddEntry(history, payloads, FmtText, Bytes("after"), 21);
+                journal.Flush();
+                CHECK(journal.Errors() == 1);
+                saved = Dump(history);
+                history.RemoveListener(&journal);
+            }
+            RemoveDir(tmp);
+
+            PayloadStore payloads;
+            History history(payloads);
+            history.SetBudget(Unlimited(), 0);
+            Journal journal(payloads);
+            CHECK(journal.Open(path));
+            CHECK(journal.Errors() == 0);
+            journal.Load(history, 30);
+            CHECK(Dump(history) == saved);
+            journal.Close();
+            RemoveFile(path);
+        } });
+    }
+
+    void AddColdTierTests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "coldtier.update", []()
+        {
+            PayloadStore payloads;
+            History history(payloads);
+            history.SetBudget(Unlimited(), 0);
+            std::mutex mutex;
+            std::condition_variable cv;
+            bool notified = false;
+            ColdTier cold(payloads, [&]()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                notified = true;
+                cv.notify_all();
+            });
+            ColdTierConfig config;
+            config.hotEntries = 2;
+            config.hotIdle = 1000;
+            config.minSize = 100;
+            cold.SetConfig(config);
+
+            // Oldest first: past the hot count, idle at the front, recent at the front, too small
+            const HistId old = AddEntry(history, payloads, FmtText, Bytes(std::string(1000, 'o')), 1);
+            const HistId small = AddEntry(history, payloads, FmtText, Bytes("small"), 2);
+            const HistId idle = AddEntry(history, payloads, FmtText, Bytes(std::string(1000, 'i')), 3);
+            const HistId recent = AddEntry(history, payloads, FmtText, Bytes(std::string(1000, 'r')), 5000);
+            history.Touch(old, 5000);
+            history.Touch(recent, 5000);
+            // Now recent, old, idle, small: idle is second but wasn't used within hotIdle
+            cold.Update(history, 5500);
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                CHECK(cv.wait_for(lock, std::chrono::seconds(10), [&] { return notified; }));
+            }
+            cold.Commit();
+            const auto isCold = [&](const HistId id) { return payloads.IsCold(history.Items(id)[0].payload); };
+            CHECK(!isCold(recent));
+            CHECK(!isCold(old));
+            CHECK(isCold(idle));
+            CHECK(!isCold(small));
+            CHECK(Contents(payloads, history.Items(idle)[0].payload) == Bytes(std::string(1000, 'i')));
+        } });
+    }
+
+    // Records what DelayedRender does to the clipboard.
+    class FakeClipboard : public ClipboardTarget
+    {
+    public:
+        bool Offer(const uint32_t uFormat) override { offered.push_back(uFormat); return true; }
+        bool Put(const uint32_t uFormat, const uint8_t* const data, const size_t size) override
+        {
+            put.push_back({ uFormat, std::vector<uint8_t>(data, data + size) });
+            return true;
+        }
+
+        std::vector<uint32_t> offered;
+        std::vector<std::pair<uint32_t, std::vector<uint8_t>>> put;
+    };
+
+    void AddDelayedRenderTests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "delayedrender.render", []()
+        {
+            PayloadStore payloads;
+            History history(payloads);
+            const std::vector<uint8_t> text = Utf16("text"), locale = { 9, 4, 0, 0 };
+            std::vector<HistItem> items = { { FmtUnicodeText, payloads.Add(text.data(), text.size()) }, { FmtLocale, payloads.Add(locale.data(), locale.size()) } };
+            const HistId id = history.Add(std::move(items), 1);
+
+            DelayedRender render(payloads);
+            FakeClipboard clipboard;
+            CHECK(render.Offer(history, id, clipboard));
+            CHECK((clipboard.offered == std::vector<uint32_t>{ FmtUnicodeText, FmtLocale }));
+            CHECK(clipboard.put.empty());
+
+            // Still renders once the entry is gone
+            history.Erase(id);
+            CHECK(render.Render(FmtLocale, clipboard));
+            CHECK(!render.Render(FmtText, clipboard));
+            CHECK(render.RenderAll(clipboard));
+            CHECK(clipboard.put.size() == 2);
+            CHECK(clipboard.put[0].first == FmtLocale && clipboard.put[0].second == locale);
+            CHECK(clipboard.put[1].first == FmtUnicodeText && clipboard.put[1].second == text);
+            CHECK(render.RenderedBytes() == text.size() + locale.size());
+            render.Reset();
+            CHECK(payloads.Count() == 0);
+        } });
+    }
+
+    void AddSearchTests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "search.find", []()
+        {
+            PayloadStore payloads;
+            History history(payloads);
+            history.SetBudget(Unlimited(), 0);
+            SearchIndex search;
+            history.AddListener(&search);
+            std::vector<HistId> ids;
+            for (int i = 0; i < 5; ++i)
+                ids.push_back(AddEntry(history, payloads, FmtUnicodeText, Utf16("Apple number " + std::to_string(i)), uint64_t(i + 1)));
+            AddEntry(history, payloads, FmtUnicodeText, Utf16("banana"), 10);
+
+            // Most recent first, the touched entry leading
+            history.Touch(ids[1], 20);
+            CHECK((search.Find(history, "apple") == std::vector<HistId>{ ids[1], ids[4], ids[3], ids[2], ids[0] }));
+            CHECK((search.Find(history, "APPLE", 2) == std::vector<HistId>{ ids[1], ids[4] }));
+            CHECK((search.Find(history, "number 3") == std::vector<HistId>{ ids[3] }));
+            // Shorter than a trigram
+            CHECK(search.Find(history, "ap").size() == 5);
+            CHECK(search.Find(history, "cherry").empty());
+
+            history.Erase(ids[4]);
+            CHECK((search.Find(history, "apple", 2) == std::vector<HistId>{ ids[1], ids[3] }));
+            history.RemoveListener(&search);
+        } });
+    }
+
+    void AddQueryTests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "query.match", []()
+        {
+            PayloadStore payloads;
+            History history(payloads);
+            history.SetBudget(Unlimited(), 0);
+            const HistId text = AddEntry(history, payloads, FmtUnicodeText, Utf16("Error 42 in line 7\r\nWarning"), 1);
+            const HistId big = AddEntry(history, payloads, FmtText, std::vector<uint8_t>(5000, 'x'), 2);
+            const std::vector<QueryEntry> entries = QueryEngine::Snapshot(history);
+            const auto matches = [&](const char* const q)
+            {
+                Query query;
+                CHECK(query.Parse(q));
+                std::vector<HistId> hits;
+                uint64_t bytes = 0;
+                for (const QueryEntry& e : entries)
+                    if (query.Match(e, bytes))
+                        hits.push_back(e.id);
+                return hits;
+            };
+            CHECK((matches("error") == std::vector<HistId>{ text }));
+            CHECK((matches("\"in line\" warning") == std::vector<HistId>{ text }));
+            CHECK((matches("re:\"error [0-9]+\"") == std::vector<HistId>{ text }));
+            CHECK((matches("/^warning$/") == std::vector<HistId>{ text }));
+            CHECK(matches("re:\"error [a-z]+$\"").empty());
+            CHECK((matches("size>4k") == std::vector<HistId>{ big }));
+            CHECK((matches("is:text size<1k") == std::vector<HistId>{ text }));
+            Query bad;
+            CHECK(!bad.Parse("re:("));
+        } });
+
+        tests.push_back({ "query.counted", []()
+        {
+            PayloadStore payloads;
+            History history(payloads);
+            history.SetBudget(Unlimited(), 0);
+            const HistId run = AddEntry(history, payloads, FmtText, Bytes("id " + std::string(12, 'x') + " end"), 1);
+            const HistId ticket = AddEntry(history, payloads, FmtText, Bytes("ticket abbc-1234"), 2);
+            const std::vector<QueryEntry> entries = QueryEngine::Snapshot(history);
+            const auto matches = [&](const char* const q)
+            {
+                Query query;
+                CHECK(query.Parse(q));
+                std::vector<HistId> hits;
+                uint64_t bytes = 0;
+                for (const QueryEntry& e : entries)
+                    if (query.Match(e, bytes))
+                        hits.push_back(e.id);
+                return hits;
+            };
+            // The counts of a quantifier aren't text every match has to contain
+            CHECK((matches("/x{10,20}/") == std::vector<HistId>{ run }));
+            CHECK((matches("\"/id x{12} end/\"") == std::vector<HistId>{ run }));
+            CHECK((matches("/ab{2}c-[0-9]{4}/") == std::vector<HistId>{ ticket }));
+            CHECK((matches("\"/ticket ab{1,}c/\"") == std::vector<HistId>{ ticket }));
+            CHECK(matches("/x{13,}/").empty());
+            CHECK(matches("/ab{3}c-1234/").empty());
+            CHECK(matches("\"/ticket abbc-[0-9]{5}/\"").empty());
+        } });
+
+        tests.push_back({ "query.engine", []()
+        {
+            PayloadStore payloads;
+            History history(payloads);
+            history.SetBudget(Unlimited(), 0);
+            std::vector<HistId> ids;
+            for (int i = 0; i < 100; ++i)
+                ids.push_back(AddEntry(history, payloads, FmtUnicodeText, Utf16(std::string(1000, 'a') + (i % 10 == 0 ? " needle " : " hay ") + std::to_string(i)), uint64_t(i + 1)));
+            Query query;
+            query.Parse("needle");
+            QueryEngine engine(nullptr, 4);
+            std::vector<HistId> hits;
+            const QueryStats stats = engine.Run(QueryEngine::Snapshot(history), query, 3, [&](const HistId id) { hits.push_back(id); });
+            CHECK(stats.hits == 3);
+            CHECK((hits == std::vector<HistId>{ ids[90], ids[80], ids[70] }));
+
+            // In the background, with the result collected once notified
+            std::mutex mutex;
+            std::condition_variable cv;
+            bool notified = false;
+            QueryEngine background([&]()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                notified = true;
+                cv.notify_all();
+            }, 4);
+            const uint64_t serial = background.Start(QueryEngine::Snapshot(history), query, SIZE_MAX);
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                CHECK(cv.wait_for(lock, std::chrono::seconds(10), [&] { return notified; }));
+            }
+            uint64_t done = 0;
+            CHECK(background.TakeResult(done, hits));
+            CHECK(done == serial);
+            CHECK(hits.size() == 10 && hits.front() == ids[90] && hits.back() == ids[0]);
+        } });
+    }
+
+    void Put16(std::vector<uint8_t>& data, const size_t offset, const uint32_t v)
+    {
+        data[offset] = uint8_t(v);
+        data[offset + 1] = uint8_t(v >> 8);
+    }
+
+    void Put32(std::vector<uint8_t>& data, const size_t offset, const uint32_t v)
+    {
+        Put16(data, offset, v & 0xFFFF);
+        Put16(data, offset + 2, v >> 16);
+    }
+
+    // DROPFILES of wide paths, as Explorer puts on the clipboard.
+    std::vector<uint8_t> DropFiles(const std::vector<std::string>& paths)
+    {
+        std::vector<uint8_t> data(20);
+        Put32(data, 0, 20);
+        Put32(data, 16, 1);
+        for (const std::string& p : paths)
+        {
+            const std::vector<uint8_t> path = Utf16(p);
+            data.insert(data.end(), path.begin(), path.end());
+        }
+        data.push_back(0);
+        data.push_back(0);
+        return data;
+    }
+
+    EntrySummary Summarize(PayloadStore& payloads, const std::vector<std::pair<uint32_t, std::vector<uint8_t>>>& items, const TextKinds& kinds = TextKinds())
+    {
+        std::vector<PayloadId> ids;
+        std::vector<std::pair<uint32_t, PayloadRef>> refs;
+        for (const auto& i : items)
+        {
+            ids.push_back(payloads.Add(i.second.data(), i.second.size()));
+            refs.push_back({ i.first, payloads.Ref(ids.back()) });
+        }
+        const EntrySummary s = Summarize(refs, kinds);
+        for (const PayloadId id : ids)
+            payloads.Release(id);
+        return s;
+    }
+
+    void AddSummaryTests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "summary.text", []()
+        {
+            PayloadStore payloads;
+            const std::vector<uint8_t> text = Utf16("  Hello\r\n\tworld  \r\nthird"), locale = { 9, 4, 0, 0 };
+            EntrySummary s = Summarize(payloads, { { FmtLocale, locale }, { FmtUnicodeText, text } });
+            CHECK(s.kind == SummaryKind::Text);
+            CHECK(s.uFormat == FmtUnicodeText);
+            CHECK(strcmp(s.label, "Hello world third") == 0);
+            CHECK(s.chars == 24 && s.lines == 3);
+            CHECK(s.totalBytes == text.size() + locale.size());
+
+            s = Summarize(payloads, { { FmtText, Bytes(std::string("one\ntwo\n") + '\0' + "junk") } });
+            CHECK(s.uFormat == FmtText);
+            CHECK(strcmp(s.label, "one two") == 0);
+            CHECK(s.chars == 8 && s.lines == 2);
+
+            // The label keeps whole characters, a surrogate pair is one
+            std::vector<uint8_t> wide = Utf16(std::string(49, 'x'));
+            wide.resize(wide.size() - 2);
+            wide.insert(wide.end(), { 0xE9, 0x00, 0x3D, 0xD8, 0x00, 0xDE, 0x41, 0x00, 0x00, 0x00 });
+            s = Summarize(payloads, { { FmtUnicodeText, wide } });
+            CHECK(s.chars == 52);
+            CHECK(strlen(s.label) == 49 + 2);
+            CHECK(strcmp(s.label + 49, "\xC3\xA9") == 0);
+        } });
+
+        tests.push_back({ "summary.malformed_html", []()
+        {
+            PayloadStore payloads;
+            const TextKinds kinds = { { 0xC101, TextKind::Html } };
+            // Continuation bytes without a lead byte are replaced, and the label stays in bounds
+            const std::string junk = "Version:0.9\r\n<p>A" + std::string(1000, '\x80') + "</p>";
+            EntrySummary s = Summarize(payloads, { { 0xC101, Bytes(junk) } }, kinds);
+            CHECK(s.kind == SummaryKind::Text);
+            std::string label = "A";
+            for (size_t i = 1; i < EntrySummary::LabelChars; ++i)
+                label += "\xEF\xBF\xBD";
+            CHECK(s.label == label);
+
+            // Well formed sequences are kept, overlong and truncated ones replaced
+            std::string text;
+            const std::string html = "<p>\xC3\xA9\xC0\xAF x\xF0\x9F\x98\x80\xED\xA0\x80!\xE2\x82";
+            ExtractText(TextKind::Html, reinterpret_cast<const uint8_t*>(html.data()), html.size(), text);
+            CHECK(text == "\xC3\xA9\xEF\xBF\xBD\xEF\xBF\xBD x\xF0\x9F\x98\x80\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD!\xEF\xBF\xBD\xEF\xBF\xBD");
+        } });
+
+        tests.push_back({ "summary.image", []()
+        {
+            PayloadStore payloads;
+            std::vector<uint8_t> dib(40 + 4);
+            Put32(dib, 0, 40);
+            Put32(dib, 4, 640);
+            Put32(dib, 8, uint32_t(-480));
+            Put16(dib, 14, 32);
+            EntrySummary s = Summarize(payloads, { { FmtDib, dib }, { FmtDibV5, Bytes("not a header") } });
+            CHECK(s.kind == SummaryKind::Image);
+            CHECK(s.uFormat == FmtDib);
+            CHECK(s.width == 640 && s.height == 480 && s.bitCount == 32);
+            CHECK(strcmp(s.label, "Image 640 x 480 x 32") == 0);
+
+            std::vector<uint8_t> core(12 + 4);
+            Put32(core, 0, 12);
+            Put16(core, 4, 16);
+            Put16(core, 6, 9);
+            Put16(core, 10, 24);
+            s = Summarize(payloads, { { FmtDib, core } });
+            CHECK(strcmp(s.label, "Image 16 x 9 x 24") == 0);
+
+            // Too short for a header
+            s = Summarize(payloads, { { FmtDibV5, Bytes("short") } });
+            CHECK(s.kind == SummaryKind::Image && s.width == 0);
+        } });
+
+        tests.push_back({ "summary.files", []()
+        {
+            PayloadStore payloads;
+            const std::vector<uint8_t> files = DropFiles({ "C:\\a.txt", "C:\\dir\\b.log", "D:\\c" });
+            const EntrySummary s = Summarize(payloads, { { FmtHDrop, files }, { FmtUnicodeText, Utf16("C:\\a.txt") } });
+            CHECK(s.kind == SummaryKind::Files);
+            CHECK(s.uFormat == FmtHDrop);
+            CHECK(s.files == 3);
+            CHECK(strcmp(s.label, "3 Files") == 0);
+        } });
+
+        tests.push_back({ "summary.other", []()
+        {
+            PayloadStore payloads;
+            EntrySummary s = Summarize(payloads, { { 0xC100, Bytes("small") }, { 0xC101, Bytes("the largest") } });
+            CHECK(s.kind == SummaryKind::Other);
+            CHECK(s.uFormat == 0xC101);
+            CHECK(strcmp(s.label, "Item: 49409") == 0);
+            CHECK(s.totalBytes == 16);
+
+            // Registered text formats come from the kinds
+            const TextKinds kinds = { { 0xC100, TextKind::Rtf } };
+            s = Summarize(payloads, { { 0xC100, Bytes("{\\rtf1\\ansi {\\b bold} text}") } }, kinds);
+            CHECK(s.kind == SummaryKind::Text);
+            CHECK(strcmp(s.label, "bold text") == 0);
+        } });
+
+        tests.push_back({ "summary.table", []()
+        {
+            PayloadStore payloads;
+            History history(payloads);
+            const HistId before = AddEntry(history, payloads, FmtText, Bytes("before"), 1);
+            SummaryTable table(history);
+            history.AddListener(&table);
+            CHECK(strcmp(table.Get(before).label, "...") == 0);
+
+            const HistId a = AddEntry(history, payloads, FmtText, Bytes("first"), 2);
+            CHECK(strcmp(table.Get(a).label, "first") == 0);
+            const uint32_t index = history.Summary(a);
+
+            // A summary worked out elsewhere is used instead of reading the payloads
+            std::vector<HistItem> items = { { FmtText, payloads.Add("second", 6) } };
+            EntrySummary provided = {};
+            strcpy(provided.label, "provided");
+            table.Provide(History::EntryKey(payloads, items), provided);
+            const HistId b = history.Add(std::move(items), 3);
+            CHECK(strcmp(table.Get(b).label, "provided") == 0);
+
+            // Erased summaries are reused
+            history.Erase(a);
+            const HistId c = AddEntry(history, payloads, FmtText, Bytes("third"), 4);
+            CHECK(history.Summary(c) == index);
+            CHECK(strcmp(table.Get(c).label, "third") == 0);
+
+            table.Set(before, provided);
+            CHECK(strcmp(table.Get(before).label, "provided") == 0);
+            history.RemoveListener(&table);
+        } });
+    }
+
+    // A row formatted a byte at a time with snprintf.
+    std::string ReferenceHexRow(const uint64_t offset, const uint8_t* const data, const size_t size)
+    {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%08X  ", unsigned(offset & 0xFFFFFFFF));
+        std::string row = buf;
+        for (size_t i = 0; i < HexRowBytes; ++i)
+        {
+            if (i < size)
+            {
+                snprintf(buf, sizeof(buf), "%02X ", data[i]);
+                row += buf;
+            }
+            else
+                row += "   ";
+            if (i == HexRowBytes / 2 - 1)
+                row += ' ';
+        }
+        row += ' ';
+        for (size_t i = 0; i < size; ++i)
+            row += data[i] >= 0x20 && data[i] < 0x7F ? char(data[i]) : '.';
+        row.resize(HexRowChars, ' ');
+        return row;
+    }
+
+    void AddHexDumpTests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "hexdump.row", []()
+        {
+            const std::vector<uint8_t> data = Bytes(std::string("Hello, world!\r\n", 15) + '\0');
+            char row[HexRowChars];
+            HexDumpRow(row, 0x10, data.data(), data.size());
+            CHECK(std::string(row, HexRowChars) == "00000010  48 65 6C 6C 6F 2C 20 77  6F 72 6C 64 21 0D 0A 00  Hello, world!...");
+
+            // Only the low 32 bits of the offset
+            HexDumpRow(row, 0x123456789A, data.data(), 3);
+            CHECK(std::string(row, HexRowChars) == "3456789A  48 65 6C" + std::string(42, ' ') + "Hel" + std::string(13, ' '));
+            CHECK(std::string(row, HexRowChars) == ReferenceHexRow(0x123456789A, data.data(), 3));
+        } });
+
+        tests.push_back({ "hexdump.rows", []()
+        {
+            const std::vector<uint8_t> data = RandomBytes(1000, 3);
+            std::vector<char> out;
+            // Every length of the last row, and windows of rows anywhere in the data
+            for (size_t size = 0; size <= 3 * HexRowBytes + 1; ++size)
+            {
+                const size_t rows = HexDumpRows(out, data.data(), size, 0, SIZE_MAX);
+                CHECK(rows == HexRowCount(size));
+                for (size_t r = 0; r < rows; ++r)
+                    CHECK(std::string(out.data() + r * HexRowChars, HexRowChars) == ReferenceHexRow(r * HexRowBytes, data.data() + r * HexRowBytes, std::min(HexRowBytes, size - r * HexRowBytes)));
+            }
+            const size_t total = HexRowCount(data.size());
+            for (const size_t first : { size_t(0), size_t(1), size_t(30), total - 2, total - 1 })
+            {
+                const size_t rows = HexDumpRows(out, data.data(), data.size(), first, 10);
+                CHECK(rows == std::min<size_t>(10, total - first));
+                bool same = true;
+                for (size_t r = 0; r < rows; ++r)
+                {
+                    const size_t offset = (first + r) * HexRowBytes;
+                    same = same && std::string(out.data() + r * HexRowChars, HexRowChars) == ReferenceHexRow(offset, data.data() + offset, std::min(HexRowBytes, data.size() - offset));
+                }
+                CHECK(same);
+            }
+
+            // Past the end, and the buffer is only grown
+            CHECK(HexDumpRows(out, data.data(), data.size(), total, 10) == 0);
+            CHECK(HexDumpRows(out, data.data(), 0, 0, 10) == 0);
+            out.assign(100 * HexRowChars, 'x');
+            CHECK(HexDumpRows(out, data.data(), data.size(), 0, 2) == 2);
+            CHECK(out.size() == 100 * HexRowChars);
+            CHECK(out[2 * HexRowChars] == 'x');
+        } });
+    }
+
+    std::wstring RowText(const TextLayout& layout, const size_t row)
+    {
+        size_t begin, end;
+        layout.Row(row, begin, end);
+        return layout.Text().substr(begin, end - begin);
+    }
+
+    void AddTextLayoutTests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "textlayout.lines", []()
+        {
+            TextLayout layout;
+            CHECK(layout.LineCount() == 1 && layout.RowCount() == 1);
+            layout.SetText(L"one\r\ntwo\n\nthree\r\n");
+            CHECK(layout.LineCount() == 5);
+            CHECK(layout.RowCount() == 5);
+            // Rows leave out the CR LF
+            CHECK(RowText(layout, 0) == L"one");
+            CHECK(RowText(layout, 1) == L"two");
+            CHECK(RowText(layout, 2).empty());
+            CHECK(RowText(layout, 3) == L"three");
+            CHECK(RowText(layout, 4).empty());
+            CHECK(layout.RowOf(0) == 0 && layout.RowOf(3) == 0 && layout.RowOf(4) == 0);
+            CHECK(layout.RowOf(5) == 1 && layout.RowOf(10) == 3 && layout.RowOf(17) == 4);
+        } });
+
+        tests.push_back({ "textlayout.wrap", []()
+        {
+            TextLayout layout;
+            layout.SetText(L"the quick brown fox jumps\r\nabcdefghij");
+            layout.SetWidth(10);
+            CHECK(layout.LineCount() == 2);
+            CHECK(layout.RowCount() == 4);
+            // After the last space, or mid word when there isn't one
+            CHECK(RowText(layout, 0) == L"the quick ");
+            CHECK(RowText(layout, 1) == L"brown fox ");
+            CHECK(RowText(layout, 2) == L"jumps");
+            CHECK(RowText(layout, 3) == L"abcdefghij");
+            CHECK(layout.RowOf(9) == 0 && layout.RowOf(10) == 1 && layout.RowOf(24) == 2);
+
+            layout.SetWidth(4);
+            CHECK(layout.RowCount() == 11);
+            CHECK(RowText(layout, 1) == L"quic");
+            CHECK(RowText(layout, 2) == L"k ");
+            CHECK(RowText(layout, 7) == L"s");
+            CHECK(RowText(layout, 8) == L"abcd");
+            CHECK(RowText(layout, 10) == L"ij");
+            CHECK(layout.RowOf(35) == 10);
+
+            // Tabs stop every TabChars spaces, and a row holds at least one character
+            layout.SetText(L"a\tb");
+            layout.SetWidth(TextLayout::TabChars + 1);
+            CHECK(layout.RowCount() == 1);
+            layout.SetWidth(TextLayout::TabChars);
+            CHECK(layout.RowCount() == 2);
+            CHECK(RowText(layout, 1) == L"b");
+            layout.SetWidth(1);
+            CHECK(layout.RowCount() == 3);
+
+            layout.SetWidth(0);
+            CHECK(layout.RowCount() == 1);
+        } });
+
+        tests.push_back({ "textlayout.long_line", []()
+        {
+            std::wstring text;
+            for (int i = 0; i < 100000; ++i)
+                text += L"abcdefghi ";
+            TextLayout layout;
+            layout.SetText(text + L"\nend");
+            layout.SetWidth(80);
+            CHECK(layout.LineCount() == 2);
+            CHECK(layout.RowCount() == 12501);
+            size_t begin, end;
+            layout.Row(12499, begin, end);
+            CHECK(begin == 999920 && end == 1000000);
+            CHECK(layout.RowOf(999999) == 12499);
+            CHECK(layout.RowOf(1000001) == 12500);
+            CHECK(RowText(layout, 12500) == L"end");
+        } });
+
+        tests.push_back({ "textlayout.cache", []()
+        {
+            TextLayout layout;
+            size_t measured = 0;
+            layout.SetMeasure([&measured](const wchar_t c) { ++measured; return c == L'W' ? 3 : 1; });
+            layout.SetText(L"WWW WWW\nabc");
+            layout.SetWidth(12);
+            CHECK(layout.RowCount() == 3);
+            CHECK(RowText(layout, 0) == L"WWW ");
+            // Each character is measured once
+            CHECK(measured == 5);
+
+            // Every width is laid out again correctly, including ones that fell out of the cache
+            const size_t rows[] = { 7, 5, 3, 3, 2, 2 };
+            static_assert(sizeof(rows) / sizeof(rows[0]) > TextLayout::MaxLayouts, "");
+            for (int pass = 0; pass < 2; ++pass)
+            {
+                for (size_t i = 0; i < sizeof(rows) / sizeof(rows[0]); ++i)
+                {
+                    layout.SetWidth(int(i + 1) * 4);
+                    CHECK(layout.RowCount() == rows[i]);
+                }
+            }
+            CHECK(measured == 5);
+
+            // A new measure or text is laid out again
+            layout.SetWidth(12);
+            layout.SetMeasure([](const wchar_t) { return 1; });
+            CHECK(layout.RowCount() == 2);
+            layout.SetText(L"a b c d e f g h i j k l m");
+            CHECK(layout.RowCount() == 3);
+            CHECK(RowText(layout, 2) == L"m");
+        } });
+    }
+
+    // A packed DIB with a header of headerSize bytes, 40 or more, followed by extra for the
+    // masks or colour table, then bits.
+    std::vector<uint8_t> Dib(const uint32_t headerSize, const int32_t width, const int32_t height, const uint32_t bitCount, const uint32_t compression, const std::vector<uint8_t>& extra, const std::vector<uint8_t>& bits)
+    {
+        std::vector<uint8_t> data(headerSize);
+        Put32(data, 0, headerSize);
+        Put32(data, 4, uint32_t(width));
+        Put32(data, 8, uint32_t(height));
+        Put16(data, 12, 1);
+        Put16(data, 14, bitCount);
+        Put32(data, 16, compression);
+        Put32(data, 20, uint32_t(bits.size()));
+        data.insert(data.end(), extra.begin(), extra.end());
+        data.insert(data.end(), bits.begin(), bits.end());
+        return data;
+    }
+
+    std::vector<uint8_t> Words(const std::vector<uint32_t>& words, const size_t bytes)
+    {
+        std::vector<uint8_t> data(words.size() * bytes);
+        for (size_t i = 0; i < words.size(); ++i)
+            bytes == 2 ? Put16(data, i * 2, words[i]) : Put32(data, i * 4, words[i]);
+        return data;
+    }
+
+    const uint32_t BiRgb = 0;
+    const uint32_t BiRle8 = 1;
+    const uint32_t BiBitfields = 3;
+
+    void AddDibTests(std::vector<TestCase>& tests)
+    {
+        // Two rows of three pixels padded to 12 bytes, the bottom row first
+        const std::vector<uint8_t> rgb24 = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 0, 0, 10, 11, 12, 13, 14, 15, 16, 17, 18, 0, 0, 0 };
+
+        tests.push_back({ "dib.rgb24", [rgb24]()
+        {
+            const std::vector<uint8_t> data = Dib(40, 3, 2, 24, BiRgb, {}, rgb24);
+            DibInfo info;
+            CHECK(ParseDib(data.data(), data.size(), info));
+            CHECK(info.width == 3 && info.height == 2 && !info.topDown);
+            CHECK(info.bitCount == 24 && info.offset == 40 && info.stride == 12);
+            CHECK(!info.alpha);
+
+            BgraImage image;
+            CHECK(DecodeDib(data.data(), data.size(), image));
+            CHECK(image.width == 3 && image.height == 2);
+            CHECK((image.pixels == std::vector<uint32_t>{ 0xFF0C0B0A, 0xFF0F0E0D, 0xFF121110, 0xFF030201, 0xFF060504, 0xFF090807 }));
+        } });
+
+        tests.push_back({ "dib.top_down", [rgb24]()
+        {
+            const std::vector<uint8_t> data = Dib(40, 3, -2, 24, BiRgb, {}, rgb24);
+            DibInfo info;
+            CHECK(ParseDib(data.data(), data.size(), info));
+            CHECK(info.height == 2 && info.topDown);
+            uint32_t row[3];
+            DecodeDibRow(info, data.data(), 1, row);
+            CHECK(row[0] == 0xFF0C0B0A && row[2] == 0xFF121110);
+            BgraImage image;
+            CHECK(DecodeDib(data.data(), data.size(), image));
+            CHECK(image.pixels[0] == 0xFF030201 && image.pixels[5] == 0xFF121110);
+        } });
+
+        tests.push_back({ "dib.palette", []()
+        {
+            // Blue and red, then 1 bpp indices 1010 0000 01
+            const std::vector<uint8_t> table = { 255, 0, 0, 0, 0, 0, 255, 0 };
+            std::vector<uint8_t> data = Dib(40, 10, 1, 1, BiRgb, table, { 0xA0, 0x40, 0, 0 });
+            BgraImage image;
+            CHECK(DecodeDib(data.data(), data.size(), image));
+            CHECK(image.pixels.size() == 10);
+            CHECK(image.pixels[0] == 0xFFFF0000 && image.pixels[1] == 0xFF0000FF && image.pixels[2] == 0xFFFF0000);
+            CHECK(image.pixels[8] == 0xFF0000FF && image.pixels[9] == 0xFFFF0000);
+
+            // A table of two colours used at 4 bpp, with index 5 past it
+            data = Dib(40, 3, 1, 4, BiRgb, table, { 0x10, 0x50, 0, 0 });
+            Put32(data, 32, 2);
+            CHECK(DecodeDib(data.data(), data.size(), image));
+            CHECK((image.pixels == std::vector<uint32_t>{ 0xFFFF0000, 0xFF0000FF, 0xFF000000 }));
+
+            // A BITMAPCOREHEADER has 3 byte colours and 16 bit sizes
+            std::vector<uint8_t> core(12);
+            Put32(core, 0, 12);
+            Put16(core, 4, 2);
+            Put16(core, 6, 1);
+            Put16(core, 8, 1);
+            Put16(core, 10, 8);
+            for (uint32_t i = 0; i < 256; ++i)
+                core.insert(core.end(), { uint8_t(i), uint8_t(i), uint8_t(255 - i) });
+            core.insert(core.end(), { 0, 200, 0, 0 });
+            CHECK(DecodeDib(core.data(), core.size(), image));
+            CHECK((image.pixels == std::vector<uint32_t>{ 0xFFFF0000, 0xFF37C8C8 }));
+        } });
+
+        tests.push_back({ "dib.bitfields", []()
+        {
+            // 5-6-5 masks after a BITMAPINFOHEADER
+            std::vector<uint8_t> data = Dib(40, 3, 1, 16, BiBitfields, Words({ 0xF800, 0x07E0, 0x001F }, 4), Words({ 0xF800, 0x07E0, 0x001F, 0 }, 2));
+            DibInfo info;
+            CHECK(ParseDib(data.data(), data.size(), info));
+            CHECK(info.offset == 52 && info.masks[0] == 0xF800 && info.masks[3] == 0);
+            BgraImage image;
+            CHECK(DecodeDib(data.data(), data.size(), image));
+            CHECK((image.pixels == std::vector<uint32_t>{ 0xFFFF0000, 0xFF00FF00, 0xFF0000FF }));
+
+            // BI_RGB at 16 bpp is 5-5-5
+            data = Dib(40, 2, 1, 16, BiRgb, {}, Words({ 0x7C00, 0x03FF }, 2));
+            CHECK(DecodeDib(data.data(), data.size(), image));
+            CHECK((image.pixels == std::vector<uint32_t>{ 0xFFFF0000, 0xFF00FFFF }));
+        } });
+
+        tests.push_back({ "dib.alpha", []()
+        {
+            // A BITMAPV5HEADER with its masks, straight alpha is premultiplied
+            std::vector<uint8_t> data = Dib(124, 2, 1, 32, BiBitfields, {}, Words({ 0x80FF4000, 0xFFFFFFFF }, 4));
+            Put32(data, 40, 0x00FF0000);
+            Put32(data, 44, 0x0000FF00);
+            Put32(data, 48, 0x000000FF);
+            Put32(data, 52, 0xFF000000);
+            DibInfo info;
+            CHECK(ParseDib(data.data(), data.size(), info));
+            CHECK(info.offset == 124 && info.alpha);
+            BgraImage image;
+            CHECK(DecodeDib(data.data(), data.size(), image));
+            CHECK((image.pixels == std::vector<uint32_t>{ 0x80802000, 0xFFFFFFFF }));
+
+            // All zero alpha is opaque
+            data = Dib(40, 2, 1, 32, BiRgb, {}, Words({ 0x00112233, 0x00445566 }, 4));
+            CHECK(ParseDib(data.data(), data.size(), info));
+            CHECK(!info.alpha);
+            CHECK(DecodeDib(data.data(), data.size(), image));
+            CHECK((image.pixels == std::vector<uint32_t>{ 0xFF112233, 0xFF445566 }));
+        } });
+
+        tests.push_back({ "dib.malformed", [rgb24]()
+        {
+            DibInfo info;
+            BgraImage image;
+            const std::vector<std::vector<uint8_t>> valid = {
+                Dib(40, 3, 2, 24, BiRgb, {}, rgb24),
+                Dib(40, 10, 1, 1, BiRgb, { 255, 0, 0, 0, 0, 0, 255, 0 }, { 0xA0, 0x40, 0, 0 }),
+                Dib(40, 3, 1, 16, BiBitfields, Words({ 0xF800, 0x07E0, 0x001F }, 4), Words({ 0xF800, 0x07E0, 0x001F, 0 }, 2)),
+            };
+            for (const std::vector<uint8_t>& data : valid)
+            {
+                CHECK(ParseDib(data.data(), data.size(), info));
+                // Truncated anywhere, copied so reading past the end would be caught by a sanitizer
+                for (size_t size = 0; size < data.size(); ++size)
+                {
+                    const std::vector<uint8_t> part(data.begin(), data.begin() + ptrdiff_t(size));
+                    CHECK(!DecodeDib(part.data(), part.size(), image));
+                }
+            }
+            CHECK(!ParseDib(nullptr, 0, info));
+
+            const auto rejects = [&](const size_t offset, const uint32_t v, const bool wide)
+            {
+                std::vector<uint8_t> data = valid[0];
+                wide ? Put32(data, offset, v) : Put16(data, offset, v);
+                return !ParseDib(data.data(), data.size(), info);
+            };
+            CHECK(rejects(0, 20, true));                // header size
+            CHECK(rejects(0, 1000, true));
+            CHECK(rejects(4, 0, true));                 // width
+            CHECK(rejects(4, 0x80000000, true));
+            CHECK(rejects(8, 0, true));                 // height
+            CHECK(rejects(4, 100000, true));            // larger than the data
+            CHECK(rejects(14, 2, false));               // bit count
+            CHECK(rejects(14, 64, false));
+            CHECK(rejects(16, BiRle8, true));           // compression
+            CHECK(rejects(16, BiBitfields, true));      // masks at 24 bpp
+            CHECK(rejects(32, 0xFFFFFFFF, true));       // colour table
+        } });
+    }
+
+    // Area average of the source pixels that BoxScaler puts in each output pixel, channel by channel.
+    BgraImage ReferenceBoxScale(const std::vector<uint32_t>& src, const int32_t srcWidth, const int32_t srcHeight, const int32_t width, const int32_t height)
+    {
+        BgraImage image;
+        image.width = width;
+        image.height = height;
+        for (int32_t r = 0; r < height; ++r)
+        {
+            for (int32_t i = 0; i < width; ++i)
+            {
+                uint64_t sums[4] = {};
+                uint64_t count = 0;
+                for (int32_t y = 0; y < srcHeight; ++y)
+                {
+                    if (int64_t(y) * height / srcHeight != r)
+                        continue;
+                    for (int32_t x = int32_t(int64_t(i) * srcWidth / width); x < int32_t(int64_t(i + 1) * srcWidth / width); ++x)
+                    {
+                        for (int c = 0; c < 4; ++c)
+                            sums[c] += (src[size_t(y) * size_t(srcWidth) + size_t(x)] >> (c * 8)) & 0xFF;
+                        ++count;
+                    }
+                }
+                uint32_t p = 0;
+                for (int c = 0; c < 4; ++c)
+                    p |= uint32_t((sums[c] + count / 2) / count) << (c * 8);
+                image.pixels.push_back(p);
+            }
+        }
+        return image;
+    }
+
+    BgraImage BoxScale(const std::vector<uint32_t>& src, const int32_t srcWidth, const int32_t srcHeight, const int32_t width, const int32_t height)
+    {
+        BoxScaler scaler(srcWidth, srcHeight, width, height);
+        for (int32_t y = 0; y < srcHeight; ++y)
+            scaler.AddRow(src.data() + size_t(y) * size_t(srcWidth));
+        return std::move(scaler.Result());
+    }
+
+    // A 24 bpp DIB of one colour, BGR.
+    std::vector<uint8_t> SolidDib(const int32_t width, const int32_t height, const uint8_t b, const uint8_t g, const uint8_t r)
+    {
+        const size_t stride = (size_t(width) * 3 + 3) / 4 * 4;
+        std::vector<uint8_t> bits(stride * size_t(height));
+        for (int32_t y = 0; y < height; ++y)
+        {
+            for (int32_t x = 0; x < width; ++x)
+            {
+                uint8_t* const p = bits.data() + size_t(y) * stride + size_t(x) * 3;
+                p[0] = b;
+                p[1] = g;
+                p[2] = r;
+            }
+        }
+        return Dib(40, width, height, 24, BiRgb, {}, bits);
+    }
+
+    void AddThumbnailTests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "thumbnail.box_scale", []()
+        {
+            // 2 x 2 blocks, with rounding
+            const std::vector<uint32_t> src = {
+                0x00000000, 0x04040404, 0xFF000000, 0xFF000000,
+                0x02020202, 0x01010101, 0xFF000000, 0xFF0000FF,
+                0x10203040, 0x10203040, 0x00000001, 0x00000000,
+                0x10203040, 0x10203040, 0x00000000, 0x00000000,
+            };
+            BgraImage image = BoxScale(src, 4, 4, 2, 2);
+            CHECK(image.width == 2 && image.height == 2);
+            CHECK((image.pixels == std::vector<uint32_t>{ 0x02020202, 0xFF000040, 0x10203040, 0x00000000 }));
+
+            // Never larger than the source
+            image = BoxScale(src, 4, 4, 8, 8);
+            CHECK(image.width == 4 && image.height == 4);
+            CHECK(image.pixels == src);
+
+            // Sizes that don't divide, wide enough for the vector loop
+            const std::vector<uint8_t> bytes = RandomBytes(301 * 77 * 4, 4);
+            std::vector<uint32_t> pixels(301 * 77);
+            memcpy(pixels.data(), bytes.data(), bytes.size());
+            for (const auto& size : { std::make_pair(64, 48), std::make_pair(7, 5), std::make_pair(300, 1), std::make_pair(1, 76) })
+            {
+                image = BoxScale(pixels, 301, 77, size.first, size.second);
+                const BgraImage expected = ReferenceBoxScale(pixels, 301, 77, size.first, size.second);
+                CHECK(image.width == expected.width && image.height == expected.height);
+                CHECK(image.pixels == expected.pixels);
+            }
+        } });
+
+        tests.push_back({ "thumbnail.make", []()
+        {
+            const std::vector<uint8_t> dib = SolidDib(600, 300, 0x30, 0x20, 0x10);
+            Thumbnail t;
+            CHECK(MakeThumbnail(dib.data(), dib.size(), ThumbnailCache::MaxSize, t));
+            CHECK(t.sourceWidth == 600 && t.sourceHeight == 300);
+            CHECK(t.image.width == 256 && t.image.height == 128);
+            CHECK(t.menuImage.width == 64 && t.menuImage.height == 32);
+            CHECK(std::all_of(t.image.pixels.begin(), t.image.pixels.end(), [](const uint32_t p) { return p == 0xFF102030; }));
+            CHECK(std::all_of(t.menuImage.pixels.begin(), t.menuImage.pixels.end(), [](const uint32_t p) { return p == 0xFF102030; }));
+
+            // Small images keep their size
+            const std::vector<uint8_t> small = SolidDib(20, 10, 1, 2, 3);
+            CHECK(MakeThumbnail(small.data(), small.size(), ThumbnailCache::MaxSize, t));
+            CHECK(t.image.width == 20 && t.menuImage.width == 20);
+
+            CHECK(!MakeThumbnail(dib.data(), 100, ThumbnailCache::MaxSize, t));
+        } });
+
+        tests.push_back({ "thumbnail.cache", []()
+        {
+            const size_t Images = ThumbnailCache::MaxThumbnails + 6;
+            PayloadStore payloads;
+            History history(payloads);
+            history.SetBudget(Unlimited(), 0);
+            std::mutex mutex;
+            std::condition_variable cv;
+            bool notified = false;
+            ThumbnailCache cache([&]()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                notified = true;
+                cv.notify_all();
+            });
+            history.AddListener(&cache);
+            // Commits until none of ids are pending
+            const auto commit = [&](const std::vector<HistId>& ids)
+            {
+                while (std::any_of(ids.begin(), ids.end(), [&](const HistId id) { return cache.Pending(id); }))
+                {
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        if (!cv.wait_for(lock, std::chrono::seconds(10), [&] { return notified; }))
+                            return false;
+                        notified = false;
+                    }
+                    cache.Commit();
+                }
+                return true;
+            };
+
+            std::vector<HistId> ids;
+            for (size_t i = 0; i < Images; ++i)
+                ids.push_back(AddEntry(history, payloads, FmtDib, SolidDib(8, 8, uint8_t(i), 0, 0), uint64_t(i + 1)));
+            const HistId text = AddEntry(history, payloads, FmtUnicodeText, Utf16("text"), 100);
+            const HistId bad = AddEntry(history, payloads, FmtDib, Bytes("not a DIB"), 101);
+            CHECK(!cache.Pending(text));
+            CHECK(commit(ids));
+            CHECK(commit({ bad }));
+
+            // The oldest fell out of the cache
+            for (size_t i = 0; i < Images; ++i)
+                CHECK((cache.Get(ids[i]) != nullptr) == (i >= Images - ThumbnailCache::MaxThumbnails));
+            CHECK(cache.Get(ids.back())->image.pixels[0] == (0xFF000000 | uint32_t(Images - 1)));
+            CHECK(cache.Get(text) == nullptr);
+            CHECK(cache.Get(bad) == nullptr);
+
+            // Touched entries are kept over older ones
+            const size_t oldest = Images - ThumbnailCache::MaxThumbnails;
+            history.Touch(ids[oldest], 200);
+            const HistId last = AddEntry(history, payloads, FmtDib, SolidDib(8, 8, 0, 0, 1), 201);
+            CHECK(commit({ last }));
+            CHECK(cache.Get(last) != nullptr);
+            CHECK(cache.Get(ids[oldest]) != nullptr);
+            CHECK(cache.Get(ids[oldest + 1]) == nullptr);
+
+            // Erasing drops the thumbnail, or the one being made
+            history.Erase(last);
+            CHECK(cache.Get(last) == nullptr);
+            const HistId erased = AddEntry(history, payloads, FmtDib, SolidDib(8, 8, 0, 0, 2), 202);
+            CHECK(cache.Pending(erased));
+            history.Erase(erased);
+            CHECK(!cache.Pending(erased));
+            cache.Request(history, ids.back());
+            CHECK(!cache.Pending(ids.back()));
+            history.RemoveListener(&cache);
+        } });
+    }
+
+    // Bursts of captures, with the UI thread popping between some of them.
+    void AddCapturePipelineTests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "pipeline.bursts", []()
+        {
+            const int Bursts = 40;
+            PayloadStore payloads;
+            std::mutex mutex;
+            std::condition_variable cv;
+            bool notified = false;
+            std::vector<Capture> popped;
+            CapturePipeline pipeline([&]()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                notified = true;
+                cv.notify_all();
+            }, 4);
+            const auto drain = [&]()
+            {
+                Capture c;
+                while (pipeline.Pop(c))
+                    popped.push_back(std::move(c));
+            };
+
+            // An entry already in the history, prepared again now and then
+            const std::vector<uint8_t> kept = Utf16("kept entry");
+            const PayloadId keptId = payloads.Add(kept.data(), kept.size());
+            const std::vector<uint8_t> locale = { 9, 4, 0, 0 };
+
+            std::mt19937 rng(5);
+            std::vector<std::string> labels;
+            std::vector<HistId> entries;
+            bool serials = true;
+            for (int b = 0; b < Bursts; ++b)
+            {
+                const int n = 1 + int(rng() % 50);
+                for (int i = 0; i < n; ++i)
+                {
+                    uint64_t serial;
+                    if (rng() % 8 == 0)
+                    {
+                        const HistId entry = HistId(labels.size() + 1);
+                        serial = pipeline.Prepare(entry, { { FmtUnicodeText, payloads.Ref(keptId) } });
+                        labels.push_back("kept entry");
+                        entries.push_back(entry);
+                    }
+                    else
+                    {
+                        const std::string label = "capture " + std::to_string(labels.size());
+                        const std::vector<uint8_t> text = Utf16(label + std::string(1 + rng() % 300, ' ') + "end");
+                        std::vector<CaptureItem> items = { { FmtUnicodeText, payloads.Stage(text.data(), text.size()), 0 }, { FmtLocale, payloads.Stage(locale.data(), locale.size()), 0 } };
+                        serial = pipeline.Add(uint64_t(b), std::move(items));
+                        labels.push_back(label + " end");
+                        entries.push_back(InvalidHist);
+                    }
+                    serials = serials && serial == labels.size() - 1;
+                }
+                if (b % 3 == 0)
+                    drain();
+            }
+            CHECK(serials);
+
+            while (popped.size() < labels.size())
+            {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    if (!cv.wait_for(lock, std::chrono::seconds(10), [&] { return notified; }))
+                        break;
+                    notified = false;
+                }
+                drain();
+            }
+            CHECK(popped.size() == labels.size());
+            CHECK(pipeline.Pending() == 0);
+
+            bool ordered = true, summarized = true, hashed = true, indexed = true;
+            for (size_t i = 0; i < popped.size(); ++i)
+            {
+                const Capture& c = popped[i];
+                ordered = ordered && c.serial == i && c.entry == entries[i];
+                summarized = summarized && labels[i] == c.summary.label;
+                for (const CaptureItem& item : c.items)
+                    hashed = hashed && item.hash == HashBytes(item.raw->data(), item.raw->size());
+                indexed = indexed && c.text.text.compare(0, 7, labels[i], 0, 7) == 0 && !c.text.trigrams.empty();
+            }
+            CHECK(ordered);
+            CHECK(summarized);
+            CHECK(hashed);
+            CHECK(indexed);
+            payloads.Release(keptId);
+        } });
+    }
+
+    // A listener thread handing changes to a UI thread that only pops once notified.
+    void AddChangeQueueTests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "changequeue.handoff", []()
+        {
+            const uint32_t Changes = 10000;
+            std::mutex mutex;
+            std::condition_variable cv;
+            bool notified = false;
+            size_t notifications = 0;
+            ChangeQueue queue([&]()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                notified = true;
+                ++notifications;
+                cv.notify_all();
+            }, []() { return uint64_t(1000000); });
+
+            std::thread listener([&]()
+            {
+                for (uint32_t i = 0; i < Changes; ++i)
+                {
+                    ClipboardChange change = {};
+                    change.notified = i;
+                    change.captured = i + 3;
+                    change.time = i;
+                    queue.Push(std::move(change));
+                }
+            });
+
+            uint32_t popped = 0;
+            bool ordered = true;
+            while (popped < Changes)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    if (!cv.wait_for(lock, std::chrono::seconds(10), [&] { return notified; }))
+                        break;
+                    notified = false;
+                }
+                ClipboardChange change;
+                while (queue.Pop(change))
+                    ordered = ordered && change.time == popped++;
+            }
+            listener.join();
+
+            CHECK(popped == Changes);
+            CHECK(ordered);
+            CHECK(notifications >= 1 && notifications <= Changes);
+            CHECK(queue.CaptureLatency().Count() == Changes);
+            CHECK(queue.CaptureLatency().Max() == 3);
+            CHECK(queue.HandoffLatency().Count() == Changes);
+        } });
+    }
+
+    void AddCoalescerTests(std::vector<TestCase>& tests)
+    {
+        const uint64_t Ms = 1000;
+
+        tests.push_back({ "coalescer.debounce", [Ms]()
+        {
+            UpdateCoalescer c;
+            CHECK(c.Due() == UINT64_MAX);
+            c.Notify(0, 1);
+            c.Notify(5 * Ms, 1);
+            c.Notify(10 * Ms, 2);
+            CHECK(c.Due() == 35 * Ms);
+            CHECK(!c.Poll(34 * Ms));
+            CHECK(c.Poll(35 * Ms));
+            CHECK(!c.Pending());
+            CHECK(c.Stats().notifications == 3);
+            CHECK(c.Stats().duplicates == 1);
+            CHECK(c.Stats().coalesced == 1);
+            CHECK(c.Stats().captures == 1);
+        } });
+
+        // Changes that never settle are captured by maxDelay
+        tests.push_back({ "coalescer.max_delay", [Ms]()
+        {
+            UpdateCoalescer c;
+            uint64_t captured = 0;
+            for (uint32_t i = 0; i < 40 && captured == 0; ++i)
+            {
+                const uint64_t now = i * 10 * Ms;
+                c.Notify(now, i + 1);
+                if (c.Poll(now))
+                    captured = now;
+            }
+            CHECK(captured == 150 * Ms);
+        } });
+
+        // Replays a source copying 50 times a second for 5 s, then stopping
+        tests.push_back({ "coalescer.throttle", [Ms]()
+        {
+            UpdateCoalescer c;
+            uint32_t sequence = 0;
+            std::vector<uint64_t> captures;
+            for (uint64_t now = 0; now < 10000 * Ms; now += Ms)
+            {
+                if (now < 5000 * Ms && now % (20 * Ms) == 0)
+                    c.Notify(now, ++sequence);
+                if (c.Poll(now))
+                    captures.push_back(now);
+            }
+            CHECK(c.Stats().notifications == 250);
+            CHECK(c.Stats().throttled > 0);
+            CHECK(captures.size() < 40);
+            CHECK(!c.Pending());
+            // The last change isn't lost
+            CHECK(!captures.empty() && captures.back() >= 5000 * Ms);
+            for (size_t i = 1; i < captures.size(); ++i)
+                CHECK(captures[i] - captures[i - 1] <= 2000 * Ms + 25 * Ms);
+        } });
+    }
+
+    // A clock, a lock and the sleeps of Acquire, all simulated.
+    struct FakeLock
+    {
+        uint64_t now = 0;           // us
+        uint64_t releaseAt;
+        uint32_t yields = 0;
+        std::vector<uint32_t> sleeps;
+
+        explicit FakeLock(const uint64_t releaseAt) : releaseAt(releaseAt) { }
+
+        AcquireResult Acquire(const BackoffPolicy& policy)
+        {
+            return ::Acquire(policy,
+                [this]() { return now >= releaseAt; },
+                [this]() { return now; },
+                [this](const uint32_t ms) { sleeps.push_back(ms); now += uint64_t(ms) * 1000; },
+                [this]() { ++yields; now += 10; });
+        }
+    };
+
+    void AddBackoffTests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "backoff.steps", []()
+        {
+            BackoffPolicy policy;
+            policy.timeout = 100;
+            Backoff b(policy, 0);
+            uint32_t sleep = 0;
+            CHECK(b.Next(0, sleep) == Backoff::Step::Retry);
+            CHECK(b.Next(0, sleep) == Backoff::Step::Retry);
+            for (int i = 0; i < 4; ++i)
+                CHECK(b.Next(0, sleep) == Backoff::Step::Yield);
+            std::vector<uint32_t> sleeps;
+            uint64_t now = 0;
+            while (b.Next(now, sleep) == Backoff::Step::Sleep)
+            {
+                sleeps.push_back(sleep);
+                now += uint64_t(sleep) * 1000;
+            }
+            CHECK((sleeps == std::vector<uint32_t>{ 1, 2, 4, 8, 16, 32, 37 }));
+            CHECK(now == 100000);
+        } });
+
+        tests.push_back({ "backoff.acquire", []()
+        {
+            BackoffPolicy policy;
+            FakeLock unheld(0);
+            AcquireResult r = unheld.Acquire(policy);
+            CHECK(r.acquired && r.attempts == 1 && r.waited == 0);
+
+            FakeLock held(20000);
+            r = held.Acquire(policy);
+            CHECK(r.acquired);
+            CHECK(held.yields == 4);
+            CHECK(r.waited >= 20000 && r.waited < 40000);
+            CHECK(r.attempts == 1 + 2 + 4 + uint32_t(held.sleeps.size()));
+
+            // Never released
+            FakeLock stuck(UINT64_MAX);
+            r = stuck.Acquire(policy);
+            CHECK(!r.acquired);
+            CHECK(r.waited >= 1000000 && r.waited < 1001000);
+            CHECK(*std::max_element(stuck.sleeps.begin(), stuck.sleeps.end()) == policy.maxSleep);
+
+            ContentionStats stats;
+            stats.Record({ true, 1, 0 }, L"");
+            stats.Record({ true, 5, 2000 }, L"editor.exe");
+            stats.Record({ false, 30, 1000000 }, L"manager.exe");
+            stats.Record({ true, 3, 500 }, L"manager.exe");
+            CHECK(stats.Acquired() == 3 && stats.Failed() == 1 && stats.Contended() == 3);
+            CHECK(stats.Wait().Max() >= 1000000);
+            const auto holders = stats.Holders();
+            CHECK(holders.size() == 2 && holders[0].first == L"manager.exe" && holders[0].second == 2);
+        } });
+    }
+
+    void AddPolicyTests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "policy.built_in", []()
+        {
+            CapturePolicy policy;
+            CaptureEvaluation e(policy, "notepad.exe");
+            uint64_t maxSize = 0;
+            CHECK(e.Wants(FmtUnicodeText, "", maxSize));
+            e.Copied(FmtUnicodeText, "");
+            // Synthesized from the Unicode text
+            CHECK(!e.Wants(FmtText, "", maxSize));
+            CHECK(!e.Wants(FmtOemText, "", maxSize));
+            CHECK(e.Wants(FmtDib, "", maxSize));
+            CHECK(!e.Wants(9, "", maxSize));  // CF_PALETTE
+            CHECK(e.Wants(0xC123, "Some Format", maxSize));
+            CHECK(maxSize == 32 << 20);
+        } });
+
+        tests.push_back({ "policy.load", []()
+        {
+            CapturePolicy policy;
+            const size_t builtIn = policy.Rules().size();
+            size_t errorLine = 0;
+            CHECK(policy.Load("# Passwords\r\n\"Rich Text Format\" keepass.exe never\n\nHTML* * max 1m\n49161 * always\nCF_UNICODETEXT * first text\n", errorLine));
+            CHECK(policy.Rules().size() == builtIn + 4);
+            CHECK(!policy.Load("CF_TEXT * always\nCF_DIB * sometimes\n", errorLine));
+            CHECK(errorLine == 2);
+            CHECK(!policy.Load("\"unterminated * never\n", errorLine));
+            CHECK(errorLine == 1);
+            CHECK(policy.Rules().size() == builtIn + 4);
+
+            uint64_t maxSize = 0;
+            CaptureEvaluation keepass(policy, "keepass.exe");
+            CHECK(!keepass.Wants(0xC100, "Rich Text Format", maxSize));
+            CaptureEvaluation word(policy, "winword.exe");
+            CHECK(word.Wants(0xC100, "Rich Text Format", maxSize));
+            CHECK(word.Wants(0xC101, "HTML Format", maxSize));
+            CHECK(maxSize == 1 << 20);
+            CHECK(word.Wants(49161, "Anything", maxSize));
+            CHECK(maxSize == UINT64_MAX);
+            CHECK(policy.Find(0xC101, "HTML Format", "winword.exe")->action == CaptureAction::MaxSize);
+        } });
+    }
+
+    // Registers formats in order from 0xC000, as Windows does, and counts the lookups.
+    class StubFormatBackend : public FormatBackend
+    {
+    public:
+        uint32_t Register(const char* const name) override
+        {
+            names.push_back(name);
+            return uint32_t(0xC000 + names.size() - 1);
+        }
+
+        std::string Name(const uint32_t id) override
+        {
+            ++lookups;
+            return id >= 0xC000 && id < 0xC000 + names.size() ? names[id - 0xC000] : id == 0xC200 ? "Private Thing" : "";
+        }
+
+        std::vector<std::string> names;
+        size_t lookups = 0;
+    };
+
+    void AddFormatTests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "formats.registry", []()
+        {
+            StubFormatBackend backend;
+            FormatRegistry registry(backend);
+            CHECK(backend.names.size() == FormatTableSize - StandardFormatCount);
+            CHECK(registry.Describe(FmtUnicodeText).encoding == TextEncoding::Utf16);
+            CHECK(registry.Name(FmtDibV5) == "CF_DIBV5");
+            CHECK(registry.Describe(0xC000).textKind == TextKind::Html);
+            CHECK(registry.Name(0xC000) == "HTML Format");
+            CHECK(registry.RegisteredTextKinds().count(0xC000) == 1);
+
+            // Named by the backend once
+            CHECK(registry.Describe(0xC200).view == FormatView::Hex);
+            CHECK(registry.Name(0xC200) == "Private Thing");
+            CHECK(registry.Label(0xC200) == "Private Thing");
+            CHECK(backend.lookups == 1);
+            // Private formats aren't registered
+            CHECK(registry.Label(0x0200) == "Format: 512");
+            CHECK(backend.lookups == 1);
+
+            for (uint32_t id = 0; id < StandardFormatCount; ++id)
+                CHECK(FormatTable[id].id == id);
+            CHECK(IsImageFormat(FmtDib) && !IsImageFormat(FmtText));
+        } });
+    }
+
+    void AddTraceTests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "trace.export", []()
+        {
+            TraceClear();
+            {
+                TRACE_SCOPE("test.off");
+            }
+            TraceEnable(true);
+            TraceThreadName("test thread");
+            {
+                TraceSpan span("test.span");
+                span.Arg("size", 1234);
+            }
+            TraceCounter("test.counter", 7);
+            TraceEnable(false);
+            {
+                TRACE_SCOPE("test.after");
+            }
+            const std::string json = TraceExport();
+            CHECK(json.find("\"test.span\"") != std::string::npos);
+            CHECK(json.find("\"size\":1234") != std::string::npos);
+            CHECK(json.find("\"test.counter\"") != std::string::npos);
+            CHECK(json.find("\"value\":7") != std::string::npos);
+            CHECK(json.find("\"test thread\"") != std::string::npos);
+            CHECK(json.find("test.off") == std::string::npos);
+            CHECK(json.find("test.after") == std::string::npos);
+
+            TraceClear();
+            CHECK(TraceExport().find("test.span") == std::string::npos);
+        } });
+
+        tests.push_back({ "trace.named_while_disabled", []()
+        {
+            TraceEnable(false);
+            std::thread([]() { TraceThreadName("idle thread"); }).join();
+            // Named without a buffer, so only its name is exported
+            const std::string json = TraceExport();
+            const size_t at = json.find("\"idle thread\"");
+            CHECK(at != std::string::npos);
+            CHECK(json.find("\"ph\":\"X\"", at) == std::string::npos);
+        } });
+    }
+
+    class CaptureSink : public LogSink
+    {
+    public:
+        void Write(LogLevel /*level*/, const std::string& line) override
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_lines.push_back(line);
+        }
+
+        std::vector<std::string> Lines() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_lines;
+        }
+
+    private:
+        mutable std::mutex m_mutex;
+        std::vector<std::string> m_lines;
+    };
+
+    size_t CountContaining(const std::vector<std::string>& lines, const std::string& text)
+    {
+        return size_t(std::count_if(lines.begin(), lines.end(), [&](const std::string& l) { return l.find(text) != std::string::npos; }));
+    }
+
+    void AddLogTests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "asynclog.write", []()
+        {
+            auto sink = std::make_shared<CaptureSink>();
+            LogAddSink(sink);
+            const LogStats before = LogGetStats();
+
+            LogWrite(LOG_INFO, "narrow message", __FILE__, __LINE__, __FUNCTION__);
+            LogWrite(LOG_WARN, L"wide message", L"Tests.cpp", __LINE__, L"Test");
+            for (int i = 0; i < 5; ++i)
+                LogWrite(LOG_INFO, "repeated message", __FILE__, __LINE__, __FUNCTION__);
+            // Over the rate of the location
+            for (int i = 0; i < 20; ++i)
+                LogWrite(LOG_INFO, ("flood " + std::to_string(i)).c_str(), __FILE__, __LINE__, __FUNCTION__);
+            LogFlush();
+
+            const std::vector<std::string> lines = sink->Lines();
+            const LogStats after = LogGetStats();
+            CHECK(CountContaining(lines, "narrow message") == 1);
+            CHECK(CountContaining(lines, "wide message") == 1);
+            CHECK(CountContaining(lines, "repeated message") == 1);
+            CHECK(CountContaining(lines, "repeated 4 times") == 1);
+            CHECK(CountContaining(lines, "flood ") == LogSiteRate);
+            CHECK(CountContaining(lines, "10 more messages suppressed") == 1);
+            CHECK(after.coalesced - before.coalesced == 4);
+            CHECK(after.suppressed - before.suppressed == 20 - LogSiteRate);
+            CHECK(after.dropped == before.dropped);
+        } });
+    }
+
+    // FormatTo and snprintf of the same format and arguments, into a buffer of the capacity.
+    template <class S, class... Args>
+    bool SameAsPrintf(const size_t capacity, const S fmt, const char* const printfFmt, const Args... args)
+    {
+        char expected[256], actual[257];
+        memset(actual, 'x', sizeof(actual));
+        const int n = snprintf(expected, capacity, printfFmt, args...);
+        const size_t length = FormatTo(capacity > 0 ? actual : nullptr, capacity, fmt, args...);
+        const bool same = n >= 0 && length == size_t(n) && (capacity == 0 || strcmp(actual, expected) == 0);
+        // Nothing written past the terminator
+        const bool bounded = capacity == 0 || actual[std::min(length, capacity - 1) + 1] == 'x';
+        if (!same || !bounded)
+            printf("  \"%s\" into %zu: \"%s\" (%zu), snprintf \"%s\" (%d)\n", printfFmt, capacity, capacity > 0 ? actual : "", length, capacity > 0 ? expected : "", n);
+        return same && bounded;
+    }
+
+#define CHECK_PRINTF(fmt, ...) CHECK(SameAsPrintf(256, RAD_FMT(fmt), fmt, __VA_ARGS__))
+
+    void AddTypedFormatTests(std::vector<TestCase>& tests)
+    {
+        tests.push_back({ "typedformat.integers", []()
+        {
+            for (const int v : { 0, 1, -1, 42, -42, 123456, INT32_MAX, INT32_MIN })
+            {
+                CHECK_PRINTF("%d", v);
+                CHECK_PRINTF("%i|%5d|%-5d|%05d", v, v, v, v);
+                CHECK_PRINTF("%+d|% d|%+05d|%-+6d|%-05d|% 05d", v, v, v, v, v, v);
+                CHECK_PRINTF("%.3d|%8.3d|%-8.3d|%.0d", v, v, v, v);
+                CHECK_PRINTF("%u|%x|%X|%o", unsigned(v), unsigned(v), unsigned(v), unsigned(v));
+                CHECK_PRINTF("%#x|%#X|%#o|%#10x|%#010x", unsigned(v), unsigned(v), unsigned(v), unsigned(v), unsigned(v));
+            }
+            CHECK_PRINTF("%hhd|%hd|%hhu|%hu", 300, 70000, 300, 70000);
+            CHECK_PRINTF("%c|%3c|%-3c|", 'a', 'b', 'c');
+        } });
+
+        tests.push_back({ "typedformat.integers64", []()
+        {
+            for (const long long v : { 0LL, -1LL, 5000000000LL, -5000000000LL, LLONG_MAX, LLONG_MIN })
+            {
+                CHECK_PRINTF("%lld|%+lld|%25lld|%-25lld|%025lld", v, v, v, v, v);
+                CHECK_PRINTF("%llu|%llx|%#llX|%llo", (unsigned long long) v, (unsigned long long) v, (unsigned long long) v, (unsigned long long) v);
+            }
+            CHECK_PRINTF("%llu|%20llx", ULLONG_MAX, ULLONG_MAX);
+            CHECK_PRINTF("%zu|%zx|%jd", SIZE_MAX, size_t(0xABC), intmax_t(-7));
+        } });
+
+        tests.push_back({ "typedformat.strings", []()
+        {
+            const char* const s = "hello";
+            CHECK_PRINTF("%s|%10s|%-10s|", s, s, s);
+            CHECK_PRINTF("%.2s|%.0s|%.10s|%6.3s|%-6.3s|", s, s, s, s, s);
+            CHECK_PRINTF("%s%%|%%%d%%|100%%", s, 5);
+            CHECK_PRINTF("[%s]", "");
+
+            // Precision stops at the end of a string that isn't terminated
+            const char unterminated[3] = { 'a', 'b', 'c' };
+            char buf[16];
+            CHECK(FormatTo(buf, RAD_FMT("%.3s|%.2s"), unterminated, unterminated) == 6);
+            CHECK(strcmp(buf, "abc|ab") == 0);
+
+            const std::string str("std::string");
+            CHECK(FormatTo(buf, RAD_FMT("%.3s|%s"), str, std::string()) == 4);
+            CHECK(strcmp(buf, "std|") == 0);
+
+            wchar_t wbuf[32];
+            CHECK(FormatTo(wbuf, RAD_FMT(L"%s %5d %-3s|%.2ls"), L"wide", -12, std::wstring(L"x"), L"abc") == 17);
+            CHECK(std::wstring(wbuf) == L"wide   -12 x  |ab");
+        } });
+
+        tests.push_back({ "typedformat.floats", []()
+        {
+            for (const double d : { 0.0, -1.5, 3.14159265358979, 1e300, -2.5e-10 })
+                CHECK_PRINTF("%f|%.2f|%10.3f|%-10.1e|%+g|%E|%G", d, d, d, d, d, d, d);
+        } });
+
+        tests.push_back({ "typedformat.truncate", []()
+        {
+            for (const size_t capacity : { size_t(0), size_t(1), size_t(2), size_t(5), size_t(12), size_t(13), size_t(14) })
+            {
+                CHECK(SameAsPrintf(capacity, RAD_FMT("%s %d!"), "%s %d!", "hello", 123456));
+                CHECK(SameAsPrintf(capacity, RAD_FMT("%-8s|%05llu"), "%-8s|%05llu", "ab", 42ULL));
+            }
+
+            FormatBuffer<char, 8> fits(RAD_FMT("%d"), 1234567);
+            CHECK(!fits.truncated() && fits.size() == 7 && strcmp(fits.c_str(), "1234567") == 0);
+            FormatBuffer<char, 8> cut(RAD_FMT("%d"), 12345678);
+            CHECK(cut.truncated() && cut.size() == 7 && strcmp(cut.c_str(), "1234567") == 0);
+        } });
+    }
+
+    int Usage()
+    {
+        fprintf(stderr, "RadClipboardTests [--filter TEXT]\n");
+        return 2;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::string filter;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc)
+            return Usage();
+        const char* const value = argv[++i];
+        if (arg == "--filter")
+            filter = value;
+        else
+            return Usage();
+    }
+
+    std::vector<TestCase> tests;
+    AddPayloadTests(tests);
+    AddLz4Tests(tests);
+    AddArenaTests(tests);
+    AddHistoryTests(tests);
+    AddJournalTests(tests);
+    AddColdTierTests(tests);
+    AddDelayedRenderTests(tests);
+    AddSearchTests(tests);
+    AddQueryTests(tests);
+    AddSummaryTests(tests);
+    AddHexDumpTests(tests);
+    AddTextLayoutTests(tests);
+    AddDibTests(tests);
+    AddThumbnailTests(tests);
+    AddCapturePipelineTests(tests);
+    AddChangeQueueTests(tests);
+    AddCoalescerTests(tests);
+    AddBackoffTests(tests);
+    AddPolicyTests(tests);
+    AddFormatTests(tests);
+    AddTraceTests(tests);
+    AddLogTests(tests);
+    AddTypedFormatTests(tests);
+
+    size_t run = 0;
+    size_t failed = 0;
+    for (const TestCase& t : tests)
+    {
+        if (!filter.empty() && std::string(t.name).find(filter) == std::string::npos)
+            continue;
+        g_failed = 0;
+        t.run();
+        ++run;
+        if (g_failed != 0)
+            ++failed;
+        printf("%s: %s\n", t.name, g_failed == 0 ? "ok" : "FAILED");
+        fflush(stdout);
+    }
+    printf("%zu tests, %zu failed\n", run, failed);
+    return failed != 0 ? 1 : 0;
+}
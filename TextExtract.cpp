@@ -0,0 +1,459 @@
+#include "TextExtract.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "ClipboardFormats.h"
+
+namespace
+{
+    const size_t DropFilesSize = 20;    // pFiles, pt, fNC, fWide
+
+    inline uint16_t Get16(const uint8_t* p) { uint16_t x; memcpy(&x, p, sizeof(x)); return x; }
+    inline uint32_t Get32(const uint8_t* p) { uint32_t x; memcpy(&x, p, sizeof(x)); return x; }
+
+    inline bool IsAlpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+    inline bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+    inline int HexValue(char c)
+    {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    // Returns the offset after the terminating nul.
+    size_t AppendUtf16(const uint8_t* data, size_t size, std::string& out, size_t limit)
+    {
+        out.reserve(std::min(limit, out.size() + size / 2));
+        size_t i = 0;
+        while (i + 2 <= size && out.size() < limit)
+        {
+            uint32_t c = Get16(data + i);
+            i += 2;
+            if (c == 0)
+                return i;
+            if (c < 0x80)
+            {
+                out += char(c);
+                continue;
+            }
+            if (c >= 0xD800 && c < 0xDC00 && i + 2 <= size)
+            {
+                const uint32_t lo = Get16(data + i);
+                if (lo >= 0xDC00 && lo < 0xE000)
+                {
+                    c = 0x10000 + ((c - 0xD800) << 10) + (lo - 0xDC00);
+                    i += 2;
+                }
+            }
+            AppendUtf8(out, c);
+        }
+        return size;
+    }
+
+    size_t AppendAnsi(const uint8_t* data, size_t size, std::string& out, size_t limit)
+    {
+        size_t i = 0;
+        while (i < size && out.size() < limit)
+        {
+            const uint8_t c = data[i++];
+            if (c == 0)
+                return i;
+            AppendUtf8(out, c);
+        }
+        return size;
+    }
+
+    // Length of the well formed UTF-8 sequence at s, or 0.
+    size_t Utf8Length(const char* s, size_t size)
+    {
+        const uint8_t b = uint8_t(s[0]);
+        size_t length;
+        uint8_t lo = 0x80, hi = 0xBF;   // of the second byte
+        if (b < 0x80)
+            return 1;
+        else if (b >= 0xC2 && b <= 0xDF)
+            length = 2;
+        else if (b >= 0xE0 && b <= 0xEF)
+        {
+            length = 3;
+            if (b == 0xE0)
+                lo = 0xA0;
+            else if (b == 0xED)
+                hi = 0x9F;
+        }
+        else if (b >= 0xF0 && b <= 0xF4)
+        {
+            length = 4;
+            if (b == 0xF0)
+                lo = 0x90;
+            else if (b == 0xF4)
+                hi = 0x8F;
+        }
+        else
+            return 0;
+        if (size < length || uint8_t(s[1]) < lo || uint8_t(s[1]) > hi)
+            return 0;
+        for (size_t k = 2; k < length; ++k)
+            if ((uint8_t(s[k]) & 0xC0) != 0x80)
+                return 0;
+        return length;
+    }
+
+    bool IsBlockTag(const char* name, size_t len)
+    {
+        static const char* const Tags[] = { "br", "p", "div", "li", "tr", "td", "th", "h1", "h2", "h3", "h4", "h5", "h6", "ul", "ol", "table", "pre", "blockquote" };
+        for (const char* t : Tags)
+        {
+            if (strlen(t) != len)
+                continue;
+            size_t i = 0;
+            while (i < len && (name[i] | 0x20) == t[i])
+                ++i;
+            if (i == len)
+                return true;
+        }
+        return false;
+    }
+
+    void AppendHtml(const char* s, size_t size, std::string& out, size_t limit)
+    {
+        // Skip the Version/StartHTML header
+        size_t i = 0;
+        while (i < size && s[i] != '<')
+            ++i;
+
+        const char* skipUntil = nullptr;
+        while (i < size && out.size() < limit)
+        {
+            const char c = s[i];
+            if (c == '<')
+            {
+                size_t j = i + 1;
+                const bool close = j < size && s[j] == '/';
+                if (close)
+                    ++j;
+                const size_t name = j;
+                while (j < size && (IsAlpha(s[j]) || IsDigit(s[j])))
+                    ++j;
+                const size_t nameLen = j - name;
+                if (skipUntil != nullptr)
+                {
+                    if (close && nameLen == strlen(skipUntil) && strncmp(s + name, skipUntil, nameLen) == 0)
+                        skipUntil = nullptr;
+                }
+                else if (!close && nameLen == 6 && strncmp(s + name, "script", 6) == 0)
+                    skipUntil = "script";
+                else if (!close && nameLen == 5 && strncmp(s + name, "style", 5) == 0)
+                    skipUntil = "style";
+                else if (IsBlockTag(s + name, nameLen) && !out.empty() && out.back() != '\n')
+                    out += '\n';
+
+                if (i + 4 <= size && strncmp(s + i, "<!--", 4) == 0)
+                {
+                    j = i + 4;
+                    while (j + 3 <= size && strncmp(s + j, "-->", 3) != 0)
+                        ++j;
+                    i = j + 3;
+                    continue;
+                }
+                while (j < size && s[j] != '>')
+                    ++j;
+                i = j + 1;
+                continue;
+            }
+            ++i;
+            if (c == '\0')
+                break;
+            if (skipUntil != nullptr || c == '\r' || c == '\n')
+                continue;
+
+            if (c == '&')
+            {
+                size_t j = i;
+                while (j < size && j < i + 10 && s[j] != ';')
+                    ++j;
+                if (j < size && s[j] == ';')
+                {
+                    const std::string e(s + i, j - i);
+                    uint32_t cp = 0;
+                    if (e == "amp") cp = '&';
+                    else if (e == "lt") cp = '<';
+                    else if (e == "gt") cp = '>';
+                    else if (e == "quot") cp = '"';
+                    else if (e == "apos") cp = '\'';
+                    else if (e == "nbsp") cp = ' ';
+                    else if (e.size() > 2 && e[0] == '#' && (e[1] == 'x' || e[1] == 'X'))
+                        cp = uint32_t(strtoul(e.c_str() + 2, nullptr, 16));
+                    else if (e.size() > 1 && e[0] == '#')
+                        cp = uint32_t(strtoul(e.c_str() + 1, nullptr, 10));
+                    if (cp != 0)
+                    {
+                        AppendUtf8(out, cp);
+                        i = j + 1;
+                        continue;
+                    }
+                }
+            }
+            if (uint8_t(c) < 0x80)
+            {
+                out += c;
+                continue;
+            }
+            // HTML Format is UTF-8, anything malformed is replaced
+            const size_t length = Utf8Length(s + i - 1, size - (i - 1));
+            if (length == 0)
+                AppendUtf8(out, 0xFFFD);
+            else
+            {
+                out.append(s + i - 1, length);
+                i += length - 1;
+            }
+        }
+    }
+
+    void AppendRtf(const char* s, size_t size, std::string& out, size_t limit)
+    {
+        static const char* const Destinations[] = { "fonttbl", "colortbl", "stylesheet", "info", "pict", "object", "header", "footer",
+            "themedata", "colorschememapping", "datastore", "latentstyles", "listtable", "listoverridetable", "rsidtbl", "generator", "xmlnstbl", "mmathPr", "fldinst" };
+
+        std::string skip(1, '\0');     // per group
+        std::string uc(1, char(1));
+        int fallback = 0;
+        size_t i = 0;
+
+        auto emit = [&](uint32_t cp)
+        {
+            if (fallback > 0)
+                --fallback;
+            else if (skip.back() == 0)
+                AppendUtf8(out, cp);
+        };
+
+        while (i < size && out.size() < limit)
+        {
+            const char c = s[i++];
+            switch (c)
+            {
+            case '{':
+                skip.push_back(skip.back());
+                uc.push_back(uc.back());
+                break;
+
+            case '}':
+                if (skip.size() > 1)
+                {
+                    skip.pop_back();
+                    uc.pop_back();
+                }
+                break;
+
+            case '\r': case '\n':
+                break;
+
+            case '\\':
+            {
+                if (i >= size)
+                    break;
+                const char n = s[i];
+                if (IsAlpha(n))
+                {
+                    const size_t word = i;
+                    while (i < size && IsAlpha(s[i]))
+                        ++i;
+                    const std::string w(s + word, i - word);
+                    long param = 0;
+                    bool hasParam = false;
+                    const size_t p = i;
+                    if (i < size && s[i] == '-')
+                        ++i;
+                    while (i < size && IsDigit(s[i]))
+                        ++i;
+                    if (i > p)
+                    {
+                        param = strtol(std::string(s + p, i - p).c_str(), nullptr, 10);
+                        hasParam = true;
+                    }
+                    if (i < size && s[i] == ' ')
+                        ++i;
+
+                    if (w == "par" || w == "line" || w == "row")
+                        emit('\n');
+                    else if (w == "tab" || w == "cell")
+                        emit('\t');
+                    else if (w == "emdash") emit(0x2014);
+                    else if (w == "endash") emit(0x2013);
+                    else if (w == "bullet") emit(0x2022);
+                    else if (w == "lquote") emit(0x2018);
+                    else if (w == "rquote") emit(0x2019);
+                    else if (w == "ldblquote") emit(0x201C);
+                    else if (w == "rdblquote") emit(0x201D);
+                    else if (w == "uc" && hasParam)
+                        uc.back() = char(param);
+                    else if (w == "u" && hasParam)
+                    {
+                        emit(uint32_t(param < 0 ? param + 65536 : param));
+                        fallback = uc.back();
+                    }
+                    else
+                    {
+                        for (const char* d : Destinations)
+                            if (w == d)
+                                skip.back() = 1;
+                    }
+                }
+                else
+                {
+                    ++i;
+                    if (n == '*')
+                        skip.back() = 1;
+                    else if (n == '\'' && i + 2 <= size && HexValue(s[i]) >= 0 && HexValue(s[i + 1]) >= 0)
+                    {
+                        emit(uint32_t(HexValue(s[i]) * 16 + HexValue(s[i + 1])));
+                        i += 2;
+                    }
+                    else if (n == '\\' || n == '{' || n == '}')
+                        emit(uint8_t(n));
+                    else if (n == '~')
+                        emit(' ');
+                    else if (n == '\r' || n == '\n')
+                        emit('\n');
+                }
+                break;
+            }
+
+            case '\0':
+                i = size;
+                break;
+
+            default:
+                emit(uint8_t(c));
+                break;
+            }
+        }
+    }
+
+    void AppendFileList(const uint8_t* data, size_t size, std::string& out, size_t limit)
+    {
+        if (size < DropFilesSize)
+            return;
+        size_t i = Get32(data);
+        const bool wide = Get32(data + 16) != 0;
+        while (i < size && out.size() < limit)
+        {
+            const size_t start = out.size();
+            i += wide ? AppendUtf16(data + i, size - i, out, limit) : AppendAnsi(data + i, size - i, out, limit);
+            if (out.size() == start)
+                break;
+            out += '\n';
+        }
+    }
+}
+
+namespace
+{
+    // Lower is preferred.
+    int TextRank(TextKind kind)
+    {
+        switch (kind)
+        {
+        case TextKind::Unicode: return 0;
+        case TextKind::Ansi:    return 1;
+        case TextKind::Html:    return 2;
+        case TextKind::Rtf:     return 3;
+        default:                return 4;
+        }
+    }
+}
+
+TextKind StandardTextKind(const uint32_t uFormat)
+{
+    return StandardFormat(uFormat).textKind;
+}
+
+TextKind GetTextKind(const TextKinds& kinds, const uint32_t uFormat)
+{
+    const auto it = kinds.find(uFormat);
+    return it != kinds.end() ? it->second : StandardTextKind(uFormat);
+}
+
+void AppendUtf8(std::string& out, uint32_t cp)
+{
+    if (cp > 0x10FFFF || (cp >= 0xD800 && cp < 0xE000))
+        cp = 0xFFFD;
+    if (cp < 0x80)
+        out += char(cp);
+    else if (cp < 0x800)
+    {
+        out += char(0xC0 | (cp >> 6));
+        out += char(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000)
+    {
+        out += char(0xE0 | (cp >> 12));
+        out += char(0x80 | ((cp >> 6) & 0x3F));
+        out += char(0x80 | (cp & 0x3F));
+    }
+    else
+    {
+        out += char(0xF0 | (cp >> 18));
+        out += char(0x80 | ((cp >> 12) & 0x3F));
+        out += char(0x80 | ((cp >> 6) & 0x3F));
+        out += char(0x80 | (cp & 0x3F));
+    }
+}
+
+void ExtractText(const TextKind kind, const uint8_t* const data, const size_t size, std::string& out, const size_t maxSize)
+{
+    // A payload that couldn't be read
+    if (data == nullptr)
+        return;
+    const size_t limit = maxSize > SIZE_MAX - out.size() ? SIZE_MAX : out.size() + maxSize;
+    switch (kind)
+    {
+    case TextKind::Ansi:        AppendAnsi(data, size, out, limit); break;
+    case TextKind::Unicode:     AppendUtf16(data, size, out, limit); break;
+    case TextKind::Html:        AppendHtml(reinterpret_cast<const char*>(data), size, out, limit); break;
+    case TextKind::Rtf:         AppendRtf(reinterpret_cast<const char*>(data), size, out, limit); break;
+    case TextKind::FileList:    AppendFileList(data, size, out, limit); break;
+    case TextKind::None:        break;
+    }
+    if (out.size() > limit)
+    {
+        // Don't leave a partial UTF-8 sequence
+        size_t end = limit;
+        while (end > 0 && (uint8_t(out[end]) & 0xC0) == 0x80)
+            --end;
+        out.resize(end);
+    }
+}
+
+std::string EntryText(const std::vector<std::pair<TextKind, PayloadRef>>& items, const size_t maxSize)
+{
+    const std::pair<TextKind, PayloadRef>* best = nullptr;
+    for (const auto& i : items)
+        if (i.first != TextKind::FileList && TextRank(i.first) < TextRank(best != nullptr ? best->first : TextKind::None))
+            best = &i;
+
+    std::string text;
+    std::vector<uint8_t> scratch;
+    // Markup and UTF-16 take more bytes than the text they hold
+    const size_t peek = maxSize < SIZE_MAX / 4 ? maxSize * 4 : SIZE_MAX;
+    if (best != nullptr)
+    {
+        const PayloadRef& p = best->second;
+        ExtractText(best->first, p.Read(peek, scratch), std::min(peek, p.size), text, maxSize);
+    }
+    for (const auto& i : items)
+    {
+        if (i.first == TextKind::FileList && text.size() < maxSize)
+        {
+            if (!text.empty())
+                text += '\n';
+            ExtractText(TextKind::FileList, i.second.Read(i.second.size, scratch), i.second.size, text, maxSize - text.size());
+        }
+    }
+    return text;
+}
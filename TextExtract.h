@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "PayloadStore.h"
+
+enum class TextKind : uint8_t
+{
+    None,
+    Ansi,       // 8 bit text, read as Latin-1
+    Unicode,    // UTF-16
+    Html,       // HTML Format, UTF-8 with a header
+    Rtf,
+    FileList,   // DROPFILES
+};
+
+// Kind of the standard clipboard formats, registered formats are None.
+TextKind StandardTextKind(uint32_t uFormat);
+
+// Registered formats that hold text, such as HTML Format.
+typedef std::unordered_map<uint32_t, TextKind> TextKinds;
+TextKind GetTextKind(const TextKinds& kinds, uint32_t uFormat);
+
+// Appends the plain text of a payload as UTF-8, up to maxSize bytes.
+void ExtractText(TextKind kind, const uint8_t* data, size_t size, std::string& out, size_t maxSize = SIZE_MAX);
+
+void AppendUtf8(std::string& out, uint32_t cp);
+
+// Text of an entry, the best of its text formats followed by any file lists.
+std::string EntryText(const std::vector<std::pair<TextKind, PayloadRef>>& items, size_t maxSize);
@@ -0,0 +1,164 @@
+#include "Thumbnails.h"
+
+#include "ClipboardFormats.h"
+
+const int32_t ThumbnailCache::MaxSize;
+const int32_t ThumbnailCache::MenuWidth;
+const int32_t ThumbnailCache::MenuHeight;
+const size_t ThumbnailCache::MaxThumbnails;
+
+bool MakeThumbnail(const uint8_t* const data, const size_t size, const int32_t maxSize, Thumbnail& thumbnail)
+{
+    DibInfo info;
+    if (!ParseDib(data, size, info))
+        return false;
+
+    // The full image is never decoded, only a row at a time
+    int32_t width, height;
+    FitSize(info.width, info.height, maxSize, maxSize, width, height);
+    BoxScaler scaler(info.width, info.height, width, height);
+    std::vector<uint32_t> row(size_t(info.width));
+    for (int32_t y = 0; y < info.height; ++y)
+    {
+        DecodeDibRow(info, data, y, row.data());
+        scaler.AddRow(row.data());
+    }
+
+    thumbnail.sourceWidth = info.width;
+    thumbnail.sourceHeight = info.height;
+    thumbnail.image = std::move(scaler.Result());
+
+    // The history menu shows a smaller copy
+    const BgraImage& image = thumbnail.image;
+    FitSize(image.width, image.height, ThumbnailCache::MenuWidth, ThumbnailCache::MenuHeight, width, height);
+    BoxScaler menu(image.width, image.height, width, height);
+    for (int32_t y = 0; y < image.height; ++y)
+        menu.AddRow(image.pixels.data() + size_t(y) * size_t(image.width));
+    thumbnail.menuImage = std::move(menu.Result());
+    return true;
+}
+
+ThumbnailCache::ThumbnailCache(std::function<void()> notify)
+    : m_notify(std::move(notify))
+    , m_thread(&ThumbnailCache::Run, this)
+{
+}
+
+ThumbnailCache::~ThumbnailCache()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+}
+
+std::shared_ptr<const Thumbnail> ThumbnailCache::Get(const HistId id) const
+{
+    const auto it = m_byId.find(id);
+    return it != m_byId.end() ? it->second->second : nullptr;
+}
+
+std::vector<HistId> ThumbnailCache::Commit()
+{
+    std::vector<Job> done;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        done.swap(m_done);
+    }
+
+    std::vector<HistId> ids;
+    for (Job& j : done)
+    {
+        // Erased while it was being made
+        if (m_queued.erase(j.id) == 0)
+            continue;
+        ids.push_back(j.id);
+        if (!j.thumbnail)
+            continue;
+        m_thumbnails.emplace_front(j.id, std::move(j.thumbnail));
+        m_byId[j.id] = m_thumbnails.begin();
+    }
+    while (m_thumbnails.size() > MaxThumbnails)
+    {
+        m_byId.erase(m_thumbnails.back().first);
+        m_thumbnails.pop_back();
+    }
+    return ids;
+}
+
+void ThumbnailCache::OnAdd(const History& h, const HistId id)
+{
+    Request(h, id);
+}
+
+void ThumbnailCache::Request(const History& h, const HistId id)
+{
+    if (m_queued.count(id) != 0 || m_byId.count(id) != 0)
+        return;
+    for (const HistItem& i : h.Items(id))
+    {
+        if (IsImageFormat(i.uFormat))
+        {
+            m_queued.insert(id);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_pending.push_back({ id, h.Payloads().Ref(i.payload), nullptr });
+            }
+            m_cv.notify_one();
+            break;
+        }
+    }
+}
+
+void ThumbnailCache::OnTouch(const History& /*h*/, const HistId id)
+{
+    const auto it = m_byId.find(id);
+    if (it != m_byId.end())
+        m_thumbnails.splice(m_thumbnails.begin(), m_thumbnails, it->second);
+}
+
+void ThumbnailCache::OnErase(const History& /*h*/, const HistId id)
+{
+    m_queued.erase(id);
+    const auto it = m_byId.find(id);
+    if (it != m_byId.end())
+    {
+        m_thumbnails.erase(it->second);
+        m_byId.erase(it);
+    }
+}
+
+void ThumbnailCache::Run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_cv.wait(lock, [this] { return m_stop || !m_pending.empty(); });
+        if (m_stop)
+            break;
+
+        Job j = std::move(m_pending.front());
+        m_pending.pop_front();
+        lock.unlock();
+
+        std::vector<uint8_t> scratch;
+        const uint8_t* const data = j.payload.Read(j.payload.size, scratch);
+        auto thumbnail = std::make_shared<Thumbnail>();
+        if (data != nullptr && MakeThumbnail(data, j.payload.size, MaxSize, *thumbnail))
+            j.thumbnail = std::move(thumbnail);
+        // The payload can be released once the entry is gone
+        j.payload = PayloadRef();
+
+        lock.lock();
+        const bool first = m_done.empty();
+        m_done.push_back(std::move(j));
+        if (first && m_notify)
+        {
+            lock.unlock();
+            m_notify();
+            lock.lock();
+        }
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "History.h"
+#include "Rad/Dib.h"
+
+struct Thumbnail
+{
+    int32_t sourceWidth;
+    int32_t sourceHeight;
+    BgraImage image;
+    BgraImage menuImage;    // fits in MenuWidth x MenuHeight
+};
+
+// Scales a packed DIB to fit in maxSize x maxSize a row at a time, and that to the menu size.
+bool MakeThumbnail(const uint8_t* data, size_t size, int32_t maxSize, Thumbnail& thumbnail);
+
+// Previews of the image entries, made on a background thread as they are added or requested.
+// Finished thumbnails are only moved into the cache by Commit, which must be called on the
+// thread that owns the history, after notify has been called.
+class ThumbnailCache : public HistoryListener
+{
+public:
+    static const int32_t MaxSize = 256;
+    static const int32_t MenuWidth = 64;
+    static const int32_t MenuHeight = 48;
+    static const size_t MaxThumbnails = 64;
+
+    explicit ThumbnailCache(std::function<void()> notify);
+    ThumbnailCache(const ThumbnailCache&) = delete;
+    ThumbnailCache& operator=(const ThumbnailCache&) = delete;
+    ~ThumbnailCache();
+
+    // Null if there isn't one yet, or the entry isn't an image.
+    std::shared_ptr<const Thumbnail> Get(HistId id) const;
+    bool Pending(HistId id) const { return m_queued.count(id) != 0; }
+    // Queues the entry if it is an image without a thumbnail, such as one loaded from the journal.
+    void Request(const History& h, HistId id);
+    // Returns the entries that are no longer pending, including any that couldn't be decoded.
+    std::vector<HistId> Commit();
+
+    // HistoryListener
+    void OnAdd(const History& h, HistId id) override;
+    void OnTouch(const History& h, HistId id) override;
+    void OnErase(const History& h, HistId id) override;
+
+private:
+    typedef std::list<std::pair<HistId, std::shared_ptr<const Thumbnail>>> List;
+
+    struct Job
+    {
+        HistId id;
+        PayloadRef payload;
+        std::shared_ptr<Thumbnail> thumbnail;   // null if it couldn't be decoded
+    };
+
+    void Run();
+
+    const std::function<void()> m_notify;
+    std::unordered_set<HistId> m_queued;
+    List m_thumbnails;      // most recently used first
+    std::unordered_map<HistId, List::iterator> m_byId;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<Job> m_pending;
+    std::vector<Job> m_done;
+    bool m_stop = false;
+    std::thread m_thread;
+};
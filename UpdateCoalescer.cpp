@@ -0,0 +1,82 @@
+#include "UpdateCoalescer.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    const double HalfLife = 1e6;    // us
+
+    double Decay(const uint64_t dt)
+    {
+        return std::exp2(-double(dt) / HalfLife);
+    }
+}
+
+double UpdateCoalescer::Rate(const uint64_t now) const
+{
+    // For a steady rate r the score settles at about r / ln 2
+    return m_score * Decay(now - std::min(now, m_scoreTime)) * std::log(2.0);
+}
+
+void UpdateCoalescer::Notify(const uint64_t now, const uint32_t sequence)
+{
+    ++m_stats.notifications;
+    if (m_seen && sequence == m_sequence)
+    {
+        ++m_stats.duplicates;
+        return;
+    }
+    m_seen = true;
+    m_sequence = sequence;
+
+    m_score = m_score * Decay(now - std::min(now, m_scoreTime)) + 1;
+    m_scoreTime = now;
+
+    if (!m_pending)
+    {
+        m_pending = true;
+        m_first = now;
+        m_changes = 0;
+    }
+    m_last = now;
+    ++m_changes;
+}
+
+// When the pending change would be captured without throttling
+uint64_t UpdateCoalescer::Settled() const
+{
+    return std::min(m_last + uint64_t(m_policy.debounce) * 1000, m_first + uint64_t(m_policy.maxDelay) * 1000);
+}
+
+uint64_t UpdateCoalescer::Due() const
+{
+    if (!m_pending)
+        return UINT64_MAX;
+    const uint64_t due = Settled();
+    return m_captured ? std::max(due, m_lastCapture + m_interval) : due;
+}
+
+bool UpdateCoalescer::Poll(const uint64_t now)
+{
+    if (!m_pending || now < Due())
+        return false;
+
+    const uint64_t dropped = m_changes - 1;
+    if (m_captured && m_lastCapture + m_interval > Settled())
+        m_stats.throttled += dropped;
+    else
+        m_stats.coalesced += dropped;
+    ++m_stats.captures;
+
+    // The interval doubles while the source keeps going too fast, and halves once it slows
+    const uint64_t minInterval = uint64_t(1e6 / std::max(m_policy.maxRate, 0.001));
+    if (Rate(now) > m_policy.maxRate)
+        m_interval = std::min(std::max(m_interval * 2, minInterval), uint64_t(m_policy.maxInterval) * 1000);
+    else
+        m_interval = m_interval / 2 >= minInterval ? m_interval / 2 : 0;
+
+    m_pending = false;
+    m_captured = true;
+    m_lastCapture = now;
+    return true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+
+struct CoalescePolicy
+{
+    uint32_t debounce = 25;         // ms without a change before capturing
+    uint32_t maxDelay = 150;        // ms, captured by then even if changes keep coming
+    double maxRate = 8;             // changes per second before the source is throttled
+    uint32_t maxInterval = 2000;    // ms, the longest a throttled source waits between captures
+};
+
+struct CoalesceStats
+{
+    uint64_t notifications;
+    uint64_t duplicates;    // the sequence number hadn't changed
+    uint64_t coalesced;     // changes replaced by a later one within the debounce
+    uint64_t throttled;     // changes dropped while the source was throttled
+    uint64_t captures;
+};
+
+// Decides when to capture from clipboard change notifications, keyed on the clipboard sequence
+// number. A burst of notifications for one copy is captured once, after the debounce. A source
+// changing the clipboard faster than maxRate is captured at growing intervals, dropping the
+// states in between, until it slows down again.
+// Times are in us and passed in, so recorded timings can be replayed.
+class UpdateCoalescer
+{
+public:
+    explicit UpdateCoalescer(const CoalescePolicy& policy = CoalescePolicy())
+        : m_policy(policy)
+    {
+    }
+
+    void Notify(uint64_t now, uint32_t sequence);
+    // When Poll should next be called, UINT64_MAX if nothing is pending.
+    uint64_t Due() const;
+    // Returns true if the clipboard should be captured now.
+    bool Poll(uint64_t now);
+
+    // First notification of the pending change.
+    uint64_t PendingSince() const { return m_first; }
+    bool Pending() const { return m_pending; }
+    // us between captures while the source is throttled, 0 if it isn't.
+    uint64_t Interval() const { return m_interval; }
+    // Changes per second, decaying with a half life of a second.
+    double Rate(uint64_t now) const;
+    const CoalesceStats& Stats() const { return m_stats; }
+
+private:
+    uint64_t Settled() const;
+
+    CoalescePolicy m_policy;
+    CoalesceStats m_stats = {};
+
+    bool m_seen = false;
+    uint32_t m_sequence = 0;        // last seen
+
+    bool m_pending = false;
+    uint64_t m_first = 0;           // notifications of the pending change
+    uint64_t m_last = 0;
+    uint32_t m_changes = 0;         // sequence numbers seen since the last capture
+
+    bool m_captured = false;
+    uint64_t m_lastCapture = 0;
+    uint64_t m_interval = 0;
+
+    double m_score = 0;             // decayed count of changes
+    uint64_t m_scoreTime = 0;
+};
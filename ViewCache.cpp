@@ -0,0 +1,39 @@
+#include "ViewCache.h"
+#include <algorithm>
+
+std::shared_ptr<ViewProduct> ViewCache::Get(const HistId id, const uint32_t uFormat)
+{
+    auto it = std::find_if(m_items.begin(), m_items.end(), [id, uFormat](const Item& i) { return i.id == id && i.uFormat == uFormat; });
+    if (it != m_items.end())
+    {
+        m_items.splice(m_items.begin(), m_items, it);
+        return it->product;
+    }
+
+    if (!m_history.Contains(id))
+        return nullptr;
+    const std::vector<HistItem>& items = m_history.Items(id);
+    const auto item = std::find_if(items.begin(), items.end(), [uFormat](const HistItem& i) { return i.uFormat == uFormat; });
+    if (item == items.end())
+        return nullptr;
+
+    auto product = std::make_shared<ViewProduct>();
+    product->payload = m_history.Payloads().Ref(item->payload);
+    product->size = product->payload.size;
+    product->data = product->payload.Read(product->size, product->scratch);
+    if (product->data == nullptr)
+        return nullptr;
+    m_decode(*product, uFormat);
+    product->bytes += product->size + product->text.Text().size() * sizeof(wchar_t);
+    for (const std::wstring& f : product->files)
+        product->bytes += f.size() * sizeof(wchar_t);
+
+    m_items.push_front({ id, uFormat, product });
+    m_bytes += product->bytes;
+    while (m_items.size() > 1 && (m_items.size() > MaxProducts || m_bytes > MaxBytes))
+    {
+        m_bytes -= m_items.back().product->bytes;
+        m_items.pop_back();
+    }
+    return product;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "History.h"
+#include "Rad/TextLayout.h"
+
+// Decoded form of an entry's payload for the viewer.
+struct ViewProduct
+{
+    PayloadRef payload;
+    const uint8_t* data = nullptr;      // in scratch when the payload isn't hot
+    size_t size = 0;
+    std::vector<uint8_t> scratch;
+
+    TextLayout text;
+    std::vector<std::wstring> files;
+    std::shared_ptr<void> object;       // platform object, such as a metafile or bitmap
+    size_t bytes = 0;                   // estimate for the cache budget, the decoder adds the size of object
+};
+
+// Products of the most recently viewed entries and formats, so drawing an entry
+// only reads memory and never goes back to the clipboard.
+class ViewCache
+{
+public:
+    typedef std::function<void(ViewProduct& product, uint32_t uFormat)> DecodeFn;
+    static const size_t MaxProducts = 8;
+    static const size_t MaxBytes = 128 * 1024 * 1024;
+
+    ViewCache(const History& history, DecodeFn decode)
+        : m_history(history), m_decode(std::move(decode))
+    {
+    }
+
+    // Returns null if the entry doesn't have the format.
+    std::shared_ptr<ViewProduct> Get(HistId id, uint32_t uFormat);
+    void Clear() { m_items.clear(); m_bytes = 0; }
+
+private:
+    struct Item
+    {
+        HistId id;
+        uint32_t uFormat;
+        std::shared_ptr<ViewProduct> product;
+    };
+
+    const History& m_history;
+    DecodeFn m_decode;
+    std::list<Item> m_items;    // most recently used first
+    size_t m_bytes = 0;
+};